@@ -0,0 +1,96 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __dedup_h__
+#define __dedup_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A payload in the window of recent payloads.
+ */
+struct dedup_slot {
+  int64_t seq;      // number of the payload, -1 if the slot is unused
+  long offset;      // offset of the record in the log file
+  uint64_t hash;
+  int len;
+  int size;         // allocated size of payload
+  uint8_t *payload;
+};
+
+/**
+ * Window of the last payloads written to or read from a log file.
+ *
+ * The recorder searches it by hash to replace repeated payloads by a
+ * reference to the offset of an earlier record. The player searches it by
+ * offset to resolve these references without reading the file again.
+ */
+struct dedup {
+  int window;       // number of payloads in the window
+  int max_len;      // longer payloads are not added
+  int64_t seq;      // number of payloads added so far
+  struct dedup_slot *slots;
+
+  int64_t *index;   // hash index into slots, only if created as indexed
+  size_t index_size;
+};
+
+#define DEDUP_DEFAULT_MAX_LEN  65536
+
+/**
+ * Fast non-cryptographic 64 bit hash (MurmurHash64A).
+ */
+uint64_t dedup_hash(const void *buf, size_t length);
+
+/**
+ * Initializes an empty window.
+ *
+ * @param indexed If set, the window can be searched by hash with dedup_find().
+ * @return 0 on success, otherwise something else.
+ */
+int dedup_init(struct dedup *d, int window, int max_len, int indexed);
+
+/**
+ * Removes all payloads from the window.
+ */
+void dedup_reset(struct dedup *d);
+
+/**
+ * Frees all memory of the window.
+ */
+void dedup_free(struct dedup *d);
+
+/**
+ * Adds the payload of the record at offset to the window. Offsets have to be
+ * added in increasing order. Empty payloads or payloads longer than max_len
+ * are ignored.
+ */
+void dedup_add(struct dedup *d, long offset, uint64_t hash, const void *payload, int len);
+
+/**
+ * Searches an equal payload in the window. Only for indexed windows.
+ *
+ * @return The offset of the record with the payload or -1.
+ */
+long dedup_find(struct dedup *d, uint64_t hash, const void *payload, int len);
+
+/**
+ * Searches the payload of the record at offset in the window.
+ *
+ * @return The slot or NULL.
+ */
+const struct dedup_slot *dedup_get(struct dedup *d, long offset);
+
+#endif
@@ -0,0 +1,82 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __evloop_h__
+#define __evloop_h__
+
+#include <time.h>
+#include <mosquitto.h>
+
+#define EVLOOP_MISC_INTERVAL  1000  // ms between calls of mosquitto_loop_misc()
+#define EVLOOP_MAX_EVENTS     64
+
+/**
+ * Drives the network traffic of several mosquitto clients from one thread with
+ * epoll, instead of one thread per client. Deadlines are waited for with a
+ * timerfd on the monotonic clock, so I/O is handled while waiting.
+ */
+struct evloop {
+  int epfd;
+  int timer_fd;
+  struct mosquitto **clients;
+  int *sockets;        // socket registered for every client, -1 if none
+  int *writing;        // EPOLLOUT is registered for the socket
+  int num_clients;
+  struct timespec next_misc;
+  int interrupted;     // set by evloop_interrupt()
+};
+
+/**
+ * Creates an empty loop.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int evloop_init(struct evloop *loop);
+
+/**
+ * Adds a connected client to the loop.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int evloop_add(struct evloop *loop, struct mosquitto *mosq);
+
+/**
+ * Handles the traffic of all clients until the absolute deadline on
+ * CLOCK_MONOTONIC. A deadline in the past only handles the pending traffic.
+ *
+ * @param deadline The deadline or NULL to run until evloop_interrupt().
+ * @return 0 on success, otherwise something else.
+ */
+int evloop_wait(struct evloop *loop, const struct timespec *deadline);
+
+/**
+ * Makes the running evloop_wait() return after the current events, before its
+ * deadline. Called from a callback of a client of the loop.
+ */
+void evloop_interrupt(struct evloop *loop);
+
+/**
+ * Handles the traffic until no client has data left to send, at most for
+ * timeout ms.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int evloop_flush(struct evloop *loop, int timeout);
+
+/**
+ * Frees the loop. The clients are not destroyed.
+ */
+void evloop_free(struct evloop *loop);
+
+#endif
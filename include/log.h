@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 /* set std config values */
 #ifndef LOG_FD
@@ -57,7 +58,7 @@
 #if 1 == LOGLEVEL_INFO
 
   #define INFO(msg, ...)\
-    fprintf(\
+    log_printf(\
       LOG_FD,\
       "%s:%d:info:" msg "\n",\
       __FILE__,\
@@ -65,18 +66,14 @@
       ##__VA_ARGS__)
 
   #define INFO_BUF(buf, length, msg, ...)\
-    (\
-      fprintf(\
-        LOG_FD,\
-        "%s:%d:info:" msg ":",\
-        __FILE__,\
-        __LINE__,\
-	##__VA_ARGS__),\
-      log_buf(buf, length),\
-      fprintf(\
-        LOG_FD,\
-	"\n")\
-    )
+    log_printf_buf(\
+      LOG_FD,\
+      buf,\
+      length,\
+      "%s:%d:info:" msg ":",\
+      __FILE__,\
+      __LINE__,\
+      ##__VA_ARGS__)
 #else
   #define INFO(msg, ...)
   #define INFO_BUF(buf, length, msg, ...)
@@ -86,7 +83,7 @@
 #if 1 == LOGLEVEL_DEBUG
 
   #define DEBUG(msg, ...)\
-    fprintf(\
+    log_printf(\
       LOG_FD,\
       "%s:%d:debug:" msg "\n",\
       __FILE__,\
@@ -94,18 +91,14 @@
       ##__VA_ARGS__)
 
   #define DEBUG_BUF(buf, length, msg, ...)\
-    (\
-      fprintf(\
-        LOG_FD,\
-        "%s:%d:debug:" msg ":",\
-        __FILE__,\
-        __LINE__,\
-	##__VA_ARGS__),\
-      log_buf(buf, length),\
-      fprintf(\
-        LOG_FD,\
-	"\n")\
-    )
+    log_printf_buf(\
+      LOG_FD,\
+      buf,\
+      length,\
+      "%s:%d:debug:" msg ":",\
+      __FILE__,\
+      __LINE__,\
+      ##__VA_ARGS__)
 #else
   #define DEBUG(msg, ...)
   #define DEBUG_BUF(buf, length, msg, ...)
@@ -116,7 +109,7 @@
 
   #define WARN(msg, ...)\
     (\
-      fprintf(\
+      log_printf(\
         LOG_FD,\
         "%s:%d:warn:" msg "%s%s\n",\
         __FILE__,\
@@ -128,20 +121,16 @@
     )
 
   #define WARN_BUF(buf, length, msg, ...)\
-    (\
-      fprintf(\
-        LOG_FD,\
-        "%s:%d:warn:" msg "%s%s:",\
-        __FILE__,\
-        __LINE__,\
-        (errno)?(":"):(""),\
-        (errno)?(strerror(errno)):(""),\
-	##__VA_ARGS__),\
-      log_buf(buf, length),\
-      fprintf(\
-        LOG_FD,\
-	"\n")\
-    )
+    log_printf_buf(\
+      LOG_FD,\
+      buf,\
+      length,\
+      "%s:%d:warn:" msg "%s%s:",\
+      __FILE__,\
+      __LINE__,\
+      ##__VA_ARGS__,\
+      (errno)?(":"):(""),\
+      (errno)?(strerror(errno)):(""))
 #else
   #define WARN(msg, ...)
   #define WARN_BUF(buf, length, msg, ...)
@@ -152,7 +141,7 @@
 
   #define ERROR(msg, ...)\
     (\
-      fprintf(\
+      log_printf(\
         LOG_FD,\
         "%s:%d:error:" msg "%s%s\n",\
         __FILE__,\
@@ -165,20 +154,16 @@
     )
 
   #define ERROR_BUF(buf, length, msg, ...)\
-    (\
-      fprintf(\
-        LOG_FD,\
-        "%s:%d:error:" msg "%s%s:",\
-        __FILE__,\
-        __LINE__,\
-        (errno)?(":"):(""),\
-        (errno)?(strerror(errno)):(""),\
-	##__VA_ARGS__),\
-      log_buf(buf, length),\
-      fprintf(\
-        LOG_FD,\
-	"\n")\
-    )
+    log_printf_buf(\
+      LOG_FD,\
+      buf,\
+      length,\
+      "%s:%d:error:" msg "%s%s:",\
+      __FILE__,\
+      __LINE__,\
+      ##__VA_ARGS__,\
+      (errno)?(":"):(""),\
+      (errno)?(strerror(errno)):(""))
 #else
   #define ERROR(msg, ...)
   #define ERROR_BUF(buf, length, msg, ...)
@@ -189,36 +174,87 @@
 
   #define CRIT(msg, ...)\
     (\
+      log_flush(),\
       fprintf(\
         LOG_FD,\
         "%s:%d:crit:" msg "%s%s\n",\
         __FILE__,\
         __LINE__,\
+        ##__VA_ARGS__,\
         (errno)?(":"):(""),\
-        (errno)?(strerror(errno)):(""),\
-        ##__VA_ARGS__),\
+        (errno)?(strerror(errno)):("")),\
       exit((errno)?(errno):(1))\
     )
 
   #define CRIT_BUF(buf, length, msg, ...)\
-    (\
-      fprintf(\
-        LOG_FD,\
-        "%s:%d:crit:" msg ":",\
-        __FILE__,\
-        __LINE__,\
-	##__VA_ARGS__),\
-      log_buf(buf, length),\
-      fprintf(\
-        LOG_FD,\
-	"\n")\
-    )
+    log_printf_buf(\
+      LOG_FD,\
+      buf,\
+      length,\
+      "%s:%d:crit:" msg ":",\
+      __FILE__,\
+      __LINE__,\
+      ##__VA_ARGS__)
 #else
   #define CRIT(msg, ...) exit((errno)?(errno):(1))
   #define CRIT_BUF(buf, length, msg, ...)
 #endif
 
+#define LOG_RING_SIZE       (256 * 1024)  // bytes per thread
+#define LOG_FLUSH_INTERVAL  10            // ms between two writes of the log thread
+#define LOG_MAX_TEXT        4096          // longer lines are truncated
+#define LOG_MAX_ARGS        6
+
+#define LOG_NARGS(...)  LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...)  n
+
+/**
+ * Logs a line with up to LOG_MAX_ARGS long arguments followed by one string,
+ * the last conversion of msg. Only the arguments are stored, the line is
+ * formatted by the log thread. This is cheap enough for every message.
+ *
+ *   LOG_TRACE(stdout, "len: %ld topic: %s\n", topic, (long)len);
+ */
+#define LOG_TRACE(stream, msg, str, ...)\
+  (\
+    (void)(0 && fprintf(stream, msg, ##__VA_ARGS__, str)),\
+    log_trace(stream, msg, str, LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)\
+  )
+
 void log_buf(void *buf, size_t length);
 
+/**
+ * Starts the log thread. From then on, log_printf(), log_printf_buf() and
+ * log_trace(), and so all macros except CRIT(), only append to a lock-free
+ * ring of the calling thread, which the log thread empties every
+ * LOG_FLUSH_INTERVAL ms. If a ring is full, the line is dropped and the number
+ * of dropped lines is reported. Without the log thread, they write
+ * immediately.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int log_start();
+
+/**
+ * Like fprintf(). The line is formatted by the calling thread.
+ */
+void log_printf(FILE *stream, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Like log_printf() followed by the bytes of buf in hex and a newline, as one
+ * line. Used by the *_BUF() macros.
+ */
+void log_printf_buf(FILE *stream, const void *buf, size_t length, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+/**
+ * See LOG_TRACE().
+ */
+void log_trace(FILE *stream, const char *format, const char *str, int nargs, ...);
+
+/**
+ * Writes all lines in the rings. Called at exit and before a critical error.
+ */
+void log_flush();
+
 
 #endif /* __log_h__ */
@@ -37,6 +37,13 @@
 #endif 
 
 #define MQTT_PLAYER_BEGIN_PLAY 0x1
+#define MQTT_PLAYER_REGISTER   0x2  // an instance of a group is ready to play
+#define MQTT_PLAYER_START      0x3  // the leader of a group announces the start time
+#define MQTT_PLAYER_PAUSED     0x4  // acknowledgements of the control commands
+#define MQTT_PLAYER_RESUMED    0x5
+#define MQTT_PLAYER_SEEKED     0x6
+#define MQTT_PLAYER_SPEED      0x7
+#define MQTT_PLAYER_REJECTED   0x8  // unknown or unsupported control command
 
 struct mqtt_player_status_msg {
   uint8_t status;
@@ -44,4 +51,27 @@ struct mqtt_player_status_msg {
   uint64_t usec;
 } __attribute__ ((__packed__));
 
+/**
+ * Status message of an instance of a group of players, published to
+ * <status topic>/<group>. For MQTT_PLAYER_START, sec and usec are the common
+ * start time (wall clock). All fields are in network byte order.
+ */
+struct mqtt_player_sync_msg {
+  struct mqtt_player_status_msg status;
+  uint32_t node;    // number of the instance
+  uint32_t nodes;   // number of instances in the group
+  uint32_t round;   // number of the playback, incremented by --repeat
+} __attribute__ ((__packed__));
+
+/**
+ * Acknowledgement of a command on <status topic>/control, published to the
+ * status topic. sec and usec are the playback position relative to the start
+ * of the recording. All fields are in network byte order.
+ */
+struct mqtt_player_control_msg {
+  struct mqtt_player_status_msg status;
+  uint32_t speed;   // playback speed in 1/1000
+  uint8_t paused;   // 1 while the playback is paused
+} __attribute__ ((__packed__));
+
 #endif
@@ -0,0 +1,506 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __mqttlog_h__
+#define __mqttlog_h__
+
+/*
+ * libmqttlog reads and writes the log files of mqttrecorder and mqttplayer.
+ *
+ * A log file starts with configuration lines followed by records:
+ *
+ *   cnf time: <sec>.<nsec>                  wall clock time of the recording start
+ *   cnf dedup: <window> <max length>        payloads may be references
+ *   cnf partition: <levels>                 records are grouped in chunks
+ *   cnf crc: <block size>                   checksum lines after every block
+ *   cnf stripes: <number>                   records are in the stripe files, see <logfile>.stripes
+ *   msg <sec>.<nsec> <qos> <retain> <len> <topic>
+ *   <payload as hex bytes separated by spaces>
+ *   ref <sec>.<nsec> <qos> <retain> <len> <topic>
+ *   @<distance in bytes back to a msg record with the same payload>
+ *   kfm <sec>.<nsec> <number of keys>
+ *   key <sec>.<nsec> <qos> <retain> <len> <topic>
+ *   <payload as hex bytes separated by spaces>
+ *   drp <sec>.<nsec> <count> <policy>       messages dropped by a sampling policy
+ *   crc <crc32c as 8 hex digits> <length>
+ *
+ * A crc line protects the <length> bytes before it, which start after the
+ * previous crc line or at the beginning of the file. Record times are relative to 'cnf time'.
+ * A 'cnf time' line between the records, e.g. of concatenated log files,
+ * applies to the records after it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+struct dedup;
+
+/* record types */
+#define MQTTLOG_MSG       0x1  // a recorded message
+#define MQTTLOG_KEY       0x2  // last value of a topic, part of a keyframe
+#define MQTTLOG_KEYFRAME  0x4  // start of a keyframe, len is the number of keys
+#define MQTTLOG_DROP      0x8  // dropped messages, len is the count, topic the policy
+
+/* return values of mqttlog_reader_next() */
+#define MQTTLOG_RECORD    1    // a record was read
+#define MQTTLOG_END       0    // end of the log
+#define MQTTLOG_ERROR    -1    // format or I/O error
+#define MQTTLOG_PARTIAL  -2    // the log ends within a record
+#define MQTTLOG_CORRUPT  -3    // checksum mismatch, only if verification is enabled
+
+/* formats returned by mqttlog_detect() */
+#define MQTTLOG_FORMAT_UNKNOWN      -1
+#define MQTTLOG_FORMAT_USEC          0  // records with microsecond timestamps
+#define MQTTLOG_FORMAT_NSEC          1  // records with nanosecond timestamps
+#define MQTTLOG_FORMAT_PARTITIONED   2  // records grouped in chunks, see <logfile>.parts
+#define MQTTLOG_FORMAT_STRIPED       3  // records in several files, see <logfile>.stripes
+
+#define MQTTLOG_READ_BUFFER    (1024 * 1024)
+#define MQTTLOG_WRITE_BUFFER   (64 * 1024)
+#define MQTTLOG_INDEX_INTERVAL (1024 * 1024)
+#define MQTTLOG_CRC_BLOCK      (64 * 1024)
+
+
+/**
+ * Configuration lines of a log file.
+ */
+struct mqttlog_header {
+  struct timespec anchor;  // wall clock time of the recording start
+  int dedup_window;        // 0 if the payloads are not deduplicated
+  int dedup_max_len;
+  int partition_levels;    // -1 if the records are not partitioned
+  long crc_block;          // 0 if the log has no checksums
+  int stripes;             // number of stripe files, 0 if the records are in the log file
+};
+
+
+/**
+ * A record read from a log file. The topic and payload point into buffers of
+ * the reader and are valid until the next call of mqttlog_reader_next().
+ */
+struct mqttlog_record {
+  int type;
+  struct timespec time;    // relative to the anchor
+  int64_t abs;             // absolute time in ns
+  int qos;
+  int retain;
+  int len;                 // payload length, number of keys for keyframes
+  const char *topic;
+  const uint8_t *payload;  // NULL if the payload was not decoded
+  long offset;             // offset of the record in the log file
+  const char *raw;         // the record as stored in the log file
+  size_t raw_len;
+};
+
+
+/**
+ * A byte range of a partitioned log file.
+ */
+struct mqttlog_chunk {
+  long offset;
+  long length;
+  int64_t first;    // time of the first record in ns, relative to the cnf time
+  int64_t last;     // time of the last record in ns, relative to the cnf time
+  long records;
+};
+
+
+/**
+ * A partition of a partitioned log file.
+ */
+struct mqttlog_partition {
+  char *key;
+  struct mqttlog_chunk *chunks;
+  int num_chunks;
+};
+
+#define MQTTLOG_DROP_PARTITION  "#"  // key of the partition of the drop records, no topic has it
+
+
+/**
+ * Reads records of a log file through a buffer without copying them.
+ */
+struct mqttlog_reader {
+  int fd;
+  int seekable;            // 0 for pipes
+  struct mqttlog_header header;
+  long data_start;         // offset of the first record
+
+  char *buf;
+  size_t size;             // allocated size of buf
+  size_t start;            // first unparsed byte in buf
+  size_t end;              // end of the data in buf
+  long base;               // offset of buf[0] in the log file
+  int eof;
+
+  uint8_t *payload;        // decoded payload
+  size_t payload_size;
+  struct dedup *dedup;     // recent payloads to resolve references
+
+  const struct mqttlog_chunk *chunks;  // NULL if the whole file is read
+  int num_chunks;
+  int chunk;
+  int shared;              // the file descriptor belongs to another reader
+
+  int verify;              // check the crc lines
+  uint32_t crc;            // checksum of the current block so far
+  long crc_start;          // offset of the current block
+
+  struct timespec anchor;  // cnf time of the header, header.anchor follows cnf lines between the records
+};
+
+
+/**
+ * Writes records through a buffer either to a file or into memory.
+ */
+struct mqttlog_writer {
+  int fd;                  // -1 for a memory writer
+  char *buf;
+  size_t len;              // bytes in buf
+  size_t size;             // allocated size of buf
+  long offset;             // bytes written including the buffered ones
+  int error;
+  int append;              // the file existed before
+
+  struct dedup *dedup;     // recent payloads, if deduplication is enabled
+
+  FILE *index_fd;          // sidecar index, NULL if disabled
+  long index_interval;
+  long index_last;         // offset of the last index entry
+
+  long crc_block;          // 0 if no crc lines are written
+  uint32_t crc;            // checksum of the current block so far
+  long crc_start;          // offset of the current block
+};
+
+
+/**
+ * An entry of the sidecar index of a log file.
+ */
+struct mqttlog_index_entry {
+  int64_t time;            // time in ns relative to the anchor of the header
+  long offset;
+  int keyframe;            // the entry is the start of a keyframe
+  int64_t anchor;          // absolute anchor in ns at the entry if it differs from the header, otherwise 0
+};
+
+
+/**
+ * Sidecar index of a log file, stored in <logfile>.idx.
+ */
+struct mqttlog_index {
+  struct mqttlog_index_entry *entries;
+  size_t count;
+  size_t size;
+};
+
+
+/**
+ * Encodes a payload as hex bytes separated by spaces. out must have room for
+ * 3 * len bytes, no terminating newline or null byte is written.
+ *
+ * @return The number of bytes written, 3 * len - 1 or 0.
+ */
+size_t mqttlog_hex_encode(const uint8_t *payload, size_t len, char *out);
+
+/**
+ * Decodes a payload of hex bytes separated by spaces.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_hex_decode(const char *hex, size_t hex_len, uint8_t *out, size_t len);
+
+/**
+ * Calculates the CRC32C of a buffer, with the crc32 instruction of SSE4.2 if
+ * the CPU supports it.
+ *
+ * @param crc 0 or the result of the previous call to continue a checksum.
+ */
+uint32_t mqttlog_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * Detects the format of a log file.
+ *
+ * @return One of MQTTLOG_FORMAT_*.
+ */
+int mqttlog_detect(const char *path);
+
+
+/**
+ * Opens a log file and reads its configuration lines. "-" is stdin.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_reader_open(struct mqttlog_reader *r, const char *path);
+
+/**
+ * Like mqttlog_reader_open() for an open file descriptor.
+ */
+int mqttlog_reader_fdopen(struct mqttlog_reader *r, int fd);
+
+/**
+ * Opens a reader for one chunk of a partitioned log file. It reads through the
+ * file descriptor of the reader of the log file, which has to stay open, into
+ * a buffer of the size of the chunk. The chunk is not copied.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_reader_open_chunk(struct mqttlog_reader *r, const struct mqttlog_reader *file, const struct mqttlog_chunk *chunk);
+
+/**
+ * Closes the log file and frees the buffers.
+ */
+void mqttlog_reader_close(struct mqttlog_reader *r);
+
+/**
+ * Reads the next record.
+ *
+ * @param decode Record types (MQTTLOG_*) whose payload is decoded.
+ * @return One of MQTTLOG_RECORD, MQTTLOG_END, MQTTLOG_ERROR, MQTTLOG_PARTIAL.
+ */
+int mqttlog_reader_next(struct mqttlog_reader *r, struct mqttlog_record *rec, int decode);
+
+/**
+ * Continues reading at an offset which has to be the start of a record.
+ * Within the current buffer no data is read again.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_reader_seek(struct mqttlog_reader *r, long offset);
+
+/**
+ * Like mqttlog_reader_seek(), for the records after a cnf time line between
+ * the records, see struct mqttlog_index_entry.
+ *
+ * @param anchor Absolute anchor in ns of the records at the offset, 0 for the
+ *               anchor of the header.
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_reader_seek_anchor(struct mqttlog_reader *r, long offset, int64_t anchor);
+
+/**
+ * @return The offset of the next record.
+ */
+long mqttlog_reader_tell(struct mqttlog_reader *r);
+
+/**
+ * Checks the crc lines while reading. Has to be called directly after opening
+ * the log file, seeking stops the verification. On a mismatch,
+ * mqttlog_reader_next() returns MQTTLOG_CORRUPT, the damaged block starts at
+ * r->crc_start and ends at mqttlog_reader_tell().
+ */
+void mqttlog_reader_verify(struct mqttlog_reader *r);
+
+/**
+ * Restricts reading to the chunks of one partition and moves to the first one.
+ * The chunks are not copied.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_reader_set_chunks(struct mqttlog_reader *r, const struct mqttlog_chunk *chunks, int num_chunks);
+
+
+/**
+ * Opens a log file for writing. "-" is stdout.
+ *
+ * @param append Append to an existing file instead of truncating it.
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_writer_open(struct mqttlog_writer *w, const char *path, int append);
+
+/**
+ * Like mqttlog_writer_open() for an open file descriptor.
+ */
+int mqttlog_writer_fdopen(struct mqttlog_writer *w, int fd);
+
+/**
+ * Initializes a writer which keeps everything in memory (w->buf, w->len).
+ */
+int mqttlog_writer_mem(struct mqttlog_writer *w);
+
+/**
+ * Removes everything from a memory writer.
+ */
+void mqttlog_writer_reset(struct mqttlog_writer *w);
+
+/**
+ * Writes the configuration lines. Enables the deduplication if
+ * header->dedup_window is set.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_writer_header(struct mqttlog_writer *w, const struct mqttlog_header *header);
+
+/**
+ * Continues an existing log opened with append. Takes over its configuration
+ * like mqttlog_writer_header() without writing it again.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_writer_continue(struct mqttlog_writer *w, const struct mqttlog_header *header);
+
+/**
+ * Writes a sidecar index to <path>.idx while writing the log.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_writer_index(struct mqttlog_writer *w, const char *path, long interval);
+
+/**
+ * Writes a record of type MQTTLOG_MSG or MQTTLOG_KEY. Messages are written as
+ * references if the deduplication is enabled and the payload is in the window.
+ *
+ * @return The number of bytes written or -1 on error.
+ */
+long mqttlog_writer_record(struct mqttlog_writer *w, int type, const struct timespec *time, int qos, int retain, int len, const char *topic, const void *payload);
+
+/**
+ * Writes the start of a keyframe.
+ *
+ * @return The number of bytes written or -1 on error.
+ */
+long mqttlog_writer_keyframe(struct mqttlog_writer *w, const struct timespec *time, size_t keys);
+
+/**
+ * Writes the number of messages dropped by a policy since its last drop
+ * record.
+ *
+ * @return The number of bytes written or -1 on error.
+ */
+long mqttlog_writer_drop(struct mqttlog_writer *w, const struct timespec *time, int count, const char *policy);
+
+/**
+ * Writes bytes unchanged, e.g. records of a memory writer.
+ *
+ * @return The number of bytes written or -1 on error.
+ */
+long mqttlog_writer_raw(struct mqttlog_writer *w, const void *buf, size_t len);
+
+/**
+ * Copies a byte range of another log file unchanged, with copy_file_range()
+ * or sendfile() where possible. The range has to consist of whole records, in
+ * a log with checksums of whole blocks including their crc lines. The current
+ * block is ended before.
+ *
+ * @return Number of copied bytes or -1 on error.
+ */
+long mqttlog_writer_copy(struct mqttlog_writer *w, int fd, long offset, long len);
+
+/**
+ * Writes the buffer to the file.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_writer_flush(struct mqttlog_writer *w);
+
+/**
+ * Flushes and closes the writer.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_writer_close(struct mqttlog_writer *w);
+
+
+/**
+ * Truncates a log file after its last valid record, e.g. after a crash of the
+ * recorder. Blocks with a checksum mismatch are removed completely. A
+ * remaining block without crc line gets one, entries of the index after the
+ * end are removed.
+ *
+ * @return The new length of the log file or -1 on error.
+ */
+long mqttlog_recover(const char *path);
+
+
+/**
+ * Loads <path>.idx.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_index_load(struct mqttlog_index *idx, const char *path);
+
+/**
+ * Builds an index by reading a log file from its first record.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_index_build(struct mqttlog_index *idx, struct mqttlog_reader *r, long interval);
+
+/**
+ * Saves an index as <path>.idx.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_index_save(const struct mqttlog_index *idx, const char *path);
+
+/**
+ * Appends an entry to an index. The entries have to be added sorted by
+ * offset.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_index_add(struct mqttlog_index *idx, int64_t time, long offset, int keyframe, int64_t anchor);
+
+/**
+ * Searches the last entry at or before a relative time.
+ *
+ * @param keyframe If set, only keyframes are searched.
+ * @return The entry or NULL.
+ */
+const struct mqttlog_index_entry *mqttlog_index_lookup(const struct mqttlog_index *idx, int64_t time, int keyframe);
+
+/**
+ * Searches the last entry at or before a relative time.
+ *
+ * @param keyframe If set, only keyframes are searched.
+ * @return The offset of the entry or -1.
+ */
+long mqttlog_index_find(const struct mqttlog_index *idx, int64_t time, int keyframe);
+
+/**
+ * Frees an index.
+ */
+void mqttlog_index_free(struct mqttlog_index *idx);
+
+
+/**
+ * Loads the partitions of a partitioned log file from <path>.parts.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_parts_load(const char *path, struct mqttlog_partition **parts, int *num_parts);
+
+/**
+ * Frees the partitions.
+ */
+void mqttlog_parts_free(struct mqttlog_partition *parts, int num_parts);
+
+
+/**
+ * Loads the stripe files of a striped log file from <path>.stripes. Every
+ * stripe file is a log file of its own with the same cnf time.
+ *
+ * @param files Set to the paths of the stripe files, ordered by their number.
+ * @return 0 on success, otherwise something else.
+ */
+int mqttlog_stripes_load(const char *path, char ***files, int *num_files);
+
+/**
+ * Frees the paths of the stripe files.
+ */
+void mqttlog_stripes_free(char **files, int num_files);
+
+#endif
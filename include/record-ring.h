@@ -0,0 +1,109 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __record_ring_h__
+#define __record_ring_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct mqttlog_writer;
+
+/**
+ * A record in the ring, followed by the topic with a terminating zero and the
+ * payload.
+ */
+struct ring_record {
+  int64_t time;     // in ns
+  uint32_t size;    // of the record in the ring, including the padding
+  uint32_t topic_len;
+  int32_t len;      // payload length, number of keys or dropped messages
+  uint8_t type;     // MQTTLOG_*
+  uint8_t qos;
+  uint8_t retain;
+};
+
+#define RING_RECORD_TOPIC(rec)    ((const char *)((rec) + 1))
+#define RING_RECORD_PAYLOAD(rec)  ((const uint8_t *)((rec) + 1) + (rec)->topic_len + 1)
+
+/**
+ * Preallocated circular buffer of records. A new record replaces the oldest
+ * records if the buffer is full.
+ */
+struct record_ring {
+  uint8_t *buf;
+  size_t size;
+  size_t head;      // where the next record is written
+  size_t tail;      // oldest record
+  size_t end;       // end of the records before the wrap around
+  int wrapped;      // the records continue at the start of the buffer
+  size_t count;     // number of records
+  size_t used;      // bytes of all records
+};
+
+/**
+ * Allocates the buffer. All its pages are touched, so no page fault or
+ * allocation happens while recording.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int ring_init(struct record_ring *r, size_t size);
+
+/**
+ * Frees the buffer.
+ */
+void ring_free(struct record_ring *r);
+
+/**
+ * Removes all records.
+ */
+void ring_clear(struct record_ring *r);
+
+/**
+ * Appends a record and removes the oldest records to make room for it.
+ *
+ * @return 0 on success, -1 if the record is larger than the buffer.
+ */
+int ring_push(struct record_ring *r, int type, int64_t time, int qos, int retain, int len, const char *topic, const void *payload);
+
+/**
+ * Removes the records older than time.
+ */
+void ring_expire(struct record_ring *r, int64_t time);
+
+/**
+ * Copies all records of src in their order to the start of dst, which has
+ * to be at least as large as src.
+ */
+void ring_copy(struct record_ring *dst, const struct record_ring *src);
+
+/**
+ * @return The oldest record or NULL if the ring is empty.
+ */
+const struct ring_record *ring_first(const struct record_ring *r);
+
+/**
+ * @return The record after rec or NULL if rec is the newest one.
+ */
+const struct ring_record *ring_next(const struct record_ring *r, const struct ring_record *rec);
+
+/**
+ * Writes the records of a ring in their order to a log file. The keys of a
+ * keyframe whose start was overwritten are left out.
+ *
+ * @return 0 on success, -1 if writing failed.
+ */
+int ring_write(const struct record_ring *r, struct mqttlog_writer *w);
+
+#endif
@@ -0,0 +1,78 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __rewrite_h__
+#define __rewrite_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A rule which shifts the timestamps embedded in the payloads of the topics
+ * matching a filter, given as <filter>:<rule> with the rules
+ *
+ *   json=<key>[,<unit>]                  numbers at every "<key>": of a JSON payload
+ *   bin=<offset>,<type>[,<unit>]         integer at a byte offset, type u32le,
+ *                                        u32be, u64le or u64be
+ *
+ * The unit is s, ms, us or ns, by default ms. JSON numbers keep their number
+ * of fractional digits, numbers with an exponent are left as they are.
+ */
+struct rewrite {
+  #define REWRITE_JSON  1
+  #define REWRITE_BIN   2
+  int type;
+  char *spec;           // as given on the command line
+  char *filter;
+  char *key;            // "<key>" with quotes
+  size_t key_len;
+  long offset;
+  int width;            // 4 or 8 bytes
+  int big_endian;
+  int64_t unit;         // ns per unit
+};
+
+/**
+ * Parses a rule <filter>:<rule>.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int rewrite_parse(struct rewrite *r, char *spec);
+
+/**
+ * Frees the memory of a rule.
+ */
+void rewrite_free(struct rewrite *r);
+
+/**
+ * Searches a string in a buffer with SSE2 if available: candidates are the
+ * positions where the first and the last byte match, 16 at a time.
+ *
+ * @return The first occurrence or NULL.
+ */
+const char *rewrite_find(const char *buf, size_t len, const char *needle, size_t needle_len);
+
+/**
+ * Shifts the timestamps of a payload by shift ns. The payload is not modified,
+ * the result is written to a buffer which grows as needed and can be reused
+ * for the next payload.
+ *
+ * @param buf  Buffer for the rewritten payload, *buf may be NULL.
+ * @param size Allocated size of *buf.
+ * @return The length of the rewritten payload in *buf, -1 if the payload
+ *         contains no timestamp of the rule or on allocation failure.
+ */
+long rewrite_apply(const struct rewrite *r, const uint8_t *payload, size_t len, int64_t shift, uint8_t **buf, size_t *size);
+
+#endif
@@ -0,0 +1,98 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __timespec_h__
+#define __timespec_h__
+
+#include <time.h>
+#include <stdint.h>
+
+#define NSEC_PER_SEC  1000000000L
+
+/**
+ * Calculates res = a + b. res may point to a or b.
+ */
+static inline void timespec_add(const struct timespec *a, const struct timespec *b, struct timespec *res) {
+  res->tv_sec  = a->tv_sec + b->tv_sec;
+  res->tv_nsec = a->tv_nsec + b->tv_nsec;
+  if( NSEC_PER_SEC <= res->tv_nsec ) {
+    res->tv_sec++;
+    res->tv_nsec -= NSEC_PER_SEC;
+  }
+}
+
+/**
+ * Calculates res = a - b. res may point to a or b.
+ */
+static inline void timespec_sub(const struct timespec *a, const struct timespec *b, struct timespec *res) {
+  res->tv_sec  = a->tv_sec - b->tv_sec;
+  res->tv_nsec = a->tv_nsec - b->tv_nsec;
+  if( 0 > res->tv_nsec ) {
+    res->tv_sec--;
+    res->tv_nsec += NSEC_PER_SEC;
+  }
+}
+
+/**
+ * @return <0, 0 or >0 if a is less, equal or greater than b.
+ */
+static inline int timespec_cmp(const struct timespec *a, const struct timespec *b) {
+  if( a->tv_sec != b->tv_sec ) {
+    return (a->tv_sec < b->tv_sec)?(-1):(1);
+  }
+  if( a->tv_nsec != b->tv_nsec ) {
+    return (a->tv_nsec < b->tv_nsec)?(-1):(1);
+  }
+  return 0;
+}
+
+/**
+ * @return The time in nanoseconds.
+ */
+static inline int64_t timespec_to_ns(const struct timespec *t) {
+  return (int64_t)t->tv_sec * NSEC_PER_SEC + t->tv_nsec;
+}
+
+/**
+ * Converts nanoseconds into a struct timespec.
+ */
+static inline void timespec_from_ns(int64_t ns, struct timespec *t) {
+  t->tv_sec  = ns / NSEC_PER_SEC;
+  t->tv_nsec = ns % NSEC_PER_SEC;
+  if( 0 > t->tv_nsec ) {
+    t->tv_sec--;
+    t->tv_nsec += NSEC_PER_SEC;
+  }
+}
+
+/**
+ * Converts the fractional digits of a decimal time value into nanoseconds.
+ * "5" is 500000000ns, "000001" is 1000ns and "000000001" is 1ns. Digits
+ * beyond the ninth are ignored.
+ */
+static inline long timespec_nsec_from_digits(const char *digits) {
+  long nsec = 0;
+  int i;
+
+  for( i = 0; i < 9; i++ ) {
+    nsec *= 10;
+    if( '0' <= *digits && '9' >= *digits ) {
+      nsec += *digits++ - '0';
+    }
+  }
+
+  return nsec;
+}
+
+#endif
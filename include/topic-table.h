@@ -0,0 +1,90 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __topic_table_h__
+#define __topic_table_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Last value of a topic.
+ */
+struct topic_entry {
+  char *topic;
+  int64_t time;     // time of the last value in ns
+  int qos;
+  int retain;
+  int len;
+  uint8_t *payload;
+  int size;         // allocated size of payload
+  void *data;       // user data, not freed by the table
+  struct topic_entry *next;
+};
+
+/**
+ * Hash table which maps topics to their last value.
+ */
+struct topic_table {
+  struct topic_entry **buckets;
+  size_t num_buckets;
+  size_t count;
+};
+
+#define TOPIC_TABLE_DEFAULT_BUCKETS 1024
+
+/**
+ * 64 bit FNV-1a hash of a buffer.
+ */
+uint64_t fnv1a(const void *buf, size_t length);
+
+/**
+ * Initializes an empty table.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int topic_table_init(struct topic_table *table, size_t num_buckets);
+
+/**
+ * Searches the entry of a topic.
+ *
+ * @param create If set, a new entry with length 0 is added if the topic is
+ *               not in the table.
+ * @return The entry or NULL.
+ */
+struct topic_entry *topic_table_get(struct topic_table *table, const char *topic, int create);
+
+/**
+ * Stores a copy of the payload in an entry.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int topic_entry_set(struct topic_entry *entry, int64_t time, int qos, int retain, int len, const void *payload);
+
+/**
+ * Calls fn for every entry of the table.
+ */
+void topic_table_foreach(struct topic_table *table, void (*fn)(struct topic_entry *entry, void *userdata), void *userdata);
+
+/**
+ * Removes all entries from the table.
+ */
+void topic_table_clear(struct topic_table *table);
+
+/**
+ * Frees all memory of the table.
+ */
+void topic_table_free(struct topic_table *table);
+
+#endif
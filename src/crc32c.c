@@ -0,0 +1,123 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "mqttlog.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define CRC32C_SSE42 1
+  #include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY  0x82f63b78  // Castagnoli, reflected
+
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_impl)(uint32_t crc, const uint8_t *p, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Software implementation, slicing by 8 bytes.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t v;
+
+  while( len && ((uintptr_t)p & 7) ) {
+    crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    len--;
+  }
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while( 8 <= len ) {
+    memcpy(&v, p, 8);
+    v ^= crc;
+    crc = crc32c_table[7][v & 0xff]         ^ crc32c_table[6][(v >> 8) & 0xff]
+        ^ crc32c_table[5][(v >> 16) & 0xff] ^ crc32c_table[4][(v >> 24) & 0xff]
+        ^ crc32c_table[3][(v >> 32) & 0xff] ^ crc32c_table[2][(v >> 40) & 0xff]
+        ^ crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+    p += 8;
+    len -= 8;
+  }
+#endif
+
+  while( len-- ) {
+    crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc;
+}
+
+
+#ifdef CRC32C_SSE42
+/**
+ * Implementation with the crc32 instruction of SSE4.2.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len) {
+  #ifdef __x86_64__
+  uint64_t crc64 = crc;
+  uint64_t v;
+
+  while( 8 <= len ) {
+    memcpy(&v, p, 8);
+    crc64 = _mm_crc32_u64(crc64, v);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)crc64;
+  #endif
+
+  while( len-- ) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+
+  return crc;
+}
+#endif
+
+
+static void crc32c_init() {
+  uint32_t crc;
+  int i, j;
+
+  for( i = 0; i < 256; i++ ) {
+    crc = i;
+    for( j = 0; j < 8; j++ ) {
+      crc = (crc & 1)?((crc >> 1) ^ CRC32C_POLY):(crc >> 1);
+    }
+    crc32c_table[0][i] = crc;
+  }
+
+  for( i = 0; i < 256; i++ ) {
+    for( j = 1; j < 8; j++ ) {
+      crc32c_table[j][i] = crc32c_table[0][crc32c_table[j - 1][i] & 0xff] ^ (crc32c_table[j - 1][i] >> 8);
+    }
+  }
+
+  crc32c_impl = crc32c_sw;
+#ifdef CRC32C_SSE42
+  if( __builtin_cpu_supports("sse4.2") ) {
+    crc32c_impl = crc32c_hw;
+  }
+#endif
+}
+
+
+uint32_t mqttlog_crc32c(uint32_t crc, const void *buf, size_t len) {
+  pthread_once(&crc32c_once, crc32c_init);
+
+  return ~crc32c_impl(~crc, (const uint8_t *)buf, len);
+}
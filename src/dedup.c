@@ -0,0 +1,198 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "dedup.h"
+
+uint64_t dedup_hash(const void *buf, size_t length) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const uint8_t *p = (const uint8_t *)buf;
+  const uint8_t *end = p + (length & ~(size_t)7);
+  uint64_t h = 0x8445d61a4e774912ULL ^ (length * m);
+  uint64_t k;
+
+  while( p != end ) {
+    memcpy(&k, p, sizeof(k));
+    p += sizeof(k);
+
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+
+    h ^= k;
+    h *= m;
+  }
+
+  switch( length & 7 ) {
+    case 7: h ^= (uint64_t)p[6] << 48;
+    case 6: h ^= (uint64_t)p[5] << 40;
+    case 5: h ^= (uint64_t)p[4] << 32;
+    case 4: h ^= (uint64_t)p[3] << 24;
+    case 3: h ^= (uint64_t)p[2] << 16;
+    case 2: h ^= (uint64_t)p[1] << 8;
+    case 1: h ^= (uint64_t)p[0];
+            h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+
+  return h;
+}
+
+
+int dedup_init(struct dedup *d, int window, int max_len, int indexed) {
+  memset(d, 0, sizeof(struct dedup));
+
+  d->window = window;
+  d->max_len = max_len;
+
+  d->slots = calloc(window, sizeof(struct dedup_slot));
+  if( NULL == d->slots ) {
+    return -1;
+  }
+
+  if( indexed ) {
+    d->index_size = 2 * window;
+    d->index = malloc(d->index_size * sizeof(int64_t));
+    if( NULL == d->index ) {
+      free(d->slots);
+      return -1;
+    }
+  }
+
+  dedup_reset(d);
+
+  return 0;
+}
+
+
+void dedup_reset(struct dedup *d) {
+  size_t i;
+
+  d->seq = 0;
+  for( i = 0; i < d->window; i++ ) {
+    d->slots[i].seq = -1;
+  }
+  for( i = 0; i < d->index_size; i++ ) {
+    d->index[i] = -1;
+  }
+}
+
+
+void dedup_free(struct dedup *d) {
+  int i;
+
+  for( i = 0; i < d->window; i++ ) {
+    free(d->slots[i].payload);
+  }
+  free(d->slots);
+  free(d->index);
+  memset(d, 0, sizeof(struct dedup));
+}
+
+
+void dedup_add(struct dedup *d, long offset, uint64_t hash, const void *payload, int len) {
+  struct dedup_slot *slot;
+  uint8_t *p;
+
+  if( 0 >= len || d->max_len < len ) {
+    return;
+  }
+
+  slot = &d->slots[d->seq % d->window];
+  if( slot->size < len ) {
+    p = realloc(slot->payload, len);
+    if( NULL == p ) {
+      // not in the window is always safe
+      slot->seq = -1;
+      return;
+    }
+    slot->payload = p;
+    slot->size = len;
+  }
+
+  memcpy(slot->payload, payload, len);
+  slot->seq    = d->seq;
+  slot->offset = offset;
+  slot->hash   = hash;
+  slot->len    = len;
+
+  if( d->index ) {
+    d->index[hash % d->index_size] = d->seq;
+  }
+
+  d->seq++;
+}
+
+
+long dedup_find(struct dedup *d, uint64_t hash, const void *payload, int len) {
+  struct dedup_slot *slot;
+  int64_t seq;
+
+  if( NULL == d->index ) {
+    return -1;
+  }
+
+  seq = d->index[hash % d->index_size];
+  if( 0 > seq ) {
+    return -1;
+  }
+
+  slot = &d->slots[seq % d->window];
+  if( slot->seq != seq || slot->hash != hash || slot->len != len || memcmp(slot->payload, payload, len) ) {
+    return -1;
+  }
+
+  return slot->offset;
+}
+
+
+const struct dedup_slot *dedup_get(struct dedup *d, long offset) {
+  struct dedup_slot *slot;
+  int64_t lo, hi, mid;
+
+  // the slots hold the payloads seq - window up to seq - 1 sorted by offset
+  lo = (d->seq > d->window)?(d->seq - d->window):(0);
+  hi = d->seq - 1;
+
+  while( lo <= hi ) {
+    mid = lo + (hi - lo) / 2;
+    slot = &d->slots[mid % d->window];
+
+    if( slot->seq != mid ) {
+      // a slot which could not be allocated, search linear
+      for( mid = lo; mid <= hi; mid++ ) {
+        slot = &d->slots[mid % d->window];
+        if( slot->seq == mid && slot->offset == offset ) {
+          return slot;
+        }
+      }
+      return NULL;
+    }
+
+    if( slot->offset == offset ) {
+      return slot;
+    } else if( slot->offset < offset ) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  return NULL;
+}
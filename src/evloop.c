@@ -0,0 +1,275 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "evloop.h"
+#include "timespec.h"
+
+#define EVLOOP_TIMER  UINT32_MAX  // epoll data of the timerfd
+
+
+int evloop_init(struct evloop *loop) {
+  struct epoll_event ev;
+
+  memset(loop, 0, sizeof(struct evloop));
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if( 0 > loop->epfd ) {
+    return -1;
+  }
+
+  loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if( 0 > loop->timer_fd ) {
+    close(loop->epfd);
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.events = EPOLLIN;
+  ev.data.u32 = EVLOOP_TIMER;
+  if( epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timer_fd, &ev) ) {
+    close(loop->timer_fd);
+    close(loop->epfd);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int evloop_add(struct evloop *loop, struct mosquitto *mosq) {
+  int n = loop->num_clients + 1;
+
+  loop->clients = realloc(loop->clients, n * sizeof(struct mosquitto *));
+  loop->sockets = realloc(loop->sockets, n * sizeof(int));
+  loop->writing = realloc(loop->writing, n * sizeof(int));
+  if( NULL == loop->clients || NULL == loop->sockets || NULL == loop->writing ) {
+    return -1;
+  }
+
+  loop->clients[loop->num_clients] = mosq;
+  loop->sockets[loop->num_clients] = -1;
+  loop->writing[loop->num_clients] = 0;
+  loop->num_clients = n;
+
+  return 0;
+}
+
+
+/**
+ * Adds a socket to the epoll set or updates its events if it is already in it.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+static int evloop_register(struct evloop *loop, int fd, struct epoll_event *ev) {
+  if( !epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, ev) ) {
+    return 0;
+  }
+  if( EEXIST == errno ) {
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, ev);
+  }
+  return -1;
+}
+
+
+/**
+ * Forgets the socket of a client after the connection was lost. The socket
+ * is closed and so removed from the epoll set, the socket of a reconnect
+ * often gets the same number and has to be added again.
+ */
+static void evloop_forget(struct evloop *loop, int i) {
+  loop->sockets[i] = -1;
+  loop->writing[i] = 0;
+}
+
+
+/**
+ * Registers the current socket of a client and whether it wants to write.
+ * The socket changes when the client reconnects. A socket which could not be
+ * registered is tried again in the next step.
+ */
+static void evloop_update(struct evloop *loop, int i) {
+  struct epoll_event ev;
+  int fd = mosquitto_socket(loop->clients[i]);
+  int writing = (0 <= fd && mosquitto_want_write(loop->clients[i]));
+
+  if( fd == loop->sockets[i] && writing == loop->writing[i] ) {
+    return;
+  }
+
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.events = EPOLLIN | ((writing)?(EPOLLOUT):(0));
+  ev.data.u32 = i;
+
+  if( fd != loop->sockets[i] ) {
+    // a closed socket is already removed from the epoll set (ENOENT, EBADF)
+    if( 0 <= loop->sockets[i] ) {
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, loop->sockets[i], NULL);
+    }
+    if( 0 <= fd && evloop_register(loop, fd, &ev) ) {
+      fd = -1;
+    }
+  } else if( epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) ) {
+    // the socket was closed and a new one got the same number
+    if( ENOENT != errno || evloop_register(loop, fd, &ev) ) {
+      fd = -1;
+    }
+  }
+
+  loop->sockets[i] = fd;
+  loop->writing[i] = writing;
+}
+
+
+/**
+ * Keeps the connections alive and reconnects lost ones.
+ */
+static void evloop_misc(struct evloop *loop) {
+  struct timespec now;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if( 0 > timespec_cmp(&now, &loop->next_misc) ) {
+    return;
+  }
+
+  for( i = 0; i < loop->num_clients; i++ ) {
+    if( 0 > mosquitto_socket(loop->clients[i]) ) {
+      evloop_forget(loop, i);
+      mosquitto_reconnect(loop->clients[i]);
+    }
+    if( MOSQ_ERR_SUCCESS != mosquitto_loop_misc(loop->clients[i]) ) {
+      evloop_forget(loop, i);
+    }
+  }
+
+  timespec_from_ns(timespec_to_ns(&now) + (int64_t)EVLOOP_MISC_INTERVAL * 1000000L, &loop->next_misc);
+}
+
+
+/**
+ * Waits for events at most timeout ms and handles them.
+ *
+ * @return 1 if the timer expired, 0 if not or -1 on error.
+ */
+static int evloop_step(struct evloop *loop, int timeout) {
+  struct epoll_event events[EVLOOP_MAX_EVENTS];
+  struct mosquitto *mosq;
+  uint64_t expirations;
+  int expired = 0;
+  int i, n;
+
+  for( i = 0; i < loop->num_clients; i++ ) {
+    evloop_update(loop, i);
+  }
+
+  n = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, timeout);
+  if( 0 > n ) {
+    return (EINTR == errno)?(0):(-1);
+  }
+
+  for( i = 0; i < n; i++ ) {
+    if( EVLOOP_TIMER == events[i].data.u32 ) {
+      while( 0 < read(loop->timer_fd, &expirations, sizeof(expirations)) );
+      expired = 1;
+      continue;
+    }
+
+    // on an error mosquitto closes the socket
+    mosq = loop->clients[events[i].data.u32];
+    if( (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && MOSQ_ERR_SUCCESS != mosquitto_loop_read(mosq, 1) ) {
+      evloop_forget(loop, events[i].data.u32);
+      continue;
+    }
+    if( (events[i].events & EPOLLOUT) && MOSQ_ERR_SUCCESS != mosquitto_loop_write(mosq, 1) ) {
+      evloop_forget(loop, events[i].data.u32);
+    }
+  }
+
+  evloop_misc(loop);
+
+  return expired;
+}
+
+
+int evloop_wait(struct evloop *loop, const struct timespec *deadline) {
+  struct itimerspec timer;
+  int ret;
+
+  memset(&timer, 0, sizeof(struct itimerspec));
+  if( NULL != deadline ) {
+    timer.it_value = *deadline;
+    // a zero value would disarm the timer, a negative one is invalid
+    if( 0 > timer.it_value.tv_sec || (!timer.it_value.tv_sec && !timer.it_value.tv_nsec) ) {
+      timer.it_value.tv_sec = 0;
+      timer.it_value.tv_nsec = 1;
+    }
+  }
+  if( timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) ) {
+    return -1;
+  }
+
+  while( !(ret = evloop_step(loop, EVLOOP_MISC_INTERVAL)) && !loop->interrupted );
+  loop->interrupted = 0;
+
+  return (0 > ret)?(-1):(0);
+}
+
+
+void evloop_interrupt(struct evloop *loop) {
+  loop->interrupted = 1;
+}
+
+
+int evloop_flush(struct evloop *loop, int timeout) {
+  struct timespec now, end;
+  int i, pending;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  timespec_from_ns(timespec_to_ns(&now) + (int64_t)timeout * 1000000L, &end);
+
+  do {
+    pending = 0;
+    for( i = 0; i < loop->num_clients; i++ ) {
+      if( 0 <= mosquitto_socket(loop->clients[i]) && mosquitto_want_write(loop->clients[i]) ) {
+        pending = 1;
+      }
+    }
+    if( !pending ) {
+      return 0;
+    }
+    if( 0 > evloop_step(loop, 10) ) {
+      return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while( 0 > timespec_cmp(&now, &end) );
+
+  return -1;
+}
+
+
+void evloop_free(struct evloop *loop) {
+  close(loop->timer_fd);
+  close(loop->epfd);
+  free(loop->clients);
+  free(loop->sockets);
+  free(loop->writing);
+  memset(loop, 0, sizeof(struct evloop));
+}
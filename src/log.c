@@ -14,6 +14,10 @@
  */
 #include "log.h"
 #include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 
 void log_buf(void *buf, size_t length) {
   int i;
@@ -24,3 +28,333 @@ void log_buf(void *buf, size_t length) {
   }
 }
 
+
+/* ---- asynchronous logging ---- */
+
+#define LOG_ENTRY_PAD    0  // rest of the ring up to its end is unused
+#define LOG_ENTRY_TEXT   1  // a formatted line
+#define LOG_ENTRY_TRACE  2  // a format with its arguments
+
+/**
+ * A line in a ring, followed by the text or the string argument.
+ */
+struct log_entry {
+  uint32_t size;           // of the entry including the text, a multiple of 8
+  uint16_t type;
+  uint16_t nargs;
+  FILE *stream;
+  const char *format;
+  long args[LOG_MAX_ARGS];
+  char text[];
+};
+
+/**
+ * Ring of one thread. Only the thread writes head, only the log thread
+ * writes tail, so no lock is needed. Both count bytes and wrap modulo size.
+ */
+struct log_ring {
+  char *buf;
+  size_t head;
+  size_t tail;
+  unsigned long dropped;
+  struct log_ring *next;
+};
+
+static struct {
+  int started;
+  pthread_t thread;
+  pthread_mutex_t lock;    // held while the rings are emptied
+  pthread_mutex_t rings_lock;
+  struct log_ring *rings;
+} log_state = { 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, NULL };
+
+static __thread struct log_ring *log_ring = NULL;
+
+
+/**
+ * @return The ring of the calling thread, NULL if it could not be created.
+ */
+static struct log_ring *ring_get() {
+  struct log_ring *ring;
+
+  if( NULL != log_ring ) {
+    return log_ring;
+  }
+
+  ring = calloc(1, sizeof(struct log_ring));
+  if( NULL == ring ) {
+    return NULL;
+  }
+  ring->buf = malloc(LOG_RING_SIZE);
+  if( NULL == ring->buf ) {
+    free(ring);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&log_state.rings_lock);
+  ring->next = log_state.rings;
+  log_state.rings = ring;
+  pthread_mutex_unlock(&log_state.rings_lock);
+
+  log_ring = ring;
+  return ring;
+}
+
+
+/**
+ * Reserves an entry in the ring of the calling thread. The entry is
+ * published with entry_commit().
+ *
+ * @return The entry or NULL if the ring is full.
+ */
+static struct log_entry *entry_reserve(size_t text_len, int type) {
+  struct log_ring *ring;
+  struct log_entry *entry;
+  size_t size, offset, pad, used;
+
+  ring = ring_get();
+  if( NULL == ring ) {
+    return NULL;
+  }
+
+  size = (sizeof(struct log_entry) + text_len + 1 + 7) & ~(size_t)7;
+  offset = ring->head % LOG_RING_SIZE;
+  pad = (offset + size > LOG_RING_SIZE)?(LOG_RING_SIZE - offset):(0);
+  used = ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  if( used + pad + size > LOG_RING_SIZE ) {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  if( pad ) {
+    entry = (struct log_entry *)(ring->buf + offset);
+    entry->size = pad;
+    entry->type = LOG_ENTRY_PAD;
+    __atomic_store_n(&ring->head, ring->head + pad, __ATOMIC_RELEASE);
+    offset = 0;
+  }
+
+  entry = (struct log_entry *)(ring->buf + offset);
+  entry->size = size;
+  entry->type = type;
+  return entry;
+}
+
+
+static void entry_commit(struct log_entry *entry) {
+  __atomic_store_n(&log_ring->head, log_ring->head + entry->size, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Formats a line of LOG_TRACE().
+ */
+static void trace_write(FILE *stream, const char *format, int nargs, const long *a, const char *str) {
+  switch( nargs ) {
+    case 0: fprintf(stream, format, str); break;
+    case 1: fprintf(stream, format, a[0], str); break;
+    case 2: fprintf(stream, format, a[0], a[1], str); break;
+    case 3: fprintf(stream, format, a[0], a[1], a[2], str); break;
+    case 4: fprintf(stream, format, a[0], a[1], a[2], a[3], str); break;
+    case 5: fprintf(stream, format, a[0], a[1], a[2], a[3], a[4], str); break;
+    default: fprintf(stream, format, a[0], a[1], a[2], a[3], a[4], a[5], str); break;
+  }
+}
+
+
+void log_flush() {
+  struct log_ring *ring;
+  struct log_entry *entry;
+  unsigned long dropped;
+  size_t head;
+  int err = errno;
+
+  if( !log_state.started ) {
+    return;
+  }
+
+  pthread_mutex_lock(&log_state.lock);
+
+  pthread_mutex_lock(&log_state.rings_lock);
+  ring = log_state.rings;
+  pthread_mutex_unlock(&log_state.rings_lock);
+
+  // new rings are added at the front, the list behind it does not change
+  for( ; NULL != ring; ring = ring->next ) {
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while( ring->tail != head ) {
+      entry = (struct log_entry *)(ring->buf + ring->tail % LOG_RING_SIZE);
+      if( LOG_ENTRY_TEXT == entry->type ) {
+        fputs(entry->text, entry->stream);
+      } else if( LOG_ENTRY_TRACE == entry->type ) {
+        trace_write(entry->stream, entry->format, entry->nargs, entry->args, entry->text);
+      }
+      __atomic_store_n(&ring->tail, ring->tail + entry->size, __ATOMIC_RELEASE);
+    }
+
+    dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if( dropped ) {
+      fprintf(LOG_FD, "log: %lu lines dropped, the log ring of a thread was full\n", dropped);
+    }
+  }
+
+  fflush(stdout);
+  fflush(LOG_FD);
+
+  pthread_mutex_unlock(&log_state.lock);
+  errno = err;
+}
+
+
+static void *log_thread(void *arg) {
+  struct timespec interval = { 0, LOG_FLUSH_INTERVAL * 1000000L };
+
+  for(;;) {
+    nanosleep(&interval, NULL);
+    log_flush();
+  }
+
+  return NULL;
+}
+
+
+int log_start() {
+  sigset_t all, old;
+  int ret;
+
+  if( log_state.started ) {
+    return 0;
+  }
+
+  // the signals are handled by the other threads
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  ret = pthread_create(&log_state.thread, NULL, log_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if( ret ) {
+    return -1;
+  }
+
+  log_state.started = 1;
+  atexit(log_flush);
+
+  return 0;
+}
+
+
+/**
+ * Appends a formatted line to the ring of the calling thread or writes it if
+ * the log thread is not running.
+ */
+static void text_write(FILE *stream, const char *text, size_t n) {
+  struct log_entry *entry;
+
+  if( !log_state.started ) {
+    fputs(text, stream);
+    return;
+  }
+
+  entry = entry_reserve(n, LOG_ENTRY_TEXT);
+  if( NULL != entry ) {
+    entry->stream = stream;
+    memcpy(entry->text, text, n);
+    entry->text[n] = '\0';
+    entry_commit(entry);
+  }
+}
+
+
+void log_printf(FILE *stream, const char *format, ...) {
+  char text[LOG_MAX_TEXT];
+  va_list ap;
+  int n, err = errno;
+
+  va_start(ap, format);
+  if( !log_state.started ) {
+    vfprintf(stream, format, ap);
+    va_end(ap);
+    errno = err;
+    return;
+  }
+  n = vsnprintf(text, sizeof(text), format, ap);
+  va_end(ap);
+
+  if( 0 > n ) {
+    errno = err;
+    return;
+  }
+  if( (size_t)n >= sizeof(text) ) {
+    n = sizeof(text) - 1;
+  }
+
+  text_write(stream, text, n);
+  errno = err;
+}
+
+
+void log_printf_buf(FILE *stream, const void *buf, size_t length, const char *format, ...) {
+  const uint8_t *bytes = (const uint8_t *)buf;
+  char text[LOG_MAX_TEXT];
+  va_list ap;
+  size_t i;
+  int n, err = errno;
+
+  va_start(ap, format);
+  n = vsnprintf(text, sizeof(text), format, ap);
+  va_end(ap);
+
+  if( 0 > n ) {
+    errno = err;
+    return;
+  }
+  if( (size_t)n >= sizeof(text) - 1 ) {
+    n = sizeof(text) - 2;
+  }
+
+  // the bytes which fit, the newline is kept
+  for( i = 0; i < length && (size_t)n + 3 < sizeof(text) - 1; i++ ) {
+    n += snprintf(text + n, 4, "%02x ", bytes[i]);
+  }
+  text[n++] = '\n';
+  text[n] = '\0';
+
+  text_write(stream, text, n);
+  errno = err;
+}
+
+
+void log_trace(FILE *stream, const char *format, const char *str, int nargs, ...) {
+  struct log_entry *entry;
+  va_list ap;
+  size_t len;
+  int i, err = errno;
+
+  va_start(ap, nargs);
+  if( !log_state.started ) {
+    long a[LOG_MAX_ARGS];
+    for( i = 0; i < nargs && i < LOG_MAX_ARGS; i++ ) {
+      a[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+    trace_write(stream, format, nargs, a, str);
+    errno = err;
+    return;
+  }
+
+  len = strnlen(str, LOG_MAX_TEXT - 1);
+  entry = entry_reserve(len, LOG_ENTRY_TRACE);
+  if( NULL != entry ) {
+    entry->stream = stream;
+    entry->format = format;
+    entry->nargs = nargs;
+    for( i = 0; i < nargs && i < LOG_MAX_ARGS; i++ ) {
+      entry->args[i] = va_arg(ap, long);
+    }
+    memcpy(entry->text, str, len);
+    entry->text[len] = '\0';
+    entry_commit(entry);
+  }
+  va_end(ap);
+  errno = err;
+}
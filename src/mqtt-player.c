@@ -17,18 +17,35 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
 #include "mqtt-player.h"
 #include "config.h"
 #include "log.h"
+#include "timespec.h"
+#include "topic-table.h"
+#include "mqttlog.h"
+#include "evloop.h"
+#include "rewrite.h"
 
-#define BUF_SIZE 256 
-
-#define MSG_ARG_TYPE        0
-#define MSG_ARG_TIME        1
-#define MSG_ARG_QOS         2
-#define MSG_ARG_RETAIN      3
-#define MSG_ARG_PAYLOADLEN  4
-#define MSG_ARG_TOPIC       5
+/**
+ * A command received on the control topic, see --control.
+ */
+struct command {
+  #define COMMAND_INVALID  0
+  #define COMMAND_PAUSE    1
+  #define COMMAND_RESUME   2
+  #define COMMAND_SEEK     3
+  #define COMMAND_SPEED    4
+  int type;
+  double value;         // seconds for COMMAND_SEEK, factor for COMMAND_SPEED
+};
 
 struct _conf {
   #define CONF_DEFAULT_MQTT_CLIENT_ID     "mqtt-player"
@@ -43,10 +60,6 @@ struct _conf {
   #define CONF_MAX_LENGTH_MQTT_TOPIC  256
   char mqtt_topic[CONF_MAX_LENGTH_MQTT_TOPIC];
 
-  #define CONF_DEFAULT_LOG_FILE     ""
-  #define CONF_MAX_LENGTH_LOG_FILE  256
-  char log_file[CONF_MAX_LENGTH_LOG_FILE];
-
   #define CONF_DEFAULT_MQTT_PORT  1883
   int mqtt_port;
 
@@ -60,12 +73,12 @@ struct _conf {
   int verbose;
 
   #define CONF_DEFAULT_SEC   0
-  #define CONF_DEFAULT_USEC  0
-  struct timeval start_time;
+  #define CONF_DEFAULT_NSEC  0
+  struct timespec start_time;
 
   #define CONF_DEFAULT_RECORD_SEC   0
-  #define CONF_DEFAULT_RECORD_USEC  0
-  struct timeval record_start_time;
+  #define CONF_DEFAULT_RECORD_NSEC  0
+  struct timespec record_start_time;
 
   #define CONF_DEFAULT_IGNORE_TIMING 0
   int ignore_timing;
@@ -73,24 +86,209 @@ struct _conf {
   #define CONF_DEFAULT_REPEAT 0
   int repeat;
 
-  struct mosquitto *mosq;
-  FILE *fd;
+  #define CONF_DEFAULT_START_OFFSET 0
+  int64_t start_offset;  // in ns relative to the start of the recording
+
+  // topic filters of the messages to play, all if empty
+  char **filters;
+  int num_filters;
+
+  #define CONF_DEFAULT_SHARD   0
+  #define CONF_DEFAULT_SHARDS  1
+  int shard;   // play only the topics of this shard
+  int shards;
+
+  #define CONF_DEFAULT_GROUP           ""
+  #define CONF_MAX_LENGTH_GROUP        64
+  #define CONF_DEFAULT_LEAD_TIME       1000  // ms
+  #define CONF_SYNC_REGISTER_INTERVAL  200   // ms
+  char group[CONF_MAX_LENGTH_GROUP];
+  int lead_time;
+
+  #define CONF_DEFAULT_COPIES       0
+  #define CONF_DEFAULT_PREFIX       "sim/{n}/"
+  #define CONF_MAX_LENGTH_PREFIX    256
+  #define CONF_DEFAULT_COPY_OFFSET  0  // ms
+  #define CONF_DEFAULT_JITTER       0  // ms
+  int copies;           // number of copies of the log to play, 0 to play it as is
+  char prefix[CONF_MAX_LENGTH_PREFIX];
+  int copy_offset;
+  int jitter;
+
+  #define CONF_DEFAULT_FOLLOW         0
+  #define CONF_FOLLOW_POLL_INTERVAL   1000  // ms, in case a change is not notified
+  #define CONF_DEFAULT_LAG            -1    // ms
+  int follow;           // wait for records appended to the log files
+  int lag;              // play the messages this time after they were recorded, -1 to start now
+
+  // messages of all log files in memory, played by every copy
+  struct memory_msg *messages;
+  size_t num_messages;
+  size_t size_messages;
+  uint8_t *payloads;
+  size_t payloads_len;
+  size_t payloads_size;
+  struct topic_table topics;
+  int complete;         // all log files were read completely
+
+  // start barrier of the group, shared with the mosquitto thread
+  pthread_mutex_t sync_lock;
+  pthread_cond_t sync_cond;
+  char sync_topic[CONF_MAX_LENGTH_MQTT_TOPIC + CONF_MAX_LENGTH_GROUP];
+  uint32_t round;
+  char *registered;     // instances registered for the round, only the leader
+  int num_registered;
+  int started;          // the start time of the round is known
+  struct timespec sync_start;
+
+  #define CONF_DEFAULT_CONNECTIONS  1
+  #define CONF_DEFAULT_EVENT_LOOP   0
+  #define CONF_FLUSH_TIMEOUT        5000  // ms to send the last messages
+  int connections;      // the topics are distributed over this number of clients
+  int event_loop;       // drive all clients from one epoll loop instead of one thread each
+  struct mosquitto **clients;
+  struct evloop loop;
+
+  #define CONF_DEFAULT_CONTROL  0
+  #define CONF_MAX_COMMANDS     64
+  #define CONF_MAX_SPEED        1000.0
+  int control;          // accept commands on <topic>/control
+  char control_topic[CONF_MAX_LENGTH_MQTT_TOPIC + 8];
+  // commands received by the mosquitto thread, applied by the main thread
+  pthread_mutex_t control_lock;
+  pthread_cond_t control_cond;  // on the monotonic clock
+  struct command commands[CONF_MAX_COMMANDS];
+  int num_commands;
+  int paused;
+  double speed;
+
+  struct mosquitto *mosq;  // the first client, which also publishes the status
   sigset_t sigset;
-  struct timeval start;
+  struct timespec start;
+  int64_t position;     // time of the recording in ns which is played at config.start
+
+  // rules which shift the timestamps in the payloads, the first matching one applies
+  struct rewrite *rewrites;
+  int num_rewrites;
+  struct topic_table rewritten;  // rule of every topic published so far
+  int64_t play_time;    // wall clock time in ns at which config.position is played
+  uint8_t *rewrite_buf;
+  size_t rewrite_size;
+
+  // the stripe files of a striped log are read ahead by their own threads
+  #define CONF_PREFETCH        (16 * 1024 * 1024)
+  #define CONF_PREFETCH_CHUNK  (1024 * 1024)
+
+  // log files to play, merged into one timeline
+  struct input *inputs;
+  int num_inputs;
+
+  // min heap of the inputs ordered by the time of their next record
+  struct input **heap;
+  int heap_size;
 
 } config;
 
 
+/**
+ * Reads a stripe file ahead of the player on its own file descriptor, so the
+ * stripe files on different disks are read in parallel. The data is not kept,
+ * the reader of the input finds it in the page cache.
+ */
+struct prefetch {
+  int fd;
+  char *buf;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  long wanted;          // offset up to which the reader has read
+  long done;            // offset up to which the file was read ahead
+  long seen;            // last offset passed to prefetch_update(), only used by the main thread
+  int stop;
+};
+
+
+/**
+ * A selected chunk of a partitioned log file.
+ */
+struct chunk {
+  struct mqttlog_chunk range;
+  int partition;        // index of its partition in the parts file
+  long from;            // offset at which it is read, -1 if it is skipped
+};
+
+
+/**
+ * An open chunk of a partitioned log file with its next record.
+ */
+struct cursor {
+  struct mqttlog_reader reader;  // reads the whole chunk at once on the file descriptor of the input
+  struct mqttlog_record rec;
+  int chunk;                     // index in the chunks of the input
+};
+
+
+/**
+ * A log file with one record read ahead. A partitioned log file is one input,
+ * which merges its open chunks. A striped log file has one input per stripe
+ * file.
+ */
+struct input {
+  #define INPUT_OK     0
+  #define INPUT_EOF    1
+  #define INPUT_ERROR  2
+  int state;
+  char *file;
+  struct mqttlog_reader reader;
+  struct mqttlog_record rec;
+  struct mqttlog_index index;  // empty if the log file has no index
+  int partition_levels;        // -1 if the log file is not partitioned
+  struct chunk *chunks;        // selected chunks, ordered by their first record
+  int num_chunks;
+  int num_partitions;          // partitions in the parts file
+  int next_chunk;              // first chunk which is not opened yet
+  struct cursor **cursors;     // open chunks, min heap ordered by the time of their next record
+  int num_cursors;
+  struct cursor *current;      // cursor of rec, moved on by the next read
+  int stripe;                  // number of the stripe file, -1 if the log file is not striped
+  struct prefetch *prefetch;   // NULL if the file is not read ahead
+
+  // a copy of the messages in memory, see --copies
+  int copy;             // number of the copy, -1 for log files
+  int64_t shift;        // time offset of the copy in ns
+  size_t pos;           // next message in config.messages
+  char *prefix;
+  char *topic;          // topic of the current record with prefix
+  size_t topic_size;
+
+  int watch_fd;         // inotify instance watching the log file, see --follow
+};
+
+
+/**
+ * A message of the log files held in memory.
+ */
+struct memory_msg {
+  int64_t abs;          // absolute time in ns
+  int qos;
+  int retain;
+  int len;
+  const char *topic;    // interned in config.topics
+  size_t payload;       // offset in config.payloads
+};
+
+
 /**
  * Initialize the configuration. Have to be called befor using the config variable.
  *
  * @return 0 on success, otherwise something else.
  */
 int config_init() {
+  pthread_condattr_t condattr;
+
   strncpy(config.mqtt_client_id, CONF_DEFAULT_MQTT_CLIENT_ID, CONF_MAX_LENGTH_MQTT_CLIENT_ID);
   strncpy(config.mqtt_broker,    CONF_DEFAULT_MQTT_BROKER,    CONF_MAX_LENGTH_MQTT_BROKER);
   strncpy(config.mqtt_topic,     CONF_DEFAULT_MQTT_TOPIC,     CONF_MAX_LENGTH_MQTT_TOPIC);
-  strncpy(config.log_file,       CONF_DEFAULT_LOG_FILE,       CONF_MAX_LENGTH_LOG_FILE);
 
   config.mqtt_port          = CONF_DEFAULT_MQTT_PORT;
   config.mqtt_clean_session = CONF_DEFAULT_MQTT_CLEAN_SESSION;
@@ -98,15 +296,69 @@ int config_init() {
   config.verbose            = CONF_DEFAULT_VERBOSE;
 
   config.start_time.tv_sec  = CONF_DEFAULT_SEC;
-  config.start_time.tv_usec = CONF_DEFAULT_USEC;
+  config.start_time.tv_nsec = CONF_DEFAULT_NSEC;
   
   config.record_start_time.tv_sec  = CONF_DEFAULT_RECORD_SEC;
-  config.record_start_time.tv_usec = CONF_DEFAULT_RECORD_USEC;
+  config.record_start_time.tv_nsec = CONF_DEFAULT_RECORD_NSEC;
 
   config.ignore_timing      = CONF_DEFAULT_IGNORE_TIMING;
   config.repeat             = CONF_DEFAULT_REPEAT;
+  config.start_offset       = CONF_DEFAULT_START_OFFSET;
+
+  config.mosq       = NULL;
+  config.inputs     = NULL;
+  config.num_inputs = 0;
+  config.heap       = NULL;
+  config.heap_size  = 0;
+  config.filters     = NULL;
+  config.num_filters = 0;
+  config.shard       = CONF_DEFAULT_SHARD;
+  config.shards      = CONF_DEFAULT_SHARDS;
+  config.lead_time   = CONF_DEFAULT_LEAD_TIME;
+  strcpy(config.group, CONF_DEFAULT_GROUP);
+
+  config.copies        = CONF_DEFAULT_COPIES;
+  config.copy_offset   = CONF_DEFAULT_COPY_OFFSET;
+  config.jitter        = CONF_DEFAULT_JITTER;
+  strcpy(config.prefix, CONF_DEFAULT_PREFIX);
+  config.messages      = NULL;
+  config.num_messages  = 0;
+  config.size_messages = 0;
+  config.payloads      = NULL;
+  config.payloads_len  = 0;
+  config.payloads_size = 0;
+  config.complete      = 0;
+  config.follow        = CONF_DEFAULT_FOLLOW;
+  config.connections   = CONF_DEFAULT_CONNECTIONS;
+  config.event_loop    = CONF_DEFAULT_EVENT_LOOP;
+  config.clients       = NULL;
+  config.lag           = CONF_DEFAULT_LAG;
+  config.control       = CONF_DEFAULT_CONTROL;
+  config.num_commands  = 0;
+  config.paused        = 0;
+  config.speed         = 1.0;
+  config.position      = 0;
+  config.rewrites      = NULL;
+  config.num_rewrites  = 0;
+  config.play_time     = 0;
+  config.rewrite_buf   = NULL;
+  config.rewrite_size  = 0;
+
+  config.round          = 0;
+  config.registered     = NULL;
+  config.num_registered = 0;
+  config.started        = 0;
+  if( pthread_mutex_init(&config.sync_lock, NULL) || pthread_cond_init(&config.sync_cond, NULL) ) {
+    CRIT("Could not initialize the start barrier.");
+  }
+
+  // the deadlines of the messages are on the monotonic clock
+  if( pthread_mutex_init(&config.control_lock, NULL) || pthread_condattr_init(&condattr)
+      || pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC) || pthread_cond_init(&config.control_cond, &condattr) ) {
+    CRIT("Could not initialize the control commands.");
+  }
+  pthread_condattr_destroy(&condattr);
 
-  config.mosq = NULL;
   if( 0 > sigemptyset(&config.sigset) ) {
     CRIT("sigemptyset()");
   }
@@ -125,8 +377,9 @@ int config_init() {
  * @param progname Name of the program.
  */
 void print_usage(char *progname) {
-  printf("Usage: %s [options] <logfile>\n\n", progname);
-  printf("Logfile is a file from wich the messages will be loaded.\n\n");
+  printf("Usage: %s [options] <logfile> [<logfile> ...]\n\n", progname);
+  printf("Logfile is a file from wich the messages will be loaded. If several logfiles are\n");
+  printf("given, they are aligned by their recording start time and played as one timeline.\n\n");
   printf("Options: \n");
   printf("-t --topic          MQTT topic where the program post messages about the player status.\n");
   printf("                    Default value: %s\n", CONF_DEFAULT_MQTT_TOPIC);
@@ -143,6 +396,47 @@ void print_usage(char *progname) {
   printf("                    Default value: %d\n", CONF_DEFAULT_MQTT_KEEPALIVE);
   printf("-i --ignore-timing  Ignore the timing in the log file and replays it as fast as possible.\n");
   printf("-r --repeat         Repeat the log endlessly.\n");
+  printf("-s --start          Start playing at the given second of the recording. The last value of\n");
+  printf("                    every topic published before is restored first, using the nearest\n");
+  printf("                    keyframe of the log file.\n");
+  printf("-f --filter         Play only messages matching the topic filter. Can be given several\n");
+  printf("                    times. Of partitioned log files only the matching chunks are read.\n");
+  printf("-S --shard          Play only the topics of shard i of n, given as i/n. The topics are\n");
+  printf("                    assigned to the shards by their hash.\n");
+  printf("                    Default value: %d/%d\n", CONF_DEFAULT_SHARD, CONF_DEFAULT_SHARDS);
+  printf("-g --group          Start playing together with the other instances of this group, one\n");
+  printf("                    per shard. The instances register on <topic>/<group>, instance 0\n");
+  printf("                    announces a common start time when all are registered.\n");
+  printf("-l --lead-time      Time in ms between the registration of the last instance and the\n");
+  printf("                    common start. The wall clocks of the hosts have to be synchronized.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_LEAD_TIME);
+  printf("-n --copies         Play n copies of the log files to generate more load. The messages\n");
+  printf("                    are loaded into memory once and every copy publishes them with its\n");
+  printf("                    own topic prefix.\n");
+  printf("-P --prefix         Topic prefix of the copies. {n} is replaced by the number of the copy.\n");
+  printf("                    Default value: %s\n", CONF_DEFAULT_PREFIX);
+  printf("-o --offset         Time offset in ms between two copies.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_COPY_OFFSET);
+  printf("-j --jitter         Maximal random time offset in ms of every copy, chosen every round.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_JITTER);
+  printf("-F --follow         At the end of a log file, wait for records appended to it, e.g. by a\n");
+  printf("                    running mqttrecorder. A log file '-' is read from stdin.\n");
+  printf("-L --lag            Publish every message the given time in ms after it was recorded,\n");
+  printf("                    according to the wall clock time of the recording. Older messages\n");
+  printf("                    are published immediately.\n");
+  printf("-N --connections    Number of connections to the broker. Every topic is published by one\n");
+  printf("                    of them.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_CONNECTIONS);
+  printf("-E --event-loop     Handle the traffic of all connections in one epoll loop in the main\n");
+  printf("                    thread instead of one thread per connection.\n");
+  printf("-C --control        Accept the commands pause, resume, seek <sec> and speed <factor> on\n");
+  printf("                    <topic>/control while playing. Every command is acknowledged on <topic>.\n");
+  printf("-T --timestamp      Shift the timestamps in the payloads of the topics matching a filter\n");
+  printf("                    by the time between recording and playback, given as\n");
+  printf("                    <filter>:json=<key>[,<unit>]           number at the JSON key,\n");
+  printf("                    <filter>:bin=<offset>,<type>[,<unit>]  integer at a byte offset,\n");
+  printf("                    type u32le, u32be, u64le or u64be. The unit is s, ms, us or ns,\n");
+  printf("                    default ms. Can be given several times, the first matching rule applies.\n");
   printf("-v --verbose        Print alot informations messages.\n");
   printf("-h --help           Print this help message.\n");
 }
@@ -168,7 +462,7 @@ void parse_args(int argc, char **argv) {
 	print_usage(*argv);
 	exit(1);
       } else {
-        strncpy(config.mqtt_client_id, argv[i], CONF_MAX_LENGTH_MQTT_CLIENT_ID);
+        snprintf(config.mqtt_client_id, sizeof(config.mqtt_client_id), "%s", argv[i]);
       }
 
     // BROKER
@@ -179,7 +473,7 @@ void parse_args(int argc, char **argv) {
 	print_usage(*argv);
 	exit(1);
       } else {
-        strncpy(config.mqtt_broker, argv[i], CONF_MAX_LENGTH_MQTT_BROKER);
+        snprintf(config.mqtt_broker, sizeof(config.mqtt_broker), "%s", argv[i]);
       }
 
     // TOPIC
@@ -189,7 +483,7 @@ void parse_args(int argc, char **argv) {
 	print_usage(*argv);
 	exit(1);
       } else {
-        strncpy(config.mqtt_topic, argv[i], CONF_MAX_LENGTH_MQTT_TOPIC);
+        snprintf(config.mqtt_topic, sizeof(config.mqtt_topic), "%s", argv[i]);
       }
 
     // PORT
@@ -246,6 +540,200 @@ void parse_args(int argc, char **argv) {
     } else if( !strcmp(argv[i], "-r") || !strcmp(argv[i], "--repeat") ) {
       config.repeat = 1;
 
+    // START
+    } else if( !strcmp(argv[i], "-s") || !strcmp(argv[i], "--start") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no start time specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.start_offset = (int64_t)(atof(argv[i]) * NSEC_PER_SEC);
+	if( 0 > config.start_offset ) {
+	  fprintf(stderr, "ERROR: Invalid start time given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // FILTER
+    } else if( !strcmp(argv[i], "-f") || !strcmp(argv[i], "--filter") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no topic filter specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.filters = realloc(config.filters, (config.num_filters + 1) * sizeof(char *));
+        if( NULL == config.filters ) {
+          CRIT("realloc()");
+        }
+        config.filters[config.num_filters++] = argv[i];
+      }
+
+    // SHARD
+    } else if( !strcmp(argv[i], "-S") || !strcmp(argv[i], "--shard") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no shard specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        if( 2 != sscanf(argv[i], "%d/%d", &config.shard, &config.shards) || 0 > config.shard || config.shard >= config.shards ) {
+	  fprintf(stderr, "ERROR: Invalid shard given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // GROUP
+    } else if( !strcmp(argv[i], "-g") || !strcmp(argv[i], "--group") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no group specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        if( CONF_MAX_LENGTH_GROUP <= strlen(argv[i]) ) {
+	  fprintf(stderr, "ERROR: Group longer than %d characters given: %s\n", CONF_MAX_LENGTH_GROUP - 1, argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+        strcpy(config.group, argv[i]);
+      }
+
+    // LEAD TIME
+    } else if( !strcmp(argv[i], "-l") || !strcmp(argv[i], "--lead-time") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no lead time specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.lead_time = atoi(argv[i]);
+	if( 0 > config.lead_time ) {
+	  fprintf(stderr, "ERROR: Invalid lead time given: %d\n", config.lead_time);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // COPIES
+    } else if( !strcmp(argv[i], "-n") || !strcmp(argv[i], "--copies") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no number of copies specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.copies = atoi(argv[i]);
+	if( 0 > config.copies ) {
+	  fprintf(stderr, "ERROR: Invalid number of copies given: %d\n", config.copies);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // PREFIX
+    } else if( !strcmp(argv[i], "-P") || !strcmp(argv[i], "--prefix") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no prefix specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        if( CONF_MAX_LENGTH_PREFIX <= strlen(argv[i]) ) {
+	  fprintf(stderr, "ERROR: Prefix longer than %d characters given: %s\n", CONF_MAX_LENGTH_PREFIX - 1, argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+        strcpy(config.prefix, argv[i]);
+      }
+
+    // OFFSET
+    } else if( !strcmp(argv[i], "-o") || !strcmp(argv[i], "--offset") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no offset specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.copy_offset = atoi(argv[i]);
+	if( 0 > config.copy_offset ) {
+	  fprintf(stderr, "ERROR: Invalid offset given: %d\n", config.copy_offset);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // JITTER
+    } else if( !strcmp(argv[i], "-j") || !strcmp(argv[i], "--jitter") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no jitter specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.jitter = atoi(argv[i]);
+	if( 0 > config.jitter ) {
+	  fprintf(stderr, "ERROR: Invalid jitter given: %d\n", config.jitter);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // FOLLOW
+    } else if( !strcmp(argv[i], "-F") || !strcmp(argv[i], "--follow") ) {
+      config.follow = 1;
+
+    // LAG
+    } else if( !strcmp(argv[i], "-L") || !strcmp(argv[i], "--lag") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no lag specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.lag = atoi(argv[i]);
+	if( 0 > config.lag ) {
+	  fprintf(stderr, "ERROR: Invalid lag given: %d\n", config.lag);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // CONNECTIONS
+    } else if( !strcmp(argv[i], "-N") || !strcmp(argv[i], "--connections") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no number of connections specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.connections = atoi(argv[i]);
+	if( 1 > config.connections ) {
+	  fprintf(stderr, "ERROR: Invalid number of connections given: %d\n", config.connections);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // EVENT LOOP
+    } else if( !strcmp(argv[i], "-E") || !strcmp(argv[i], "--event-loop") ) {
+      config.event_loop = 1;
+
+    // CONTROL
+    } else if( !strcmp(argv[i], "-C") || !strcmp(argv[i], "--control") ) {
+      config.control = 1;
+
+    // TIMESTAMP
+    } else if( !strcmp(argv[i], "-T") || !strcmp(argv[i], "--timestamp") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no timestamp rule specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.rewrites = realloc(config.rewrites, (config.num_rewrites + 1) * sizeof(struct rewrite));
+        if( NULL == config.rewrites ) {
+          CRIT("realloc()");
+        }
+        if( rewrite_parse(&config.rewrites[config.num_rewrites], argv[i]) ) {
+	  fprintf(stderr, "ERROR: Invalid timestamp rule given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+        config.num_rewrites++;
+      }
+
     // VERBOSE
     } else if( !strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose") ) {
       config.verbose = 1;
@@ -255,7 +743,7 @@ void parse_args(int argc, char **argv) {
       print_usage(*argv);
       exit(0);
     
-    }else if( '-' == *argv[i] ) {
+    }else if( '-' == *argv[i] && argv[i][1] ) {
         fprintf(stderr, "ERROR: Unknown parameter '%s'.\n", argv[i]);
 	print_usage(*argv);
 	exit(1);
@@ -263,184 +751,2122 @@ void parse_args(int argc, char **argv) {
 
     // FILE
     } else {
-      strncpy(config.log_file, argv[i], CONF_MAX_LENGTH_LOG_FILE);
+      config.inputs = realloc(config.inputs, (config.num_inputs + 1) * sizeof(struct input));
+      if( NULL == config.inputs ) {
+        CRIT("realloc()");
+      }
+      memset(&config.inputs[config.num_inputs], 0, sizeof(struct input));
+      config.inputs[config.num_inputs].file = argv[i];
+      config.num_inputs++;
     }
   }
 }
 
 /**
- * Handles the signal from ctrl+C. Simple close the connection and close the file.
+ * @return 1 if the topic belongs to the shard of this instance and matches one
+ *         of the filters or no filter is given.
  */
-void sig_handler(int sig) {
-  if( SIGINT != sig ) {
-    CRIT("Got unexpected signal.");
-  }
-
-  mosquitto_disconnect(config.mosq);
+int topic_selected(const char *topic) {
+  bool result;
+  int i;
 
-  mosquitto_destroy(config.mosq);
+  if( 1 < config.shards && config.shard != fnv1a(topic, strlen(topic)) % config.shards ) {
+    return 0;
+  }
 
-  mosquitto_lib_cleanup();
+  if( !config.num_filters ) {
+    return 1;
+  }
 
-  fclose(config.fd);
+  for( i = 0; i < config.num_filters; i++ ) {
+    if( !mosquitto_topic_matches_sub(config.filters[i], topic, &result) && result ) {
+      return 1;
+    }
+  }
 
-  exit(0);
+  return 0;
 }
 
+
 /**
- * Main!
+ * Checks whether a topic filter can match topics of a partition. The key of
+ * a partition is made of the first levels of the topics in it. If the key has
+ * less levels, it is the whole topic.
  */
-int main(int argc, char **argv) {
-  struct sigaction sigact;
-  char buf[BUF_SIZE];
-  int qos, retain, len;
-  struct timeval recv_time, now;
-  char topic[CONF_MAX_LENGTH_MQTT_TOPIC];
-  int i, ret;
-  struct mqtt_player_status_msg status;
+int partition_matches(const char *filter, const char *key, int levels) {
+  const char *f = filter, *k = key;
+  const char *fe, *ke;
+  bool result;
+  int n = 1;
+
+  for( ke = key; *ke; ke++ ) {
+    n += ('/' == *ke);
+  }
 
-  if( config_init() ) {
-    CRIT("Faild to initialize config.");
+  if( !levels || n < levels ) {
+    return !mosquitto_topic_matches_sub(filter, key, &result) && result;
   }
-  
-  parse_args(argc, argv);
 
-  if( !strlen(config.log_file) ) {
-    fprintf(stderr, "ERROR: You have to provide a logfile.\n");
-    print_usage(*argv);
-    exit(1);
+  while(1) {
+    fe = strchr(f, '/');
+    ke = strchr(k, '/');
+    if( NULL == fe ) {
+      fe = f + strlen(f);
+    }
+    if( NULL == ke ) {
+      ke = k + strlen(k);
+    }
+
+    if( 1 == fe - f && '#' == *f ) {
+      return 1;
+    }
+    if( !(1 == fe - f && '+' == *f) && (fe - f != ke - k || strncmp(f, k, fe - f)) ) {
+      return 0;
+    }
+
+    if( !*ke ) {
+      // all levels of the key match, longer topics can match the rest
+      return 1;
+    }
+    if( !*fe ) {
+      // the topics of the partition are longer than the filter
+      return 0;
+    }
+    f = fe + 1;
+    k = ke + 1;
   }
+}
+
+
+/**
+ * @return 1 if one of the filters can match topics of the partition.
+ */
+int partition_selected(const char *key, int levels) {
+  int i;
 
-  config.fd = fopen(config.log_file, "r");
-  if( NULL == config.fd ) {
-    CRIT("Could not open log file.");
+  if( !config.num_filters ) {
+    return 1;
   }
 
-  memset(&sigact, 0, sizeof(struct sigaction));
-  sigact.sa_handler = sig_handler;
-  if( sigaction(SIGINT, &sigact, NULL) ) {
-    CRIT("Could not initialize signal handler.");
+  for( i = 0; i < config.num_filters; i++ ) {
+    if( partition_matches(config.filters[i], key, levels) ) {
+      return 1;
+    }
   }
-  
-  mosquitto_lib_init();
 
-  config.mosq = mosquitto_new(config.mqtt_client_id, config.mqtt_clean_session, NULL);
-  if( NULL == config.mosq ) {
-    CRIT("Could not create a mosquitto object.");
+  return 0;
+}
+
+
+/**
+ * Adds an input to a list of inputs.
+ *
+ * @return The new input.
+ */
+struct input *inputs_add(struct input **inputs, int *num, char *file) {
+  struct input *in;
+
+  *inputs = realloc(*inputs, (*num + 1) * sizeof(struct input));
+  if( NULL == *inputs ) {
+    CRIT("realloc()");
   }
+  in = &(*inputs)[(*num)++];
+  memset(in, 0, sizeof(struct input));
+  in->file = file;
+  in->partition_levels = -1;
+  in->stripe = -1;
+  in->copy = -1;
+  in->watch_fd = -1;
+
+  return in;
+}
 
-  if( mosquitto_connect(config.mosq, config.mqtt_broker, config.mqtt_port, config.mqtt_keepalive) ) {
-    CRIT("Could not connect MQTT broker.");
+
+/**
+ * Orders chunks by the time of their first record. The chunks of one
+ * partition keep their order in the log file.
+ */
+int chunk_cmp(const void *a, const void *b) {
+  const struct chunk *x = (const struct chunk *)a;
+  const struct chunk *y = (const struct chunk *)b;
+
+  if( x->range.first != y->range.first ) {
+    return (x->range.first < y->range.first)?(-1):(1);
   }
+  return (x->range.offset < y->range.offset)?(-1):(x->range.offset > y->range.offset);
+}
 
-  mosquitto_loop_start(config.mosq);
 
-  do {
+/**
+ * Adds a partitioned log file as one input, which reads the chunks of the
+ * selected partitions. The partitions and their chunks are listed in
+ * <logfile>.parts.
+ */
+void inputs_add_partitions(struct input **inputs, int *num, char *file, int levels) {
+  struct mqttlog_partition *parts;
+  struct input *in;
+  int num_parts, num_selected = 0;
+  int i, j;
+
+  if( mqttlog_parts_load(file, &parts, &num_parts) ) {
+    CRIT("Could not read parts file of '%s'.", file);
+  }
 
-    if( gettimeofday(&config.start, NULL) ) {
-      CRIT("Could not get time().");
+  in = inputs_add(inputs, num, file);
+  in->partition_levels = levels;
+  in->num_partitions = num_parts;
+
+  for( i = 0; i < num_parts; i++ ) {
+    // the partition of the drop records holds no messages
+    if( !strcmp(parts[i].key, MQTTLOG_DROP_PARTITION) || !partition_selected(parts[i].key, levels) ) {
+      continue;
     }
 
-    if( 0 != fseek(config.fd, SEEK_SET, 0) ) {
-      CRIT("lseek faild.");
+    in->chunks = realloc(in->chunks, (in->num_chunks + parts[i].num_chunks) * sizeof(struct chunk));
+    if( NULL == in->chunks ) {
+      CRIT("realloc()");
+    }
+    for( j = 0; j < parts[i].num_chunks; j++ ) {
+      in->chunks[in->num_chunks].range = parts[i].chunks[j];
+      in->chunks[in->num_chunks].partition = i;
+      in->chunks[in->num_chunks].from = parts[i].chunks[j].offset;
+      in->num_chunks++;
     }
+    num_selected++;
+  }
 
-    // read file config
-    while(1) {
-      if( fscanf(config.fd, "cnf time: %ld.%ld\n", &config.record_start_time.tv_sec, &config.record_start_time.tv_usec) ) {
-        if( config.verbose ) {
-          printf("record time: %3ld", config.record_start_time.tv_sec);
-          printf(".%06ld\n", config.record_start_time.tv_usec);
-	}
-      } else {
-        break;
-      }
+  mqttlog_parts_free(parts, num_parts);
+
+  qsort(in->chunks, in->num_chunks, sizeof(struct chunk), chunk_cmp);
+
+  // at most every chunk is open
+  in->cursors = malloc((in->num_chunks + 1) * sizeof(struct cursor *));
+  if( NULL == in->cursors ) {
+    CRIT("malloc()");
+  }
+
+  if( config.verbose ) {
+    log_printf(stdout, "%s: %d of %d partitions selected, %d chunks\n", file, num_selected, num_parts, in->num_chunks);
+  }
+}
+
+
+/**
+ * Adds one input per stripe file of a striped log file. The stripe files are
+ * listed in <logfile>.stripes.
+ */
+void inputs_add_stripes(struct input **inputs, int *num, char *file) {
+  struct input *in;
+  char **files;
+  int num_files;
+  int i;
+
+  if( mqttlog_stripes_load(file, &files, &num_files) ) {
+    CRIT("Could not read stripes file of '%s'.", file);
+  }
+
+  // the inputs own the paths
+  for( i = 0; i < num_files; i++ ) {
+    in = inputs_add(inputs, num, files[i]);
+    in->stripe = i;
+    mqttlog_index_load(&in->index, in->file);
+  }
+  free(files);
+
+  if( config.verbose ) {
+    log_printf(stdout, "%s: %d stripes\n", file, num_files);
+  }
+}
+
+
+/**
+ * Reads the file of an input ahead until CONF_PREFETCH bytes after the
+ * position of its reader.
+ */
+void *prefetch_thread(void *arg) {
+  struct prefetch *p = (struct prefetch *)arg;
+  long from;
+  ssize_t n;
+
+  pthread_mutex_lock(&p->lock);
+  while( !p->stop ) {
+    if( p->done < p->wanted ) {
+      p->done = p->wanted;
+    }
+    if( p->done >= p->wanted + CONF_PREFETCH ) {
+      pthread_cond_wait(&p->cond, &p->lock);
+      continue;
     }
+    from = p->done;
+    pthread_mutex_unlock(&p->lock);
 
-    if( config.verbose ) {
-      printf("-- start playing --\n");
+    n = pread(p->fd, p->buf, CONF_PREFETCH_CHUNK, from);
+
+    pthread_mutex_lock(&p->lock);
+    // unless the reader moved meanwhile, the end is only read again after a seek
+    if( p->done == from ) {
+      p->done = (0 < n)?(from + n):(LONG_MAX);
     }
+  }
+  pthread_mutex_unlock(&p->lock);
 
-    status.status = MQTT_PLAYER_BEGIN_PLAY;
-    status.sec = hton64(config.record_start_time.tv_sec);
-    status.usec = hton64(config.record_start_time.tv_usec);
-    // post status
-    mosquitto_publish(config.mosq, NULL, config.mqtt_topic, sizeof(struct mqtt_player_status_msg), &status, 2, 0);
+  return NULL;
+}
 
-    // read data
-    while(1) {
-      if( feof(config.fd) ) {
-        break;
-      }
-  
-      ret = fscanf(config.fd, "msg %ld.%ld %d %d %d %s\n", &recv_time.tv_sec, &recv_time.tv_usec, &qos, &retain, &len, topic);
-      if( 0 == ret ) {
-        break;
-      }
-  
-      if( config.verbose ) {
-        printf("time: %3ld", recv_time.tv_sec);
-        printf(".%06ld ", recv_time.tv_usec);
-        printf("qos: %d ", qos);
-        printf("retain: %d ", retain);
-        printf("len: %d ", len);
-        printf("topic: %s\n", topic);
+
+/**
+ * Starts reading the file of an input ahead.
+ */
+void prefetch_start(struct input *in) {
+  struct prefetch *p;
+  sigset_t oldset;
+
+  p = calloc(1, sizeof(struct prefetch));
+  if( NULL == p ) {
+    CRIT("calloc()");
+  }
+  p->fd = open(in->file, O_RDONLY);
+  if( 0 > p->fd ) {
+    CRIT("Could not open log file '%s'.", in->file);
+  }
+  p->buf = malloc(CONF_PREFETCH_CHUNK);
+  if( NULL == p->buf ) {
+    CRIT("malloc()");
+  }
+
+  // SIGINT has to be handled by the main thread, which joins the threads
+  if( pthread_sigmask(SIG_BLOCK, &config.sigset, &oldset) ) {
+    CRIT("pthread_sigmask()");
+  }
+  if( pthread_mutex_init(&p->lock, NULL) || pthread_cond_init(&p->cond, NULL) || pthread_create(&p->thread, NULL, prefetch_thread, p) ) {
+    CRIT("Could not start the prefetch thread of '%s'.", in->file);
+  }
+  if( pthread_sigmask(SIG_SETMASK, &oldset, NULL) ) {
+    CRIT("pthread_sigmask()");
+  }
+
+  in->prefetch = p;
+}
+
+
+/**
+ * Tells the prefetch thread of an input how far its reader has read.
+ */
+void prefetch_update(struct input *in) {
+  struct prefetch *p = in->prefetch;
+  long pos = in->reader.base + (long)in->reader.end;
+
+  // the position only changes when the reader refills its buffer
+  if( NULL == p || pos == p->seen ) {
+    return;
+  }
+  p->seen = pos;
+
+  pthread_mutex_lock(&p->lock);
+  if( pos > p->wanted ) {
+    p->wanted = pos;
+    pthread_cond_signal(&p->cond);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+
+/**
+ * Continues reading ahead at an offset after the reader of an input moved.
+ */
+void prefetch_seek(struct input *in, long offset) {
+  struct prefetch *p = in->prefetch;
+
+  if( NULL == p ) {
+    return;
+  }
+  p->seen = -1;
+
+  pthread_mutex_lock(&p->lock);
+  p->wanted = offset;
+  p->done = offset;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+}
+
+
+/**
+ * Stops reading ahead and frees the prefetch state of an input.
+ */
+void prefetch_stop(struct input *in) {
+  struct prefetch *p = in->prefetch;
+
+  if( NULL == p ) {
+    return;
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->thread, NULL);
+
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  close(p->fd);
+  free(p->buf);
+  free(p);
+  in->prefetch = NULL;
+}
+
+
+/**
+ * @return 1 if the next record of chunk a has to be read before the one of b.
+ */
+int cursor_before(struct cursor *a, struct cursor *b) {
+  if( a->rec.abs != b->rec.abs ) {
+    return a->rec.abs < b->rec.abs;
+  }
+  // the chunks of a partition are in the order of the log file
+  return a->chunk < b->chunk;
+}
+
+
+/**
+ * Restores the heap property of the open chunks downwards from position i.
+ */
+void cursor_sift_down(struct input *in, int i) {
+  struct cursor *tmp;
+  int child;
+
+  while( (child = 2 * i + 1) < in->num_cursors ) {
+    if( child + 1 < in->num_cursors && cursor_before(in->cursors[child + 1], in->cursors[child]) ) {
+      child++;
+    }
+    if( !cursor_before(in->cursors[child], in->cursors[i]) ) {
+      break;
+    }
+    tmp = in->cursors[i];
+    in->cursors[i] = in->cursors[child];
+    in->cursors[child] = tmp;
+    i = child;
+  }
+}
+
+
+/**
+ * Adds an open chunk with a read ahead record to the heap of the input.
+ */
+void cursor_push(struct input *in, struct cursor *cur) {
+  struct cursor *tmp;
+  int i, parent;
+
+  i = in->num_cursors++;
+  in->cursors[i] = cur;
+
+  while( i ) {
+    parent = (i - 1) / 2;
+    if( !cursor_before(in->cursors[i], in->cursors[parent]) ) {
+      break;
+    }
+    tmp = in->cursors[i];
+    in->cursors[i] = in->cursors[parent];
+    in->cursors[parent] = tmp;
+    i = parent;
+  }
+}
+
+
+/**
+ * Removes the top of the heap of the open chunks and closes it.
+ */
+void cursor_pop(struct input *in) {
+  struct cursor *cur = in->cursors[0];
+
+  in->cursors[0] = in->cursors[--in->num_cursors];
+  cursor_sift_down(in, 0);
+
+  mqttlog_reader_close(&cur->reader);
+  free(cur);
+}
+
+
+/**
+ * Reads the next record of an open chunk.
+ *
+ * @return 1 if a record was read, 0 at the end of the chunk, -1 on a format
+ *         error.
+ */
+int cursor_read(struct input *in, struct cursor *cur, int decode) {
+  int ret;
+
+  ret = mqttlog_reader_next(&cur->reader, &cur->rec, decode);
+  if( MQTTLOG_RECORD == ret ) {
+    return 1;
+  }
+
+  if( MQTTLOG_END != ret && MQTTLOG_PARTIAL != ret ) {
+    fprintf(stderr, "ERROR: Format error in '%s' at offset %ld, see mqttlog-check.\n", in->file, mqttlog_reader_tell(&cur->reader));
+    in->state = INPUT_ERROR;
+    return -1;
+  }
+
+  if( MQTTLOG_PARTIAL == ret && config.verbose ) {
+    log_printf(stdout, "%s: incomplete record at offset %ld\n", in->file, mqttlog_reader_tell(&cur->reader));
+  }
+  return 0;
+}
+
+
+/**
+ * Opens the next chunk of a partitioned log file at the offset it is read
+ * from and adds it to the open chunks if it has a record.
+ *
+ * @return 0 on success, -1 on a format error.
+ */
+int chunk_open(struct input *in, int decode) {
+  struct chunk *c = &in->chunks[in->next_chunk];
+  struct cursor *cur;
+  int ret;
+
+  if( 0 > c->from ) {
+    in->next_chunk++;
+    return 0;
+  }
+
+  cur = malloc(sizeof(struct cursor));
+  if( NULL == cur ) {
+    CRIT("malloc()");
+  }
+  if( mqttlog_reader_open_chunk(&cur->reader, &in->reader, &c->range) || mqttlog_reader_seek(&cur->reader, c->from) ) {
+    CRIT("Could not read the chunk at offset %ld of '%s'.", c->range.offset, in->file);
+  }
+  cur->chunk = in->next_chunk++;
+
+  ret = cursor_read(in, cur, decode);
+  if( 0 < ret ) {
+    cursor_push(in, cur);
+    return 0;
+  }
+
+  mqttlog_reader_close(&cur->reader);
+  free(cur);
+  return ret;
+}
+
+
+/**
+ * Closes the open chunks of a partitioned log file. The next read starts
+ * again with the first chunk.
+ */
+void chunks_restart(struct input *in) {
+  while( in->num_cursors ) {
+    cursor_pop(in);
+  }
+  in->next_chunk = 0;
+  in->current = NULL;
+}
+
+
+/**
+ * Closes the open chunks and frees the chunks of an input.
+ */
+void chunks_close(struct input *in) {
+  chunks_restart(in);
+  free(in->chunks);
+  free(in->cursors);
+  in->chunks = NULL;
+  in->cursors = NULL;
+  in->num_chunks = 0;
+}
+
+
+/**
+ * Opens all log files. A partitioned log file is one input, which merges the
+ * chunks of its selected partitions. A striped log file is replaced by one
+ * input per stripe file.
+ */
+void inputs_open() {
+  struct input *inputs = NULL, *in;
+  struct mqttlog_reader probe;
+  int num = 0;
+  int i, levels, stripes;
+
+  for( i = 0; i < config.num_inputs; i++ ) {
+    // stdin can be read only once
+    if( !strcmp(config.inputs[i].file, "-") ) {
+      inputs_add(&inputs, &num, config.inputs[i].file);
+      continue;
+    }
+
+    if( mqttlog_reader_open(&probe, config.inputs[i].file) ) {
+      CRIT("Could not open log file '%s'.", config.inputs[i].file);
+    }
+    levels = probe.header.partition_levels;
+    stripes = probe.header.stripes;
+    mqttlog_reader_close(&probe);
+
+    if( 0 <= levels && config.follow ) {
+      CRIT("Partitioned log file '%s' can not be followed.", config.inputs[i].file);
+    }
+    if( stripes && config.follow ) {
+      CRIT("Striped log file '%s' can not be followed.", config.inputs[i].file);
+    }
+
+    if( stripes ) {
+      inputs_add_stripes(&inputs, &num, config.inputs[i].file);
+    } else if( 0 > levels ) {
+      in = inputs_add(&inputs, &num, config.inputs[i].file);
+      // the index is optional, without it the log file is scanned
+      mqttlog_index_load(&in->index, in->file);
+    } else {
+      inputs_add_partitions(&inputs, &num, config.inputs[i].file, levels);
+    }
+  }
+
+  free(config.inputs);
+  config.inputs = inputs;
+  config.num_inputs = num;
+
+  // the inputs do not move anymore
+  for( i = 0; i < config.num_inputs; i++ ) {
+    if( 0 <= config.inputs[i].stripe ) {
+      prefetch_start(&config.inputs[i]);
+    }
+  }
+
+  config.heap = malloc(config.num_inputs * sizeof(struct input *));
+  if( NULL == config.heap ) {
+    CRIT("malloc()");
+  }
+}
+
+
+/**
+ * Closes all log files.
+ */
+void inputs_close() {
+  int i;
+
+  for( i = 0; i < config.num_inputs; i++ ) {
+    prefetch_stop(&config.inputs[i]);
+    if( NULL != config.inputs[i].reader.buf ) {
+      mqttlog_reader_close(&config.inputs[i].reader);
+    }
+    mqttlog_index_free(&config.inputs[i].index);
+    chunks_close(&config.inputs[i]);
+    if( 0 <= config.inputs[i].stripe ) {
+      free(config.inputs[i].file);
+    }
+    free(config.inputs[i].prefix);
+    free(config.inputs[i].topic);
+    if( 0 <= config.inputs[i].watch_fd ) {
+      close(config.inputs[i].watch_fd);
+    }
+  }
+
+  free(config.heap);
+  free(config.inputs);
+  config.heap = NULL;
+  config.inputs = NULL;
+  config.num_inputs = 0;
+
+  free(config.messages);
+  free(config.payloads);
+  config.messages = NULL;
+  config.payloads = NULL;
+  config.num_messages = 0;
+  if( NULL != config.topics.buckets ) {
+    topic_table_free(&config.topics);
+  }
+}
+
+
+/**
+ * Builds the topic of a copy from its prefix and the topic of the message.
+ *
+ * @return The topic, valid until the next call for the same copy.
+ */
+const char *copy_topic(struct input *in, const char *topic) {
+  size_t prefix_len = strlen(in->prefix);
+  size_t len = strlen(topic);
+
+  if( prefix_len + len + 1 > in->topic_size ) {
+    in->topic_size = prefix_len + len + 1;
+    in->topic = realloc(in->topic, in->topic_size);
+    if( NULL == in->topic ) {
+      CRIT("realloc()");
+    }
+  }
+  memcpy(in->topic, in->prefix, prefix_len);
+  memcpy(in->topic + prefix_len, topic, len + 1);
+
+  return in->topic;
+}
+
+
+/**
+ * Reads the next message of a copy into in->rec.
+ *
+ * @return 1 if a message was read, 0 after the last message.
+ */
+int copy_next(struct input *in) {
+  struct memory_msg *msg;
+
+  if( INPUT_OK != in->state || in->pos >= config.num_messages ) {
+    in->state = INPUT_EOF;
+    return 0;
+  }
+  msg = &config.messages[in->pos++];
+
+  in->rec.type    = MQTTLOG_MSG;
+  in->rec.abs     = msg->abs + in->shift;
+  in->rec.qos     = msg->qos;
+  in->rec.retain  = msg->retain;
+  in->rec.len     = msg->len;
+  in->rec.payload = config.payloads + msg->payload;
+  in->rec.topic   = copy_topic(in, msg->topic);
+
+  return 1;
+}
+
+
+/**
+ * Starts a copy from its first message. The random part of its time offset
+ * is chosen again.
+ *
+ * @return 1 if there is a message, otherwise 0.
+ */
+int copy_rewind(struct input *in) {
+  in->pos = 0;
+  in->state = INPUT_OK;
+  in->shift = (int64_t)in->copy * config.copy_offset * 1000000L;
+  if( config.jitter ) {
+    // microsecond resolution
+    in->shift += (int64_t)(random() % ((long)config.jitter * 1000 + 1)) * 1000;
+  }
+
+  return copy_next(in);
+}
+
+
+/**
+ * @return 1 if a command of the control topic is waiting to be applied.
+ */
+int control_pending() {
+  int pending;
+
+  pthread_mutex_lock(&config.control_lock);
+  pending = (0 < config.num_commands);
+  pthread_mutex_unlock(&config.control_lock);
+
+  return pending;
+}
+
+
+/**
+ * Sleeps until an absolute deadline on the monotonic clock. With the event
+ * loop, the traffic of the clients is handled meanwhile. With --control, a
+ * command ends the sleep early.
+ *
+ * @param deadline The deadline or NULL to wait for a command.
+ * @return 1 if a command is waiting to be applied, otherwise 0.
+ */
+int wait_until(const struct timespec *deadline) {
+  int ret;
+
+  if( config.event_loop ) {
+    if( evloop_wait(&config.loop, deadline) ) {
+      CRIT("Event loop failed.");
+    }
+    return config.control && control_pending();
+  }
+
+  if( config.control ) {
+    pthread_mutex_lock(&config.control_lock);
+    while( !config.num_commands ) {
+      if( NULL == deadline ) {
+        pthread_cond_wait(&config.control_cond, &config.control_lock);
+      } else if( 0 > deadline->tv_sec || ETIMEDOUT == pthread_cond_timedwait(&config.control_cond, &config.control_lock, deadline) ) {
+        break;
+      }
+    }
+    ret = (0 < config.num_commands);
+    pthread_mutex_unlock(&config.control_lock);
+    return ret;
+  }
+
+  // with --lag, messages recorded long ago may be due before the boot
+  while( 0 <= deadline->tv_sec && (ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL)) ) {
+    if( EINTR != ret ) {
+      errno = ret;
+      CRIT("clock_nanosleep()");
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * Waits until the log file of an input is modified or at most
+ * CONF_FOLLOW_POLL_INTERVAL. The first call only starts watching the file,
+ * so data appended before is not missed.
+ */
+void input_wait(struct input *in) {
+  char events[4096];
+  struct pollfd pfd;
+  struct timespec now;
+
+  if( 0 > in->watch_fd ) {
+    in->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if( 0 > in->watch_fd || 0 > inotify_add_watch(in->watch_fd, in->file, IN_MODIFY) ) {
+      CRIT("Could not watch log file '%s'.", in->file);
+    }
+    return;
+  }
+
+  pfd.fd = in->watch_fd;
+  pfd.events = POLLIN;
+  if( 0 > poll(&pfd, 1, CONF_FOLLOW_POLL_INTERVAL) && EINTR != errno ) {
+    CRIT("poll()");
+  }
+
+  // only the wakeup matters
+  while( 0 < read(in->watch_fd, events, sizeof(events)) );
+
+  // keep the connections alive while the log file does not grow
+  if( config.event_loop ) {
+    memset(&now, 0, sizeof(struct timespec));
+    wait_until(&now);
+  }
+}
+
+
+/**
+ * Reads the next record of a partitioned log file into in->rec. The open
+ * chunks are merged by the time of their next record. A chunk is only opened
+ * when its first record is due, so the chunks open at once are those whose
+ * time ranges overlap, every one in a buffer of its size.
+ *
+ * @return 1 if a record was read, 0 at the end of the chunks or on a format
+ *         error. in->state tells which one.
+ */
+int input_read_chunks(struct input *in, int decode) {
+  struct cursor *cur = in->current;
+  int64_t anchor = timespec_to_ns(&in->reader.anchor);
+  int ret;
+
+  // in->rec of the previous call points into the buffer of the top chunk
+  if( NULL != cur ) {
+    in->current = NULL;
+    ret = cursor_read(in, cur, decode);
+    if( 0 > ret ) {
+      return 0;
+    }
+    if( ret ) {
+      cursor_sift_down(in, 0);
+    } else {
+      cursor_pop(in);
+    }
+  }
+
+  while( in->next_chunk < in->num_chunks && (!in->num_cursors || anchor + in->chunks[in->next_chunk].range.first <= in->cursors[0]->rec.abs) ) {
+    if( chunk_open(in, decode) ) {
+      return 0;
+    }
+  }
+
+  if( !in->num_cursors ) {
+    in->state = INPUT_EOF;
+    return 0;
+  }
+
+  in->current = in->cursors[0];
+  in->rec = in->current->rec;
+  return 1;
+}
+
+
+/**
+ * Reads the next record of a log file into in->rec.
+ *
+ * @param decode Record types (MQTTLOG_*) for which the payload is decoded.
+ * @return 1 if a record was read, 0 at the end of the file or on a format
+ *         error. in->state tells which one.
+ */
+int input_read(struct input *in, int decode) {
+  int ret;
+
+  if( INPUT_OK != in->state ) {
+    return 0;
+  }
+
+  if( 0 <= in->partition_levels ) {
+    return input_read_chunks(in, decode);
+  }
+
+  ret = mqttlog_reader_next(&in->reader, &in->rec, decode);
+  prefetch_update(in);
+
+  // A record cut off at the end may still be written. The reader keeps it
+  // and parses it again with the appended data. A pipe ends when it is closed.
+  while( config.follow && in->reader.seekable && (MQTTLOG_END == ret || MQTTLOG_PARTIAL == ret) ) {
+    input_wait(in);
+    ret = mqttlog_reader_next(&in->reader, &in->rec, decode);
+  }
+
+  if( MQTTLOG_RECORD == ret ) {
+    return 1;
+  }
+
+  if( MQTTLOG_ERROR == ret ) {
+    fprintf(stderr, "ERROR: Format error in '%s' at offset %ld, see mqttlog-check.\n", in->file, mqttlog_reader_tell(&in->reader));
+    in->state = INPUT_ERROR;
+    return 0;
+  }
+
+  // a record cut off at the end was not completely written by the recorder
+  if( MQTTLOG_PARTIAL == ret && config.verbose ) {
+    log_printf(stdout, "%s: incomplete record at offset %ld\n", in->file, mqttlog_reader_tell(&in->reader));
+  }
+  in->state = INPUT_EOF;
+  return 0;
+}
+
+
+/**
+ * Reads the next message of a log file into in->rec. Keyframes are skipped.
+ *
+ * @return 1 if a message was read, 0 at the end of the file or on a format
+ *         error. in->state tells which one.
+ */
+int input_next(struct input *in) {
+  if( 0 <= in->copy ) {
+    return copy_next(in);
+  }
+
+  while( input_read(in, MQTTLOG_MSG) ) {
+    if( MQTTLOG_MSG == in->rec.type && topic_selected(in->rec.topic) ) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * Moves to an offset of the log file.
+ *
+ * @param anchor Absolute anchor in ns of the records at the offset, 0 for the
+ *               cnf time of the header.
+ */
+void input_goto(struct input *in, long offset, int64_t anchor) {
+  if( mqttlog_reader_seek_anchor(&in->reader, offset, anchor) ) {
+    CRIT("Could not seek in '%s'.", in->file);
+  }
+  in->state = INPUT_OK;
+  prefetch_seek(in, offset);
+}
+
+
+/**
+ * (Re)opens a log file, reads its configuration and the first record.
+ *
+ * @return 1 if the log file contains at least one record, otherwise 0.
+ */
+int input_rewind(struct input *in) {
+  int i;
+
+  if( 0 <= in->copy ) {
+    return copy_rewind(in);
+  }
+
+  // the open chunks read with the file descriptor of the reader
+  if( 0 <= in->partition_levels ) {
+    for( i = 0; i < in->num_chunks; i++ ) {
+      in->chunks[i].from = in->chunks[i].range.offset;
+    }
+    chunks_restart(in);
+  }
+
+  if( NULL != in->reader.buf ) {
+    mqttlog_reader_close(&in->reader);
+  }
+
+  if( mqttlog_reader_open(&in->reader, in->file) ) {
+    CRIT("Could not open log file '%s'.", in->file);
+  }
+  in->state = INPUT_OK;
+  prefetch_seek(in, 0);
+
+  if( config.verbose ) {
+    log_printf(stdout, "%s: record time: %3ld.%09ld\n", in->file, (long)in->reader.header.anchor.tv_sec, in->reader.header.anchor.tv_nsec);
+  }
+
+  return input_next(in);
+}
+
+
+/**
+ * Moves a partitioned log file to the last keyframe at or before the absolute
+ * time t of every partition. The chunks are scanned up to t without decoding
+ * any payload. Afterwards the chunks of a partition before its keyframe are
+ * skipped and the one with the keyframe is read from there.
+ */
+void chunks_seek(struct input *in, int64_t t) {
+  struct mqttlog_record *rec = &in->rec;
+  long *keyframe;
+  int *keyframe_chunk;
+  int i, p;
+
+  keyframe = malloc((in->num_partitions + 1) * sizeof(long));
+  keyframe_chunk = malloc((in->num_partitions + 1) * sizeof(int));
+  if( NULL == keyframe || NULL == keyframe_chunk ) {
+    CRIT("malloc()");
+  }
+  for( p = 0; p < in->num_partitions; p++ ) {
+    keyframe_chunk[p] = -1;
+  }
+
+  for( i = 0; i < in->num_chunks; i++ ) {
+    in->chunks[i].from = in->chunks[i].range.offset;
+  }
+  chunks_restart(in);
+
+  while( input_read(in, 0) ) {
+    if( MQTTLOG_KEYFRAME == rec->type && rec->abs <= t ) {
+      p = in->chunks[in->current->chunk].partition;
+      keyframe[p] = rec->offset;
+      keyframe_chunk[p] = in->current->chunk;
+    } else if( rec->abs >= t ) {
+      break;
+    }
+  }
+
+  for( i = 0; i < in->num_chunks; i++ ) {
+    p = in->chunks[i].partition;
+    if( i < keyframe_chunk[p] ) {
+      in->chunks[i].from = -1;
+    } else if( i == keyframe_chunk[p] ) {
+      in->chunks[i].from = keyframe[p];
+    }
+  }
+  chunks_restart(in);
+  if( INPUT_ERROR != in->state ) {
+    in->state = INPUT_OK;
+  }
+
+  free(keyframe);
+  free(keyframe_chunk);
+}
+
+
+/**
+ * Moves a log file forward to the first message at or after the absolute time
+ * t and collects the last value of every topic before t in a table.
+ *
+ * The last keyframe at or before t is taken from the index of the log file.
+ * Without an index, the log file is first scanned for it without decoding any
+ * payload, a partitioned log file for the last keyframe of every partition.
+ * The state is then rebuilt from this keyframe and the messages between the
+ * keyframe and t.
+ *
+ * @return 1 if a message at or after t exists, otherwise 0.
+ */
+int input_seek(struct input *in, int64_t t, struct topic_table *table) {
+  struct mqttlog_record *rec = &in->rec;
+  const struct mqttlog_index_entry *found;
+  struct topic_entry *entry;
+  long keyframe = in->reader.data_start;
+  int64_t anchor = 0;
+
+  if( INPUT_OK != in->state ) {
+    return 0;
+  }
+
+  if( 0 <= in->partition_levels ) {
+    // every partition has its own keyframes
+    chunks_seek(in, t);
+  } else {
+    if( in->index.count ) {
+      found = mqttlog_index_lookup(&in->index, t - timespec_to_ns(&in->reader.anchor), 1);
+      if( NULL != found ) {
+        keyframe = found->offset;
+        anchor = found->anchor;
+      }
+    } else {
+      input_goto(in, in->reader.data_start, 0);
+
+      while( input_read(in, 0) ) {
+        if( MQTTLOG_KEYFRAME == rec->type && rec->abs <= t ) {
+          keyframe = rec->offset;
+          anchor = timespec_to_ns(&in->reader.header.anchor);
+        } else if( rec->abs >= t ) {
+          break;
+        }
+      }
+    }
+
+    input_goto(in, keyframe, anchor);
+  }
+
+  while( input_read(in, MQTTLOG_MSG | MQTTLOG_KEY) ) {
+    if( (MQTTLOG_MSG == rec->type && rec->abs >= t) || (MQTTLOG_KEYFRAME == rec->type && rec->abs > t) ) {
+      break;
+    }
+
+    if( !(rec->type & (MQTTLOG_MSG | MQTTLOG_KEY)) || !topic_selected(rec->topic) ) {
+      continue;
+    }
+
+    entry = topic_table_get(table, rec->topic, 1);
+    if( NULL == entry ) {
+      CRIT("Could not store last value of '%s'.", rec->topic);
+    }
+    // keep the newest value if several log files contain the topic
+    if( entry->time <= rec->abs && topic_entry_set(entry, rec->abs, rec->qos, rec->retain, rec->len, rec->payload) ) {
+      CRIT("Could not store last value of '%s'.", rec->topic);
+    }
+  }
+
+  if( INPUT_OK != in->state ) {
+    return 0;
+  }
+
+  if( MQTTLOG_MSG != rec->type || !topic_selected(rec->topic) ) {
+    return input_next(in);
+  }
+
+  return 1;
+}
+
+
+/**
+ * @return The client which publishes the messages of a topic. So the messages
+ *         of one topic stay in order.
+ */
+struct mosquitto *client_for(const char *topic) {
+  if( 1 == config.connections ) {
+    return config.mosq;
+  }
+  // --shard uses the lower bits of the hash, so every shard uses all clients
+  return config.clients[(fnv1a(topic, strlen(topic)) >> 32) % config.connections];
+}
+
+
+/**
+ * Applies the first rewrite rule matching a topic to a payload. The rule of a
+ * topic is looked up once, later messages find it in config.rewritten.
+ *
+ * @return The payload to publish, a rewritten one is in config.rewrite_buf.
+ */
+const void *rewrite_payload(const char *topic, int *len, const void *payload, int64_t shift) {
+  struct topic_entry *entry;
+  bool result;
+  long n;
+  int i;
+
+  entry = topic_table_get(&config.rewritten, topic, 1);
+  if( NULL == entry ) {
+    CRIT("Could not store the timestamp rule of '%s'.", topic);
+  }
+
+  if( NULL == entry->data ) {
+    for( i = 0; i < config.num_rewrites; i++ ) {
+      if( !mosquitto_topic_matches_sub(config.rewrites[i].filter, topic, &result) && result ) {
+        break;
+      }
+    }
+    // the index + 1, num_rewrites + 1 if no rule matches
+    entry->data = (void *)(intptr_t)(i + 1);
+  }
+  i = (intptr_t)entry->data - 1;
+
+  if( i == config.num_rewrites ) {
+    return payload;
+  }
+
+  n = rewrite_apply(&config.rewrites[i], payload, *len, shift, &config.rewrite_buf, &config.rewrite_size);
+  if( 0 > n ) {
+    return payload;
+  }
+  *len = n;
+
+  return config.rewrite_buf;
+}
+
+
+/**
+ * Computes the shift of the embedded timestamps of a message: the wall clock
+ * time at which it is played, with --speed, minus the time it was recorded at.
+ *
+ * @param abs The time of the message on the timeline of the playback in ns.
+ * @param shift The offset of its copy in ns by which abs is later than the
+ *              recording, 0 if it is no copy.
+ */
+int64_t shift_for(int64_t abs, int64_t shift) {
+  int64_t rel = abs - timespec_to_ns(&config.record_start_time) - config.position;
+
+  if( 1.0 != config.speed ) {
+    rel = (int64_t)(rel / config.speed);
+  }
+
+  return config.play_time + rel - (abs - shift);
+}
+
+
+/**
+ * Publishes a message with the client of its topic and shifts the timestamps
+ * in its payload if a rule matches.
+ *
+ * @param abs The time of the message on the timeline of the playback in ns.
+ * @param shift The offset of its copy in ns, 0 if it is no copy.
+ */
+void publish(const char *topic, int len, const void *payload, int qos, int retain, int64_t abs, int64_t shift) {
+  if( config.num_rewrites ) {
+    payload = rewrite_payload(topic, &len, payload, shift_for(abs, shift));
+  }
+
+  mosquitto_publish(client_for(topic), NULL, topic, len, payload, qos, retain);
+}
+
+
+/**
+ * Sets the wall clock time at which the current position is played, which
+ * the shift of the embedded timestamps is computed from.
+ */
+void shift_update() {
+  struct timespec now_real, now_mono;
+
+  if( clock_gettime(CLOCK_REALTIME, &now_real) || clock_gettime(CLOCK_MONOTONIC, &now_mono) ) {
+    CRIT("Could not get time.");
+  }
+
+  config.play_time = timespec_to_ns(&now_real) - timespec_to_ns(&now_mono) + timespec_to_ns(&config.start);
+}
+
+
+/**
+ * Publishes a restored last value.
+ *
+ * @param userdata The copy which publishes the value or NULL.
+ */
+void publish_last_value(struct topic_entry *entry, void *userdata) {
+  const char *topic = entry->topic;
+  int64_t shift = 0;
+
+  if( NULL != userdata ) {
+    topic = copy_topic((struct input *)userdata, entry->topic);
+    shift = ((struct input *)userdata)->shift;
+  }
+
+  if( config.verbose ) {
+    LOG_TRACE(stdout, "restore: qos: %ld retain: %ld len: %ld topic: %s\n", topic, (long)entry->qos, (long)entry->retain, (long)entry->len);
+  }
+
+  publish(topic, entry->len, entry->payload, entry->qos, entry->retain, entry->time + shift, shift);
+}
+
+
+/**
+ * @return 1 if the next record of a has to be played before the one of b.
+ */
+int input_before(struct input *a, struct input *b) {
+  if( a->rec.abs != b->rec.abs ) {
+    return a->rec.abs < b->rec.abs;
+  }
+  // keep the order of the command line for equal timestamps
+  return a < b;
+}
+
+
+/**
+ * Restores the heap property downwards from position i.
+ */
+void heap_sift_down(int i) {
+  struct input *tmp;
+  int child;
+
+  while( (child = 2 * i + 1) < config.heap_size ) {
+    if( child + 1 < config.heap_size && input_before(config.heap[child + 1], config.heap[child]) ) {
+      child++;
+    }
+    if( !input_before(config.heap[child], config.heap[i]) ) {
+      break;
+    }
+    tmp = config.heap[i];
+    config.heap[i] = config.heap[child];
+    config.heap[child] = tmp;
+    i = child;
+  }
+}
+
+
+/**
+ * Adds an input with a read ahead record to the heap.
+ */
+void heap_push(struct input *in) {
+  struct input *tmp;
+  int i, parent;
+
+  i = config.heap_size++;
+  config.heap[i] = in;
+
+  while( i ) {
+    parent = (i - 1) / 2;
+    if( !input_before(config.heap[i], config.heap[parent]) ) {
+      break;
+    }
+    tmp = config.heap[i];
+    config.heap[i] = config.heap[parent];
+    config.heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+
+/**
+ * Removes the top of the heap.
+ */
+void heap_pop() {
+  config.heap[0] = config.heap[--config.heap_size];
+  heap_sift_down(0);
+}
+
+/**
+ * Appends the current record of an input to the messages in memory.
+ */
+void messages_add(struct mqttlog_record *rec) {
+  struct topic_entry *entry;
+  struct memory_msg *msg;
+
+  if( config.num_messages == config.size_messages ) {
+    config.size_messages = config.size_messages?(2 * config.size_messages):(1024);
+    config.messages = realloc(config.messages, config.size_messages * sizeof(struct memory_msg));
+    if( NULL == config.messages ) {
+      CRIT("realloc()");
+    }
+  }
+
+  if( config.payloads_len + rec->len > config.payloads_size ) {
+    config.payloads_size = config.payloads_size?(2 * config.payloads_size):(MQTTLOG_READ_BUFFER);
+    while( config.payloads_len + rec->len > config.payloads_size ) {
+      config.payloads_size *= 2;
+    }
+    config.payloads = realloc(config.payloads, config.payloads_size);
+    if( NULL == config.payloads ) {
+      CRIT("realloc()");
+    }
+  }
+
+  // every topic is stored once
+  entry = topic_table_get(&config.topics, rec->topic, 1);
+  if( NULL == entry ) {
+    CRIT("Could not store topic '%s'.", rec->topic);
+  }
+
+  msg = &config.messages[config.num_messages++];
+  msg->abs     = rec->abs;
+  msg->qos     = rec->qos;
+  msg->retain  = rec->retain;
+  msg->len     = rec->len;
+  msg->topic   = entry->topic;
+  msg->payload = config.payloads_len;
+
+  if( rec->len ) {
+    memcpy(config.payloads + config.payloads_len, rec->payload, rec->len);
+    config.payloads_len += rec->len;
+  }
+}
+
+
+/**
+ * Reads the messages of all log files in the heap into memory, closes the
+ * log files and replaces them by the copies, which play the messages from
+ * memory. The inputs have to be rewound or moved to the start time.
+ */
+void messages_load() {
+  struct input *copies, *in;
+  char prefix[CONF_MAX_LENGTH_PREFIX + 16];
+  char *p, *n;
+  int i;
+
+  if( topic_table_init(&config.topics, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+    CRIT("Could not create the topic table.");
+  }
+
+  while( config.heap_size ) {
+    in = config.heap[0];
+    messages_add(&in->rec);
+
+    if( input_next(in) ) {
+      heap_sift_down(0);
+    } else {
+      heap_pop();
+    }
+  }
+
+  // repeat only if all log files were read completely
+  config.complete = 1;
+  for( i = 0; i < config.num_inputs; i++ ) {
+    if( INPUT_EOF != config.inputs[i].state ) {
+      config.complete = 0;
+    }
+    prefetch_stop(&config.inputs[i]);
+    mqttlog_reader_close(&config.inputs[i].reader);
+    mqttlog_index_free(&config.inputs[i].index);
+    chunks_close(&config.inputs[i]);
+    if( 0 <= config.inputs[i].stripe ) {
+      free(config.inputs[i].file);
+    }
+  }
+  free(config.inputs);
+
+  copies = calloc(config.copies, sizeof(struct input));
+  if( NULL == copies ) {
+    CRIT("calloc()");
+  }
+
+  for( i = 0; i < config.copies; i++ ) {
+    in = &copies[i];
+    in->file = "memory";
+    in->partition_levels = -1;
+    in->stripe = -1;
+    in->copy = i;
+    in->state = INPUT_EOF;
+    in->watch_fd = -1;
+
+    // replace every {n} of the template by the number of the copy
+    prefix[0] = 0;
+    for( p = config.prefix; NULL != (n = strstr(p, "{n}")); p = n + 3 ) {
+      snprintf(prefix + strlen(prefix), sizeof(prefix) - strlen(prefix), "%.*s%d", (int)(n - p), p, i);
+    }
+    snprintf(prefix + strlen(prefix), sizeof(prefix) - strlen(prefix), "%s", p);
+
+    in->prefix = strdup(prefix);
+    if( NULL == in->prefix ) {
+      CRIT("strdup()");
+    }
+  }
+
+  config.inputs = copies;
+  config.num_inputs = config.copies;
+
+  config.heap = realloc(config.heap, config.num_inputs * sizeof(struct input *));
+  if( NULL == config.heap ) {
+    CRIT("realloc()");
+  }
+
+  if( config.verbose ) {
+    log_printf(stdout, "-- %zu messages with %zu bytes payload in memory, %d copies --\n", config.num_messages, config.payloads_len, config.copies);
+  }
+}
+
+
+/**
+ * Publishes a status message of this instance to the group.
+ */
+void sync_publish(uint8_t status, const struct timespec *start) {
+  struct mqtt_player_sync_msg msg;
+
+  memset(&msg, 0, sizeof(struct mqtt_player_sync_msg));
+  msg.status.status = status;
+  if( NULL != start ) {
+    msg.status.sec = hton64(start->tv_sec);
+    msg.status.usec = hton64(start->tv_nsec / 1000);
+  }
+  msg.node = hton32(config.shard);
+  msg.nodes = hton32(config.shards);
+  msg.round = hton32(config.round);
+
+  mosquitto_publish(config.mosq, NULL, config.sync_topic, sizeof(struct mqtt_player_sync_msg), &msg, 1, 0);
+}
+
+
+/**
+ * Receives the status messages of the group. The leader (instance 0) counts
+ * the registrations of the current round and announces the start time when
+ * all instances are registered. Runs in the thread of mosquitto.
+ */
+void sync_callback(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message) {
+  struct mqtt_player_sync_msg msg;
+  struct timespec start;
+  uint32_t node;
+
+  if( sizeof(struct mqtt_player_sync_msg) != message->payloadlen || strcmp(message->topic, config.sync_topic) ) {
+    return;
+  }
+  memcpy(&msg, message->payload, sizeof(struct mqtt_player_sync_msg));
+  node = ntoh32(msg.node);
+
+  if( ntoh32(msg.nodes) != config.shards || node >= config.shards ) {
+    ERROR("Instance %u of group '%s' has a different number of shards.", node, config.group);
+    return;
+  }
+
+  pthread_mutex_lock(&config.sync_lock);
+
+  if( ntoh32(msg.round) == config.round && !config.started ) {
+
+    if( MQTT_PLAYER_REGISTER == msg.status.status && !config.shard && !config.registered[node] ) {
+      config.registered[node] = 1;
+      if( ++config.num_registered == config.shards ) {
+        if( clock_gettime(CLOCK_REALTIME, &start) ) {
+          CRIT("Could not get time.");
+        }
+        start.tv_sec += config.lead_time / 1000;
+        start.tv_nsec += (config.lead_time % 1000) * 1000000L;
+        if( NSEC_PER_SEC <= start.tv_nsec ) {
+          start.tv_sec++;
+          start.tv_nsec -= NSEC_PER_SEC;
+        }
+        // microseconds, like in the message
+        start.tv_nsec -= start.tv_nsec % 1000;
+        sync_publish(MQTT_PLAYER_START, &start);
+      }
+
+    } else if( MQTT_PLAYER_START == msg.status.status ) {
+      config.sync_start.tv_sec = ntoh64(msg.status.sec);
+      config.sync_start.tv_nsec = ntoh64(msg.status.usec) * 1000;
+      config.started = 1;
+      pthread_cond_broadcast(&config.sync_cond);
+    }
+  }
+
+  pthread_mutex_unlock(&config.sync_lock);
+}
+
+
+/**
+ * Waits until all instances of the group are ready and sets config.start to
+ * the common start time on the monotonic clock. The registration is repeated
+ * until the start time is known, so instances may start in any order.
+ */
+void sync_wait() {
+  struct timespec timeout, now_real, now_mono, offset;
+
+  pthread_mutex_lock(&config.sync_lock);
+
+  config.round++;
+  config.started = 0;
+  config.num_registered = 0;
+  memset(config.registered, 0, config.shards);
+
+  while( !config.started ) {
+    sync_publish(MQTT_PLAYER_REGISTER, NULL);
+
+    // the event loop waits on the monotonic clock, the condition on the wall clock
+    if( clock_gettime((config.event_loop)?(CLOCK_MONOTONIC):(CLOCK_REALTIME), &timeout) ) {
+      CRIT("Could not get time.");
+    }
+    timeout.tv_nsec += CONF_SYNC_REGISTER_INTERVAL * 1000000L;
+    if( NSEC_PER_SEC <= timeout.tv_nsec ) {
+      timeout.tv_sec++;
+      timeout.tv_nsec -= NSEC_PER_SEC;
+    }
+
+    if( config.event_loop ) {
+      // the callback runs in this thread while the loop handles the traffic
+      pthread_mutex_unlock(&config.sync_lock);
+      wait_until(&timeout);
+      pthread_mutex_lock(&config.sync_lock);
+    } else {
+      pthread_cond_timedwait(&config.sync_cond, &config.sync_lock, &timeout);
+    }
+  }
+
+  pthread_mutex_unlock(&config.sync_lock);
+
+  // the common start time is translated to the monotonic clock once
+  if( clock_gettime(CLOCK_REALTIME, &now_real) || clock_gettime(CLOCK_MONOTONIC, &now_mono) ) {
+    CRIT("Could not get time.");
+  }
+  timespec_sub(&config.sync_start, &now_real, &offset);
+  timespec_add(&now_mono, &offset, &config.start);
+
+  if( config.verbose ) {
+    log_printf(stdout, "-- group %s: start at %ld.%06ld --\n", config.group, (long)config.sync_start.tv_sec, config.sync_start.tv_nsec / 1000);
+  }
+}
+
+
+/**
+ * Receives the commands on the control topic and wakes up the main thread,
+ * which applies them. Runs in the thread of mosquitto or of the event loop.
+ */
+void control_callback(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message) {
+  struct command cmd;
+  char text[64], *end;
+  int len = message->payloadlen;
+
+  if( strcmp(message->topic, config.control_topic) ) {
+    return;
+  }
+
+  memset(&cmd, 0, sizeof(struct command));
+  cmd.type = COMMAND_INVALID;
+
+  if( sizeof(text) > len ) {
+    memcpy(text, message->payload, len);
+    while( len && isspace(text[len - 1]) ) {
+      len--;
+    }
+    text[len] = 0;
+
+    if( !strcmp(text, "pause") ) {
+      cmd.type = COMMAND_PAUSE;
+    } else if( !strcmp(text, "resume") ) {
+      cmd.type = COMMAND_RESUME;
+    } else if( !strncmp(text, "seek ", 5) ) {
+      cmd.value = strtod(text + 5, &end);
+      if( end != text + 5 && !*end && 0 <= cmd.value ) {
+        cmd.type = COMMAND_SEEK;
+      }
+    } else if( !strncmp(text, "speed ", 6) ) {
+      cmd.value = strtod(text + 6, &end);
+      if( end != text + 6 && !*end && 0 < cmd.value && CONF_MAX_SPEED >= cmd.value ) {
+        cmd.type = COMMAND_SPEED;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&config.control_lock);
+  if( CONF_MAX_COMMANDS > config.num_commands ) {
+    config.commands[config.num_commands++] = cmd;
+  } else {
+    ERROR("Too many pending control commands.");
+  }
+  pthread_cond_signal(&config.control_cond);
+  pthread_mutex_unlock(&config.control_lock);
+
+  if( config.event_loop ) {
+    evloop_interrupt(&config.loop);
+  }
+}
+
+
+/**
+ * @return The time of the recording in ns which is played now, relative to the
+ *         start of the merged timeline.
+ */
+int64_t control_position() {
+  struct timespec now;
+  int64_t elapsed;
+
+  if( config.paused ) {
+    return config.position;
+  }
+
+  if( clock_gettime(CLOCK_MONOTONIC, &now) ) {
+    CRIT("Could not get time.");
+  }
+  elapsed = timespec_to_ns(&now) - timespec_to_ns(&config.start);
+  if( 1.0 != config.speed ) {
+    elapsed = (int64_t)(elapsed * config.speed);
+  }
+
+  return config.position + elapsed;
+}
+
+
+/**
+ * Acknowledges a control command with the new state of the playback on the
+ * status topic.
+ */
+void control_ack(uint8_t status) {
+  struct mqtt_player_control_msg msg;
+
+  memset(&msg, 0, sizeof(struct mqtt_player_control_msg));
+  msg.status.status = status;
+  msg.status.sec = hton64(config.position / NSEC_PER_SEC);
+  msg.status.usec = hton64((config.position % NSEC_PER_SEC) / 1000);
+  msg.speed = hton32((uint32_t)(config.speed * 1000 + 0.5));
+  msg.paused = config.paused;
+
+  mosquitto_publish(config.mosq, NULL, config.mqtt_topic, sizeof(struct mqtt_player_control_msg), &msg, 1, 0);
+
+  if( config.verbose ) {
+    log_printf(stdout, "-- control: status: %u position: %ld.%06ld speed: %.3f%s --\n", status,
+               (long)(config.position / NSEC_PER_SEC), (long)(config.position % NSEC_PER_SEC) / 1000, config.speed, (config.paused)?(" paused"):(""));
+  }
+}
+
+
+/**
+ * Moves all log files to the time t in ns relative to the start of the merged
+ * timeline and collects the last value of every topic before t, like --start.
+ * The read buffers and the connections are kept.
+ *
+ * @return 0 on success, -1 if the playback can not seek.
+ */
+int control_seek(int64_t t, struct topic_table *last_values) {
+  struct input *in;
+  int i;
+
+  // the copies are played from memory, stdin can not be read again
+  if( config.copies ) {
+    return -1;
+  }
+  for( i = 0; i < config.num_inputs; i++ ) {
+    if( !strcmp(config.inputs[i].file, "-") ) {
+      return -1;
+    }
+  }
+
+  config.heap_size = 0;
+  topic_table_clear(last_values);
+
+  for( i = 0; i < config.num_inputs; i++ ) {
+    in = &config.inputs[i];
+    if( INPUT_EOF == in->state ) {
+      in->state = INPUT_OK;
+    }
+    if( input_seek(in, timespec_to_ns(&config.record_start_time) + t, last_values) ) {
+      heap_push(in);
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * Applies the commands received on the control topic in their order. Every
+ * command anchors the timeline anew at the current position, so the deadline
+ * of the next message has to be computed again.
+ *
+ * @return 1 if a command was applied, otherwise 0.
+ */
+int control_apply(struct topic_table *last_values) {
+  struct command commands[CONF_MAX_COMMANDS];
+  int i, num;
+
+  pthread_mutex_lock(&config.control_lock);
+  num = config.num_commands;
+  memcpy(commands, config.commands, num * sizeof(struct command));
+  config.num_commands = 0;
+  pthread_mutex_unlock(&config.control_lock);
+
+  for( i = 0; i < num; i++ ) {
+    config.position = control_position();
+    if( clock_gettime(CLOCK_MONOTONIC, &config.start) ) {
+      CRIT("Could not get time.");
+    }
+    shift_update();
+
+    switch( commands[i].type ) {
+      case COMMAND_PAUSE:
+        config.paused = 1;
+        control_ack(MQTT_PLAYER_PAUSED);
+        break;
+
+      case COMMAND_RESUME:
+        config.paused = 0;
+        control_ack(MQTT_PLAYER_RESUMED);
+        break;
+
+      case COMMAND_SEEK:
+        if( control_seek((int64_t)(commands[i].value * NSEC_PER_SEC), last_values) ) {
+          control_ack(MQTT_PLAYER_REJECTED);
+        } else {
+          config.position = (int64_t)(commands[i].value * NSEC_PER_SEC);
+          shift_update();
+          if( config.verbose ) {
+            log_printf(stdout, "-- restore %zu topics --\n", last_values->count);
+          }
+          topic_table_foreach(last_values, publish_last_value, NULL);
+          control_ack(MQTT_PLAYER_SEEKED);
+        }
+        break;
+
+      case COMMAND_SPEED:
+        config.speed = commands[i].value;
+        control_ack(MQTT_PLAYER_SPEED);
+        break;
+
+      default:
+        control_ack(MQTT_PLAYER_REJECTED);
+    }
+  }
+
+  return 0 < num;
+}
+
+
+/**
+ * Creates and connects all clients. Each one gets its own thread or all are
+ * added to the event loop.
+ */
+void clients_connect() {
+  char id[CONF_MAX_LENGTH_MQTT_CLIENT_ID + 16];
+  int i;
+
+  config.clients = calloc(config.connections, sizeof(struct mosquitto *));
+  if( NULL == config.clients ) {
+    CRIT("calloc()");
+  }
+
+  if( config.event_loop && evloop_init(&config.loop) ) {
+    CRIT("Could not create the event loop.");
+  }
+
+  for( i = 0; i < config.connections; i++ ) {
+    if( 1 == config.connections ) {
+      snprintf(id, sizeof(id), "%s", config.mqtt_client_id);
+    } else {
+      snprintf(id, sizeof(id), "%s-%d", config.mqtt_client_id, i);
+    }
+
+    config.clients[i] = mosquitto_new(id, config.mqtt_clean_session, NULL);
+    if( NULL == config.clients[i] ) {
+      CRIT("Could not create a mosquitto object.");
+    }
+  }
+  config.mosq = config.clients[0];
+
+  if( strlen(config.group) ) {
+    mosquitto_message_callback_set(config.mosq, sync_callback);
+  } else if( config.control ) {
+    mosquitto_message_callback_set(config.mosq, control_callback);
+  }
+
+  for( i = 0; i < config.connections; i++ ) {
+    if( mosquitto_connect(config.clients[i], config.mqtt_broker, config.mqtt_port, config.mqtt_keepalive) ) {
+      CRIT("Could not connect MQTT broker.");
+    }
+
+    if( config.event_loop ) {
+      if( evloop_add(&config.loop, config.clients[i]) ) {
+        CRIT("Could not add client to the event loop.");
       }
+    } else {
+      mosquitto_loop_start(config.clients[i]);
+    }
+  }
+}
+
+
+/**
+ * Sends what is left and disconnects all clients.
+ */
+void clients_close() {
+  int i;
+
+  if( config.event_loop && evloop_flush(&config.loop, CONF_FLUSH_TIMEOUT) ) {
+    ERROR("Could not send all messages.");
+  }
+
+  for( i = 0; i < config.connections; i++ ) {
+    mosquitto_disconnect(config.clients[i]);
+  }
+
+  for( i = 0; i < config.connections; i++ ) {
+    if( config.event_loop ) {
+      mosquitto_loop_write(config.clients[i], 1);
+    } else {
+      mosquitto_loop_stop(config.clients[i], false);
+    }
+    mosquitto_destroy(config.clients[i]);
+  }
+
+  if( config.event_loop ) {
+    evloop_free(&config.loop);
+  }
+  free(config.clients);
+  config.clients = NULL;
+}
+
+
+/**
+ * Sets config.start so that every message is published config.lag ms after
+ * the wall clock time it was recorded at.
+ */
+void lag_start() {
+  struct timespec now_real, now_mono;
+  int64_t offset;
+
+  if( clock_gettime(CLOCK_REALTIME, &now_real) || clock_gettime(CLOCK_MONOTONIC, &now_mono) ) {
+    CRIT("Could not get time.");
+  }
+
+  offset = timespec_to_ns(&config.record_start_time) + config.start_offset + (int64_t)config.lag * 1000000L - timespec_to_ns(&now_real);
+  timespec_from_ns(timespec_to_ns(&now_mono) + offset, &config.start);
+}
+
+
+/**
+ * Handles the signal from ctrl+C. Simple close the connection and close the file.
+ */
+void sig_handler(int sig) {
+  if( SIGINT != sig ) {
+    CRIT("Got unexpected signal.");
+  }
+
+  clients_close();
+
+  mosquitto_lib_cleanup();
+
+  inputs_close();
+
+  exit(0);
+}
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  struct sigaction sigact;
+  struct timespec recv_time, anchor, deadline;
+  struct mqttlog_record *rec;
+  struct input *in;
+  int i, ret, complete;
+  int64_t rel;
+  struct mqtt_player_status_msg status;
+  struct topic_table last_values;
+
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
   
-      if( 0 > qos && 2 < qos ) {
-        CRIT("Format error in '%s'.", config.log_file);
-      }
+  parse_args(argc, argv);
+
+  if( log_start() ) {
+    CRIT("Could not start the log thread.");
+  }
+
+  srandom(time(NULL) ^ getpid());
+
+  if( !config.num_inputs ) {
+    fprintf(stderr, "ERROR: You have to provide a logfile.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  for( i = 0; i < config.num_inputs; i++ ) {
+    if( !strcmp(config.inputs[i].file, "-") && (config.repeat || config.start_offset || config.copies) ) {
+      fprintf(stderr, "ERROR: --repeat, --start and --copies can not be used with stdin.\n");
+      print_usage(*argv);
+      exit(1);
+    }
+  }
+
+  if( config.follow && config.copies ) {
+    fprintf(stderr, "ERROR: --follow and --copies can not be combined.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( 0 <= config.lag && strlen(config.group) ) {
+    fprintf(stderr, "ERROR: --lag and --group can not be combined.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( config.control && (0 <= config.lag || strlen(config.group)) ) {
+    fprintf(stderr, "ERROR: --control can not be combined with --lag or --group.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  inputs_open();
+
+  if( config.num_rewrites && topic_table_init(&config.rewritten, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+    CRIT("Could not create the timestamp rule table.");
+  }
+
+  if( topic_table_init(&last_values, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+    CRIT("Could not create the last value table.");
+  }
+
+  memset(&sigact, 0, sizeof(struct sigaction));
+  sigact.sa_handler = sig_handler;
+  if( sigaction(SIGINT, &sigact, NULL) ) {
+    CRIT("Could not initialize signal handler.");
+  }
   
-      if( 0 > retain && 1 < retain ) {
-        CRIT("Format error in '%s'.", config.log_file);
+  mosquitto_lib_init();
+
+  if( strlen(config.group) ) {
+    snprintf(config.sync_topic, sizeof(config.sync_topic), "%s/%s", config.mqtt_topic, config.group);
+    config.registered = calloc(config.shards, 1);
+    if( NULL == config.registered ) {
+      CRIT("calloc()");
+    }
+  }
+
+  if( config.control ) {
+    snprintf(config.control_topic, sizeof(config.control_topic), "%s/control", config.mqtt_topic);
+  }
+
+  clients_connect();
+
+  if( strlen(config.group) && mosquitto_subscribe(config.mosq, NULL, config.sync_topic, 1) ) {
+    CRIT("Could not subscribe '%s'.", config.sync_topic);
+  }
+
+  if( config.control && mosquitto_subscribe(config.mosq, NULL, config.control_topic, 1) ) {
+    CRIT("Could not subscribe '%s'.", config.control_topic);
+  }
+
+  do {
+
+    if( clock_gettime(CLOCK_MONOTONIC, &config.start) ) {
+      CRIT("Could not get time().");
+    }
+
+    config.heap_size = 0;
+    config.position = config.start_offset;
+
+    // The copies keep the messages and last values loaded in the first round.
+    if( !config.copies || NULL == config.messages ) {
+
+      // The earliest recording start is the start of the merged timeline.
+      for( i = 0; i < config.num_inputs; i++ ) {
+        in = &config.inputs[i];
+        ret = input_rewind(in);
+
+        if( !i || 0 > timespec_cmp(&in->reader.anchor, &anchor) ) {
+          anchor = in->reader.anchor;
+        }
+
+        if( ret && !config.start_offset ) {
+          heap_push(in);
+        }
       }
-  
-      if( 0 < len ) {
-        ret == fscanf(config.fd, "%02hhx", &buf[0]);
-        if( 0 == ret ) {
-          break;
+      config.record_start_time = anchor;
+
+      if( config.start_offset ) {
+        topic_table_clear(&last_values);
+        for( i = 0; i < config.num_inputs; i++ ) {
+          in = &config.inputs[i];
+          if( input_seek(in, timespec_to_ns(&anchor) + config.start_offset, &last_values) ) {
+            heap_push(in);
+          }
         }
       }
-  
-      for( i = 1; i < len; i++ ) {
-        ret == fscanf(config.fd, " %02hhx", &buf[i]);
-        if( 0 == ret ) {
-          break;
+
+      if( config.copies ) {
+        messages_load();
+      }
+    }
+
+    if( config.copies ) {
+      for( i = 0; i < config.num_inputs; i++ ) {
+        in = &config.inputs[i];
+        if( input_rewind(in) ) {
+          heap_push(in);
         }
       }
-      ret == fscanf(config.fd, "\n");
-      if( 0 == ret ) {
-        break;
+    }
+
+    shift_update();
+
+    if( config.start_offset ) {
+      if( config.verbose ) {
+        log_printf(stdout, "-- restore %zu topics --\n", last_values.count);
       }
-  
+
+      if( config.copies ) {
+        for( i = 0; i < config.num_inputs; i++ ) {
+          topic_table_foreach(&last_values, publish_last_value, &config.inputs[i]);
+        }
+      } else {
+        topic_table_foreach(&last_values, publish_last_value, NULL);
+      }
+    }
+
+    if( strlen(config.group) ) {
+      sync_wait();
+    }
+
+    if( 0 <= config.lag ) {
+      lag_start();
+    }
+
+    shift_update();
+
+    if( config.verbose ) {
+      log_printf(stdout, "-- start playing --\n");
+    }
+
+    status.status = MQTT_PLAYER_BEGIN_PLAY;
+    status.sec = hton64(config.record_start_time.tv_sec);
+    status.usec = hton64(config.record_start_time.tv_nsec / 1000);
+    // post status
+    mosquitto_publish(config.mosq, NULL, config.mqtt_topic, sizeof(struct mqtt_player_status_msg), &status, 2, 0);
+
+    // read data
+    while( config.heap_size ) {
+      // a command may change the timeline or move the log files
+      if( config.control && control_apply(&last_values) ) {
+        continue;
+      }
+      if( config.paused ) {
+        wait_until(NULL);
+        continue;
+      }
+
+      in = config.heap[0];
+      rec = &in->rec;
+
       if( !config.ignore_timing ) {
-        timeradd(&recv_time, &config.start, &recv_time);
-  
-        if( gettimeofday(&now, NULL) ) {
-          CRIT("Could not get time.");
+        // Sleep until an absolute deadline on the monotonic clock. So the
+        // time spent for parsing and publishing does not add up and gaps
+        // below one microsecond are kept.
+        rel = rec->abs - timespec_to_ns(&config.record_start_time) - config.position;
+        if( 1.0 != config.speed ) {
+          rel = (int64_t)(rel / config.speed);
         }
-  
-        if( timercmp(&now, &recv_time, <) ) {
-          timersub(&recv_time, &now, &recv_time);
-          usleep(recv_time.tv_sec * 1000000 + recv_time.tv_usec);
+        timespec_from_ns(rel, &deadline);
+        timespec_add(&deadline, &config.start, &deadline);
+        if( wait_until(&deadline) ) {
+          continue;
         }
+      } else if( config.event_loop ) {
+        // only handle the pending traffic
+        memset(&deadline, 0, sizeof(struct timespec));
+        wait_until(&deadline);
+      }
+
+      // time relative to the start of the merged timeline
+      timespec_from_ns(rec->abs - timespec_to_ns(&config.record_start_time) - config.start_offset, &recv_time);
+  
+      if( config.verbose ) {
+        LOG_TRACE(stdout, "time: %3ld.%09ld qos: %ld retain: %ld len: %ld topic: %s\n", rec->topic, (long)recv_time.tv_sec, recv_time.tv_nsec, (long)rec->qos, (long)rec->retain, (long)rec->len);
       }
   
-      mosquitto_publish(config.mosq, NULL, topic, len, buf, qos, retain);
+      publish(rec->topic, rec->len, rec->payload, rec->qos, rec->retain, rec->abs, in->shift);
+
+      if( input_next(in) ) {
+        heap_sift_down(0);
+      } else {
+        heap_pop();
+      }
     }
-    
-  }while( config.repeat && feof(config.fd) );
 
-  mosquitto_disconnect(config.mosq);
- 
-  mosquitto_loop_stop(config.mosq, false);
+    // repeat only if all log files were read completely
+    complete = !config.copies || config.complete;
+    for( i = 0; i < config.num_inputs; i++ ) {
+      if( INPUT_EOF != config.inputs[i].state ) {
+        complete = 0;
+      }
+    }
+    
+  }while( config.repeat && complete );
 
-  mosquitto_destroy(config.mosq);
+  clients_close();
 
   mosquitto_lib_cleanup();
 
-  fclose(config.fd);
+  topic_table_free(&last_values);
+
+  if( config.num_rewrites ) {
+    topic_table_free(&config.rewritten);
+    for( i = 0; i < config.num_rewrites; i++ ) {
+      rewrite_free(&config.rewrites[i]);
+    }
+    free(config.rewrites);
+    free(config.rewrite_buf);
+  }
+
+  inputs_close();
 
   return 0;
 }
-
@@ -13,11 +13,24 @@
  * limitations under the License.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <mosquitto.h>
 #include <sys/time.h>
+#include <time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include "config.h"
 #include "log.h"
+#include "timespec.h"
+#include "topic-table.h"
+#include "dedup.h"
+#include "mqttlog.h"
+#include "record-ring.h"
+#include "evloop.h"
 
 struct _conf {
   #define CONF_DEFAULT_MQTT_CLIENT_ID     "recorder"
@@ -51,12 +64,72 @@ struct _conf {
   #define CONF_DEFAULT_VERBOSE  0
   int verbose;
 
+  #define CONF_DEFAULT_CLOCK  CLOCK_MONOTONIC
+  clockid_t clock;
+
   #define CONF_DEFAULT_SEC   0
-  #define CONF_DEFAULT_USEC  0
-  struct timeval start_time;
+  #define CONF_DEFAULT_NSEC  0
+  struct timespec start_time;
+
+  #define CONF_DEFAULT_KEYFRAME_INTERVAL  0
+  int keyframe_interval;
+  int64_t next_keyframe;
+  struct topic_table last_values;
+
+  #define CONF_DEFAULT_DEDUP_WINDOW  0
+  int dedup_window;
+
+  #define CONF_DEFAULT_PARTITION_LEVELS  -1
+  #define CONF_PARTITION_CHUNK_SIZE      65536
+  #define CONF_PARTITION_MAX_BUFFERED    (64 * 1024 * 1024)
+  int partition_levels;  // topic levels of a partition key, 0 for the whole topic
+  struct topic_table partitions;
+  int num_partitions;
+  size_t buffered;       // bytes buffered in all partitions
+  FILE *parts_fd;
+
+  #define CONF_MAX_STRIPES          16
+  #define CONF_DEFAULT_STRIPE_TIME  0  // ms
+  #define CONF_STRIPE_BUFFER        (1024 * 1024)
+  char *stripe_files[CONF_MAX_STRIPES];
+  int num_stripes;       // 0 if the records are written to the log file
+  int stripe_time;       // ms of records written to one stripe in turn, 0 distributes the topics by their hash
+  struct stripe *stripes;
+
+  #define CONF_DEFAULT_CRC_BLOCK  0
+  long crc_block;  // bytes per crc line, 0 disables the checksums
+
+  #define CONF_DEFAULT_APPEND  0
+  int append;
+
+  #define CONF_DEFAULT_FLUSH  0
+  int flush;  // write every message immediately
+
+  #define CONF_DEFAULT_EVENT_LOOP  0
+  int event_loop;  // drive the client from an epoll loop instead of mosquitto_loop_forever()
+
+  #define CONF_DROP_REPORT_INTERVAL  1  // s
+  struct policy *policies;    // sampling policies, the first matching one applies
+  int num_policies;
+  struct topic_table sampled; // policy and state of every topic seen so far
+  int64_t next_drop_report;
+
+  #define CONF_DEFAULT_RING_SIZE      0  // MB
+  #define CONF_DEFAULT_RING_WINDOW    0  // s
+  #define CONF_DEFAULT_DUMP_INTERVAL  0  // s
+  int ring_size;          // flight recorder mode if set, the log file is only written on a dump
+  int ring_window;        // keep only the messages of the last seconds, 0 for all which fit
+  int dump_interval;      // dump the ring periodically, 0 disables it
+  char *trigger;          // topic filter of messages which trigger a dump
+  char *trigger_payload;  // payload the trigger message has to have or NULL
+  struct record_ring ring;
+  struct record_ring snapshot;  // copy of the ring which is written by a dump
+  pthread_mutex_t ring_lock;
+  pthread_t dump_thread;
+  struct mqttlog_header header;
 
   struct mosquitto *mosq;
-  FILE *fd;
+  struct mqttlog_writer log;
   sigset_t sigset;
 
 } config;
@@ -78,9 +151,32 @@ int config_init() {
   config.mqtt_keepalive     = CONF_DEFAULT_MQTT_KEEPALIVE;
   config.mqtt_qos           = CONF_DEFAULT_MQTT_QOS;
   config.verbose            = CONF_DEFAULT_VERBOSE;
+  config.clock              = CONF_DEFAULT_CLOCK;
 
   config.start_time.tv_sec  = CONF_DEFAULT_SEC;
-  config.start_time.tv_usec = CONF_DEFAULT_USEC;
+  config.start_time.tv_nsec = CONF_DEFAULT_NSEC;
+
+  config.keyframe_interval  = CONF_DEFAULT_KEYFRAME_INTERVAL;
+  config.next_keyframe      = 0;
+  config.dedup_window       = CONF_DEFAULT_DEDUP_WINDOW;
+  config.partition_levels   = CONF_DEFAULT_PARTITION_LEVELS;
+  config.num_partitions     = 0;
+  config.num_stripes        = 0;
+  config.stripe_time        = CONF_DEFAULT_STRIPE_TIME;
+  config.buffered           = 0;
+  config.parts_fd           = NULL;
+  config.crc_block          = CONF_DEFAULT_CRC_BLOCK;
+  config.append             = CONF_DEFAULT_APPEND;
+  config.flush              = CONF_DEFAULT_FLUSH;
+  config.event_loop         = CONF_DEFAULT_EVENT_LOOP;
+  config.policies           = NULL;
+  config.num_policies       = 0;
+  config.next_drop_report   = 0;
+  config.ring_size          = CONF_DEFAULT_RING_SIZE;
+  config.ring_window        = CONF_DEFAULT_RING_WINDOW;
+  config.dump_interval      = CONF_DEFAULT_DUMP_INTERVAL;
+  config.trigger            = NULL;
+  config.trigger_payload    = NULL;
 
   config.mosq = NULL;
   if( 0 > sigemptyset(&config.sigset) ) {
@@ -120,11 +216,137 @@ void print_usage(char *progname) {
   printf("-q --qos            The maximal quality of service level with which the recorder will revieve messages.\n");
   printf("                    Possible values: 0-2\n");
   printf("                    Default value: %d\n", CONF_DEFAULT_MQTT_QOS);
+  printf("-C --clock          Clock used for the timestamps of the recorded messages.\n");
+  printf("                    monotonic: CLOCK_MONOTONIC, not affected by NTP steps.\n");
+  printf("                    coarse:    CLOCK_MONOTONIC_COARSE, cheaper but only with tick resolution.\n");
+  printf("                    Default value: monotonic\n");
+  printf("-K --keyframe       Interval in seconds in which the last value of every topic is written\n");
+  printf("                    to the log. The player uses these keyframes to restore the state\n");
+  printf("                    when it starts in the middle of a recording. 0 disables keyframes.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_KEYFRAME_INTERVAL);
+  printf("-d --dedup          Number of recent payloads which are remembered. A payload equal to\n");
+  printf("                    one of them is written as reference to the earlier record. 0 disables\n");
+  printf("                    the deduplication.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_DEDUP_WINDOW);
+  printf("-P --partition      Group the records by the first n levels of their topic into chunks of\n");
+  printf("                    %d bytes. 0 uses the whole topic. The chunks are listed in\n", CONF_PARTITION_CHUNK_SIZE);
+  printf("                    <logfile>.parts. A player with --filter then reads only the chunks\n");
+  printf("                    of the selected topics. Can not be combined with --dedup.\n");
+  printf("-S --stripe         Write the records to the given file instead of the log file. Can be\n");
+  printf("                    given up to %d times, e.g. for files on different disks. Every\n", CONF_MAX_STRIPES);
+  printf("                    file is written by its own thread and listed in <logfile>.stripes.\n");
+  printf("                    Can not be combined with --partition, --append or --ring.\n");
+  printf("-B --stripe-time    Write the records of the given number of ms to one stripe in turn.\n");
+  printf("                    0 distributes the topics over the stripes by their hash.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_STRIPE_TIME);
+  printf("-V --crc            Write a CRC32C checksum line after every block of the given number of\n");
+  printf("                    bytes. mqttlog-check verifies them. 0 disables the checksums.\n");
+  printf("                    Default value: %d, recommended: %d\n", CONF_DEFAULT_CRC_BLOCK, MQTTLOG_CRC_BLOCK);
+  printf("-A --append         Continue an existing log file, e.g. after a crash. The log file is\n");
+  printf("                    truncated after its last valid record first. The settings of the\n");
+  printf("                    existing log file are kept.\n");
+  printf("-F --flush          Write every message immediately instead of buffering it, e.g. for a\n");
+  printf("                    player which follows the log file. Always on if the log file is '-'\n");
+  printf("                    for stdout.\n");
+  printf("-s --sample         Sampling policy for the topics matching a filter, given as\n");
+  printf("                    <filter>:every=<n>  keep every nth message of a topic,\n");
+  printf("                    <filter>:rate=<n>   keep at most n messages per second of a topic,\n");
+  printf("                    <filter>:changed    keep only messages with a changed payload.\n");
+  printf("                    Can be given several times, the first matching policy applies. The\n");
+  printf("                    number of dropped messages is written to the log every %d s.\n", CONF_DROP_REPORT_INTERVAL);
+  printf("-R --ring           Flight recorder mode: Keep the last messages in a ring buffer of the\n");
+  printf("                    given size in MB instead of writing them to the log file. The ring is\n");
+  printf("                    dumped to <logfile>.<date>-<time> on SIGUSR1, on a trigger message or\n");
+  printf("                    periodically. Can not be combined with --partition or --append.\n");
+  printf("-W --window         Keep only the messages of the last seconds in the ring. 0 keeps all\n");
+  printf("                    messages which fit into it.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_RING_WINDOW);
+  printf("-T --trigger        Dump the ring when a message matching the topic filter is received.\n");
+  printf("                    Given as <filter> or <filter>=<payload>.\n");
+  printf("-I --dump-interval  Dump the ring every given number of seconds. 0 disables it.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_DUMP_INTERVAL);
+  printf("-E --event-loop     Handle the traffic in an epoll loop instead of mosquitto's own loop.\n");
   printf("-v --verbose        Print alot information to stdout.\n");
   printf("-h --help           Print this help message.\n");
 }
 
 
+/**
+ * A sampling policy for the topics matching a filter.
+ */
+struct policy {
+  #define POLICY_EVERY    1  // keep every nth message of a topic
+  #define POLICY_RATE     2  // keep at most n messages per second of a topic
+  #define POLICY_CHANGED  3  // keep only changed payloads of a topic
+  int type;
+  char *spec;       // as given on the command line
+  char *filter;
+  long every;
+  int64_t period;   // minimal time in ns between two kept messages
+  int dropped;      // since the last drop record
+};
+
+/**
+ * Sampling state of a topic.
+ */
+struct sample {
+  struct policy *policy;  // NULL if no policy matches the topic
+  long count;             // messages since the last kept one
+  int64_t next;           // earliest time of the next kept message
+};
+
+
+/**
+ * Parses a sampling policy <filter>:<policy> and adds it to the list.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int policy_add(char *spec) {
+  struct policy *p;
+  char *sep = strrchr(spec, ':');
+  double rate;
+
+  if( NULL == sep || sep == spec ) {
+    return -1;
+  }
+
+  config.policies = realloc(config.policies, (config.num_policies + 1) * sizeof(struct policy));
+  if( NULL == config.policies ) {
+    CRIT("realloc()");
+  }
+  p = &config.policies[config.num_policies];
+  memset(p, 0, sizeof(struct policy));
+
+  if( !strncmp(sep + 1, "every=", 6) ) {
+    p->type = POLICY_EVERY;
+    p->every = atol(sep + 7);
+    if( 1 > p->every ) {
+      return -1;
+    }
+  } else if( !strncmp(sep + 1, "rate=", 5) ) {
+    p->type = POLICY_RATE;
+    rate = atof(sep + 6);
+    if( 0 >= rate ) {
+      return -1;
+    }
+    p->period = (int64_t)(NSEC_PER_SEC / rate);
+  } else if( !strcmp(sep + 1, "changed") ) {
+    p->type = POLICY_CHANGED;
+  } else {
+    return -1;
+  }
+
+  p->spec = spec;
+  p->filter = strndup(spec, sep - spec);
+  if( NULL == p->filter ) {
+    CRIT("strndup()");
+  }
+  config.num_policies++;
+
+  return 0;
+}
+
+
 /**
  * Parse the commandline arguments. The first argument provided in argv is the 
  * program name.
@@ -145,7 +367,7 @@ void parse_args(int argc, char **argv) {
 	print_usage(*argv);
 	exit(1);
       } else {
-        strncpy(config.mqtt_client_id, argv[i], CONF_MAX_LENGTH_MQTT_CLIENT_ID);
+        snprintf(config.mqtt_client_id, sizeof(config.mqtt_client_id), "%s", argv[i]);
       }
 
     // BROKER
@@ -156,7 +378,7 @@ void parse_args(int argc, char **argv) {
 	print_usage(*argv);
 	exit(1);
       } else {
-        strncpy(config.mqtt_broker, argv[i], CONF_MAX_LENGTH_MQTT_BROKER);
+        snprintf(config.mqtt_broker, sizeof(config.mqtt_broker), "%s", argv[i]);
       }
 
     // TOPIC
@@ -166,7 +388,7 @@ void parse_args(int argc, char **argv) {
 	print_usage(*argv);
 	exit(1);
       } else {
-        strncpy(config.mqtt_topic, argv[i], CONF_MAX_LENGTH_MQTT_TOPIC);
+        snprintf(config.mqtt_topic, sizeof(config.mqtt_topic), "%s", argv[i]);
       }
 
     // PORT
@@ -230,6 +452,199 @@ void parse_args(int argc, char **argv) {
 	}
       }
 
+    // CLOCK
+    } else if( !strcmp(argv[i], "-C") || !strcmp(argv[i], "--clock") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no clock specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        if( !strcmp(argv[i], "monotonic") ) {
+	  config.clock = CLOCK_MONOTONIC;
+	} else if( !strcmp(argv[i], "coarse") ) {
+	  config.clock = CLOCK_MONOTONIC_COARSE;
+	} else {
+          fprintf(stderr, "ERROR: Invalid clock given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // KEYFRAME
+    } else if( !strcmp(argv[i], "-K") || !strcmp(argv[i], "--keyframe") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no interval specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.keyframe_interval = atoi(argv[i]);
+	if( 0 > config.keyframe_interval ) {
+	  fprintf(stderr, "ERROR: Invalid keyframe interval given: %d\n", config.keyframe_interval);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // DEDUP
+    } else if( !strcmp(argv[i], "-d") || !strcmp(argv[i], "--dedup") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no window size specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.dedup_window = atoi(argv[i]);
+	if( 0 > config.dedup_window ) {
+	  fprintf(stderr, "ERROR: Invalid window size given: %d\n", config.dedup_window);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // PARTITION
+    } else if( !strcmp(argv[i], "-P") || !strcmp(argv[i], "--partition") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no number of topic levels specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.partition_levels = atoi(argv[i]);
+	if( 0 > config.partition_levels ) {
+	  fprintf(stderr, "ERROR: Invalid number of topic levels given: %d\n", config.partition_levels);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // STRIPE
+    } else if( !strcmp(argv[i], "-S") || !strcmp(argv[i], "--stripe") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no stripe file specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        if( CONF_MAX_STRIPES == config.num_stripes ) {
+	  fprintf(stderr, "ERROR: More than %d stripe files given.\n", CONF_MAX_STRIPES);
+	  print_usage(*argv);
+	  exit(1);
+	}
+        config.stripe_files[config.num_stripes++] = argv[i];
+      }
+
+    // STRIPE TIME
+    } else if( !strcmp(argv[i], "-B") || !strcmp(argv[i], "--stripe-time") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no time specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.stripe_time = atoi(argv[i]);
+	if( 0 > config.stripe_time ) {
+	  fprintf(stderr, "ERROR: Invalid stripe time given: %d\n", config.stripe_time);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // CRC
+    } else if( !strcmp(argv[i], "-V") || !strcmp(argv[i], "--crc") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no block size specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.crc_block = atol(argv[i]);
+	if( 0 > config.crc_block ) {
+	  fprintf(stderr, "ERROR: Invalid block size given: %ld\n", config.crc_block);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // APPEND
+    } else if( !strcmp(argv[i], "-A") || !strcmp(argv[i], "--append") ) {
+      config.append = 1;
+
+    // FLUSH
+    } else if( !strcmp(argv[i], "-F") || !strcmp(argv[i], "--flush") ) {
+      config.flush = 1;
+
+    // SAMPLE
+    } else if( !strcmp(argv[i], "-s") || !strcmp(argv[i], "--sample") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no sampling policy specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        if( policy_add(argv[i]) ) {
+	  fprintf(stderr, "ERROR: Invalid sampling policy given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // RING
+    } else if( !strcmp(argv[i], "-R") || !strcmp(argv[i], "--ring") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no ring size specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.ring_size = atoi(argv[i]);
+	if( 0 > config.ring_size ) {
+	  fprintf(stderr, "ERROR: Invalid ring size given: %d\n", config.ring_size);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // WINDOW
+    } else if( !strcmp(argv[i], "-W") || !strcmp(argv[i], "--window") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no window specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.ring_window = atoi(argv[i]);
+	if( 0 > config.ring_window ) {
+	  fprintf(stderr, "ERROR: Invalid window given: %d\n", config.ring_window);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // TRIGGER
+    } else if( !strcmp(argv[i], "-T") || !strcmp(argv[i], "--trigger") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no trigger specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.trigger = argv[i];
+        config.trigger_payload = strchr(argv[i], '=');
+        if( NULL != config.trigger_payload ) {
+          *config.trigger_payload++ = '\0';
+        }
+      }
+
+    // DUMP INTERVAL
+    } else if( !strcmp(argv[i], "-I") || !strcmp(argv[i], "--dump-interval") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no interval specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.dump_interval = atoi(argv[i]);
+	if( 0 > config.dump_interval ) {
+	  fprintf(stderr, "ERROR: Invalid dump interval given: %d\n", config.dump_interval);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // EVENT LOOP
+    } else if( !strcmp(argv[i], "-E") || !strcmp(argv[i], "--event-loop") ) {
+      config.event_loop = 1;
+
     // VERBOSE
     } else if( !strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose") ) {
       config.verbose = 1;
@@ -241,138 +656,1103 @@ void parse_args(int argc, char **argv) {
 
     // FILE
     } else {
-      strncpy(config.log_file, argv[i], CONF_MAX_LENGTH_LOG_FILE);
+      snprintf(config.log_file, sizeof(config.log_file), "%s", argv[i]);
     }
   }
 }
 
 void log_callback(struct mosquitto *mosq, void *userdata, int level, char const *str) {
   if( config.verbose ) {
-    printf("%s\n", str);
+    LOG_TRACE(stdout, "%s\n", str);
   }
 }
 
 void connect_callback(struct mosquitto *mosq, void *userdata, int result) {
   if( !result ) {
-    if( gettimeofday(&config.start_time, NULL) ) {
-      CRIT("Could not get time.");
-    }
-
     mosquitto_subscribe(mosq, NULL, config.mqtt_topic, config.mqtt_qos);
   } else {
     CRIT("Connection to broker faild.");
   }
 }
 
-void message_callback(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg) {
-  int i;
-  struct timeval time;
-  
-  if( gettimeofday(&time, NULL) ) {
-    CRIT("Could not get time.");
-  }
-  
-  timersub(&time, &config.start_time, &time);
+/**
+ * A group of topics whose records are written together in chunks.
+ */
+struct partition {
+  int id;
+  char *key;
+  struct mqttlog_writer mem;  // records of the current chunk
+  int64_t first;    // time of the first record in the chunk
+  int64_t last;     // time of the last record in the chunk
+  long records;     // number of records in the chunk
+  size_t keys;      // number of keys of the current keyframe
+};
 
-  if( 0 > sigprocmask(SIG_BLOCK, &config.sigset, NULL ) ) {
-    CRIT("sigprocmask(SIG_BLOCK)");
+/**
+ * Copies the first config.partition_levels levels of a topic into key.
+ */
+void partition_key(const char *topic, char *key, size_t size) {
+  int levels = 0;
+  size_t i;
+
+  for( i = 0; i < size - 1 && topic[i]; i++ ) {
+    if( '/' == topic[i] && config.partition_levels && ++levels == config.partition_levels ) {
+      break;
+    }
+    key[i] = topic[i];
   }
+  key[i] = '\0';
+}
+
+/**
+ * @return The partition of a topic. It is created if it does not exist.
+ */
+struct partition *partition_get(const char *topic) {
+  char key[CONF_MAX_LENGTH_MQTT_TOPIC];
+  struct topic_entry *entry;
+  struct partition *p;
 
-  fprintf(config.fd, "msg");
-  fprintf(config.fd, " %zd.%06zd", time.tv_sec, time.tv_usec);
-  fprintf(config.fd, " %d", msg->qos);
-  fprintf(config.fd, " %d", msg->retain);
-  fprintf(config.fd, " %d", msg->payloadlen);
-  fprintf(config.fd, " %s", msg->topic);
-  fprintf(config.fd, "\n");
+  partition_key(topic, key, sizeof(key));
+
+  entry = topic_table_get(&config.partitions, key, 1);
+  if( NULL == entry ) {
+    CRIT("Could not create partition '%s'.", key);
+  }
 
-  if( 0 < msg->payloadlen ) {
-    fprintf(config.fd, "%02hx", ((unsigned char *)msg->payload)[0]);
+  if( NULL == entry->data ) {
+    p = calloc(1, sizeof(struct partition));
+    if( NULL == p ) {
+      CRIT("calloc()");
+    }
+    p->id = config.num_partitions++;
+    p->key = entry->topic;
+    if( mqttlog_writer_mem(&p->mem) ) {
+      CRIT("Could not create the buffer of partition '%s'.", key);
+    }
+    fprintf(config.parts_fd, "prt %d %s\n", p->id, p->key);
+    entry->data = p;
   }
 
-  for( i = 1; i < msg->payloadlen; i++ ) {
-    fprintf(config.fd, " %02hx", ((unsigned char *)msg->payload)[i]);
+  return (struct partition *)entry->data;
+}
+
+/**
+ * Appends the buffered records of a partition as one chunk to the log file
+ * and lists the chunk in the parts file.
+ */
+void partition_flush(struct partition *p) {
+  struct timespec first, last;
+
+  if( !p->records ) {
+    return;
   }
 
-  fprintf(config.fd, "\n");
+  timespec_from_ns(p->first, &first);
+  timespec_from_ns(p->last, &last);
+  fprintf(config.parts_fd, "chk %d %ld %zu %ld.%09ld %ld.%09ld %ld\n", p->id, config.log.offset, p->mem.len,
+          (long)first.tv_sec, first.tv_nsec, (long)last.tv_sec, last.tv_nsec, p->records);
 
-  if( 0 > sigprocmask(SIG_UNBLOCK, &config.sigset, NULL ) ) {
-    CRIT("sigprocmask(SIG_UNBLOCK)");
+  if( 0 > mqttlog_writer_raw(&config.log, p->mem.buf, p->mem.len) ) {
+    CRIT("Could not write log file.");
   }
+
+  config.buffered -= p->mem.len;
+  p->records = 0;
+  mqttlog_writer_reset(&p->mem);
 }
 
-void sig_handler(int sig) {
-  if( SIGINT != sig ) {
-    CRIT("Got unexpected signal.");
+void partition_flush_entry(struct topic_entry *entry, void *userdata) {
+  partition_flush((struct partition *)entry->data);
+}
+
+/**
+ * Adds the bytes of a record to its partition and flushes the chunk if it is
+ * full. All partitions are flushed if too much is buffered.
+ */
+void partition_account(struct partition *p, const struct timespec *time, long written) {
+  if( !p->records ) {
+    p->first = timespec_to_ns(time);
+  }
+  p->last = timespec_to_ns(time);
+  p->records++;
+  config.buffered += written;
+
+  if( CONF_PARTITION_CHUNK_SIZE <= p->mem.len ) {
+    partition_flush(p);
+  } else if( CONF_PARTITION_MAX_BUFFERED <= config.buffered ) {
+    topic_table_foreach(&config.partitions, partition_flush_entry, NULL);
   }
+}
 
-  mosquitto_disconnect(config.mosq);
+/**
+ * A file the records are distributed to. The message thread encodes the
+ * records into a memory writer and hands its buffer to the thread of the
+ * stripe, which writes it while the next buffer is filled.
+ */
+struct stripe {
+  int id;
+  char file[PATH_MAX];        // absolute path as listed in the stripes file
+  int fd;
+  struct mqttlog_writer mem;  // records not yet handed to the thread
+  size_t keys;                // number of keys of the current keyframe
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *pending;              // buffer written by the thread, NULL if it is idle
+  size_t pending_len;
+  size_t pending_size;
+  char *spare;                // written buffer which is reused for the next records
+  size_t spare_size;
+  int stop;
+  int error;                  // errno of a failed write
+};
 
-  mosquitto_destroy(config.mosq);
+/**
+ * Writes the buffers handed over by the message thread to the stripe file.
+ */
+void *stripe_thread(void *arg) {
+  struct stripe *s = (struct stripe *)arg;
+  size_t done;
+  ssize_t n;
+  int error;
+
+  pthread_mutex_lock(&s->lock);
+  for( ;; ) {
+    while( NULL == s->pending && !s->stop ) {
+      pthread_cond_wait(&s->cond, &s->lock);
+    }
+    if( NULL == s->pending ) {
+      break;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    error = 0;
+    for( done = 0; done < s->pending_len; done += n ) {
+      n = write(s->fd, s->pending + done, s->pending_len - done);
+      if( 0 > n ) {
+        if( EINTR == errno ) {
+          n = 0;
+          continue;
+        }
+        error = errno;
+        break;
+      }
+    }
 
-  mosquitto_lib_cleanup();
+    // Like the single file writer, the index is flushed with every block, so
+    // it survives a crash. It may hold entries of the records encoded in the
+    // meantime, which the recovery drops if their block is missing.
+    if( !error && NULL != s->mem.index_fd && fflush(s->mem.index_fd) ) {
+      error = errno;
+    }
 
-  fclose(config.fd);
+    pthread_mutex_lock(&s->lock);
+    s->spare = s->pending;
+    s->spare_size = s->pending_size;
+    s->pending = NULL;
+    if( error ) {
+      s->error = error;
+    }
+    pthread_cond_signal(&s->cond);
+  }
+  pthread_mutex_unlock(&s->lock);
 
-  exit(0);
+  return NULL;
 }
 
 /**
- * Main!
+ * Hands the encoded records of a stripe to its thread and continues with the
+ * buffer the thread has written before. Waits if the thread is still busy.
  */
-int main(int argc, char **argv) {
-  struct sigaction sigact;
-  struct timeval time;
+void stripe_handoff(struct stripe *s) {
+  if( !s->mem.len ) {
+    return;
+  }
 
-  if( config_init() ) {
-    CRIT("Faild to initialize config.");
+  pthread_mutex_lock(&s->lock);
+  while( NULL != s->pending ) {
+    pthread_cond_wait(&s->cond, &s->lock);
+  }
+  if( s->error ) {
+    errno = s->error;
+    CRIT("Could not write stripe file '%s'.", s->file);
   }
-  
-  parse_args(argc, argv);
 
-  if( !strlen(config.log_file) ) {
-    fprintf(stderr, "ERROR: You have to provide a logfile.\n");
-    print_usage(*argv);
-    exit(1);
+  s->pending = s->mem.buf;
+  s->pending_len = s->mem.len;
+  s->pending_size = s->mem.size;
+  if( NULL != s->spare ) {
+    s->mem.buf = s->spare;
+    s->mem.size = s->spare_size;
+    s->spare = NULL;
+  } else {
+    s->mem.size = CONF_STRIPE_BUFFER;
+    s->mem.buf = malloc(s->mem.size);
+    if( NULL == s->mem.buf ) {
+      CRIT("malloc()");
+    }
   }
+  // the offset continues, so references and the index stay valid
+  s->mem.len = 0;
 
-  config.fd = fopen(config.log_file, "w");
-  if( NULL == config.fd ) {
-    CRIT("Could not open log file.");
+  pthread_cond_signal(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Hands the records of a stripe to its thread once a buffer is full.
+ */
+void stripe_account(struct stripe *s) {
+  if( CONF_STRIPE_BUFFER <= s->mem.len ) {
+    stripe_handoff(s);
   }
+}
 
-  if( gettimeofday(&time, NULL) ) {
-    CRIT("Could not get time.");
+/**
+ * @return The stripe of a record: by the time block with --stripe-time,
+ *         otherwise by the hash of the topic. So the records of a topic
+ *         stay in order.
+ */
+struct stripe *stripe_for(const char *topic, const struct timespec *time) {
+  if( config.stripe_time ) {
+    return &config.stripes[(timespec_to_ns(time) / ((int64_t)config.stripe_time * 1000000)) % config.num_stripes];
   }
+  return &config.stripes[fnv1a(topic, strlen(topic)) % config.num_stripes];
+}
 
-  fprintf(config.fd,"cnf time: %zd.%06zd\n", time.tv_sec, time.tv_usec);
+/**
+ * Creates the stripe files with their own header and index, starts their
+ * threads and lists the files in <logfile>.stripes.
+ */
+void stripes_open(const struct mqttlog_header *header) {
+  char stripes_file[CONF_MAX_LENGTH_LOG_FILE + 16];
+  struct mqttlog_header stripe_header = *header;
+  sigset_t oldset;
+  struct stripe *s;
+  FILE *fd;
+  int i;
 
-  memset(&sigact, 0, sizeof(struct sigaction));
-  sigact.sa_handler = sig_handler;
-  if( sigaction(SIGINT, &sigact, NULL) ) {
-    CRIT("Could not initialize signal handler.");
+  config.stripes = calloc(config.num_stripes, sizeof(struct stripe));
+  if( NULL == config.stripes ) {
+    CRIT("calloc()");
   }
 
-  mosquitto_lib_init();
+  snprintf(stripes_file, sizeof(stripes_file), "%s.stripes", config.log_file);
+  fd = fopen(stripes_file, "w");
+  if( NULL == fd ) {
+    CRIT("Could not open stripes file.");
+  }
+  if( config.stripe_time ) {
+    fprintf(fd, "lay time %d\n", config.stripe_time);
+  } else {
+    fprintf(fd, "lay topic\n");
+  }
 
-  config.mosq = mosquitto_new(config.mqtt_client_id, config.mqtt_clean_session, NULL);
-  if( NULL == config.mosq ) {
-    CRIT("Could not create a mosquitto object.");
+  // every stripe file is a log file of its own
+  stripe_header.stripes = 0;
+
+  // SIGINT has to be handled by the main thread, which joins the stripe threads
+  if( pthread_sigmask(SIG_BLOCK, &config.sigset, &oldset) ) {
+    CRIT("pthread_sigmask()");
   }
 
-  mosquitto_log_callback_set(config.mosq, log_callback);
-  mosquitto_connect_callback_set(config.mosq, connect_callback);
-  mosquitto_message_callback_set(config.mosq, message_callback);
+  for( i = 0; i < config.num_stripes; i++ ) {
+    s = &config.stripes[i];
+    s->id = i;
+    s->fd = open(config.stripe_files[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if( 0 > s->fd ) {
+      CRIT("Could not open stripe file '%s'.", config.stripe_files[i]);
+    }
+    // the player may run in another directory
+    if( NULL == realpath(config.stripe_files[i], s->file) ) {
+      CRIT("Could not resolve path of stripe file '%s'.", config.stripe_files[i]);
+    }
 
-  mosquitto_connect(config.mosq, config.mqtt_broker, config.mqtt_port, config.mqtt_keepalive);
+    if( mqttlog_writer_mem(&s->mem) || mqttlog_writer_header(&s->mem, &stripe_header) ) {
+      CRIT("Could not create the buffer of stripe '%s'.", s->file);
+    }
+    if( mqttlog_writer_index(&s->mem, s->file, MQTTLOG_INDEX_INTERVAL) ) {
+      CRIT("Could not open index file of stripe '%s'.", s->file);
+    }
+
+    if( pthread_mutex_init(&s->lock, NULL) || pthread_cond_init(&s->cond, NULL) || pthread_create(&s->thread, NULL, stripe_thread, s) ) {
+      CRIT("Could not start the thread of stripe '%s'.", s->file);
+    }
+
+    fprintf(fd, "stp %d %s\n", i, s->file);
+  }
+
+  if( pthread_sigmask(SIG_SETMASK, &oldset, NULL) ) {
+    CRIT("pthread_sigmask()");
+  }
+
+  if( fclose(fd) ) {
+    CRIT("Could not write stripes file.");
+  }
+}
+
+/**
+ * Hands the records of all stripes to their threads, see --flush.
+ */
+void stripes_flush() {
+  int i;
 
-  while( !mosquitto_loop_forever(config.mosq, -1, 100) );
+  for( i = 0; i < config.num_stripes; i++ ) {
+    stripe_handoff(&config.stripes[i]);
+  }
+}
+
+/**
+ * Waits for the stripe threads and writes the remaining records of every
+ * stripe with its checksum and index.
+ */
+void stripes_close() {
+  struct stripe *s;
+  int i;
+
+  for( i = 0; i < config.num_stripes; i++ ) {
+    s = &config.stripes[i];
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+  }
+
+  for( i = 0; i < config.num_stripes; i++ ) {
+    s = &config.stripes[i];
+    pthread_join(s->thread, NULL);
+    if( s->error ) {
+      errno = s->error;
+      ERROR("Could not write stripe file '%s'.", s->file);
+    }
+
+    // the rest is written directly
+    s->mem.fd = s->fd;
+    if( mqttlog_writer_close(&s->mem) ) {
+      ERROR("Could not write stripe file '%s'.", s->file);
+    }
+    free(s->spare);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+  }
+
+  free(config.stripes);
+  config.stripes = NULL;
+}
+
+/**
+ * Writes one record, either directly to the log file, to its partition or to
+ * its stripe.
+ */
+void output_record(int type, const struct timespec *time, int qos, int retain, int len, const char *topic, const void *payload) {
+  struct partition *p;
+  struct stripe *s;
+  long written;
+
+  if( config.ring_size ) {
+    if( ring_push(&config.ring, type, timespec_to_ns(time), qos, retain, len, topic, payload) ) {
+      ERROR("Message on '%s' is larger than the ring.", topic);
+    }
+    return;
+  }
+
+  if( config.num_stripes ) {
+    s = stripe_for(topic, time);
+    written = mqttlog_writer_record(&s->mem, type, time, qos, retain, len, topic, payload);
+    stripe_account(s);
+  } else if( 0 > config.partition_levels ) {
+    written = mqttlog_writer_record(&config.log, type, time, qos, retain, len, topic, payload);
+  } else {
+    p = partition_get(topic);
+    written = mqttlog_writer_record(&p->mem, type, time, qos, retain, len, topic, payload);
+    partition_account(p, time, written);
+  }
+
+  if( 0 > written ) {
+    CRIT("Could not write log file.");
+  }
+}
+
+void count_keyframe_entry(struct topic_entry *entry, void *userdata) {
+  partition_get(entry->topic)->keys++;
+}
+
+void count_stripe_keys(struct topic_entry *entry, void *userdata) {
+  stripe_for(entry->topic, (const struct timespec *)userdata)->keys++;
+}
+
+void write_keyframe_header(struct topic_entry *entry, void *userdata) {
+  const struct timespec *time = (const struct timespec *)userdata;
+  struct partition *p = (struct partition *)entry->data;
+
+  if( p->keys ) {
+    partition_account(p, time, mqttlog_writer_keyframe(&p->mem, time, p->keys));
+  }
+}
+
+void write_keyframe_entry(struct topic_entry *entry, void *userdata) {
+  const struct timespec *time = (const struct timespec *)userdata;
+  struct partition *p;
+
+  output_record(MQTTLOG_KEY, time, entry->qos, entry->retain, entry->len, entry->topic, entry->payload);
+
+  if( 0 <= config.partition_levels ) {
+    p = partition_get(entry->topic);
+    p->keys--;
+  }
+}
+
+/**
+ * Writes a keyframe with the last value of every topic seen so far. It starts
+ * with a 'kfm' line which tells the number of following 'key' records. If the
+ * records are partitioned or striped, every partition or stripe gets its own
+ * keyframe.
+ */
+void write_keyframe(const struct timespec *time) {
+  struct stripe *s;
+  int i;
+
+  if( config.ring_size ) {
+    ring_push(&config.ring, MQTTLOG_KEYFRAME, timespec_to_ns(time), 0, 0, config.last_values.count, "", NULL);
+  } else if( config.num_stripes ) {
+    topic_table_foreach(&config.last_values, count_stripe_keys, (void *)time);
+    for( i = 0; i < config.num_stripes; i++ ) {
+      s = &config.stripes[i];
+      if( s->keys && 0 > mqttlog_writer_keyframe(&s->mem, time, s->keys) ) {
+        CRIT("Could not write log file.");
+      }
+      s->keys = 0;
+    }
+  } else if( 0 > config.partition_levels ) {
+    if( 0 > mqttlog_writer_keyframe(&config.log, time, config.last_values.count) ) {
+      CRIT("Could not write log file.");
+    }
+  } else {
+    topic_table_foreach(&config.last_values, count_keyframe_entry, NULL);
+    topic_table_foreach(&config.partitions, write_keyframe_header, (void *)time);
+  }
+  topic_table_foreach(&config.last_values, write_keyframe_entry, (void *)time);
+}
+
+/**
+ * Applies the sampling policy of the topic to a message. The policy of a
+ * topic is looked up once, later messages find it in config.sampled.
+ *
+ * @return 1 if the message is recorded, 0 if it is dropped.
+ */
+int sample_keep(const struct mosquitto_message *msg, const struct timespec *time) {
+  struct topic_entry *entry;
+  struct sample *s;
+  int64_t t = timespec_to_ns(time);
+  bool result;
+  int i;
+
+  entry = topic_table_get(&config.sampled, msg->topic, 1);
+  if( NULL == entry ) {
+    CRIT("Could not store sampling state of '%s'.", msg->topic);
+  }
+
+  if( NULL == entry->data ) {
+    s = calloc(1, sizeof(struct sample));
+    if( NULL == s ) {
+      CRIT("calloc()");
+    }
+    for( i = 0; i < config.num_policies; i++ ) {
+      if( !mosquitto_topic_matches_sub(config.policies[i].filter, msg->topic, &result) && result ) {
+        s->policy = &config.policies[i];
+        break;
+      }
+    }
+    s->next = t;
+    entry->data = s;
+  }
+  s = (struct sample *)entry->data;
+
+  if( NULL == s->policy ) {
+    return 1;
+  }
+
+  switch( s->policy->type ) {
+    case POLICY_EVERY:
+      if( 0 == s->count++ % s->policy->every ) {
+        return 1;
+      }
+      break;
+
+    case POLICY_RATE:
+      if( t >= s->next ) {
+        // keep the rate over time, but do not catch up after a pause
+        s->next = (t - s->next < s->policy->period)?(s->next + s->policy->period):(t + s->policy->period);
+        return 1;
+      }
+      break;
+
+    case POLICY_CHANGED:
+      if( !s->count++ || entry->len != msg->payloadlen || memcmp(entry->payload, msg->payload, msg->payloadlen) ) {
+        if( topic_entry_set(entry, t, msg->qos, msg->retain, msg->payloadlen, msg->payload) ) {
+          CRIT("Could not store last value of '%s'.", msg->topic);
+        }
+        return 1;
+      }
+      break;
+  }
+
+  s->policy->dropped++;
+  return 0;
+}
+
+/**
+ * Writes the number of messages every policy dropped since its last drop
+ * record to the log file.
+ */
+void write_drops(const struct timespec *time) {
+  struct partition *p;
+  struct stripe *s;
+  long written;
+  int i;
+
+  for( i = 0; i < config.num_policies; i++ ) {
+    if( !config.policies[i].dropped ) {
+      continue;
+    }
+    if( config.ring_size ) {
+      ring_push(&config.ring, MQTTLOG_DROP, timespec_to_ns(time), 0, 0, config.policies[i].dropped, config.policies[i].spec, NULL);
+    } else if( config.num_stripes ) {
+      s = stripe_for(config.policies[i].spec, time);
+      if( 0 > mqttlog_writer_drop(&s->mem, time, config.policies[i].dropped, config.policies[i].spec) ) {
+        CRIT("Could not write log file.");
+      }
+      stripe_account(s);
+    } else if( 0 <= config.partition_levels ) {
+      // the drop records get a partition of their own
+      p = partition_get(MQTTLOG_DROP_PARTITION);
+      written = mqttlog_writer_drop(&p->mem, time, config.policies[i].dropped, config.policies[i].spec);
+      if( 0 > written ) {
+        CRIT("Could not write log file.");
+      }
+      partition_account(p, time, written);
+    } else if( 0 > mqttlog_writer_drop(&config.log, time, config.policies[i].dropped, config.policies[i].spec) ) {
+      CRIT("Could not write log file.");
+    }
+    if( config.verbose ) {
+      LOG_TRACE(stdout, "dropped %ld messages: %s\n", config.policies[i].spec, (long)config.policies[i].dropped);
+    }
+    config.policies[i].dropped = 0;
+  }
+}
+
+/**
+ * @return 1 if the message triggers a dump of the ring.
+ */
+int trigger_matches(const struct mosquitto_message *msg) {
+  bool result;
+
+  if( NULL == config.trigger || mosquitto_topic_matches_sub(config.trigger, msg->topic, &result) || !result ) {
+    return 0;
+  }
+
+  return NULL == config.trigger_payload
+      || (strlen(config.trigger_payload) == (size_t)msg->payloadlen && !memcmp(config.trigger_payload, msg->payload, msg->payloadlen));
+}
+
+void message_callback(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg) {
+  struct timespec time;
+  struct topic_entry *entry;
+  
+  if( clock_gettime(config.clock, &time) ) {
+    CRIT("Could not get time.");
+  }
+  
+  timespec_sub(&time, &config.start_time, &time);
+
+  if( 0 > sigprocmask(SIG_BLOCK, &config.sigset, NULL ) ) {
+    CRIT("sigprocmask(SIG_BLOCK)");
+  }
+
+  if( config.ring_size ) {
+    pthread_mutex_lock(&config.ring_lock);
+  }
+
+  if( config.keyframe_interval && timespec_to_ns(&time) >= config.next_keyframe ) {
+    write_keyframe(&time);
+    config.next_keyframe = timespec_to_ns(&time) + (int64_t)config.keyframe_interval * NSEC_PER_SEC;
+  }
+
+  // dropped messages are not serialized at all
+  if( !config.num_policies || sample_keep(msg, &time) ) {
+    if( config.keyframe_interval ) {
+      entry = topic_table_get(&config.last_values, msg->topic, 1);
+      if( NULL == entry || topic_entry_set(entry, timespec_to_ns(&time), msg->qos, msg->retain, msg->payloadlen, msg->payload) ) {
+        CRIT("Could not store last value of '%s'.", msg->topic);
+      }
+    }
+
+    output_record(MQTTLOG_MSG, &time, msg->qos, msg->retain, msg->payloadlen, msg->topic, msg->payload);
+  }
+
+  if( config.flush && config.num_stripes ) {
+    stripes_flush();
+  } else if( config.flush && !config.ring_size && 0 > config.partition_levels && mqttlog_writer_flush(&config.log) ) {
+    CRIT("Could not write log file.");
+  }
+
+  if( config.num_policies && timespec_to_ns(&time) >= config.next_drop_report ) {
+    write_drops(&time);
+    config.next_drop_report = timespec_to_ns(&time) + (int64_t)CONF_DROP_REPORT_INTERVAL * NSEC_PER_SEC;
+  }
+
+  if( config.ring_size ) {
+    if( config.ring_window ) {
+      ring_expire(&config.ring, timespec_to_ns(&time) - (int64_t)config.ring_window * NSEC_PER_SEC);
+    }
+    pthread_mutex_unlock(&config.ring_lock);
+
+    if( trigger_matches(msg) ) {
+      pthread_kill(config.dump_thread, SIGUSR1);
+    }
+  }
+
+  if( 0 > sigprocmask(SIG_UNBLOCK, &config.sigset, NULL ) ) {
+    CRIT("sigprocmask(SIG_UNBLOCK)");
+  }
+}
+
+/**
+ * Flushes the buffered partitions, closes the stripe files and the log file.
+ */
+void close_log() {
+  struct timespec time;
+
+  // in flight recorder mode only the dumps are written
+  if( config.ring_size ) {
+    return;
+  }
+
+  if( config.num_policies ) {
+    if( clock_gettime(config.clock, &time) ) {
+      CRIT("Could not get time.");
+    }
+    timespec_sub(&time, &config.start_time, &time);
+    write_drops(&time);
+  }
+
+  if( 0 <= config.partition_levels ) {
+    topic_table_foreach(&config.partitions, partition_flush_entry, NULL);
+    fclose(config.parts_fd);
+  }
+
+  if( config.num_stripes ) {
+    stripes_close();
+  }
+
+  if( mqttlog_writer_close(&config.log) ) {
+    ERROR("Could not write log file.");
+  }
+}
+
+/**
+ * Creates a new log file and writes its header.
+ */
+void new_log(struct mqttlog_header *header) {
+  if( mqttlog_writer_open(&config.log, config.log_file, 0) ) {
+    CRIT("Could not open log file.");
+  }
+
+  if( 0 <= config.partition_levels ) {
+    char parts_file[CONF_MAX_LENGTH_LOG_FILE + 8];
+
+    snprintf(parts_file, sizeof(parts_file), "%s.parts", config.log_file);
+    config.parts_fd = fopen(parts_file, "w");
+    if( NULL == config.parts_fd ) {
+      CRIT("Could not open parts file.");
+    }
+
+    if( topic_table_init(&config.partitions, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+      CRIT("Could not create the partition table.");
+    }
+  }
+
+  // The wall clock time is only used as anchor of the recording. All messages
+  // are timestamped relative to it with the monotonic clock.
+  if( clock_gettime(CLOCK_REALTIME, &header->anchor) ) {
+    CRIT("Could not get time.");
+  }
+
+  if( clock_gettime(config.clock, &config.start_time) ) {
+    CRIT("Could not get time.");
+  }
+
+  header->dedup_window = config.dedup_window;
+  header->dedup_max_len = DEDUP_DEFAULT_MAX_LEN;
+  header->partition_levels = config.partition_levels;
+  header->crc_block = config.crc_block;
+  header->stripes = config.num_stripes;
+  if( mqttlog_writer_header(&config.log, header) ) {
+    CRIT("Could not write log file.");
+  }
+
+  // the log file keeps only the header, the records go to the stripe files
+  if( config.num_stripes ) {
+    stripes_open(header);
+  }
+}
+
+
+/**
+ * Restores the last value of every topic from the end of an existing log
+ * file, starting at its last keyframe. So the next keyframe is complete.
+ */
+void restore_last_values(struct mqttlog_reader *reader) {
+  struct mqttlog_record rec;
+  struct mqttlog_index idx;
+  struct topic_entry *entry;
+  long keyframe = -1;
+  int ret;
+
+  if( !mqttlog_index_load(&idx, config.log_file) ) {
+    keyframe = mqttlog_index_find(&idx, INT64_MAX, 1);
+    mqttlog_index_free(&idx);
+  } else {
+    while( MQTTLOG_RECORD == mqttlog_reader_next(reader, &rec, 0) ) {
+      if( MQTTLOG_KEYFRAME == rec.type ) {
+        keyframe = rec.offset;
+      }
+    }
+  }
+
+  if( mqttlog_reader_seek(reader, (0 <= keyframe)?(keyframe):(reader->data_start)) ) {
+    CRIT("Could not seek in log file.");
+  }
+
+  while( MQTTLOG_RECORD == (ret = mqttlog_reader_next(reader, &rec, MQTTLOG_MSG | MQTTLOG_KEY)) ) {
+    if( !(rec.type & (MQTTLOG_MSG | MQTTLOG_KEY)) ) {
+      continue;
+    }
+    entry = topic_table_get(&config.last_values, rec.topic, 1);
+    if( NULL == entry || topic_entry_set(entry, timespec_to_ns(&rec.time), rec.qos, rec.retain, rec.len, rec.payload) ) {
+      CRIT("Could not store last value of '%s'.", rec.topic);
+    }
+  }
+
+  if( MQTTLOG_END != ret ) {
+    CRIT("Could not read log file.");
+  }
+}
+
+
+/**
+ * Opens an existing log file to continue it. Its header is returned.
+ */
+void append_log(struct mqttlog_header *header) {
+  struct mqttlog_reader reader;
+  struct timespec now, elapsed;
+
+  if( 0 > mqttlog_recover(config.log_file) ) {
+    CRIT("Could not recover log file.");
+  }
+
+  if( mqttlog_reader_open(&reader, config.log_file) ) {
+    CRIT("Could not open log file.");
+  }
+  *header = reader.header;
+
+  if( 0 <= header->partition_levels ) {
+    CRIT("Partitioned log files can not be continued.");
+  }
+  if( header->stripes ) {
+    CRIT("Striped log files can not be continued.");
+  }
+  if( 0 <= config.partition_levels || header->dedup_window != config.dedup_window || header->crc_block != config.crc_block ) {
+    fprintf(stderr, "WARNING: Continuing with the settings of the existing log file.\n");
+  }
+  config.partition_levels = -1;
+  config.dedup_window = header->dedup_window;
+  config.crc_block = header->crc_block;
+
+  if( config.keyframe_interval ) {
+    restore_last_values(&reader);
+  }
+  mqttlog_reader_close(&reader);
+
+  if( mqttlog_writer_open(&config.log, config.log_file, 1) || mqttlog_writer_continue(&config.log, header) ) {
+    CRIT("Could not open log file.");
+  }
+
+  // The timestamps continue relative to the anchor of the log file.
+  if( clock_gettime(CLOCK_REALTIME, &now) || clock_gettime(config.clock, &config.start_time) ) {
+    CRIT("Could not get time.");
+  }
+  timespec_sub(&now, &header->anchor, &elapsed);
+  timespec_sub(&config.start_time, &elapsed, &config.start_time);
+
+  // the first message writes a keyframe with the restored values
+  if( config.keyframe_interval ) {
+    config.next_keyframe = timespec_to_ns(&elapsed);
+  }
+}
+
+
+/**
+ * Writes the records of the snapshot to a new log file. The file is written
+ * under a temporary name and renamed when it is complete.
+ */
+void flight_write(const char *file) {
+  char tmp[CONF_MAX_LENGTH_LOG_FILE + 64];
+  struct mqttlog_writer w;
+  int ret;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  if( mqttlog_writer_open(&w, tmp, 0) || mqttlog_writer_header(&w, &config.header) ) {
+    ERROR("Could not write dump '%s'.", tmp);
+    return;
+  }
+
+  ret = ring_write(&config.snapshot, &w);
+
+  if( mqttlog_writer_close(&w) || ret || rename(tmp, file) ) {
+    ERROR("Could not write dump '%s'.", file);
+    unlink(tmp);
+  }
+}
+
+
+/**
+ * Dumps the ring to <logfile>.<date>-<time>. Only the copy of the ring into
+ * the snapshot blocks the recording, the file is written afterwards.
+ */
+void flight_dump() {
+  char file[CONF_MAX_LENGTH_LOG_FILE + 32];
+  struct timespec now;
+  struct tm tm;
+  size_t n;
+
+  pthread_mutex_lock(&config.ring_lock);
+  if( config.ring_window ) {
+    if( clock_gettime(config.clock, &now) ) {
+      CRIT("Could not get time.");
+    }
+    timespec_sub(&now, &config.start_time, &now);
+    ring_expire(&config.ring, timespec_to_ns(&now) - (int64_t)config.ring_window * NSEC_PER_SEC);
+  }
+  ring_copy(&config.snapshot, &config.ring);
+  pthread_mutex_unlock(&config.ring_lock);
+
+  if( !config.snapshot.count ) {
+    if( config.verbose ) {
+      log_printf(stdout, "dump: ring is empty\n");
+    }
+    return;
+  }
+
+  if( clock_gettime(CLOCK_REALTIME, &now) ) {
+    CRIT("Could not get time.");
+  }
+  localtime_r(&now.tv_sec, &tm);
+  n = snprintf(file, sizeof(file), "%s.", config.log_file);
+  n += strftime(file + n, sizeof(file) - n, "%Y%m%d-%H%M%S", &tm);
+  snprintf(file + n, sizeof(file) - n, ".%03ld", now.tv_nsec / 1000000);
+
+  flight_write(file);
+
+  if( config.verbose ) {
+    log_printf(stdout, "dump: %zu records to %s\n", config.snapshot.count, file);
+  }
+}
+
+
+/**
+ * Waits for SIGUSR1 or the dump interval and dumps the ring.
+ */
+void *flight_thread(void *arg) {
+  struct timespec timeout;
+  sigset_t set;
+  int sig;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+
+  while(1) {
+    timeout.tv_sec = (config.dump_interval)?(config.dump_interval):(3600);
+    timeout.tv_nsec = 0;
+
+    sig = sigtimedwait(&set, NULL, &timeout);
+    if( 0 > sig && EINTR == errno ) {
+      continue;
+    }
+    if( 0 > sig && (EAGAIN != errno || !config.dump_interval) ) {
+      continue;
+    }
+
+    flight_dump();
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Starts the flight recorder mode. Instead of a log file, the ring buffer is
+ * created. SIGUSR1 is blocked in all other threads, so it is received by the
+ * thread which writes the dumps.
+ */
+void flight_start() {
+  sigset_t set;
+
+  if( ring_init(&config.ring, (size_t)config.ring_size * 1024 * 1024) || ring_init(&config.snapshot, (size_t)config.ring_size * 1024 * 1024) ) {
+    CRIT("Could not allocate the ring buffer.");
+  }
+
+  if( clock_gettime(CLOCK_REALTIME, &config.header.anchor) || clock_gettime(config.clock, &config.start_time) ) {
+    CRIT("Could not get time.");
+  }
+  config.header.dedup_window = config.dedup_window;
+  config.header.dedup_max_len = DEDUP_DEFAULT_MAX_LEN;
+  config.header.partition_levels = -1;
+  config.header.crc_block = config.crc_block;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  if( pthread_sigmask(SIG_BLOCK, &set, NULL) ) {
+    CRIT("pthread_sigmask()");
+  }
+
+  if( pthread_mutex_init(&config.ring_lock, NULL) || pthread_create(&config.dump_thread, NULL, flight_thread, NULL) ) {
+    CRIT("Could not start the dump thread.");
+  }
+}
+
+
+void sig_handler(int sig) {
+  if( SIGINT != sig ) {
+    CRIT("Got unexpected signal.");
+  }
+
+  mosquitto_disconnect(config.mosq);
+
+  mosquitto_destroy(config.mosq);
+
+  mosquitto_lib_cleanup();
+
+  close_log();
+
+  exit(0);
+}
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  struct sigaction sigact;
+  struct mqttlog_header header;
+
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
+  
+  parse_args(argc, argv);
+
+  if( log_start() ) {
+    CRIT("Could not start the log thread.");
+  }
+
+  if( config.keyframe_interval && topic_table_init(&config.last_values, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+    CRIT("Could not create the last value table.");
+  }
+  config.next_keyframe = (int64_t)config.keyframe_interval * NSEC_PER_SEC;
+
+  if( config.num_policies && topic_table_init(&config.sampled, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+    CRIT("Could not create the sampling table.");
+  }
+
+  if( !strlen(config.log_file) ) {
+    fprintf(stderr, "ERROR: You have to provide a logfile.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( config.dedup_window && 0 <= config.partition_levels ) {
+    fprintf(stderr, "ERROR: --dedup and --partition can not be combined.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  // stdout is written unbuffered, without index, parts file or dumps
+  if( !strcmp(config.log_file, "-") ) {
+    if( 0 <= config.partition_levels || config.num_stripes || config.append || config.ring_size || config.verbose ) {
+      fprintf(stderr, "ERROR: --partition, --stripe, --append, --ring and --verbose can not be used with stdout.\n");
+      print_usage(*argv);
+      exit(1);
+    }
+    config.flush = 1;
+  }
+
+  if( config.ring_size && (0 <= config.partition_levels || config.append) ) {
+    fprintf(stderr, "ERROR: --ring can not be combined with --partition or --append.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( config.num_stripes && (0 <= config.partition_levels || config.append || config.ring_size) ) {
+    fprintf(stderr, "ERROR: --stripe can not be combined with --partition, --append or --ring.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( config.ring_size ) {
+    flight_start();
+  } else if( config.append && !access(config.log_file, F_OK) ) {
+    append_log(&header);
+  } else {
+    new_log(&header);
+  }
+
+  // The index lets the player seek without reading the whole log. The chunks
+  // of a partitioned log are listed in the parts file instead, every stripe
+  // file has its own index.
+  if( !config.ring_size && 0 > config.partition_levels && !config.num_stripes && strcmp(config.log_file, "-") && mqttlog_writer_index(&config.log, config.log_file, MQTTLOG_INDEX_INTERVAL) ) {
+    CRIT("Could not open index file.");
+  }
+
+  // the player can read the header before the first message
+  if( config.flush && !config.ring_size && mqttlog_writer_flush(&config.log) ) {
+    CRIT("Could not write log file.");
+  }
+
+  memset(&sigact, 0, sizeof(struct sigaction));
+  sigact.sa_handler = sig_handler;
+  if( sigaction(SIGINT, &sigact, NULL) ) {
+    CRIT("Could not initialize signal handler.");
+  }
+
+  mosquitto_lib_init();
+
+  config.mosq = mosquitto_new(config.mqtt_client_id, config.mqtt_clean_session, NULL);
+  if( NULL == config.mosq ) {
+    CRIT("Could not create a mosquitto object.");
+  }
+
+  mosquitto_log_callback_set(config.mosq, log_callback);
+  mosquitto_connect_callback_set(config.mosq, connect_callback);
+  mosquitto_message_callback_set(config.mosq, message_callback);
+
+  mosquitto_connect(config.mosq, config.mqtt_broker, config.mqtt_port, config.mqtt_keepalive);
+
+  if( config.event_loop ) {
+    struct evloop loop;
+
+    if( evloop_init(&loop) || evloop_add(&loop, config.mosq) || evloop_wait(&loop, NULL) ) {
+      CRIT("Event loop failed.");
+    }
+  } else {
+    while( !mosquitto_loop_forever(config.mosq, -1, 100) );
+  }
 
   mosquitto_destroy(config.mosq);
 
   mosquitto_lib_cleanup();
 
-  fclose(config.fd);
+  close_log();
 
   return 0;
 }
@@ -0,0 +1,601 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <mosquitto.h>
+#include "config.h"
+#include "log.h"
+#include "mqttlog.h"
+#include "timespec.h"
+#include "rewrite.h"
+
+struct _conf {
+  #define CONF_DEFAULT_DURATION  100  // ms per benchmark
+  #define CONF_DURATION_ENV  "MQTTLOG_BENCH_DURATION"  // duration if --duration is not given, for the smoke run of make check
+  int duration;
+
+  #define CONF_DEFAULT_TOLERANCE  2.0
+  double tolerance;     // allowed factor over the baseline
+
+  char *baseline;       // compare with this file, NULL if not
+  char *write_baseline; // write the results to this file, NULL if not
+
+  #define CONF_SLEEP_INTERVAL  1000000L  // ns between two deadlines
+  #define CONF_READ_SIZE  (16 * 1024 * 1024)  // bytes of records read at once
+
+  struct result *results;
+  int num_results;
+
+} config;
+
+
+/**
+ * Measured time of one benchmark.
+ */
+struct result {
+  char name[64];
+  double ns;            // per record
+  double gbps;          // payload bytes, 0 if not applicable
+};
+
+
+/**
+ * Payload sizes of the codec benchmarks.
+ */
+static const int sizes[] = { 0, 16, 256, 4096, 65536, 262144 };
+#define NUM_SIZES  (sizeof(sizes) / sizeof(*sizes))
+
+
+/**
+ * Topics and filters of the topic matching benchmark, as given to --filter.
+ */
+static const char *topics[] = { "dev/17/temp", "dev/17/hum", "home/kitchen/light/state", "sys/broker/load/1min", "a" };
+static const char *filters[] = { "dev/+/hum", "home/#", "sys/broker/+/5min", "#", "a/b" };
+#define NUM_TOPICS   (sizeof(topics) / sizeof(*topics))
+#define NUM_FILTERS  (sizeof(filters) / sizeof(*filters))
+
+
+/**
+ * Initialize the configuration. Have to be called befor using the config variable.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int config_init() {
+  char *env = getenv(CONF_DURATION_ENV);
+
+  config.duration       = (NULL != env && 0 < atoi(env))?(atoi(env)):(CONF_DEFAULT_DURATION);
+  config.tolerance      = CONF_DEFAULT_TOLERANCE;
+  config.baseline       = NULL;
+  config.write_baseline = NULL;
+  config.results        = NULL;
+  config.num_results    = 0;
+
+  return 0;
+}
+
+
+/**
+ * Prints the usage message of the program.
+ *
+ * @param progname Name of the program.
+ */
+void print_usage(char *progname) {
+  printf("Usage: %s [options]\n\n", progname);
+  printf("Measures the hot paths of mqttrecorder and mqttplayer without a broker: writing and\n");
+  printf("parsing records, hex encoding and decoding for payloads from 0 B to 256 KB, topic\n");
+  printf("matching and the accuracy of the playback deadlines.\n\n");
+  printf("Options: \n");
+  printf("-d --duration       Time in ms spent on every benchmark.\n");
+  printf("                    Default value: $%s or %d\n", CONF_DURATION_ENV, CONF_DEFAULT_DURATION);
+  printf("-b --baseline       Compare the results with a baseline file and fail if a benchmark\n");
+  printf("                    is slower than the tolerance allows.\n");
+  printf("-t --tolerance      Factor by which a benchmark may be slower than its baseline.\n");
+  printf("                    Default value: %.1f\n", CONF_DEFAULT_TOLERANCE);
+  printf("-w --write-baseline Write the results as new baseline file.\n");
+  printf("-h --help           Print this help message.\n");
+}
+
+
+/**
+ * Parse the commandline arguments. The first argument provided in argv is the
+ * program name.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of arguments. The first string is the program name.
+ */
+void parse_args(int argc, char **argv) {
+  int i;
+
+  for(i = 1; i < argc; i++) {
+
+    // DURATION
+    if( !strcmp(argv[i], "-d") || !strcmp(argv[i], "--duration") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no duration specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.duration = atoi(argv[i]);
+	if( 1 > config.duration ) {
+	  fprintf(stderr, "ERROR: Invalid duration given: %d\n", config.duration);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // BASELINE
+    } else if( !strcmp(argv[i], "-b") || !strcmp(argv[i], "--baseline") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no baseline file specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.baseline = argv[i];
+      }
+
+    // TOLERANCE
+    } else if( !strcmp(argv[i], "-t") || !strcmp(argv[i], "--tolerance") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no tolerance specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.tolerance = atof(argv[i]);
+	if( 1.0 > config.tolerance ) {
+	  fprintf(stderr, "ERROR: Invalid tolerance given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // WRITE BASELINE
+    } else if( !strcmp(argv[i], "-w") || !strcmp(argv[i], "--write-baseline") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no baseline file specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.write_baseline = argv[i];
+      }
+
+    // HELP
+    } else if( !strcmp(argv[i], "-h") || !strcmp(argv[i], "--help") ) {
+      print_usage(*argv);
+      exit(0);
+
+    } else {
+      fprintf(stderr, "ERROR: Unknown parameter '%s'.\n", argv[i]);
+      print_usage(*argv);
+      exit(1);
+    }
+  }
+}
+
+
+/**
+ * @return The monotonic time in ns.
+ */
+int64_t now() {
+  struct timespec ts;
+
+  if( clock_gettime(CLOCK_MONOTONIC, &ts) ) {
+    CRIT("Could not get time.");
+  }
+  return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/**
+ * Stores and prints the result of a benchmark.
+ *
+ * @param records Number of records processed.
+ * @param bytes Number of payload bytes processed, 0 if not applicable.
+ * @param ns Time spent in ns.
+ */
+void report(const char *name, long records, double bytes, int64_t ns) {
+  struct result *res;
+
+  config.results = realloc(config.results, (config.num_results + 1) * sizeof(struct result));
+  if( NULL == config.results ) {
+    CRIT("realloc()");
+  }
+  res = &config.results[config.num_results++];
+
+  snprintf(res->name, sizeof(res->name), "%s", name);
+  res->ns = (double)ns / records;
+  res->gbps = bytes / ns;
+
+  if( bytes ) {
+    printf("%-24s %12.1f ns/record %8.3f GB/s\n", res->name, res->ns, res->gbps);
+  } else {
+    printf("%-24s %12.1f ns/record\n", res->name, res->ns);
+  }
+}
+
+
+/**
+ * Fills a payload with bytes which do not repeat within a record.
+ */
+void fill_payload(uint8_t *payload, int len) {
+  int i;
+
+  for( i = 0; i < len; i++ ) {
+    payload[i] = (uint8_t)(i * 131 + (i >> 8));
+  }
+}
+
+
+/**
+ * Writes records into memory like the recorder's message_callback().
+ */
+void bench_record_write(int len, const uint8_t *payload) {
+  struct mqttlog_writer w;
+  struct timespec t = { 0, 0 };
+  char name[64];
+  long records = 0;
+  int64_t start, end;
+  int i;
+
+  if( mqttlog_writer_mem(&w) ) {
+    CRIT("Could not create writer.");
+  }
+
+  start = now();
+  end = start + config.duration * 1000000L;
+  do {
+    for( i = 0; i < 64; i++ ) {
+      t.tv_nsec = (t.tv_nsec + 1000) % NSEC_PER_SEC;
+      if( 0 > mqttlog_writer_record(&w, MQTTLOG_MSG, &t, 1, 0, len, "dev/17/temp", payload) ) {
+        CRIT("Could not write record.");
+      }
+    }
+    records += i;
+    mqttlog_writer_reset(&w);
+  } while( now() < end );
+
+  snprintf(name, sizeof(name), "record-write/%d", len);
+  report(name, records, (double)records * len, now() - start);
+
+  mqttlog_writer_close(&w);
+}
+
+
+/**
+ * Parses records of a log file like the player, with decoded payloads.
+ */
+void bench_record_read(int len, const uint8_t *payload) {
+  struct mqttlog_writer w;
+  struct mqttlog_reader r;
+  struct mqttlog_header header;
+  struct mqttlog_record rec;
+  struct timespec t = { 0, 0 };
+  char path[] = "/tmp/mqttlog-bench.XXXXXX";
+  char name[64];
+  long records = 0, count, i;
+  int64_t start, end;
+  int fd, ret;
+
+  fd = mkstemp(path);
+  if( 0 > fd || mqttlog_writer_fdopen(&w, fd) ) {
+    CRIT("Could not create temporary log file.");
+  }
+
+  memset(&header, 0, sizeof(struct mqttlog_header));
+  header.partition_levels = -1;
+  count = CONF_READ_SIZE / (3 * len + 64) + 1;
+  if( mqttlog_writer_header(&w, &header) ) {
+    CRIT("Could not write header.");
+  }
+  for( i = 0; i < count; i++ ) {
+    t.tv_nsec = (t.tv_nsec + 1000) % NSEC_PER_SEC;
+    if( 0 > mqttlog_writer_record(&w, MQTTLOG_MSG, &t, 1, 0, len, "dev/17/temp", payload) ) {
+      CRIT("Could not write record.");
+    }
+  }
+  if( mqttlog_writer_close(&w) || mqttlog_reader_open(&r, path) ) {
+    CRIT("Could not reopen temporary log file.");
+  }
+  unlink(path);
+
+  start = now();
+  end = start + config.duration * 1000000L;
+  do {
+    if( mqttlog_reader_seek(&r, r.data_start) ) {
+      CRIT("Could not seek in temporary log file.");
+    }
+    while( MQTTLOG_RECORD == (ret = mqttlog_reader_next(&r, &rec, MQTTLOG_MSG)) ) {
+      records++;
+    }
+    if( MQTTLOG_END != ret ) {
+      CRIT("Could not read temporary log file.");
+    }
+  } while( now() < end );
+
+  snprintf(name, sizeof(name), "record-read/%d", len);
+  report(name, records, (double)records * len, now() - start);
+
+  mqttlog_reader_close(&r);
+}
+
+
+/**
+ * Encodes and decodes payloads as hex bytes.
+ */
+void bench_hex(int len, const uint8_t *payload) {
+  uint8_t *decoded;
+  char *hex;
+  char name[64];
+  size_t hex_len;
+  long records;
+  int64_t start, end;
+  int i;
+
+  hex = malloc(3 * len + 1);
+  decoded = malloc(len + 1);
+  if( NULL == hex || NULL == decoded ) {
+    CRIT("malloc()");
+  }
+
+  records = 0;
+  start = now();
+  end = start + config.duration * 1000000L;
+  do {
+    for( i = 0; i < 16; i++ ) {
+      hex_len = mqttlog_hex_encode(payload, len, hex);
+    }
+    records += i;
+  } while( now() < end );
+
+  snprintf(name, sizeof(name), "hex-encode/%d", len);
+  report(name, records, (double)records * len, now() - start);
+
+  records = 0;
+  start = now();
+  end = start + config.duration * 1000000L;
+  do {
+    for( i = 0; i < 16; i++ ) {
+      if( mqttlog_hex_decode(hex, hex_len, decoded, len) ) {
+        CRIT("Could not decode payload.");
+      }
+    }
+    records += i;
+  } while( now() < end );
+
+  snprintf(name, sizeof(name), "hex-decode/%d", len);
+  report(name, records, (double)records * len, now() - start);
+
+  if( memcmp(payload, decoded, len) ) {
+    CRIT("Decoded payload differs.");
+  }
+
+  free(hex);
+  free(decoded);
+}
+
+
+/**
+ * Shifts the timestamp at the end of a JSON payload like --timestamp of the
+ * player.
+ */
+void bench_rewrite(int len) {
+  struct rewrite rule;
+  char spec[] = "#:json=ts";
+  const char *tail = "\",\"ts\": 1700000000000}";
+  char *json;
+  uint8_t *buf = NULL;
+  size_t size = 0;
+  char name[64];
+  long records = 0, n = 0;
+  int64_t start, end;
+  int i;
+
+  if( rewrite_parse(&rule, spec) ) {
+    CRIT("Could not parse rule.");
+  }
+
+  json = malloc(len + 1);
+  if( NULL == json ) {
+    CRIT("malloc()");
+  }
+  memset(json, 'x', len);
+  memcpy(json, "{\"v\":\"", 6);
+  memcpy(json + len - strlen(tail), tail, strlen(tail));
+
+  start = now();
+  end = start + config.duration * 1000000L;
+  do {
+    for( i = 0; i < 16; i++ ) {
+      n = rewrite_apply(&rule, (uint8_t *)json, len, 3600000000000LL, &buf, &size);
+    }
+    records += i;
+  } while( now() < end );
+
+  snprintf(name, sizeof(name), "rewrite-json/%d", len);
+  report(name, records, (double)records * len, now() - start);
+
+  if( n != len || memcmp(buf + len - 14, "1700003600000}", 14) ) {
+    CRIT("Rewritten payload differs.");
+  }
+
+  free(json);
+  free(buf);
+  rewrite_free(&rule);
+}
+
+
+/**
+ * Matches topics against filters like --filter of the player.
+ */
+void bench_topic_match() {
+  long records = 0;
+  int64_t start, end;
+  size_t t, f;
+  bool result;
+
+  start = now();
+  end = start + config.duration * 1000000L;
+  do {
+    for( t = 0; t < NUM_TOPICS; t++ ) {
+      for( f = 0; f < NUM_FILTERS; f++ ) {
+        mosquitto_topic_matches_sub(filters[f], topics[t], &result);
+      }
+    }
+    records += NUM_TOPICS * NUM_FILTERS;
+  } while( now() < end );
+
+  report("topic-match", records, 0, now() - start);
+}
+
+
+/**
+ * Sleeps until deadlines like the player between two messages and prints how
+ * late it wakes up on average. It depends on the load of the host, so it is
+ * not part of the baseline.
+ */
+void bench_sleep() {
+  struct timespec deadline, step = { 0, CONF_SLEEP_INTERVAL };
+  long records = 0;
+  int64_t late = 0, end;
+  int ret;
+
+  if( clock_gettime(CLOCK_MONOTONIC, &deadline) ) {
+    CRIT("Could not get time.");
+  }
+  end = now() + config.duration * 1000000L;
+
+  do {
+    timespec_add(&deadline, &step, &deadline);
+    while( (ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) ) {
+      if( EINTR != ret ) {
+        errno = ret;
+        CRIT("clock_nanosleep()");
+      }
+    }
+    late += now() - ((int64_t)deadline.tv_sec * NSEC_PER_SEC + deadline.tv_nsec);
+    records++;
+  } while( now() < end );
+
+  printf("%-24s %12.1f ns late\n", "sleep", (double)late / records);
+}
+
+
+/**
+ * Compares the results with a baseline file of lines "<name> <ns per record>".
+ *
+ * @return 0 if no benchmark is slower than the tolerance allows, otherwise something else.
+ */
+int baseline_compare(const char *path) {
+  FILE *fd;
+  char name[64];
+  double ns;
+  int i, ret = 0;
+
+  fd = fopen(path, "r");
+  if( NULL == fd ) {
+    ERROR("Could not open baseline '%s'.", path);
+    return -1;
+  }
+
+  while( 2 == fscanf(fd, "%63s %lf", name, &ns) ) {
+    for( i = 0; i < config.num_results; i++ ) {
+      if( !strcmp(config.results[i].name, name) ) {
+        break;
+      }
+    }
+    if( i == config.num_results ) {
+      continue;
+    }
+    if( config.results[i].ns > ns * config.tolerance ) {
+      printf("REGRESSION %s: %.1f ns/record, baseline %.1f ns/record\n", name, config.results[i].ns, ns);
+      ret = -1;
+    }
+  }
+  fclose(fd);
+
+  return ret;
+}
+
+
+/**
+ * Writes the results as baseline file.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int baseline_write(const char *path) {
+  FILE *fd;
+  int i;
+
+  fd = fopen(path, "w");
+  if( NULL == fd ) {
+    return -1;
+  }
+  for( i = 0; i < config.num_results; i++ ) {
+    fprintf(fd, "%s %.1f\n", config.results[i].name, config.results[i].ns);
+  }
+
+  return fclose(fd);
+}
+
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  uint8_t *payload;
+  size_t i;
+  int ret = 0;
+
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
+
+  parse_args(argc, argv);
+
+  payload = malloc(sizes[NUM_SIZES - 1]);
+  if( NULL == payload ) {
+    CRIT("malloc()");
+  }
+  fill_payload(payload, sizes[NUM_SIZES - 1]);
+
+  for( i = 0; i < NUM_SIZES; i++ ) {
+    bench_record_write(sizes[i], payload);
+    bench_record_read(sizes[i], payload);
+    bench_hex(sizes[i], payload);
+  }
+  for( i = 0; i < NUM_SIZES; i++ ) {
+    if( 64 <= sizes[i] ) {
+      bench_rewrite(sizes[i]);
+    }
+  }
+  bench_topic_match();
+  bench_sleep();
+
+  if( NULL != config.write_baseline && baseline_write(config.write_baseline) ) {
+    CRIT("Could not write baseline '%s'.", config.write_baseline);
+  }
+
+  if( NULL != config.baseline && baseline_compare(config.baseline) ) {
+    ret = 1;
+  }
+
+  free(payload);
+  free(config.results);
+
+  return ret;
+}
@@ -0,0 +1,408 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "log.h"
+#include "mqttlog.h"
+
+struct _conf {
+  #define CONF_DEFAULT_JOBS  0  // number of online CPUs
+  int jobs;
+
+  #define CONF_DEFAULT_RECOVER  0
+  int recover;
+
+  #define CONF_DEFAULT_VERBOSE  0
+  int verbose;
+
+  // log files to check
+  char **files;
+  int num_files;
+
+} config;
+
+
+/**
+ * A block of a log file protected by a crc line.
+ */
+struct block {
+  long start;   // first byte of the block
+  long end;     // end of the crc line
+  int ok;
+};
+
+
+/**
+ * Work of one thread: the crc lines starting in [from, to).
+ */
+struct job {
+  pthread_t thread;
+  const char *data;
+  long size;
+  long from;
+  long to;
+  struct block *blocks;
+  size_t num_blocks;
+  size_t size_blocks;
+};
+
+
+/**
+ * Initialize the configuration. Have to be called befor using the config variable.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int config_init() {
+  config.jobs      = CONF_DEFAULT_JOBS;
+  config.recover   = CONF_DEFAULT_RECOVER;
+  config.verbose   = CONF_DEFAULT_VERBOSE;
+  config.files     = NULL;
+  config.num_files = 0;
+
+  return 0;
+}
+
+
+/**
+ * Prints the usage message of the program.
+ *
+ * @param progname Name of the program.
+ */
+void print_usage(char *progname) {
+  printf("Usage: %s [options] <logfile> [<logfile> ...]\n\n", progname);
+  printf("Checks log files of mqttrecorder and reports damaged byte ranges. The crc lines of\n");
+  printf("a log file are verified in parallel. Records after the last crc line and log files\n");
+  printf("without checksums are checked by parsing them.\n\n");
+  printf("Options: \n");
+  printf("-j --jobs           Number of threads.\n");
+  printf("                    Default value: number of CPUs\n");
+  printf("-r --recover        Truncate damaged log files after their last valid record.\n");
+  printf("-v --verbose        Print alot information to stdout.\n");
+  printf("-h --help           Print this help message.\n");
+}
+
+
+/**
+ * Parse the commandline arguments. The first argument provided in argv is the
+ * program name.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of arguments. The first string is the program name.
+ */
+void parse_args(int argc, char **argv) {
+  int i;
+
+  for(i = 1; i < argc; i++) {
+
+    // JOBS
+    if( !strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no number of threads specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.jobs = atoi(argv[i]);
+	if( 1 > config.jobs ) {
+	  fprintf(stderr, "ERROR: Invalid number of threads given: %d\n", config.jobs);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // RECOVER
+    } else if( !strcmp(argv[i], "-r") || !strcmp(argv[i], "--recover") ) {
+      config.recover = 1;
+
+    // VERBOSE
+    } else if( !strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose") ) {
+      config.verbose = 1;
+
+    // HELP
+    } else if( !strcmp(argv[i], "-h") || !strcmp(argv[i], "--help") ) {
+      print_usage(*argv);
+      exit(0);
+
+    } else if( '-' == *argv[i] ) {
+      fprintf(stderr, "ERROR: Unknown parameter '%s'.\n", argv[i]);
+      print_usage(*argv);
+      exit(1);
+
+    // FILE
+    } else {
+      config.files = realloc(config.files, (config.num_files + 1) * sizeof(char *));
+      if( NULL == config.files ) {
+        CRIT("realloc()");
+      }
+      config.files[config.num_files++] = argv[i];
+    }
+  }
+}
+
+
+/**
+ * Adds a checked block to the results of a job.
+ */
+void job_add(struct job *job, long start, long end, int ok) {
+  if( job->num_blocks == job->size_blocks ) {
+    job->size_blocks = (job->size_blocks)?(2 * job->size_blocks):(64);
+    job->blocks = realloc(job->blocks, job->size_blocks * sizeof(struct block));
+    if( NULL == job->blocks ) {
+      CRIT("realloc()");
+    }
+  }
+
+  job->blocks[job->num_blocks].start = start;
+  job->blocks[job->num_blocks].end = end;
+  job->blocks[job->num_blocks].ok = ok;
+  job->num_blocks++;
+}
+
+
+/**
+ * Verifies the blocks of all crc lines which start in the range of the job.
+ * A line starting with "crc " is always a crc line, payload lines only
+ * contain hex digits or a reference.
+ */
+void *job_run(void *arg) {
+  struct job *job = (struct job *)arg;
+  const char *data = job->data;
+  const char *p, *nl;
+  unsigned int crc;
+  long pos, length, end;
+  int n;
+  char line[64];
+
+  // the first line starting in the range
+  pos = job->from;
+  if( pos ) {
+    nl = memchr(data + pos - 1, '\n', job->size - pos + 1);
+    pos = (NULL == nl)?(job->size):(nl + 1 - data);
+  }
+
+  while( pos < job->to ) {
+    p = data + pos;
+    nl = memchr(p, '\n', job->size - pos);
+    end = (NULL == nl)?(job->size):(nl + 1 - data);
+
+    if( 4 <= end - pos && !memcmp(p, "crc ", 4) ) {
+      n = (end - pos < (long)sizeof(line))?(end - pos):(sizeof(line) - 1);
+      memcpy(line, p, n);
+      line[n] = '\0';
+
+      if( NULL != nl && 2 == sscanf(line, "crc %8x %ld", &crc, &length) && 0 < length && length <= pos ) {
+        job_add(job, pos - length, end, crc == mqttlog_crc32c(0, data + pos - length, length));
+      } else {
+        // damaged crc line
+        job_add(job, pos, end, 0);
+      }
+    }
+
+    pos = end;
+  }
+
+  return NULL;
+}
+
+
+int block_cmp(const void *a, const void *b) {
+  const struct block *x = (const struct block *)a;
+  const struct block *y = (const struct block *)b;
+
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+
+/**
+ * Parses the records of a log file from an offset to its end.
+ *
+ * @return The offset of the first damaged record or -1 if all are valid.
+ */
+long check_records(const char *file, long offset) {
+  struct mqttlog_reader reader;
+  struct mqttlog_record rec;
+  long damaged;
+  int ret;
+
+  if( mqttlog_reader_open(&reader, file) ) {
+    CRIT("Could not open log file '%s'.", file);
+  }
+
+  if( offset > reader.data_start && mqttlog_reader_seek(&reader, offset) ) {
+    CRIT("Could not seek in '%s'.", file);
+  }
+
+  while( MQTTLOG_RECORD == (ret = mqttlog_reader_next(&reader, &rec, MQTTLOG_MSG | MQTTLOG_KEY)) );
+
+  damaged = (MQTTLOG_END == ret)?(-1):(mqttlog_reader_tell(&reader));
+  mqttlog_reader_close(&reader);
+
+  return damaged;
+}
+
+
+/**
+ * Checks one log file and prints the damaged ranges.
+ *
+ * @return 0 if the log file is valid, otherwise something else.
+ */
+int check_file(const char *file) {
+  struct mqttlog_reader reader;
+  struct job *jobs;
+  struct block *blocks = NULL;
+  struct stat st;
+  size_t num_blocks = 0;
+  long cursor = 0, checked = 0, damaged, length;
+  const char *data;
+  int fd, i, ret = 0;
+  size_t j;
+
+  if( mqttlog_reader_open(&reader, file) ) {
+    fprintf(stderr, "%s: could not open\n", file);
+    return -1;
+  }
+  mqttlog_reader_close(&reader);
+
+  fd = open(file, O_RDONLY);
+  if( 0 > fd || fstat(fd, &st) ) {
+    CRIT("Could not open log file '%s'.", file);
+  }
+
+  if( reader.header.crc_block && st.st_size ) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if( MAP_FAILED == data ) {
+      CRIT("Could not map log file '%s'.", file);
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    jobs = calloc(config.jobs, sizeof(struct job));
+    if( NULL == jobs ) {
+      CRIT("calloc()");
+    }
+
+    for( i = 0; i < config.jobs; i++ ) {
+      jobs[i].data = data;
+      jobs[i].size = st.st_size;
+      jobs[i].from = st.st_size / config.jobs * i;
+      jobs[i].to = (i + 1 == config.jobs)?(st.st_size):(st.st_size / config.jobs * (i + 1));
+      if( pthread_create(&jobs[i].thread, NULL, job_run, &jobs[i]) ) {
+        CRIT("Could not start thread.");
+      }
+    }
+
+    for( i = 0; i < config.jobs; i++ ) {
+      pthread_join(jobs[i].thread, NULL);
+      blocks = realloc(blocks, (num_blocks + jobs[i].num_blocks) * sizeof(struct block));
+      if( NULL == blocks && jobs[i].num_blocks ) {
+        CRIT("realloc()");
+      }
+      memcpy(blocks + num_blocks, jobs[i].blocks, jobs[i].num_blocks * sizeof(struct block));
+      num_blocks += jobs[i].num_blocks;
+      free(jobs[i].blocks);
+    }
+    free(jobs);
+    munmap((void *)data, st.st_size);
+
+    qsort(blocks, num_blocks, sizeof(struct block), block_cmp);
+
+    for( j = 0; j < num_blocks; j++ ) {
+      if( blocks[j].start > cursor ) {
+        printf("%s: damaged %ld-%ld: not covered by a checksum\n", file, cursor, blocks[j].start);
+        ret = -1;
+      } else if( blocks[j].start < cursor ) {
+        printf("%s: damaged %ld-%ld: overlapping checksums\n", file, blocks[j].start, blocks[j].end);
+        ret = -1;
+      }
+      if( blocks[j].ok ) {
+        checked += blocks[j].end - blocks[j].start;
+      } else {
+        printf("%s: damaged %ld-%ld: checksum mismatch\n", file, blocks[j].start, blocks[j].end);
+        ret = -1;
+      }
+      if( blocks[j].end > cursor ) {
+        cursor = blocks[j].end;
+      }
+    }
+    free(blocks);
+  }
+  close(fd);
+
+  // records after the last crc line or in a log without checksums
+  if( cursor < st.st_size ) {
+    damaged = check_records(file, cursor);
+    if( 0 <= damaged ) {
+      printf("%s: damaged %ld-%ld: %s\n", file, damaged, (long)st.st_size, (reader.header.crc_block)?("invalid or incomplete record without checksum"):("invalid or incomplete record"));
+      ret = -1;
+    } else if( reader.header.crc_block ) {
+      printf("%s: unverified %ld-%ld: valid records without checksum\n", file, cursor, (long)st.st_size);
+    }
+  }
+
+  if( config.verbose || !ret ) {
+    printf("%s: %zu blocks, %ld of %ld bytes verified by checksum\n", file, num_blocks, checked, (long)st.st_size);
+  }
+
+  if( ret && config.recover ) {
+    length = mqttlog_recover(file);
+    if( 0 > length ) {
+      ERROR("Could not recover '%s'.", file);
+    } else {
+      printf("%s: truncated to %ld bytes\n", file, length);
+    }
+  }
+
+  return ret;
+}
+
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  int i, ret = 0;
+
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
+
+  parse_args(argc, argv);
+
+  if( !config.num_files ) {
+    fprintf(stderr, "ERROR: You have to provide a logfile.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( !config.jobs ) {
+    config.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if( 1 > config.jobs ) {
+      config.jobs = 1;
+    }
+  }
+
+  for( i = 0; i < config.num_files; i++ ) {
+    if( check_file(config.files[i]) ) {
+      ret = 1;
+    }
+  }
+
+  free(config.files);
+
+  return ret;
+}
@@ -0,0 +1,799 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "log.h"
+#include "mqttlog.h"
+#include "timespec.h"
+#include "topic-table.h"
+
+#define PATH_SIZE  4096
+
+struct _conf {
+  #define CONF_DEFAULT_START  0
+  int64_t start;        // ns relative to the recording start
+
+  #define CONF_DEFAULT_END  INT64_MAX
+  int64_t end;
+
+  #define CONF_DEFAULT_SPLIT  0
+  int64_t split;        // length of a piece in ns, 0 for one output
+
+  #define CONF_DEFAULT_OUTPUT  NULL
+  char *output;
+
+  #define CONF_DEFAULT_VERBOSE  0
+  int verbose;
+
+  // log files to cut or concatenate
+  char **files;
+  int num_files;
+
+} config;
+
+
+/**
+ * A log file to read from.
+ */
+struct source {
+  const char *file;
+  struct mqttlog_reader reader;
+  struct mqttlog_index index;   // empty if the log file has no index
+};
+
+
+/**
+ * A log file being written.
+ */
+struct output {
+  const char *file;
+  struct mqttlog_writer writer;
+  struct mqttlog_index index;
+  int64_t anchor;       // cnf time of the header in ns
+  int64_t current;      // anchor of the next record in ns
+  long index_last;      // offset of the last msg entry of the index
+  long copied;          // bytes copied unchanged
+  long written;         // records written anew
+};
+
+
+/**
+ * Initialize the configuration. Have to be called befor using the config variable.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int config_init() {
+  config.start     = CONF_DEFAULT_START;
+  config.end       = CONF_DEFAULT_END;
+  config.split     = CONF_DEFAULT_SPLIT;
+  config.output    = CONF_DEFAULT_OUTPUT;
+  config.verbose   = CONF_DEFAULT_VERBOSE;
+  config.files     = NULL;
+  config.num_files = 0;
+
+  return 0;
+}
+
+
+/**
+ * Prints the usage message of the program.
+ *
+ * @param progname Name of the program.
+ */
+void print_usage(char *progname) {
+  printf("Usage: %s [options] -o <output> <logfile> [<logfile> ...]\n\n", progname);
+  printf("Cuts a time window out of a log file of mqttrecorder or splits it into pieces.\n");
+  printf("Several log files are concatenated. Whole blocks of records are copied unchanged\n");
+  printf("by the kernel, only the records at the boundaries are written anew.\n\n");
+  printf("Options: \n");
+  printf("-s --start          Start of the window in seconds relative to the recording start.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_START);
+  printf("-e --end            End of the window in seconds relative to the recording start.\n");
+  printf("                    Default value: end of the log file\n");
+  printf("-S --split          Split the window into pieces of the given seconds. {n} in the\n");
+  printf("                    output is replaced by the number of the piece.\n");
+  printf("                    Default value: <logfile>.{n}\n");
+  printf("-o --output         Output log file, - for stdout. Gets an index <output>.idx.\n");
+  printf("-v --verbose        Print alot information to stdout.\n");
+  printf("-h --help           Print this help message.\n");
+}
+
+
+/**
+ * Parses a time in seconds.
+ *
+ * @return The time in ns or -1 if it is invalid.
+ */
+int64_t parse_seconds(const char *arg) {
+  char *end;
+  double sec = strtod(arg, &end);
+
+  if( end == arg || *end || 0 > sec ) {
+    return -1;
+  }
+  return (int64_t)(sec * NSEC_PER_SEC);
+}
+
+
+/**
+ * Parse the commandline arguments. The first argument provided in argv is the
+ * program name.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of arguments. The first string is the program name.
+ */
+void parse_args(int argc, char **argv) {
+  int i;
+
+  for(i = 1; i < argc; i++) {
+
+    // START
+    if( !strcmp(argv[i], "-s") || !strcmp(argv[i], "--start") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no start time specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.start = parse_seconds(argv[i]);
+	if( 0 > config.start ) {
+	  fprintf(stderr, "ERROR: Invalid start time given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // END
+    } else if( !strcmp(argv[i], "-e") || !strcmp(argv[i], "--end") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no end time specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.end = parse_seconds(argv[i]);
+	if( 0 > config.end ) {
+	  fprintf(stderr, "ERROR: Invalid end time given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // SPLIT
+    } else if( !strcmp(argv[i], "-S") || !strcmp(argv[i], "--split") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no length of the pieces specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.split = parse_seconds(argv[i]);
+	if( 0 >= config.split ) {
+	  fprintf(stderr, "ERROR: Invalid length of the pieces given: %s\n", argv[i]);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // OUTPUT
+    } else if( !strcmp(argv[i], "-o") || !strcmp(argv[i], "--output") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no output file specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.output = argv[i];
+      }
+
+    // VERBOSE
+    } else if( !strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose") ) {
+      config.verbose = 1;
+
+    // HELP
+    } else if( !strcmp(argv[i], "-h") || !strcmp(argv[i], "--help") ) {
+      print_usage(*argv);
+      exit(0);
+
+    } else if( '-' == *argv[i] ) {
+      fprintf(stderr, "ERROR: Unknown parameter '%s'.\n", argv[i]);
+      print_usage(*argv);
+      exit(1);
+
+    // FILE
+    } else {
+      config.files = realloc(config.files, (config.num_files + 1) * sizeof(char *));
+      if( NULL == config.files ) {
+        CRIT("realloc()");
+      }
+      config.files[config.num_files++] = argv[i];
+    }
+  }
+}
+
+
+/**
+ * Opens a log file and loads its index. A missing index is built and saved,
+ * so the next cut of the log file does not have to read it.
+ */
+void source_open(struct source *src, const char *file, int build_index) {
+  src->file = file;
+
+  if( mqttlog_reader_open(&src->reader, file) ) {
+    CRIT("Could not open log file '%s'.", file);
+  }
+  if( !src->reader.seekable ) {
+    CRIT("Log file '%s' is not a regular file.", file);
+  }
+  if( 0 <= src->reader.header.partition_levels ) {
+    CRIT("Partitioned log file '%s' can not be cut or concatenated.", file);
+  }
+  if( src->reader.header.stripes ) {
+    CRIT("Striped log file '%s' can not be cut or concatenated, cut its stripe files.", file);
+  }
+
+  if( mqttlog_index_load(&src->index, file) && build_index ) {
+    if( config.verbose ) {
+      fprintf(stderr, "%s: building index\n", file);
+    }
+    // the entries before an incomplete record are still valid
+    if( !mqttlog_index_build(&src->index, &src->reader, MQTTLOG_INDEX_INTERVAL) && mqttlog_index_save(&src->index, file) ) {
+      ERROR("Could not save index of '%s'.", file);
+    }
+  }
+}
+
+
+void source_close(struct source *src) {
+  mqttlog_index_free(&src->index);
+  mqttlog_reader_close(&src->reader);
+}
+
+
+/**
+ * Moves a log file to an offset with the given anchor of its records.
+ */
+void source_goto(struct source *src, long offset, int64_t anchor) {
+  if( mqttlog_reader_seek_anchor(&src->reader, offset, anchor) ) {
+    CRIT("Could not seek in '%s'.", src->file);
+  }
+}
+
+
+/**
+ * Reads the next record of a log file. An incomplete record at the end, e.g.
+ * after a crash of the recorder, ends the log file.
+ *
+ * @return 1 if a record was read, 0 at the end of the log file.
+ */
+int source_next(struct source *src, struct mqttlog_record *rec, int decode) {
+  int ret = mqttlog_reader_next(&src->reader, rec, decode);
+
+  if( MQTTLOG_END == ret ) {
+    return 0;
+  }
+  if( MQTTLOG_PARTIAL == ret ) {
+    if( config.verbose ) {
+      fprintf(stderr, "%s: incomplete record at offset %ld\n", src->file, mqttlog_reader_tell(&src->reader));
+    }
+    return 0;
+  }
+  if( MQTTLOG_RECORD != ret ) {
+    CRIT("%s: invalid or incomplete record at offset %ld.", src->file, mqttlog_reader_tell(&src->reader));
+  }
+  return 1;
+}
+
+
+/**
+ * Checks that a log file ends with a complete record and, if it has
+ * checksums, with a crc line. Otherwise the following log file would be
+ * damaged by its concatenation.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int source_check_end(struct source *src) {
+  struct mqttlog_reader *r = &src->reader;
+  struct mqttlog_record rec;
+  struct stat st;
+  char buf[64];
+  long n, i;
+
+  if( fstat(r->fd, &st) ) {
+    CRIT("Could not stat log file '%s'.", src->file);
+  }
+  if( st.st_size <= r->data_start ) {
+    return 0;
+  }
+
+  if( r->header.crc_block ) {
+    n = (st.st_size < (long)sizeof(buf))?(st.st_size):((long)sizeof(buf));
+    if( n != pread(r->fd, buf, n, st.st_size - n) || '\n' != buf[n - 1] ) {
+      return -1;
+    }
+    for( i = n - 2; 0 <= i && '\n' != buf[i]; i-- );
+    if( 0 > i && n != st.st_size ) {
+      return -1;
+    }
+    return (n - i - 1 < 4 || memcmp(buf + i + 1, "crc ", 4));
+  }
+
+  // parse from the last entry of the index
+  if( src->index.count ) {
+    source_goto(src, src->index.entries[src->index.count - 1].offset, src->index.entries[src->index.count - 1].anchor);
+  } else {
+    source_goto(src, r->data_start, 0);
+  }
+  while( MQTTLOG_RECORD == (n = mqttlog_reader_next(r, &rec, 0)) );
+
+  return (MQTTLOG_END != n);
+}
+
+
+/**
+ * Opens an output log file.
+ *
+ * @param anchor The cnf time of the output.
+ */
+void output_open(struct output *out, const char *file, const struct timespec *anchor) {
+  memset(out, 0, sizeof(struct output));
+
+  out->file = file;
+  out->anchor = timespec_to_ns(anchor);
+  out->current = out->anchor;
+  out->index_last = -MQTTLOG_INDEX_INTERVAL;
+
+  if( mqttlog_writer_open(&out->writer, file, 0) ) {
+    CRIT("Could not open output file '%s'.", file);
+  }
+}
+
+
+/**
+ * Adds an entry to the index of the output.
+ *
+ * @param time   Absolute time of the entry in ns.
+ * @param anchor Absolute anchor of the record at the entry in ns.
+ */
+void output_index(struct output *out, int64_t time, long offset, int keyframe, int64_t anchor) {
+  // the records are not strictly sorted around the start of the window
+  time = (time > out->anchor)?(time - out->anchor):(0);
+
+  if( mqttlog_index_add(&out->index, time, offset, keyframe, (anchor != out->anchor)?(anchor):(0)) ) {
+    CRIT("Could not add index entry.");
+  }
+}
+
+
+/**
+ * Writes a record anew, relative to the current anchor of the output.
+ */
+void output_record(struct output *out, const struct mqttlog_record *rec) {
+  struct mqttlog_writer *w = &out->writer;
+  struct timespec time;
+  long ret;
+
+  // keys of a keyframe before the anchor get its time
+  timespec_from_ns((rec->abs > out->current)?(rec->abs - out->current):(0), &time);
+
+  if( MQTTLOG_KEYFRAME == rec->type ) {
+    output_index(out, rec->abs, w->offset, 1, out->current);
+    ret = mqttlog_writer_keyframe(w, &time, rec->len);
+  } else if( MQTTLOG_DROP == rec->type ) {
+    ret = mqttlog_writer_drop(w, &time, rec->len, rec->topic);
+  } else {
+    if( MQTTLOG_MSG == rec->type && w->offset - out->index_last >= MQTTLOG_INDEX_INTERVAL ) {
+      output_index(out, rec->abs, w->offset, 0, out->current);
+      out->index_last = w->offset;
+    }
+    ret = mqttlog_writer_record(w, rec->type, &time, rec->qos, rec->retain, rec->len, rec->topic, rec->payload);
+  }
+
+  if( 0 > ret ) {
+    CRIT("Could not write output file '%s'.", out->file);
+  }
+  out->written++;
+}
+
+
+/**
+ * Writes a last value as key record at the start of the output.
+ */
+void output_key(struct topic_entry *entry, void *userdata) {
+  struct output *out = (struct output *)userdata;
+  struct mqttlog_record rec;
+
+  memset(&rec, 0, sizeof(struct mqttlog_record));
+  rec.type = MQTTLOG_KEY;
+  rec.abs = out->anchor;
+  rec.qos = entry->qos;
+  rec.retain = entry->retain;
+  rec.len = entry->len;
+  rec.topic = entry->topic;
+  rec.payload = entry->payload;
+
+  output_record(out, &rec);
+}
+
+
+/**
+ * Lets the following records of the output be relative to another anchor.
+ */
+void output_anchor(struct output *out, int64_t anchor) {
+  struct timespec t;
+  char line[64];
+  int n;
+
+  if( anchor == out->current ) {
+    return;
+  }
+
+  timespec_from_ns(anchor, &t);
+  n = snprintf(line, sizeof(line), "cnf time: %ld.%09ld\n", (long)t.tv_sec, t.tv_nsec);
+  if( 0 > mqttlog_writer_raw(&out->writer, line, n) ) {
+    CRIT("Could not write output file '%s'.", out->file);
+  }
+  out->current = anchor;
+}
+
+
+/**
+ * Copies the bytes [from, to) of a log file unchanged and takes over the
+ * entries of its index in this range.
+ */
+void output_copy(struct output *out, struct source *src, long from, long to) {
+  const struct mqttlog_index_entry *e;
+  int64_t anchor = timespec_to_ns(&src->reader.anchor);
+  long base;
+  size_t i;
+
+  if( 0 > mqttlog_writer_copy(&out->writer, src->reader.fd, from, to - from) ) {
+    CRIT("Could not copy '%s' to '%s'.", src->file, out->file);
+  }
+  base = out->writer.offset - (to - from);
+  out->copied += to - from;
+
+  for( i = 0; i < src->index.count; i++ ) {
+    e = src->index.entries + i;
+    if( from <= e->offset && e->offset < to ) {
+      output_index(out, anchor + e->time, base + e->offset - from, e->keyframe, (e->anchor)?(e->anchor):(anchor));
+      if( !e->keyframe ) {
+        out->index_last = base + e->offset - from;
+      }
+    }
+  }
+}
+
+
+void output_close(struct output *out) {
+  if( mqttlog_writer_close(&out->writer) ) {
+    CRIT("Could not write output file '%s'.", out->file);
+  }
+
+  if( strcmp(out->file, "-") && mqttlog_index_save(&out->index, out->file) ) {
+    ERROR("Could not save index of '%s'.", out->file);
+  }
+  mqttlog_index_free(&out->index);
+
+  if( config.verbose ) {
+    fprintf(stderr, "%s: %ld bytes, %ld bytes copied, %ld records written anew\n", out->file, out->writer.offset, out->copied, out->written);
+  }
+}
+
+
+/**
+ * Searches the end of a window, starting at a block boundary.
+ *
+ * @param from   Start of a block before the end of the window.
+ * @param anchor Anchor of the records at from.
+ * @param to     End of the window relative to the cnf time of the header.
+ * @param end    Is set to the offset of the first record after the window
+ *               or the end of the records.
+ * @param block_anchor Is set to the anchor of the records at the returned
+ *               offset.
+ * @return The start of the last block at or before end. Without checksums
+ *         every record starts a block.
+ */
+long source_find_end(struct source *src, long from, int64_t anchor, int64_t to, long *end, int64_t *block_anchor) {
+  struct mqttlog_reader *r = &src->reader;
+  const struct mqttlog_index_entry *entry;
+  struct mqttlog_record rec;
+  int64_t start = timespec_to_ns(&r->anchor);
+  long block;
+  int more;
+
+  // the window usually ends within one index interval after the entry
+  entry = mqttlog_index_lookup(&src->index, to, 0);
+
+  while(1) {
+    if( NULL == entry || entry->offset <= from ) {
+      entry = NULL;
+      source_goto(src, from, anchor);
+      block = from;
+      *block_anchor = anchor;
+    } else {
+      source_goto(src, entry->offset, entry->anchor);
+      block = -1;
+    }
+
+    while( (more = source_next(src, &rec, 0)) ) {
+      if( !r->header.crc_block || rec.offset == r->crc_start ) {
+        block = rec.offset;
+        *block_anchor = timespec_to_ns(&r->header.anchor);
+      }
+      if( MQTTLOG_KEY != rec.type && rec.abs - start >= to ) {
+        break;
+      }
+    }
+
+    *end = (more)?(rec.offset):(mqttlog_reader_tell(r));
+    if( !more && (!r->header.crc_block || r->crc_start == *end) ) {
+      block = *end;
+      *block_anchor = timespec_to_ns(&r->header.anchor);
+    }
+
+    if( 0 <= block ) {
+      return block;
+    }
+
+    // no crc line between the entry and the end of the window
+    entry = (entry > src->index.entries)?(entry - 1):(NULL);
+  }
+}
+
+
+/**
+ * Writes the records of a window to an output log file. The cnf time of the
+ * output is the start of the window. The last values before the window are
+ * written as keyframe at its start if the log file has keyframes.
+ *
+ * The records up to the first block boundary in the window are written anew
+ * relative to the new cnf time. A cnf time line with the original anchor
+ * follows, then the blocks are copied unchanged up to the last block boundary
+ * in the window, and the rest is written anew. Log files with references are
+ * written anew completely, a reference may point before the window.
+ *
+ * @param from Start of the window relative to the recording start.
+ * @param to   End of the window (exclusive).
+ * @return 1 if the log file has records after the window, otherwise 0.
+ */
+int cut(struct source *src, int64_t from, int64_t to, const char *file) {
+  struct mqttlog_reader *r = &src->reader;
+  const struct mqttlog_index_entry *entry;
+  struct mqttlog_header header;
+  struct mqttlog_record rec;
+  struct topic_table last_values;
+  struct topic_entry *value;
+  struct output out;
+  int64_t start = timespec_to_ns(&r->anchor);
+  int64_t anchor, block_anchor;
+  long first = -1, block, end;
+  int more, copy = 0;
+
+  // the first record of the window, keys belong to a keyframe before it
+  entry = mqttlog_index_lookup(&src->index, from, 0);
+  source_goto(src, (NULL != entry)?(entry->offset):(r->data_start), (NULL != entry)?(entry->anchor):(0));
+  while( (more = source_next(src, &rec, 0)) ) {
+    if( MQTTLOG_KEY != rec.type && rec.abs - start >= from ) {
+      first = rec.offset;
+      break;
+    }
+  }
+  anchor = timespec_to_ns(&r->header.anchor);
+
+  // the last values from the keyframe before the window
+  if( topic_table_init(&last_values, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+    CRIT("Could not create topic table.");
+  }
+  entry = mqttlog_index_lookup(&src->index, from, 1);
+  if( more && NULL != entry ) {
+    source_goto(src, entry->offset, entry->anchor);
+    while( source_next(src, &rec, MQTTLOG_MSG | MQTTLOG_KEY) && rec.offset < first ) {
+      if( !(rec.type & (MQTTLOG_MSG | MQTTLOG_KEY)) ) {
+        continue;
+      }
+      value = topic_table_get(&last_values, rec.topic, 1);
+      if( NULL == value || topic_entry_set(value, rec.abs, rec.qos, rec.retain, rec.len, rec.payload) ) {
+        CRIT("Could not store last value of '%s'.", rec.topic);
+      }
+    }
+  }
+
+  header = r->header;
+  timespec_from_ns(start + from, &header.anchor);
+  output_open(&out, file, &header.anchor);
+  if( mqttlog_writer_header(&out.writer, &header) ) {
+    CRIT("Could not write output file '%s'.", file);
+  }
+
+  if( last_values.count ) {
+    memset(&rec, 0, sizeof(struct mqttlog_record));
+    rec.type = MQTTLOG_KEYFRAME;
+    rec.abs = out.anchor;
+    rec.len = last_values.count;
+    output_record(&out, &rec);
+    topic_table_foreach(&last_values, output_key, &out);
+  }
+  topic_table_free(&last_values);
+
+  if( more ) {
+    // the records up to the first block boundary after the first record
+    source_goto(src, first, anchor);
+    while( (more = source_next(src, &rec, MQTTLOG_MSG | MQTTLOG_KEY)) ) {
+      if( MQTTLOG_KEY != rec.type && rec.abs - start >= to ) {
+        break;
+      }
+      if( rec.offset != first && !r->header.dedup_window && (!r->header.crc_block || rec.offset == r->crc_start) ) {
+        copy = 1;
+        break;
+      }
+      output_record(&out, &rec);
+    }
+  }
+
+  if( copy ) {
+    anchor = timespec_to_ns(&r->header.anchor);
+    output_anchor(&out, anchor);
+
+    block = source_find_end(src, rec.offset, anchor, to, &end, &block_anchor);
+    if( block > rec.offset ) {
+      output_copy(&out, src, rec.offset, block);
+    }
+    out.current = block_anchor;
+
+    // the records after the last block boundary
+    source_goto(src, block, block_anchor);
+    while( (more = source_next(src, &rec, MQTTLOG_MSG | MQTTLOG_KEY)) && rec.offset < end ) {
+      output_record(&out, &rec);
+    }
+  }
+
+  output_close(&out);
+  return more;
+}
+
+
+/**
+ * Replaces every {n} of the output by the number of a piece.
+ */
+void piece_file(char *file, size_t size, int piece) {
+  const char *p, *n;
+
+  file[0] = 0;
+  for( p = config.output; NULL != (n = strstr(p, "{n}")); p = n + 3 ) {
+    snprintf(file + strlen(file), size - strlen(file), "%.*s%d", (int)(n - p), p, piece);
+  }
+  snprintf(file + strlen(file), size - strlen(file), "%s", p);
+}
+
+
+/**
+ * Concatenates the log files. They keep their cnf lines, so the records of
+ * every log file stay relative to its own anchor.
+ */
+void concat() {
+  struct source src;
+  struct output out;
+  struct timespec last;
+  struct stat st;
+  int i;
+
+  for( i = 0; i < config.num_files; i++ ) {
+    source_open(&src, config.files[i], 0);
+
+    if( !i ) {
+      output_open(&out, config.output, &src.reader.anchor);
+    } else if( 0 > timespec_cmp(&src.reader.anchor, &last) ) {
+      CRIT("Log file '%s' starts before the previous one.", src.file);
+    }
+    last = src.reader.anchor;
+
+    if( i + 1 < config.num_files && source_check_end(&src) ) {
+      CRIT("Log file '%s' does not end with a complete block, repair it with mqttlog-check --recover.", src.file);
+    }
+
+    if( fstat(src.reader.fd, &st) ) {
+      CRIT("Could not stat log file '%s'.", src.file);
+    }
+    output_copy(&out, &src, 0, st.st_size);
+    source_close(&src);
+  }
+
+  output_close(&out);
+}
+
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  char file[PATH_SIZE];
+  struct source src;
+  int64_t from, to;
+  int piece;
+
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
+
+  parse_args(argc, argv);
+
+  if( !config.num_files ) {
+    fprintf(stderr, "ERROR: You have to provide a logfile.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( config.end <= config.start ) {
+    fprintf(stderr, "ERROR: The end of the window has to be after its start.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( 1 < config.num_files ) {
+    if( config.start || CONF_DEFAULT_END != config.end || config.split ) {
+      fprintf(stderr, "ERROR: Several log files can only be concatenated, cut them one by one.\n");
+      print_usage(*argv);
+      exit(1);
+    }
+    if( NULL == config.output ) {
+      fprintf(stderr, "ERROR: You have to provide an output file.\n");
+      print_usage(*argv);
+      exit(1);
+    }
+    concat();
+    free(config.files);
+    return 0;
+  }
+
+  if( config.split && NULL == config.output ) {
+    snprintf(file, sizeof(file), "%s.{n}", config.files[0]);
+    config.output = strdup(file);
+    if( NULL == config.output ) {
+      CRIT("strdup()");
+    }
+  }
+
+  if( NULL == config.output ) {
+    fprintf(stderr, "ERROR: You have to provide an output file.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( config.split && NULL == strstr(config.output, "{n}") ) {
+    fprintf(stderr, "ERROR: The output of --split has to contain {n}.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  source_open(&src, config.files[0], 1);
+
+  if( !config.split ) {
+    cut(&src, config.start, config.end, config.output);
+  } else {
+    for( piece = 0, from = config.start; ; piece++, from = to ) {
+      to = (config.end - from > config.split)?(from + config.split):(config.end);
+      piece_file(file, sizeof(file), piece);
+      if( !cut(&src, from, to, file) || to == config.end ) {
+        break;
+      }
+    }
+  }
+
+  source_close(&src);
+  free(config.files);
+
+  return 0;
+}
@@ -0,0 +1,893 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "config.h"
+#include "log.h"
+#include "mqttlog.h"
+#include "topic-table.h"
+
+/*
+ * Compares two recordings of the same replay, e.g. before and after a change
+ * of a broker or bridge. Log a is the reference, log b is compared with it.
+ *
+ * One thread per log parses the records and distributes them by the hash of
+ * their topic to the workers, so every topic is handled by one worker. A
+ * worker hashes the payloads and matches the messages of a topic in both logs
+ * by their payload hash, in the order of the logs. A message of one log which
+ * finds no match while the other log advances by --window is reported as
+ * missing (only in a), extra (only in b) or duplicated (b repeats the previous
+ * payload of the topic). A match of a message older than an already matched
+ * one is reordered. The time difference of every match is the skew.
+ *
+ * The readers wait for each other, so that they are at most --window apart and
+ * only the unmatched messages of this window are held in memory.
+ */
+
+struct _conf {
+  #define CONF_DEFAULT_JOBS  0  // number of online CPUs
+  int jobs;
+
+  #define CONF_DEFAULT_WINDOW  10000  // ms
+  int64_t window;       // in ns
+
+  #define CONF_DEFAULT_ABSOLUTE  0
+  int absolute;         // compare the wall clock times instead of the times since the first message
+
+  #define CONF_DEFAULT_VERBOSE  0
+  int verbose;
+
+  #define CONF_BATCH_BYTES    (256 * 1024)  // records of one log for one worker
+  #define CONF_QUEUE_BATCHES  8             // batches queued per worker and log
+  #define CONF_SKEW_SAMPLES   1024          // reservoir of skews per topic
+
+  int streaming;        // unmatched messages expire, 0 if a log is not in time order
+  char *files[2];
+  int num_files;
+
+} config;
+
+
+/**
+ * Records of one log for one worker. Every record is a struct batch_rec
+ * followed by the topic with a null byte and the payload, padded to 8 bytes.
+ */
+struct batch {
+  int log;
+  char *buf;
+  size_t len;
+  size_t size;
+  int64_t watermark;    // the log is read up to this time
+  int last;             // the last batch of the log
+  struct batch *next;
+};
+
+struct batch_rec {
+  int64_t time;
+  uint32_t topic_len;
+  uint32_t text_len;    // hex text or payload
+  int32_t len;          // payload length
+  int32_t decoded;      // the payload is stored instead of its hex text
+};
+
+#define BATCH_ALIGN(n)  (((n) + 7) & ~(size_t)7)
+
+
+/**
+ * A message which has no match in the other log yet.
+ */
+struct pending {
+  int64_t time;
+  uint64_t hash;
+  uint64_t seq;         // number of the message of the topic in its log
+  int duplicate;        // repeats the previous payload of the topic
+  int matched;
+  struct topic_diff *topic;
+  struct pending *next;       // unmatched messages of the topic
+  struct pending *fifo_next;  // messages of the log in the order they were read
+};
+
+
+/**
+ * Differences of a topic.
+ */
+struct topic_diff {
+  const char *topic;          // owned by the topic table of the worker
+  uint64_t count[2];          // messages in a and b
+  uint64_t missing;
+  uint64_t extra;
+  uint64_t duplicated;
+  uint64_t reordered;
+  uint64_t last_hash[2];      // payload hash of the previous message
+  uint64_t next_matched[2];   // 1 + the highest sequence number matched so far
+  struct pending *head[2];
+  struct pending *tail[2];
+
+  uint64_t matched;
+  int64_t skew_min;
+  int64_t skew_max;
+  double skew_sum;
+  int64_t *samples;
+  int num_samples;
+};
+
+
+/**
+ * A worker with the topics of one hash partition.
+ */
+struct worker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct batch *head;   // queued batches of both logs
+  struct batch *tail;
+  int queued[2];
+
+  struct topic_table topics;
+  struct pending *fifo_head[2];
+  struct pending *fifo_tail[2];
+  struct pending *free;
+  int64_t watermark[2];
+  int finished[2];
+  uint8_t *payload;     // decoded payload
+  size_t payload_size;
+  uint64_t random;
+};
+
+
+/**
+ * A log file and the batches its reader fills.
+ */
+struct source {
+  int log;
+  pthread_t thread;
+  struct mqttlog_reader reader;
+  struct batch **batches;     // one per worker
+  size_t unflushed;           // bytes added since all batches were sent
+  uint64_t messages;
+  int ret;
+};
+
+
+static struct worker *workers;
+
+// how far the readers are, to keep them within the window
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int64_t time[2];
+  int started[2];
+  int done[2];
+} progress = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+
+
+/**
+ * Initialize the configuration. Have to be called befor using the config variable.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int config_init() {
+  config.jobs      = CONF_DEFAULT_JOBS;
+  config.window    = (int64_t)CONF_DEFAULT_WINDOW * 1000000L;
+  config.absolute  = CONF_DEFAULT_ABSOLUTE;
+  config.verbose   = CONF_DEFAULT_VERBOSE;
+  config.streaming = 1;
+  config.num_files = 0;
+
+  return 0;
+}
+
+
+/**
+ * Prints the usage message of the program.
+ *
+ * @param progname Name of the program.
+ */
+void print_usage(char *progname) {
+  printf("Usage: %s [options] <logfile a> <logfile b>\n\n", progname);
+  printf("Compares two recordings of mqttrecorder message by message. The messages of every\n");
+  printf("topic are matched by their payload. Reports per topic the messages missing in b,\n");
+  printf("extra and duplicated in b, the reordered ones and the distribution of the time\n");
+  printf("skew (time in b - time in a). Exits with 0 if no message differs, otherwise 1.\n\n");
+  printf("Options: \n");
+  printf("-w --window         Time in ms within which a message has to appear in the other log.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_WINDOW);
+  printf("-a --absolute       Compare the wall clock times of the messages. By default the times\n");
+  printf("                    are relative to the first message of each log.\n");
+  printf("-j --jobs           Number of threads which compare the topics.\n");
+  printf("                    Default value: number of CPUs\n");
+  printf("-v --verbose        Print every topic, also if it does not differ.\n");
+  printf("-h --help           Print this help message.\n");
+}
+
+
+/**
+ * Parse the commandline arguments. The first argument provided in argv is the
+ * program name.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of arguments. The first string is the program name.
+ */
+void parse_args(int argc, char **argv) {
+  int i, window;
+
+  for(i = 1; i < argc; i++) {
+
+    // WINDOW
+    if( !strcmp(argv[i], "-w") || !strcmp(argv[i], "--window") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no window specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        window = atoi(argv[i]);
+	if( 0 > window ) {
+	  fprintf(stderr, "ERROR: Invalid window given: %d\n", window);
+	  print_usage(*argv);
+	  exit(1);
+	}
+        config.window = (int64_t)window * 1000000L;
+      }
+
+    // ABSOLUTE
+    } else if( !strcmp(argv[i], "-a") || !strcmp(argv[i], "--absolute") ) {
+      config.absolute = 1;
+
+    // JOBS
+    } else if( !strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no number of threads specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.jobs = atoi(argv[i]);
+	if( 1 > config.jobs ) {
+	  fprintf(stderr, "ERROR: Invalid number of threads given: %d\n", config.jobs);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // VERBOSE
+    } else if( !strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose") ) {
+      config.verbose = 1;
+
+    // HELP
+    } else if( !strcmp(argv[i], "-h") || !strcmp(argv[i], "--help") ) {
+      print_usage(*argv);
+      exit(0);
+
+    } else if( '-' == *argv[i] && argv[i][1] ) {
+      fprintf(stderr, "ERROR: Unknown parameter '%s'.\n", argv[i]);
+      print_usage(*argv);
+      exit(1);
+
+    // FILE
+    } else if( 2 > config.num_files ) {
+      config.files[config.num_files++] = argv[i];
+
+    } else {
+      fprintf(stderr, "ERROR: Exactly two log files have to be given.\n");
+      print_usage(*argv);
+      exit(1);
+    }
+  }
+}
+
+
+/* ---- workers ---- */
+
+struct pending *pending_new(struct worker *w) {
+  struct pending *p = w->free;
+
+  if( NULL != p ) {
+    w->free = p->fifo_next;
+  } else {
+    p = malloc(sizeof(struct pending));
+    if( NULL == p ) {
+      CRIT("malloc()");
+    }
+  }
+  memset(p, 0, sizeof(struct pending));
+
+  return p;
+}
+
+
+/**
+ * Adds the skew of a match to the statistics and the reservoir of its topic.
+ */
+void skew_add(struct worker *w, struct topic_diff *d, int64_t skew) {
+  uint64_t i;
+
+  if( !d->matched || skew < d->skew_min ) {
+    d->skew_min = skew;
+  }
+  if( !d->matched || skew > d->skew_max ) {
+    d->skew_max = skew;
+  }
+  d->skew_sum += skew;
+  d->matched++;
+
+  if( CONF_SKEW_SAMPLES > d->num_samples ) {
+    if( !(d->num_samples & (d->num_samples - 1)) ) {
+      d->samples = realloc(d->samples, ((d->num_samples)?(2 * d->num_samples):(1)) * sizeof(int64_t));
+      if( NULL == d->samples ) {
+        CRIT("realloc()");
+      }
+    }
+    d->samples[d->num_samples++] = skew;
+    return;
+  }
+
+  // xorshift64
+  w->random ^= w->random << 13;
+  w->random ^= w->random >> 7;
+  w->random ^= w->random << 17;
+  i = w->random % d->matched;
+  if( CONF_SKEW_SAMPLES > i ) {
+    d->samples[i] = skew;
+  }
+}
+
+
+/**
+ * Matches a message with the earliest unmatched message of its topic with the
+ * same payload in the other log, or keeps it as unmatched.
+ */
+void worker_match(struct worker *w, int log, int64_t time, const char *topic, uint64_t hash) {
+  struct topic_entry *entry;
+  struct topic_diff *d;
+  struct pending *p, *prev = NULL;
+  int other = !log;
+  uint64_t seq;
+  int duplicate;
+
+  entry = topic_table_get(&w->topics, topic, 1);
+  if( NULL == entry ) {
+    CRIT("Could not add topic.");
+  }
+  d = entry->data;
+  if( NULL == d ) {
+    d = calloc(1, sizeof(struct topic_diff));
+    if( NULL == d ) {
+      CRIT("calloc()");
+    }
+    d->topic = entry->topic;
+    entry->data = d;
+  }
+
+  seq = d->count[log]++;
+  duplicate = (seq && d->last_hash[log] == hash);
+  d->last_hash[log] = hash;
+
+  for( p = d->head[other]; NULL != p; prev = p, p = p->next ) {
+    if( p->hash == hash && p->time - time <= config.window && time - p->time <= config.window ) {
+      break;
+    }
+  }
+
+  if( NULL != p ) {
+    if( NULL == prev ) {
+      d->head[other] = p->next;
+    } else {
+      prev->next = p->next;
+    }
+    if( d->tail[other] == p ) {
+      d->tail[other] = prev;
+    }
+    p->matched = 1;
+
+    // a later message of the other log was matched before
+    if( p->seq + 1 < d->next_matched[other] ) {
+      d->reordered++;
+    } else {
+      d->next_matched[other] = p->seq + 1;
+    }
+    d->next_matched[log] = seq + 1;
+
+    skew_add(w, d, (log)?(time - p->time):(p->time - time));
+    return;
+  }
+
+  p = pending_new(w);
+  p->time = time;
+  p->hash = hash;
+  p->seq = seq;
+  p->duplicate = duplicate;
+  p->topic = d;
+
+  if( NULL == d->tail[log] ) {
+    d->head[log] = p;
+  } else {
+    d->tail[log]->next = p;
+  }
+  d->tail[log] = p;
+
+  if( NULL == w->fifo_tail[log] ) {
+    w->fifo_head[log] = p;
+  } else {
+    w->fifo_tail[log]->fifo_next = p;
+  }
+  w->fifo_tail[log] = p;
+}
+
+
+/**
+ * Counts the unmatched messages of a log before a time as differences. They
+ * are the first unmatched messages of their topics.
+ */
+void worker_expire(struct worker *w, int log, int64_t until) {
+  struct pending *p;
+  struct topic_diff *d;
+
+  while( NULL != (p = w->fifo_head[log]) && p->time < until ) {
+    w->fifo_head[log] = p->fifo_next;
+    if( NULL == w->fifo_head[log] ) {
+      w->fifo_tail[log] = NULL;
+    }
+
+    if( !p->matched ) {
+      d = p->topic;
+      d->head[log] = p->next;
+      if( NULL == d->head[log] ) {
+        d->tail[log] = NULL;
+      }
+
+      if( !log ) {
+        d->missing++;
+      } else if( p->duplicate ) {
+        d->duplicated++;
+      } else {
+        d->extra++;
+      }
+    }
+
+    p->fifo_next = w->free;
+    w->free = p;
+  }
+}
+
+
+/**
+ * Hashes the payloads of a batch and matches its messages.
+ */
+void worker_process(struct worker *w, struct batch *b) {
+  struct batch_rec *r;
+  const char *topic, *text;
+  size_t pos = 0;
+  uint64_t hash;
+  int log;
+
+  while( pos < b->len ) {
+    r = (struct batch_rec *)(b->buf + pos);
+    topic = (const char *)(r + 1);
+    text = topic + r->topic_len + 1;
+
+    if( r->decoded ) {
+      hash = fnv1a(text, r->len);
+    } else {
+      if( (size_t)r->len > w->payload_size ) {
+        w->payload_size = r->len * 2;
+        w->payload = realloc(w->payload, w->payload_size);
+        if( NULL == w->payload ) {
+          CRIT("realloc()");
+        }
+      }
+      if( mqttlog_hex_decode(text, r->text_len, w->payload, r->len) ) {
+        CRIT("Invalid payload of '%s' in '%s'.", topic, config.files[b->log]);
+      }
+      hash = fnv1a(w->payload, r->len);
+    }
+
+    worker_match(w, b->log, r->time, topic, hash);
+
+    pos += BATCH_ALIGN(sizeof(struct batch_rec) + r->topic_len + 1 + r->text_len);
+  }
+
+  w->watermark[b->log] = b->watermark;
+  w->finished[b->log] = b->last;
+
+  for( log = 0; 2 > log; log++ ) {
+    if( w->finished[!log] ) {
+      // nothing of the other log is left to match
+      worker_expire(w, log, INT64_MAX);
+    } else if( config.streaming && INT64_MIN + config.window < w->watermark[!log] ) {
+      worker_expire(w, log, w->watermark[!log] - config.window);
+    }
+  }
+}
+
+
+void *worker_run(void *arg) {
+  struct worker *w = arg;
+  struct batch *b;
+
+  while( !w->finished[0] || !w->finished[1] ) {
+    pthread_mutex_lock(&w->lock);
+    while( NULL == w->head ) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    }
+    b = w->head;
+    w->head = b->next;
+    if( NULL == w->head ) {
+      w->tail = NULL;
+    }
+    w->queued[b->log]--;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    worker_process(w, b);
+
+    free(b->buf);
+    free(b);
+  }
+
+  return NULL;
+}
+
+
+/* ---- readers ---- */
+
+struct batch *batch_new(int log) {
+  struct batch *b;
+
+  b = calloc(1, sizeof(struct batch));
+  if( NULL == b ) {
+    CRIT("calloc()");
+  }
+  b->log = log;
+
+  return b;
+}
+
+
+/**
+ * Appends a message to a batch, its payload as it is stored in the log.
+ */
+void batch_add(struct batch *b, const struct mqttlog_record *rec, int64_t time, size_t topic_len) {
+  struct batch_rec *r;
+  const char *text;
+  size_t text_len, n;
+
+  if( NULL != rec->payload ) {
+    text = (const char *)rec->payload;
+    text_len = rec->len;
+  } else {
+    // the hex text is the second line of the record
+    text = memchr(rec->raw, '\n', rec->raw_len) + 1;
+    text_len = (rec->len)?(3 * rec->len - 1):(0);
+  }
+
+  n = BATCH_ALIGN(sizeof(struct batch_rec) + topic_len + 1 + text_len);
+  if( b->len + n > b->size ) {
+    b->size = (b->len + n) * 2;
+    b->buf = realloc(b->buf, b->size);
+    if( NULL == b->buf ) {
+      CRIT("realloc()");
+    }
+  }
+
+  r = (struct batch_rec *)(b->buf + b->len);
+  r->time = time;
+  r->topic_len = topic_len;
+  r->text_len = text_len;
+  r->len = rec->len;
+  r->decoded = (NULL != rec->payload);
+  memcpy(r + 1, rec->topic, topic_len + 1);
+  memcpy((char *)(r + 1) + topic_len + 1, text, text_len);
+  b->len += n;
+}
+
+
+/**
+ * Queues a batch for a worker, waits while the worker has enough batches of
+ * the log queued.
+ */
+void batch_submit(struct worker *w, struct batch *b, int64_t watermark) {
+  b->watermark = watermark;
+  b->next = NULL;
+
+  pthread_mutex_lock(&w->lock);
+  while( CONF_QUEUE_BATCHES <= w->queued[b->log] ) {
+    pthread_cond_wait(&w->cond, &w->lock);
+  }
+  if( NULL == w->tail ) {
+    w->head = b;
+  } else {
+    w->tail->next = b;
+  }
+  w->tail = b;
+  w->queued[b->log]++;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+/**
+ * Publishes how far a log is read and waits while it is more than the window
+ * ahead of the other log.
+ */
+void source_progress(struct source *s, int64_t time) {
+  int other = !s->log;
+
+  pthread_mutex_lock(&progress.lock);
+  progress.time[s->log] = time;
+  progress.started[s->log] = 1;
+  pthread_cond_broadcast(&progress.cond);
+  while( config.streaming && progress.started[other] && !progress.done[other] && time - progress.time[other] > config.window ) {
+    pthread_cond_wait(&progress.cond, &progress.lock);
+  }
+  pthread_mutex_unlock(&progress.lock);
+}
+
+
+void *source_run(void *arg) {
+  struct source *s = arg;
+  struct mqttlog_record rec;
+  struct batch *b;
+  int64_t base = 0, time = INT64_MIN;
+  size_t topic_len;
+  int decode, i;
+
+  // references can only be resolved while reading, so decode them right away
+  decode = (s->reader.header.dedup_window)?(MQTTLOG_MSG):(0);
+
+  while( MQTTLOG_RECORD == (s->ret = mqttlog_reader_next(&s->reader, &rec, decode)) ) {
+    if( MQTTLOG_MSG != rec.type ) {
+      continue;
+    }
+
+    if( !s->messages++ && !config.absolute ) {
+      base = rec.abs;
+    }
+    time = rec.abs - base;
+
+    topic_len = strlen(rec.topic);
+    i = fnv1a(rec.topic, topic_len) % config.jobs;
+    if( NULL == s->batches[i] ) {
+      s->batches[i] = batch_new(s->log);
+    }
+    b = s->batches[i];
+    batch_add(b, &rec, time, topic_len);
+    s->unflushed += rec.raw_len;
+
+    if( CONF_BATCH_BYTES <= b->len ) {
+      batch_submit(&workers[i], b, time);
+      s->batches[i] = NULL;
+      source_progress(s, time);
+    }
+
+    // all workers learn regularly how far the log is read
+    if( (size_t)config.jobs * CONF_BATCH_BYTES <= s->unflushed ) {
+      for( i = 0; i < config.jobs; i++ ) {
+        batch_submit(&workers[i], (NULL == s->batches[i])?(batch_new(s->log)):(s->batches[i]), time);
+        s->batches[i] = NULL;
+      }
+      s->unflushed = 0;
+      source_progress(s, time);
+    }
+  }
+
+  for( i = 0; i < config.jobs; i++ ) {
+    b = (NULL == s->batches[i])?(batch_new(s->log)):(s->batches[i]);
+    b->last = 1;
+    batch_submit(&workers[i], b, INT64_MAX);
+    s->batches[i] = NULL;
+  }
+
+  pthread_mutex_lock(&progress.lock);
+  progress.done[s->log] = 1;
+  pthread_cond_broadcast(&progress.cond);
+  pthread_mutex_unlock(&progress.lock);
+
+  return NULL;
+}
+
+
+/* ---- report ---- */
+
+static struct topic_diff **diffs;
+static size_t num_diffs;
+
+void collect_topic(struct topic_entry *entry, void *userdata) {
+  diffs[num_diffs++] = entry->data;
+}
+
+
+int compare_topics(const void *a, const void *b) {
+  return strcmp((*(struct topic_diff **)a)->topic, (*(struct topic_diff **)b)->topic);
+}
+
+
+int compare_skews(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+
+/**
+ * @return 1 if the messages of a topic differ.
+ */
+int topic_differs(const struct topic_diff *d) {
+  return d->missing || d->extra || d->duplicated || d->reordered;
+}
+
+
+void print_topic(struct topic_diff *d) {
+  int n = d->num_samples;
+
+  printf("%s: %llu/%llu messages, %llu missing, %llu extra, %llu duplicated, %llu reordered", d->topic,
+         (unsigned long long)d->count[0], (unsigned long long)d->count[1], (unsigned long long)d->missing,
+         (unsigned long long)d->extra, (unsigned long long)d->duplicated, (unsigned long long)d->reordered);
+
+  if( n ) {
+    qsort(d->samples, n, sizeof(int64_t), compare_skews);
+    printf(", skew ms min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f",
+           d->skew_min / 1e6, d->samples[n / 2] / 1e6, d->samples[n * 9 / 10] / 1e6, d->samples[n * 99 / 100] / 1e6, d->skew_max / 1e6);
+  }
+  printf("\n");
+}
+
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  struct source sources[2];
+  struct topic_diff total;
+  struct pending *p;
+  size_t i, count = 0, differ = 0;
+  int j;
+
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
+
+  parse_args(argc, argv);
+
+  if( 2 != config.num_files ) {
+    fprintf(stderr, "ERROR: You have to provide two logfiles.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( !config.jobs ) {
+    config.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if( 1 > config.jobs ) {
+      config.jobs = 1;
+    }
+  }
+
+  memset(sources, 0, sizeof(sources));
+  for( j = 0; 2 > j; j++ ) {
+    sources[j].log = j;
+    if( mqttlog_reader_open(&sources[j].reader, config.files[j]) ) {
+      CRIT("Could not open log file '%s'.", config.files[j]);
+    }
+    // the chunks of a partitioned log are not in time order
+    if( 0 <= sources[j].reader.header.partition_levels ) {
+      config.streaming = 0;
+    }
+    sources[j].batches = calloc(config.jobs, sizeof(struct batch *));
+    if( NULL == sources[j].batches ) {
+      CRIT("calloc()");
+    }
+  }
+
+  workers = calloc(config.jobs, sizeof(struct worker));
+  if( NULL == workers ) {
+    CRIT("calloc()");
+  }
+  for( j = 0; j < config.jobs; j++ ) {
+    if( pthread_mutex_init(&workers[j].lock, NULL) || pthread_cond_init(&workers[j].cond, NULL) ) {
+      CRIT("Could not initialize worker.");
+    }
+    if( topic_table_init(&workers[j].topics, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+      CRIT("Could not create the topic table.");
+    }
+    workers[j].watermark[0] = INT64_MIN;
+    workers[j].watermark[1] = INT64_MIN;
+    workers[j].random = 0x9e3779b97f4a7c15ULL + j;
+    if( pthread_create(&workers[j].thread, NULL, worker_run, &workers[j]) ) {
+      CRIT("Could not start thread.");
+    }
+  }
+
+  for( j = 0; 2 > j; j++ ) {
+    if( pthread_create(&sources[j].thread, NULL, source_run, &sources[j]) ) {
+      CRIT("Could not start thread.");
+    }
+  }
+  for( j = 0; 2 > j; j++ ) {
+    pthread_join(sources[j].thread, NULL);
+  }
+  for( j = 0; j < config.jobs; j++ ) {
+    pthread_join(workers[j].thread, NULL);
+    count += workers[j].topics.count;
+  }
+
+  for( j = 0; 2 > j; j++ ) {
+    if( MQTTLOG_END != sources[j].ret ) {
+      ERROR("%s: invalid or incomplete record at offset %ld, compared the records before.", config.files[j], mqttlog_reader_tell(&sources[j].reader));
+    }
+  }
+
+  diffs = malloc((count + 1) * sizeof(struct topic_diff *));
+  if( NULL == diffs ) {
+    CRIT("malloc()");
+  }
+  for( j = 0; j < config.jobs; j++ ) {
+    topic_table_foreach(&workers[j].topics, collect_topic, NULL);
+  }
+  qsort(diffs, num_diffs, sizeof(struct topic_diff *), compare_topics);
+
+  memset(&total, 0, sizeof(struct topic_diff));
+  for( i = 0; i < num_diffs; i++ ) {
+    if( topic_differs(diffs[i]) ) {
+      differ++;
+    }
+    if( topic_differs(diffs[i]) || config.verbose ) {
+      print_topic(diffs[i]);
+    }
+
+    total.count[0] += diffs[i]->count[0];
+    total.count[1] += diffs[i]->count[1];
+    total.missing += diffs[i]->missing;
+    total.extra += diffs[i]->extra;
+    total.duplicated += diffs[i]->duplicated;
+    total.reordered += diffs[i]->reordered;
+    if( diffs[i]->matched && (!total.matched || diffs[i]->skew_min < total.skew_min) ) {
+      total.skew_min = diffs[i]->skew_min;
+    }
+    if( diffs[i]->matched && (!total.matched || diffs[i]->skew_max > total.skew_max) ) {
+      total.skew_max = diffs[i]->skew_max;
+    }
+    total.matched += diffs[i]->matched;
+    total.skew_sum += diffs[i]->skew_sum;
+  }
+
+  printf("total: %zu topics, %zu differ, %llu/%llu messages, %llu missing, %llu extra, %llu duplicated, %llu reordered",
+         num_diffs, differ, (unsigned long long)total.count[0], (unsigned long long)total.count[1], (unsigned long long)total.missing,
+         (unsigned long long)total.extra, (unsigned long long)total.duplicated, (unsigned long long)total.reordered);
+  if( total.matched ) {
+    printf(", skew ms min %.3f mean %.3f max %.3f", total.skew_min / 1e6, total.skew_sum / total.matched / 1e6, total.skew_max / 1e6);
+  }
+  printf("\n");
+
+  for( i = 0; i < num_diffs; i++ ) {
+    free(diffs[i]->samples);
+    free(diffs[i]);
+  }
+  free(diffs);
+  for( j = 0; j < config.jobs; j++ ) {
+    topic_table_free(&workers[j].topics);
+    free(workers[j].payload);
+    while( NULL != (p = workers[j].free) ) {
+      workers[j].free = p->fifo_next;
+      free(p);
+    }
+  }
+  free(workers);
+  for( j = 0; 2 > j; j++ ) {
+    free(sources[j].batches);
+    mqttlog_reader_close(&sources[j].reader);
+  }
+
+  return (differ || MQTTLOG_END != sources[0].ret || MQTTLOG_END != sources[1].ret)?(1):(0);
+}
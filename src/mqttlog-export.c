@@ -0,0 +1,1054 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include "config.h"
+#include "log.h"
+#include "mqttlog.h"
+#include "topic-table.h"
+
+/*
+ * Writes the messages of a log file as Arrow IPC file (Feather V2), which
+ * pandas, polars and DuckDB load directly. Every row group is a record batch
+ * with the columns
+ *
+ *   time     timestamp[ns, UTC]   absolute receive time
+ *   topic    dictionary<int32, utf8>
+ *   qos      uint8
+ *   retain   bool
+ *   len      int32
+ *   payload  binary
+ *
+ * The topic dictionary is written once after the last row group. The file
+ * format allows this, because readers load the dictionaries listed in the
+ * footer first.
+ *
+ * The main thread parses the records and collects the hex text of the
+ * payloads, the workers decode the row groups in parallel and the main thread
+ * writes them in order. At most 2 * jobs row groups are in memory.
+ */
+
+/* Arrow flatbuffer enums, see Schema.fbs and Message.fbs of Apache Arrow */
+#define ARROW_METADATA_V5       4
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_DICTIONARY 2
+#define ARROW_HEADER_BATCH      3
+#define ARROW_TYPE_INT          2
+#define ARROW_TYPE_BINARY       4
+#define ARROW_TYPE_UTF8         5
+#define ARROW_TYPE_BOOL         6
+#define ARROW_TYPE_TIMESTAMP   10
+#define ARROW_UNIT_NANOSECOND   3
+#define ARROW_MAGIC             "ARROW1"
+#define ARROW_COLUMNS           6
+#define ARROW_BUFFERS          13  // validity and data buffers of all columns
+
+struct _conf {
+  #define CONF_DEFAULT_ROWS  65536
+  int rows;             // rows per row group
+
+  #define CONF_GROUP_BYTES  (64 * 1024 * 1024)  // payload text per row group
+
+  #define CONF_DEFAULT_JOBS  0  // number of online CPUs
+  int jobs;
+
+  #define CONF_DEFAULT_VERBOSE  0
+  int verbose;
+
+  char *log_file;
+  char *output;         // NULL: <logfile>.arrow
+
+} config;
+
+
+/**
+ * A row group, filled by the main thread and encoded by a worker.
+ */
+struct group {
+  size_t rows;
+  int64_t *time;
+  int32_t *topic;
+  uint8_t *qos;
+  uint8_t *retain;      // one byte per row, packed into bits by the worker
+  int32_t *len;
+
+  char *text;           // hex text of the payloads or the payloads itself
+  size_t text_len;
+  size_t text_size;
+  size_t *text_offsets; // start of the payload of every row in text
+  int decoded;          // text contains the payloads already
+
+  // encoded by the worker
+  uint8_t *retain_bits;
+  int32_t *offsets;     // of the payloads in data
+  uint8_t *data;
+  int error;
+
+  int done;
+  struct group *next;   // in the queue of the workers
+};
+
+
+/**
+ * Growing buffer for a flatbuffer. Objects are appended and refer forward to
+ * their children, which are appended later.
+ */
+struct fb {
+  uint8_t *buf;
+  size_t len;
+  size_t size;
+};
+
+
+/**
+ * Position of an Arrow block in the file, an entry of the footer.
+ */
+struct block {
+  int64_t offset;
+  int32_t metadata_len;
+  int64_t body_len;
+};
+
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct group *head;   // queued row groups
+  struct group *tail;
+  int stop;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0 };
+
+
+/**
+ * Initialize the configuration. Have to be called befor using the config variable.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int config_init() {
+  config.rows     = CONF_DEFAULT_ROWS;
+  config.jobs     = CONF_DEFAULT_JOBS;
+  config.verbose  = CONF_DEFAULT_VERBOSE;
+  config.log_file = NULL;
+  config.output   = NULL;
+
+  return 0;
+}
+
+
+/**
+ * Prints the usage message of the program.
+ *
+ * @param progname Name of the program.
+ */
+void print_usage(char *progname) {
+  printf("Usage: %s [options] <logfile>\n\n", progname);
+  printf("Exports the messages of a log file of mqttrecorder as Arrow IPC file (Feather V2)\n");
+  printf("with the columns time, topic, qos, retain, len and payload. The rows are in the\n");
+  printf("order of the log file.\n\n");
+  printf("Options: \n");
+  printf("-o --output         Output file.\n");
+  printf("                    Default value: <logfile>.arrow\n");
+  printf("-r --rows           Number of rows per row group.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_ROWS);
+  printf("-j --jobs           Number of threads which encode the row groups.\n");
+  printf("                    Default value: number of CPUs\n");
+  printf("-v --verbose        Print alot information to stdout.\n");
+  printf("-h --help           Print this help message.\n");
+}
+
+
+/**
+ * Parse the commandline arguments. The first argument provided in argv is the
+ * program name.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of arguments. The first string is the program name.
+ */
+void parse_args(int argc, char **argv) {
+  int i;
+
+  for(i = 1; i < argc; i++) {
+
+    // OUTPUT
+    if( !strcmp(argv[i], "-o") || !strcmp(argv[i], "--output") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no output file specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.output = argv[i];
+      }
+
+    // ROWS
+    } else if( !strcmp(argv[i], "-r") || !strcmp(argv[i], "--rows") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no number of rows specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.rows = atoi(argv[i]);
+	if( 1 > config.rows ) {
+	  fprintf(stderr, "ERROR: Invalid number of rows given: %d\n", config.rows);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // JOBS
+    } else if( !strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs") ) {
+      if( ++i == argc ) {
+        fprintf(stderr, "ERROR: Parameter %s given but no number of threads specified.\n", argv[i-1]);
+	print_usage(*argv);
+	exit(1);
+      } else {
+        config.jobs = atoi(argv[i]);
+	if( 1 > config.jobs ) {
+	  fprintf(stderr, "ERROR: Invalid number of threads given: %d\n", config.jobs);
+	  print_usage(*argv);
+	  exit(1);
+	}
+      }
+
+    // VERBOSE
+    } else if( !strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose") ) {
+      config.verbose = 1;
+
+    // HELP
+    } else if( !strcmp(argv[i], "-h") || !strcmp(argv[i], "--help") ) {
+      print_usage(*argv);
+      exit(0);
+
+    } else if( '-' == *argv[i] ) {
+      fprintf(stderr, "ERROR: Unknown parameter '%s'.\n", argv[i]);
+      print_usage(*argv);
+      exit(1);
+
+    // FILE
+    } else if( NULL == config.log_file ) {
+      config.log_file = argv[i];
+
+    } else {
+      fprintf(stderr, "ERROR: Only one log file can be exported.\n");
+      print_usage(*argv);
+      exit(1);
+    }
+  }
+}
+
+
+/* ---- flatbuffers ---- */
+
+/**
+ * Appends n zeroed bytes at a position p with p % align == mod.
+ *
+ * @return The position.
+ */
+size_t fb_space(struct fb *b, size_t n, size_t align, size_t mod) {
+  size_t pos = b->len;
+
+  while( pos % align != mod ) {
+    pos++;
+  }
+
+  if( pos + n > b->size ) {
+    b->size = (pos + n) * 2;
+    b->buf = realloc(b->buf, b->size);
+    if( NULL == b->buf ) {
+      CRIT("realloc()");
+    }
+  }
+  memset(b->buf + b->len, 0, pos + n - b->len);
+  b->len = pos + n;
+
+  return pos;
+}
+
+
+void fb_put(struct fb *b, size_t pos, const void *value, size_t size) {
+  // flatbuffers and Arrow are little endian like the supported hosts
+  memcpy(b->buf + pos, value, size);
+}
+
+
+void fb_u8(struct fb *b, size_t pos, uint8_t value) { fb_put(b, pos, &value, 1); }
+void fb_i16(struct fb *b, size_t pos, int16_t value) { fb_put(b, pos, &value, 2); }
+void fb_i32(struct fb *b, size_t pos, int32_t value) { fb_put(b, pos, &value, 4); }
+void fb_i64(struct fb *b, size_t pos, int64_t value) { fb_put(b, pos, &value, 8); }
+
+
+/**
+ * Points the offset field at pos to an object at target behind it.
+ */
+void fb_ref(struct fb *b, size_t pos, size_t target) {
+  fb_i32(b, pos, target - pos);
+}
+
+
+/**
+ * Appends a table with its vtable. sizes[i] is the size of field i or 0 if
+ * the field is absent. The fields are ordered by size, so all are aligned.
+ *
+ * @param pos Receives the position of every field.
+ * @return The position of the table.
+ */
+size_t fb_table(struct fb *b, int num_fields, const int *sizes, size_t *pos) {
+  uint16_t offsets[16];
+  size_t vtable, table, size = 4;
+  int i, s, align = 4;
+
+  for( s = 8; s >= 1; s /= 2 ) {
+    for( i = 0; i < num_fields; i++ ) {
+      if( sizes[i] == s ) {
+        offsets[i] = size;
+        size += s;
+        if( 8 == s ) {
+          align = 8;
+        }
+      } else if( !sizes[i] ) {
+        offsets[i] = 0;
+      }
+    }
+  }
+
+  vtable = fb_space(b, 4 + 2 * num_fields, 2, 0);
+  // the first field of 8 bytes directly follows the soffset of the table
+  table = fb_space(b, size, align, (8 == align)?(4):(0));
+
+  fb_i16(b, vtable, 4 + 2 * num_fields);
+  fb_i16(b, vtable + 2, size);
+  for( i = 0; i < num_fields; i++ ) {
+    fb_i16(b, vtable + 4 + 2 * i, offsets[i]);
+    pos[i] = table + offsets[i];
+  }
+  fb_i32(b, table, table - vtable);
+
+  return table;
+}
+
+
+size_t fb_string(struct fb *b, const char *s) {
+  size_t n = strlen(s), pos;
+
+  pos = fb_space(b, 4 + n + 1, 4, 0);
+  fb_i32(b, pos, n);
+  memcpy(b->buf + pos + 4, s, n);
+
+  return pos;
+}
+
+
+/**
+ * Appends a vector of count elements. Elements of 8 bytes are aligned.
+ *
+ * @return The position of the first element, the length is stored before.
+ */
+size_t fb_vector(struct fb *b, size_t count, size_t size) {
+  size_t pos;
+
+  pos = fb_space(b, 4 + count * size, (size % 8)?(4):(8), (size % 8)?(0):(4));
+  fb_i32(b, pos, count);
+
+  return pos + 4;
+}
+
+
+/* ---- Arrow metadata ---- */
+
+/**
+ * Appends an Int type table.
+ */
+size_t arrow_int(struct fb *b, int bits, int is_signed) {
+  const int sizes[] = { 4, 1 };
+  size_t pos[2], table;
+
+  table = fb_table(b, 2, sizes, pos);
+  fb_i32(b, pos[0], bits);
+  fb_u8(b, pos[1], is_signed);
+
+  return table;
+}
+
+
+/**
+ * Appends a Field table of the schema.
+ */
+size_t arrow_field(struct fb *b, const char *name, int type, int bits, int is_signed, int dictionary) {
+  // name, nullable, type_type, type, dictionary, children
+  const int sizes[] = { 4, 1, 1, 4, (dictionary)?(4):(0), 4 };
+  const int timestamp[] = { 2, 4 };
+  const int encoding[] = { 8, 4, 1 };
+  size_t pos[6], sub[3], table, type_table;
+
+  table = fb_table(b, 6, sizes, pos);
+  fb_ref(b, pos[0], fb_string(b, name));
+  fb_u8(b, pos[1], 0);
+  fb_u8(b, pos[2], type);
+
+  if( ARROW_TYPE_INT == type ) {
+    type_table = arrow_int(b, bits, is_signed);
+  } else if( ARROW_TYPE_TIMESTAMP == type ) {
+    type_table = fb_table(b, 2, timestamp, sub);
+    fb_i16(b, sub[0], ARROW_UNIT_NANOSECOND);
+    fb_ref(b, sub[1], fb_string(b, "UTC"));
+  } else {
+    // Utf8, Binary and Bool have no fields
+    type_table = fb_table(b, 0, NULL, NULL);
+  }
+  fb_ref(b, pos[3], type_table);
+
+  if( dictionary ) {
+    fb_ref(b, pos[4], fb_table(b, 3, encoding, sub));
+    fb_i64(b, sub[0], 0);
+    fb_ref(b, sub[1], arrow_int(b, 32, 1));
+    fb_u8(b, sub[2], 0);
+  }
+
+  fb_ref(b, pos[5], fb_vector(b, 0, 4) - 4);
+
+  return table;
+}
+
+
+/**
+ * Appends the Schema table.
+ */
+size_t arrow_schema(struct fb *b) {
+  const int sizes[] = { 2, 4 };
+  size_t pos[2], table, fields, field[ARROW_COLUMNS];
+  int i;
+
+  table = fb_table(b, 2, sizes, pos);
+  fb_i16(b, pos[0], 0);
+
+  fields = fb_vector(b, ARROW_COLUMNS, 4);
+  fb_ref(b, pos[1], fields - 4);
+
+  field[0] = arrow_field(b, "time", ARROW_TYPE_TIMESTAMP, 0, 0, 0);
+  field[1] = arrow_field(b, "topic", ARROW_TYPE_UTF8, 0, 0, 1);
+  field[2] = arrow_field(b, "qos", ARROW_TYPE_INT, 8, 0, 0);
+  field[3] = arrow_field(b, "retain", ARROW_TYPE_BOOL, 0, 0, 0);
+  field[4] = arrow_field(b, "len", ARROW_TYPE_INT, 32, 1, 0);
+  field[5] = arrow_field(b, "payload", ARROW_TYPE_BINARY, 0, 0, 0);
+  for( i = 0; i < ARROW_COLUMNS; i++ ) {
+    fb_ref(b, fields + 4 * i, field[i]);
+  }
+
+  return table;
+}
+
+
+/**
+ * Appends a RecordBatch table.
+ *
+ * @param nodes Length of every column, all without nulls.
+ * @param buffers Offset and length of every buffer in the body.
+ */
+size_t arrow_batch(struct fb *b, int64_t rows, int num_nodes, const int64_t *nodes, int num_buffers, const int64_t *buffers) {
+  const int sizes[] = { 8, 4, 4 };
+  size_t pos[3], table, vec;
+  int i;
+
+  table = fb_table(b, 3, sizes, pos);
+  fb_i64(b, pos[0], rows);
+
+  vec = fb_vector(b, num_nodes, 16);
+  fb_ref(b, pos[1], vec - 4);
+  for( i = 0; i < num_nodes; i++ ) {
+    fb_i64(b, vec + 16 * i, nodes[i]);
+    fb_i64(b, vec + 16 * i + 8, 0);
+  }
+
+  vec = fb_vector(b, num_buffers, 16);
+  fb_ref(b, pos[2], vec - 4);
+  for( i = 0; i < num_buffers; i++ ) {
+    fb_i64(b, vec + 16 * i, buffers[2 * i]);
+    fb_i64(b, vec + 16 * i + 8, buffers[2 * i + 1]);
+  }
+
+  return table;
+}
+
+
+/**
+ * Starts a flatbuffer with a Message table.
+ *
+ * @return The position of the header field, which has to refer to the header.
+ */
+size_t arrow_message(struct fb *b, int header_type, int64_t body_len) {
+  const int sizes[] = { 2, 1, 4, 8 };
+  size_t pos[4], root;
+
+  b->len = 0;
+  root = fb_space(b, 4, 4, 0);
+  fb_ref(b, root, fb_table(b, 4, sizes, pos));
+  fb_i16(b, pos[0], ARROW_METADATA_V5);
+  fb_u8(b, pos[1], header_type);
+  fb_i64(b, pos[3], body_len);
+
+  return pos[2];
+}
+
+
+/* ---- output ---- */
+
+/**
+ * Writes all bytes or exits.
+ */
+void write_all(int fd, const void *buf, size_t len, int64_t *offset) {
+  const char *p = buf;
+  ssize_t n;
+
+  while( len ) {
+    n = write(fd, p, len);
+    if( 0 > n ) {
+      if( EINTR == errno ) {
+        continue;
+      }
+      CRIT("Could not write '%s'.", config.output);
+    }
+    p += n;
+    len -= n;
+    *offset += n;
+  }
+}
+
+
+/**
+ * Writes zeros up to the next multiple of 8.
+ */
+void write_pad(int fd, int64_t *offset) {
+  static const char zeros[8] = { 0 };
+
+  if( *offset % 8 ) {
+    write_all(fd, zeros, 8 - *offset % 8, offset);
+  }
+}
+
+
+/**
+ * Writes an encapsulated message: continuation marker, length, metadata and
+ * the body buffers, each padded to 8 bytes.
+ */
+void write_message(int fd, struct fb *b, int num_buffers, const void **data, const int64_t *buffers, struct block *block, int64_t *offset) {
+  uint32_t prefix[2];
+  int64_t body;
+  int i;
+
+  block->offset = *offset;
+  prefix[0] = 0xFFFFFFFF;
+  prefix[1] = (b->len + 7) & ~7;
+  block->metadata_len = 8 + prefix[1];
+
+  write_all(fd, prefix, sizeof(prefix), offset);
+  write_all(fd, b->buf, b->len, offset);
+  write_pad(fd, offset);
+
+  body = *offset;
+  for( i = 0; i < num_buffers; i++ ) {
+    write_all(fd, data[i], buffers[2 * i + 1], offset);
+    write_pad(fd, offset);
+  }
+  block->body_len = *offset - body;
+}
+
+
+/**
+ * Lays out the buffers of a body one after the other, padded to 8 bytes.
+ */
+int64_t layout(int num_buffers, const int64_t *lengths, int64_t *buffers) {
+  int64_t pos = 0;
+  int i;
+
+  for( i = 0; i < num_buffers; i++ ) {
+    buffers[2 * i] = pos;
+    buffers[2 * i + 1] = lengths[i];
+    pos += (lengths[i] + 7) & ~7;
+  }
+
+  return pos;
+}
+
+
+/**
+ * Writes a row group as record batch.
+ */
+void write_group(int fd, struct fb *b, struct group *g, struct block *block, int64_t *offset) {
+  int64_t n = g->rows, nodes[ARROW_COLUMNS], buffers[2 * ARROW_BUFFERS], body;
+  size_t header;
+  const int64_t lengths[ARROW_BUFFERS] = {
+    0, 8 * n,                               // time
+    0, 4 * n,                               // topic
+    0, n,                                   // qos
+    0, (n + 7) / 8,                         // retain
+    0, 4 * n,                               // len
+    0, 4 * (n + 1), g->offsets[n]           // payload
+  };
+  const void *data[ARROW_BUFFERS] = {
+    NULL, g->time, NULL, g->topic, NULL, g->qos, NULL, g->retain_bits, NULL, g->len, NULL, g->offsets, g->data
+  };
+  int i;
+
+  for( i = 0; i < ARROW_COLUMNS; i++ ) {
+    nodes[i] = n;
+  }
+  body = layout(ARROW_BUFFERS, lengths, buffers);
+
+  header = arrow_message(b, ARROW_HEADER_BATCH, body);
+  fb_ref(b, header, arrow_batch(b, n, ARROW_COLUMNS, nodes, ARROW_BUFFERS, buffers));
+  write_message(fd, b, ARROW_BUFFERS, data, buffers, block, offset);
+}
+
+
+/**
+ * Writes the topic dictionary as dictionary batch with id 0.
+ */
+void write_dictionary(int fd, struct fb *b, char **topics, size_t count, struct block *block, int64_t *offset) {
+  const int sizes[] = { 8, 4, 1 };
+  int64_t lengths[3], buffers[6], body, node = count;
+  int32_t *offsets;
+  const void *data[3];
+  char *chars;
+  size_t pos[3], header, i, len = 0;
+
+  offsets = malloc((count + 1) * sizeof(int32_t));
+  if( NULL == offsets ) {
+    CRIT("malloc()");
+  }
+  for( i = 0; i < count; i++ ) {
+    offsets[i] = len;
+    len += strlen(topics[i]);
+  }
+  offsets[count] = len;
+
+  chars = malloc(len + 1);
+  if( NULL == chars ) {
+    CRIT("malloc()");
+  }
+  for( i = 0; i < count; i++ ) {
+    memcpy(chars + offsets[i], topics[i], offsets[i + 1] - offsets[i]);
+  }
+
+  lengths[0] = 0;
+  lengths[1] = 4 * (count + 1);
+  lengths[2] = len;
+  data[0] = NULL;
+  data[1] = offsets;
+  data[2] = chars;
+  body = layout(3, lengths, buffers);
+
+  header = arrow_message(b, ARROW_HEADER_DICTIONARY, body);
+  fb_ref(b, header, fb_table(b, 3, sizes, pos));
+  fb_i64(b, pos[0], 0);
+  fb_ref(b, pos[1], arrow_batch(b, count, 1, &node, 3, buffers));
+  fb_u8(b, pos[2], 0);
+  write_message(fd, b, 3, data, buffers, block, offset);
+
+  free(offsets);
+  free(chars);
+}
+
+
+/**
+ * Writes the end of stream marker, the footer and the trailing magic.
+ */
+void write_footer(int fd, struct fb *b, const struct block *dictionary, const struct block *batches, size_t num_batches, int64_t *offset) {
+  const uint32_t eos[2] = { 0xFFFFFFFF, 0 };
+  const int sizes[] = { 2, 4, 4, 4 };
+  size_t pos[4], root, vec, i;
+  int32_t len;
+
+  write_all(fd, eos, sizeof(eos), offset);
+
+  b->len = 0;
+  root = fb_space(b, 4, 4, 0);
+  fb_ref(b, root, fb_table(b, 4, sizes, pos));
+  fb_i16(b, pos[0], ARROW_METADATA_V5);
+  fb_ref(b, pos[1], arrow_schema(b));
+
+  vec = fb_vector(b, 1, 24);
+  fb_ref(b, pos[2], vec - 4);
+  fb_i64(b, vec, dictionary->offset);
+  fb_i32(b, vec + 8, dictionary->metadata_len);
+  fb_i64(b, vec + 16, dictionary->body_len);
+
+  vec = fb_vector(b, num_batches, 24);
+  fb_ref(b, pos[3], vec - 4);
+  for( i = 0; i < num_batches; i++ ) {
+    fb_i64(b, vec + 24 * i, batches[i].offset);
+    fb_i32(b, vec + 24 * i + 8, batches[i].metadata_len);
+    fb_i64(b, vec + 24 * i + 16, batches[i].body_len);
+  }
+
+  len = b->len;
+  write_all(fd, b->buf, b->len, offset);
+  write_all(fd, &len, sizeof(len), offset);
+  write_all(fd, ARROW_MAGIC, 6, offset);
+}
+
+
+/* ---- row groups ---- */
+
+struct group *group_new() {
+  struct group *g;
+
+  g = calloc(1, sizeof(struct group));
+  if( NULL == g ) {
+    CRIT("calloc()");
+  }
+
+  g->time = malloc(config.rows * sizeof(int64_t));
+  g->topic = malloc(config.rows * sizeof(int32_t));
+  g->qos = malloc(config.rows);
+  g->retain = malloc(config.rows);
+  g->len = malloc(config.rows * sizeof(int32_t));
+  g->text_offsets = malloc(config.rows * sizeof(size_t));
+  g->retain_bits = malloc((config.rows + 7) / 8);
+  g->offsets = malloc((config.rows + 1) * sizeof(int32_t));
+  if( NULL == g->time || NULL == g->topic || NULL == g->qos || NULL == g->retain || NULL == g->len
+   || NULL == g->text_offsets || NULL == g->retain_bits || NULL == g->offsets ) {
+    CRIT("malloc()");
+  }
+
+  return g;
+}
+
+
+void group_free(struct group *g) {
+  free(g->time);
+  free(g->topic);
+  free(g->qos);
+  free(g->retain);
+  free(g->len);
+  free(g->text);
+  free(g->text_offsets);
+  free(g->retain_bits);
+  free(g->offsets);
+  if( !g->decoded ) {
+    free(g->data);
+  }
+  free(g);
+}
+
+
+/**
+ * Appends a record to a row group.
+ *
+ * @return 0 on success, -1 if the hex text does not match the length.
+ */
+int group_add(struct group *g, const struct mqttlog_record *rec, int32_t topic) {
+  const char *src;
+  size_t n;
+
+  if( NULL != rec->payload ) {
+    src = (const char *)rec->payload;
+    n = rec->len;
+  } else {
+    // the hex text is the second line of the record
+    src = memchr(rec->raw, '\n', rec->raw_len);
+    n = (rec->len)?(3 * (size_t)rec->len - 1):(0);
+    if( NULL == src || (size_t)(rec->raw + rec->raw_len - src) != n + 2 ) {
+      return -1;
+    }
+    src++;
+  }
+
+  if( g->text_len + n > g->text_size ) {
+    g->text_size = (g->text_len + n) * 2;
+    g->text = realloc(g->text, g->text_size);
+    if( NULL == g->text ) {
+      CRIT("realloc()");
+    }
+  }
+  memcpy(g->text + g->text_len, src, n);
+
+  g->time[g->rows] = rec->abs;
+  g->topic[g->rows] = topic;
+  g->qos[g->rows] = rec->qos;
+  g->retain[g->rows] = rec->retain;
+  g->len[g->rows] = rec->len;
+  g->text_offsets[g->rows] = g->text_len;
+  g->text_len += n;
+  g->rows++;
+
+  return 0;
+}
+
+
+/**
+ * Decodes the payloads of a row group and packs the retain flags.
+ */
+void group_encode(struct group *g) {
+  size_t i;
+  int32_t pos = 0;
+
+  memset(g->retain_bits, 0, (g->rows + 7) / 8);
+  for( i = 0; i < g->rows; i++ ) {
+    if( g->retain[i] ) {
+      g->retain_bits[i / 8] |= 1 << (i % 8);
+    }
+    g->offsets[i] = pos;
+    pos += g->len[i];
+  }
+  g->offsets[g->rows] = pos;
+
+  if( g->decoded ) {
+    // the payloads are already in place
+    g->data = (uint8_t *)g->text;
+    return;
+  }
+
+  g->data = malloc(pos + 1);
+  if( NULL == g->data ) {
+    g->error = 1;
+    return;
+  }
+  for( i = 0; i < g->rows; i++ ) {
+    if( mqttlog_hex_decode(g->text + g->text_offsets[i], (g->len[i])?(3 * g->len[i] - 1):(0), g->data + g->offsets[i], g->len[i]) ) {
+      g->error = 1;
+      return;
+    }
+  }
+}
+
+
+void *worker_run(void *arg) {
+  struct group *g;
+
+  pthread_mutex_lock(&queue.lock);
+  while( 1 ) {
+    while( NULL == queue.head && !queue.stop ) {
+      pthread_cond_wait(&queue.cond, &queue.lock);
+    }
+    if( NULL == queue.head ) {
+      break;
+    }
+    g = queue.head;
+    queue.head = g->next;
+    if( NULL == queue.head ) {
+      queue.tail = NULL;
+    }
+    pthread_mutex_unlock(&queue.lock);
+
+    group_encode(g);
+
+    pthread_mutex_lock(&queue.lock);
+    g->done = 1;
+    pthread_cond_broadcast(&queue.cond);
+  }
+  pthread_mutex_unlock(&queue.lock);
+
+  return NULL;
+}
+
+
+void group_submit(struct group *g) {
+  pthread_mutex_lock(&queue.lock);
+  g->next = NULL;
+  if( NULL == queue.tail ) {
+    queue.head = g;
+  } else {
+    queue.tail->next = g;
+  }
+  queue.tail = g;
+  pthread_cond_broadcast(&queue.cond);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+
+void group_wait(struct group *g) {
+  pthread_mutex_lock(&queue.lock);
+  while( !g->done ) {
+    pthread_cond_wait(&queue.cond, &queue.lock);
+  }
+  pthread_mutex_unlock(&queue.lock);
+
+  if( g->error ) {
+    CRIT("Could not decode a payload of '%s'.", config.log_file);
+  }
+}
+
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  struct mqttlog_reader reader;
+  struct mqttlog_record rec;
+  struct topic_table topics;
+  struct topic_entry *entry;
+  struct fb b = { NULL, 0, 0 };
+  struct block *batches = NULL, dictionary;
+  struct group **groups;
+  pthread_t *workers;
+  char **dict = NULL, path[4096];
+  size_t num_topics = 0, num_batches = 0, first = 0, last = 0, rows = 0, header;
+  int64_t offset = 0;
+  int decode, fd, ret, i, slots;
+
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
+
+  parse_args(argc, argv);
+
+  if( NULL == config.log_file ) {
+    fprintf(stderr, "ERROR: You have to provide a logfile.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+
+  if( NULL == config.output ) {
+    snprintf(path, sizeof(path), "%s.arrow", config.log_file);
+    config.output = path;
+  }
+
+  if( !config.jobs ) {
+    config.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if( 1 > config.jobs ) {
+      config.jobs = 1;
+    }
+  }
+
+  if( mqttlog_reader_open(&reader, config.log_file) ) {
+    CRIT("Could not open log file '%s'.", config.log_file);
+  }
+
+  // references can only be resolved while reading, so decode them right away
+  decode = (reader.header.dedup_window)?(MQTTLOG_MSG):(0);
+
+  if( topic_table_init(&topics, TOPIC_TABLE_DEFAULT_BUCKETS) ) {
+    CRIT("Could not create the topic table.");
+  }
+
+  fd = open(config.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if( 0 > fd ) {
+    CRIT("Could not open '%s'.", config.output);
+  }
+
+  write_all(fd, ARROW_MAGIC "\0\0", 8, &offset);
+  header = arrow_message(&b, ARROW_HEADER_SCHEMA, 0);
+  fb_ref(&b, header, arrow_schema(&b));
+  write_message(fd, &b, 0, NULL, NULL, &dictionary, &offset);
+
+  workers = malloc(config.jobs * sizeof(pthread_t));
+  slots = 2 * config.jobs;
+  groups = calloc(slots, sizeof(struct group *));
+  if( NULL == workers || NULL == groups ) {
+    CRIT("malloc()");
+  }
+  for( i = 0; i < config.jobs; i++ ) {
+    if( pthread_create(&workers[i], NULL, worker_run, NULL) ) {
+      CRIT("Could not start thread.");
+    }
+  }
+
+  // groups[first % slots] to groups[last % slots] are in flight
+  groups[0] = group_new();
+  groups[0]->decoded = !!decode;
+
+  while( 1 ) {
+    ret = mqttlog_reader_next(&reader, &rec, decode);
+
+    if( MQTTLOG_RECORD == ret && MQTTLOG_MSG == rec.type ) {
+      entry = topic_table_get(&topics, rec.topic, 1);
+      if( NULL == entry ) {
+        CRIT("Could not add topic.");
+      }
+      if( NULL == entry->data ) {
+        dict = realloc(dict, (num_topics + 1) * sizeof(char *));
+        if( NULL == dict ) {
+          CRIT("realloc()");
+        }
+        dict[num_topics++] = entry->topic;
+        entry->data = (void *)(intptr_t)num_topics;
+      }
+      if( group_add(groups[last % slots], &rec, (intptr_t)entry->data - 1) ) {
+        ret = MQTTLOG_ERROR;
+      } else {
+        rows++;
+      }
+    }
+
+    if( MQTTLOG_RECORD == ret && groups[last % slots]->rows < (size_t)config.rows && groups[last % slots]->text_len < CONF_GROUP_BYTES ) {
+      continue;
+    }
+
+    if( groups[last % slots]->rows ) {
+      group_submit(groups[last % slots]);
+      last++;
+    }
+
+    // write the finished row groups in order, wait if all slots are used
+    while( first < last && (last - first == (size_t)slots || MQTTLOG_RECORD != ret || groups[first % slots]->done) ) {
+      group_wait(groups[first % slots]);
+      batches = realloc(batches, (num_batches + 1) * sizeof(struct block));
+      if( NULL == batches ) {
+        CRIT("realloc()");
+      }
+      write_group(fd, &b, groups[first % slots], &batches[num_batches++], &offset);
+      group_free(groups[first % slots]);
+      groups[first % slots] = NULL;
+      first++;
+    }
+
+    if( MQTTLOG_RECORD != ret ) {
+      break;
+    }
+
+    if( NULL == groups[last % slots] ) {
+      groups[last % slots] = group_new();
+      groups[last % slots]->decoded = !!decode;
+    }
+  }
+
+  if( MQTTLOG_END != ret ) {
+    ERROR("%s: invalid or incomplete record at offset %ld, exported the records before.", config.log_file, mqttlog_reader_tell(&reader));
+  }
+
+  pthread_mutex_lock(&queue.lock);
+  queue.stop = 1;
+  pthread_cond_broadcast(&queue.cond);
+  pthread_mutex_unlock(&queue.lock);
+  for( i = 0; i < config.jobs; i++ ) {
+    pthread_join(workers[i], NULL);
+  }
+
+  write_dictionary(fd, &b, dict, num_topics, &dictionary, &offset);
+  write_footer(fd, &b, &dictionary, batches, num_batches, &offset);
+
+  if( close(fd) ) {
+    CRIT("Could not write '%s'.", config.output);
+  }
+
+  if( config.verbose ) {
+    printf("%s: %zu messages, %zu topics, %zu row groups, %ld bytes\n", config.output, rows, num_topics, num_batches, (long)offset);
+  }
+
+  if( NULL != groups[last % slots] ) {
+    group_free(groups[last % slots]);
+  }
+  free(groups);
+  free(workers);
+  free(batches);
+  free(dict);
+  free(b.buf);
+  topic_table_free(&topics);
+  mqttlog_reader_close(&reader);
+
+  return (MQTTLOG_END == ret)?(0):(1);
+}
@@ -0,0 +1,639 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "log.h"
+#include "mqttlog.h"
+#include "record-ring.h"
+#include "timespec.h"
+
+struct _conf {
+  #define CONF_TOPICS            20          // message i is published on dev/<i % CONF_TOPICS>/v
+  #define CONF_INTERVAL          10000000L   // ns between two messages
+  #define CONF_ANCHOR            1400000000  // cnf time of the log files
+  #define CONF_MAX_PAYLOAD       64
+  #define CONF_DEFAULT_MESSAGES  1000
+  #define CONF_DEFAULT_RING      65536
+  #define CONF_ARROW_BUFFERS     13          // of a record batch of mqttlog-export
+  char *command;
+  char *log_file;
+  long first;           // number of the first message
+  long messages;
+  long crc_block;       // 0 if the log file has no checksums
+  long keyframe;        // messages between two keyframes, 0 for none
+  long index;           // bytes between two entries of the index
+  size_t ring;          // size of the ring in bytes
+  long window;          // ms of messages kept in the ring, 0 for all
+
+  struct mqttlog_header header;
+  char last[CONF_TOPICS][CONF_MAX_PAYLOAD];  // last value of every topic
+} config;
+
+
+/**
+ * Initialize the configuration. Have to be called befor using the config variable.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+int config_init() {
+  config.command   = NULL;
+  config.log_file  = NULL;
+  config.first     = 0;
+  config.messages  = CONF_DEFAULT_MESSAGES;
+  config.crc_block = 0;
+  config.keyframe  = 0;
+  config.index     = MQTTLOG_INDEX_INTERVAL;
+  config.ring      = CONF_DEFAULT_RING;
+  config.window    = 0;
+
+  memset(&config.header, 0, sizeof(struct mqttlog_header));
+  config.header.anchor.tv_sec = CONF_ANCHOR;
+  config.header.partition_levels = -1;
+  memset(config.last, 0, sizeof(config.last));
+
+  return 0;
+}
+
+
+/**
+ * Prints the usage message of the program.
+ *
+ * @param progname Name of the program.
+ */
+void print_usage(char *progname) {
+  printf("Usage: %s [options] write|append|ring|dump|arrow <logfile>\n\n", progname);
+  printf("Writes log files with generated messages for the tests of make check and prints the\n");
+  printf("records of log files. Message i is published at i * %ld ms on dev/<i %% %d>/v.\n\n", CONF_INTERVAL / 1000000, CONF_TOPICS);
+  printf("Commands: \n");
+  printf("write               Write the messages to a new log file.\n");
+  printf("append              Continue a log file like mqttrecorder --append: truncate it after its\n");
+  printf("                    last valid record and append the messages.\n");
+  printf("ring                Push the messages into a ring and write it like a dump of\n");
+  printf("                    mqttrecorder --ring.\n");
+  printf("dump                Print the records of a log file, one per line, with their absolute\n");
+  printf("                    time.\n");
+  printf("arrow               Check the layout of an Arrow file of mqttlog-export and print its\n");
+  printf("                    rows like the messages of dump.\n\n");
+  printf("Options: \n");
+  printf("-f --first          Number of the first message.\n");
+  printf("                    Default value: 0\n");
+  printf("-n --messages       Number of messages.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_MESSAGES);
+  printf("-c --crc            Write a checksum after at least the given number of bytes.\n");
+  printf("                    Default value: 0 (no checksums)\n");
+  printf("-k --keyframe       Write a keyframe every given number of messages.\n");
+  printf("                    Default value: 0 (no keyframes)\n");
+  printf("-i --index          Bytes between two entries of the index.\n");
+  printf("                    Default value: %d\n", MQTTLOG_INDEX_INTERVAL);
+  printf("-r --ring           Size of the ring in bytes.\n");
+  printf("                    Default value: %d\n", CONF_DEFAULT_RING);
+  printf("-w --window         Keep only the messages of the last given ms in the ring.\n");
+  printf("                    Default value: 0 (all)\n");
+  printf("-h --help           Print this help message.\n");
+}
+
+
+/**
+ * Parses a number argument of an option or exits.
+ */
+long parse_number(int argc, char **argv, int i, long min) {
+  char *end;
+  long value;
+
+  if( i == argc ) {
+    fprintf(stderr, "ERROR: Parameter %s given but no number specified.\n", argv[i-1]);
+    print_usage(*argv);
+    exit(1);
+  }
+
+  value = strtol(argv[i], &end, 10);
+  if( '\0' != *end || value < min ) {
+    fprintf(stderr, "ERROR: Invalid number given for %s: %s\n", argv[i-1], argv[i]);
+    print_usage(*argv);
+    exit(1);
+  }
+
+  return value;
+}
+
+
+/**
+ * Parse the commandline arguments. The first argument provided in argv is the
+ * program name.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of arguments. The first string is the program name.
+ */
+void parse_args(int argc, char **argv) {
+  int i;
+
+  for(i = 1; i < argc; i++) {
+
+    // FIRST
+    if( !strcmp(argv[i], "-f") || !strcmp(argv[i], "--first") ) {
+      config.first = parse_number(argc, argv, ++i, 0);
+
+    // MESSAGES
+    } else if( !strcmp(argv[i], "-n") || !strcmp(argv[i], "--messages") ) {
+      config.messages = parse_number(argc, argv, ++i, 0);
+
+    // CRC
+    } else if( !strcmp(argv[i], "-c") || !strcmp(argv[i], "--crc") ) {
+      config.crc_block = parse_number(argc, argv, ++i, 0);
+
+    // KEYFRAME
+    } else if( !strcmp(argv[i], "-k") || !strcmp(argv[i], "--keyframe") ) {
+      config.keyframe = parse_number(argc, argv, ++i, 0);
+
+    // INDEX
+    } else if( !strcmp(argv[i], "-i") || !strcmp(argv[i], "--index") ) {
+      config.index = parse_number(argc, argv, ++i, 1);
+
+    // RING
+    } else if( !strcmp(argv[i], "-r") || !strcmp(argv[i], "--ring") ) {
+      config.ring = parse_number(argc, argv, ++i, 1024);
+
+    // WINDOW
+    } else if( !strcmp(argv[i], "-w") || !strcmp(argv[i], "--window") ) {
+      config.window = parse_number(argc, argv, ++i, 0);
+
+    // HELP
+    } else if( !strcmp(argv[i], "-h") || !strcmp(argv[i], "--help") ) {
+      print_usage(*argv);
+      exit(0);
+
+    } else if( '-' == argv[i][0] ) {
+      fprintf(stderr, "ERROR: Unknown parameter '%s'.\n", argv[i]);
+      print_usage(*argv);
+      exit(1);
+
+    } else if( NULL == config.command ) {
+      config.command = argv[i];
+
+    } else if( NULL == config.log_file ) {
+      config.log_file = argv[i];
+
+    } else {
+      fprintf(stderr, "ERROR: Too many arguments.\n");
+      print_usage(*argv);
+      exit(1);
+    }
+  }
+
+  if( NULL == config.log_file ) {
+    fprintf(stderr, "ERROR: No command and log file given.\n");
+    print_usage(*argv);
+    exit(1);
+  }
+  config.header.crc_block = config.crc_block;
+}
+
+
+/**
+ * Generates message i.
+ *
+ * @return The length of the payload.
+ */
+int message(long i, struct timespec *time, char *topic, size_t size, char *payload) {
+  timespec_from_ns(i * CONF_INTERVAL, time);
+  snprintf(topic, size, "dev/%ld/v", i % CONF_TOPICS);
+  // payloads of different lengths
+  return snprintf(payload, CONF_MAX_PAYLOAD, "{\"i\":%ld,\"pad\":\"%.*s\"}", i, (int)(i % 7), "xxxxxxx");
+}
+
+
+/**
+ * Generates the messages and every config.keyframe messages a keyframe with
+ * the last values before it.
+ *
+ * @param emit Called with every record, for a keyframe len is the number of
+ *             keys.
+ */
+void generate(void (*emit)(void *userdata, int type, const struct timespec *time, int qos, int len, const char *topic, const char *payload), void *userdata) {
+  struct timespec time;
+  char topic[32];
+  long i;
+  int len, k;
+
+  // the last values of the messages before the first one
+  for( i = (config.first > CONF_TOPICS)?(config.first - CONF_TOPICS):(0); i < config.first; i++ ) {
+    message(i, &time, topic, sizeof(topic), config.last[i % CONF_TOPICS]);
+  }
+
+  for( i = config.first; i < config.first + config.messages; i++ ) {
+    if( config.keyframe && i > config.first && !(i % config.keyframe) ) {
+      timespec_from_ns(i * CONF_INTERVAL, &time);
+      emit(userdata, MQTTLOG_KEYFRAME, &time, 0, CONF_TOPICS, "", NULL);
+      for( k = 0; k < CONF_TOPICS; k++ ) {
+        snprintf(topic, sizeof(topic), "dev/%d/v", k);
+        emit(userdata, MQTTLOG_KEY, &time, 0, strlen(config.last[k]), topic, config.last[k]);
+      }
+    }
+
+    len = message(i, &time, topic, sizeof(topic), config.last[i % CONF_TOPICS]);
+    emit(userdata, MQTTLOG_MSG, &time, 1, len, topic, config.last[i % CONF_TOPICS]);
+  }
+}
+
+
+/**
+ * Writes a generated record to the log file of a writer.
+ */
+void emit_log(void *userdata, int type, const struct timespec *time, int qos, int len, const char *topic, const char *payload) {
+  struct mqttlog_writer *w = (struct mqttlog_writer *)userdata;
+  long ret;
+
+  if( MQTTLOG_KEYFRAME == type ) {
+    ret = mqttlog_writer_keyframe(w, time, len);
+  } else {
+    ret = mqttlog_writer_record(w, type, time, qos, 0, len, topic, payload);
+  }
+
+  if( 0 > ret ) {
+    CRIT("Could not write log file.");
+  }
+}
+
+
+/**
+ * Pushes a generated record into a ring.
+ */
+void emit_ring(void *userdata, int type, const struct timespec *time, int qos, int len, const char *topic, const char *payload) {
+  if( ring_push((struct record_ring *)userdata, type, timespec_to_ns(time), qos, 0, len, topic, payload) ) {
+    CRIT("Could not push a record on '%s' into the ring.", topic);
+  }
+}
+
+
+/**
+ * Writes the messages to a new log file.
+ */
+void command_write() {
+  struct mqttlog_writer w;
+
+  if( mqttlog_writer_open(&w, config.log_file, 0) || mqttlog_writer_header(&w, &config.header)
+      || mqttlog_writer_index(&w, config.log_file, config.index) ) {
+    CRIT("Could not open log file '%s'.", config.log_file);
+  }
+
+  generate(emit_log, &w);
+
+  if( mqttlog_writer_close(&w) ) {
+    CRIT("Could not write log file.");
+  }
+}
+
+
+/**
+ * Recovers a log file and appends the messages with its settings, like
+ * mqttrecorder --append.
+ */
+void command_append() {
+  struct mqttlog_writer w;
+  struct mqttlog_reader r;
+
+  if( 0 > mqttlog_recover(config.log_file) || mqttlog_reader_open(&r, config.log_file) ) {
+    CRIT("Could not recover log file '%s'.", config.log_file);
+  }
+  config.header = r.header;
+  mqttlog_reader_close(&r);
+
+  if( mqttlog_writer_open(&w, config.log_file, 1) || mqttlog_writer_continue(&w, &config.header)
+      || mqttlog_writer_index(&w, config.log_file, config.index) ) {
+    CRIT("Could not open log file '%s'.", config.log_file);
+  }
+
+  generate(emit_log, &w);
+
+  if( mqttlog_writer_close(&w) ) {
+    CRIT("Could not write log file.");
+  }
+}
+
+
+/**
+ * Pushes the messages into a ring and writes a copy of it like a dump of the
+ * flight recorder.
+ */
+void command_ring() {
+  struct record_ring ring, snapshot;
+  struct mqttlog_writer w;
+
+  if( ring_init(&ring, config.ring) || ring_init(&snapshot, config.ring) ) {
+    CRIT("Could not create the ring.");
+  }
+
+  generate(emit_ring, &ring);
+  if( config.window ) {
+    ring_expire(&ring, (config.first + config.messages - 1) * CONF_INTERVAL - config.window * 1000000L);
+  }
+  ring_copy(&snapshot, &ring);
+
+  if( mqttlog_writer_open(&w, config.log_file, 0) || mqttlog_writer_header(&w, &config.header) ) {
+    CRIT("Could not open log file '%s'.", config.log_file);
+  }
+  if( ring_write(&snapshot, &w) || mqttlog_writer_close(&w) ) {
+    CRIT("Could not write log file.");
+  }
+
+  ring_free(&ring);
+  ring_free(&snapshot);
+}
+
+
+/**
+ * Prints the records of a log file.
+ *
+ * @return 0 if the log file was read completely, otherwise 1.
+ */
+int command_dump() {
+  static const char *types[] = { [MQTTLOG_MSG] = "msg", [MQTTLOG_KEYFRAME] = "kfm", [MQTTLOG_KEY] = "key", [MQTTLOG_DROP] = "drp" };
+  struct mqttlog_reader r;
+  struct mqttlog_record rec;
+  int ret;
+
+  if( mqttlog_reader_open(&r, config.log_file) ) {
+    CRIT("Could not open log file '%s'.", config.log_file);
+  }
+
+  while( MQTTLOG_RECORD == (ret = mqttlog_reader_next(&r, &rec, MQTTLOG_MSG | MQTTLOG_KEY)) ) {
+    printf("%s %ld.%09ld %d %d %s ", types[rec.type], (long)(rec.abs / NSEC_PER_SEC), (long)(rec.abs % NSEC_PER_SEC), rec.qos, rec.retain, rec.topic);
+    if( NULL != rec.payload ) {
+      fwrite(rec.payload, 1, rec.len, stdout);
+    } else {
+      printf("%d", rec.len);
+    }
+    printf("\n");
+  }
+
+  mqttlog_reader_close(&r);
+
+  if( MQTTLOG_END != ret ) {
+    fprintf(stderr, "ERROR: '%s' ends with an invalid record.\n", config.log_file);
+    return 1;
+  }
+  return 0;
+}
+
+
+/* ---- Arrow files of mqttlog-export ---- */
+
+static struct {
+  uint8_t *buf;
+  size_t size;
+} arrow;
+
+
+/**
+ * Exits if the n bytes at pos are not in the Arrow file.
+ */
+void arrow_check(size_t pos, size_t n, const char *what) {
+  if( pos > arrow.size || n > arrow.size - pos ) {
+    fprintf(stderr, "ERROR: '%s': %s at %zu is out of the file.\n", config.log_file, what, pos);
+    exit(1);
+  }
+}
+
+
+int64_t arrow_i64(size_t pos) {
+  int64_t v;
+
+  arrow_check(pos, 8, "int64");
+  memcpy(&v, arrow.buf + pos, 8);
+  return v;
+}
+
+
+int32_t arrow_i32(size_t pos) {
+  int32_t v;
+
+  arrow_check(pos, 4, "int32");
+  memcpy(&v, arrow.buf + pos, 4);
+  return v;
+}
+
+
+uint8_t arrow_u8(size_t pos) {
+  arrow_check(pos, 1, "uint8");
+  return arrow.buf[pos];
+}
+
+
+uint16_t arrow_u16(size_t pos) {
+  uint16_t v;
+
+  arrow_check(pos, 2, "uint16");
+  memcpy(&v, arrow.buf + pos, 2);
+  return v;
+}
+
+
+/**
+ * @return The position of the object an offset field at pos refers to.
+ */
+size_t arrow_ref(size_t pos) {
+  return pos + (uint32_t)arrow_i32(pos);
+}
+
+
+/**
+ * @return The position of field i of the flatbuffer table at pos or 0 if the
+ *         field is absent.
+ */
+size_t arrow_field(size_t table, int i) {
+  size_t vtable = table - arrow_i32(table);
+  uint16_t offset;
+
+  if( 4 + 2 * i >= arrow_u16(vtable) ) {
+    return 0;
+  }
+  offset = arrow_u16(vtable + 4 + 2 * i);
+  return (offset)?(table + offset):(0);
+}
+
+
+/**
+ * Checks an encapsulated message of a block of the footer.
+ *
+ * @param buffers Set to the buffers vector of its record batch.
+ * @param body Set to the position of its body.
+ * @return The number of rows of its record batch.
+ */
+int64_t arrow_message(size_t block, int type, size_t *buffers, size_t *body) {
+  int64_t offset = arrow_i64(block), body_len = arrow_i64(block + 16);
+  int32_t metadata_len = arrow_i32(block + 8);
+  size_t message, header, batch;
+
+  arrow_check(offset, metadata_len + body_len, "block");
+  if( -1 != arrow_i32(offset) || metadata_len != 8 + arrow_i32(offset + 4) ) {
+    fprintf(stderr, "ERROR: '%s': invalid message prefix at %ld.\n", config.log_file, (long)offset);
+    exit(1);
+  }
+
+  message = arrow_ref(offset + 8);
+  header = arrow_field(message, 2);
+  if( !arrow_field(message, 1) || type != arrow_u8(arrow_field(message, 1)) || !header
+      || !arrow_field(message, 3) || body_len != arrow_i64(arrow_field(message, 3)) ) {
+    fprintf(stderr, "ERROR: '%s': invalid message header at %ld.\n", config.log_file, (long)offset);
+    exit(1);
+  }
+
+  // a dictionary batch holds its record batch in field 1
+  batch = arrow_ref(header);
+  if( 2 == type ) {
+    batch = arrow_ref(arrow_field(batch, 1));
+  }
+
+  *buffers = arrow_ref(arrow_field(batch, 2)) + 4;
+  *body = offset + metadata_len;
+  return arrow_i64(arrow_field(batch, 0));
+}
+
+
+/**
+ * @return The position of buffer i of a record batch with at least n bytes.
+ */
+size_t arrow_buffer(size_t buffers, size_t body, int i, int64_t n) {
+  if( arrow_i64(buffers + 16 * i + 8) < n ) {
+    fprintf(stderr, "ERROR: '%s': buffer %d is too short.\n", config.log_file, i);
+    exit(1);
+  }
+  arrow_check(body + arrow_i64(buffers + 16 * i), n, "buffer");
+  return body + arrow_i64(buffers + 16 * i);
+}
+
+
+/**
+ * Checks the magic, the footer and the blocks of an Arrow file of
+ * mqttlog-export and prints its rows.
+ *
+ * @return 0 if the file is valid, otherwise 1.
+ */
+int command_arrow() {
+  size_t footer, root, dictionaries, batches, buffers, body, offsets, chars, p[CONF_ARROW_BUFFERS];
+  int64_t rows, topics, i, j, time;
+  int32_t len, topic, start;
+  FILE *fd;
+
+  fd = fopen(config.log_file, "r");
+  if( NULL == fd || fseek(fd, 0, SEEK_END) || 0 > (long)(arrow.size = ftell(fd)) || fseek(fd, 0, SEEK_SET) ) {
+    CRIT("Could not open '%s'.", config.log_file);
+  }
+  arrow.buf = malloc(arrow.size + 1);
+  if( NULL == arrow.buf || arrow.size != fread(arrow.buf, 1, arrow.size, fd) ) {
+    CRIT("Could not read '%s'.", config.log_file);
+  }
+  fclose(fd);
+
+  if( 18 > arrow.size || memcmp(arrow.buf, "ARROW1\0\0", 8) || memcmp(arrow.buf + arrow.size - 6, "ARROW1", 6) ) {
+    fprintf(stderr, "ERROR: '%s' does not start and end with the Arrow magic.\n", config.log_file);
+    return 1;
+  }
+
+  // the footer is followed by its length and the magic, the end of stream marker precedes it
+  len = arrow_i32(arrow.size - 10);
+  if( 0 >= len || (size_t)len > arrow.size - 18 - 8 ) {
+    fprintf(stderr, "ERROR: '%s' has an invalid footer length %d.\n", config.log_file, len);
+    return 1;
+  }
+  footer = arrow.size - 10 - len;
+  if( -1 != arrow_i32(footer - 8) || 0 != arrow_i32(footer - 4) ) {
+    fprintf(stderr, "ERROR: '%s' has no end of stream marker before the footer.\n", config.log_file);
+    return 1;
+  }
+
+  root = arrow_ref(footer);
+  dictionaries = arrow_ref(arrow_field(root, 2));
+  batches = arrow_ref(arrow_field(root, 3));
+  if( 1 != arrow_i32(dictionaries) ) {
+    fprintf(stderr, "ERROR: '%s' has not exactly one dictionary.\n", config.log_file);
+    return 1;
+  }
+
+  // the topics
+  topics = arrow_message(dictionaries + 4, 2, &buffers, &body);
+  offsets = arrow_buffer(buffers, body, 1, 4 * (topics + 1));
+  chars = arrow_buffer(buffers, body, 2, arrow_i32(offsets + 4 * topics));
+  for( i = 0; i < topics; i++ ) {
+    if( 0 > arrow_i32(offsets + 4 * i) || arrow_i32(offsets + 4 * i) > arrow_i32(offsets + 4 * (i + 1)) ) {
+      fprintf(stderr, "ERROR: '%s': invalid topic %ld.\n", config.log_file, (long)i);
+      return 1;
+    }
+  }
+
+  for( i = 0; i < arrow_i32(batches); i++ ) {
+    rows = arrow_message(batches + 4 + 24 * i, 3, &buffers, &body);
+    p[1] = arrow_buffer(buffers, body, 1, 8 * rows);
+    p[3] = arrow_buffer(buffers, body, 3, 4 * rows);
+    p[5] = arrow_buffer(buffers, body, 5, rows);
+    p[7] = arrow_buffer(buffers, body, 7, (rows + 7) / 8);
+    p[9] = arrow_buffer(buffers, body, 9, 4 * rows);
+    p[11] = arrow_buffer(buffers, body, 11, 4 * (rows + 1));
+    p[12] = arrow_buffer(buffers, body, 12, arrow_i32(p[11] + 4 * rows));
+
+    for( j = 0; j < rows; j++ ) {
+      time = arrow_i64(p[1] + 8 * j);
+      topic = arrow_i32(p[3] + 4 * j);
+      len = arrow_i32(p[9] + 4 * j);
+      start = arrow_i32(p[11] + 4 * j);
+      if( 0 > topic || topic >= topics || len != arrow_i32(p[11] + 4 * (j + 1)) - start ) {
+        fprintf(stderr, "ERROR: '%s': invalid row %ld of batch %ld.\n", config.log_file, (long)j, (long)i);
+        return 1;
+      }
+      arrow_check(p[12] + start, len, "payload");
+      printf("msg %ld.%09ld %d %d ", (long)(time / NSEC_PER_SEC), (long)(time % NSEC_PER_SEC), arrow_u8(p[5] + j), (arrow_u8(p[7] + j / 8) >> (j % 8)) & 1);
+      fwrite(arrow.buf + chars + arrow_i32(offsets + 4 * topic), 1, arrow_i32(offsets + 4 * (topic + 1)) - arrow_i32(offsets + 4 * topic), stdout);
+      printf(" ");
+      fwrite(arrow.buf + p[12] + start, 1, len, stdout);
+      printf("\n");
+    }
+  }
+
+  free(arrow.buf);
+  return 0;
+}
+
+
+/**
+ * Main!
+ */
+int main(int argc, char **argv) {
+  if( config_init() ) {
+    CRIT("Faild to initialize config.");
+  }
+
+  parse_args(argc, argv);
+
+  if( !strcmp(config.command, "write") ) {
+    command_write();
+  } else if( !strcmp(config.command, "append") ) {
+    command_append();
+  } else if( !strcmp(config.command, "ring") ) {
+    command_ring();
+  } else if( !strcmp(config.command, "dump") ) {
+    return command_dump();
+  } else if( !strcmp(config.command, "arrow") ) {
+    return command_arrow();
+  } else {
+    fprintf(stderr, "ERROR: Unknown command '%s'.\n", config.command);
+    print_usage(*argv);
+    return 1;
+  }
+
+  return 0;
+}
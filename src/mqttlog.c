@@ -0,0 +1,1764 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define _GNU_SOURCE  // copy_file_range()
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include "config.h"
+#include "mqttlog.h"
+#include "dedup.h"
+#include "timespec.h"
+
+#define DEDUP_MIN_LEN     4     // shorter payloads are smaller than a reference
+#define MAX_HEADER_LEN    96    // record line without the topic
+#define PATH_SIZE         4096
+
+
+/* ---- hex ---- */
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static inline int hex_value(char c) {
+  if( '0' <= c && '9' >= c ) {
+    return c - '0';
+  }
+  if( 'a' <= c && 'f' >= c ) {
+    return c - 'a' + 10;
+  }
+  if( 'A' <= c && 'F' >= c ) {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+
+size_t mqttlog_hex_encode(const uint8_t *payload, size_t len, char *out) {
+  char *p = out;
+  size_t i;
+
+  for( i = 0; i < len; i++ ) {
+    p[0] = hex_digits[payload[i] >> 4];
+    p[1] = hex_digits[payload[i] & 0xf];
+    p[2] = ' ';
+    p += 3;
+  }
+
+  return (len)?(p - out - 1):(0);
+}
+
+
+int mqttlog_hex_decode(const char *hex, size_t hex_len, uint8_t *out, size_t len) {
+  int h, l;
+  size_t i;
+
+  if( (len)?(3 * len - 1 != hex_len):(0 != hex_len) ) {
+    return -1;
+  }
+
+  for( i = 0; i < len; i++ ) {
+    h = hex_value(hex[0]);
+    l = hex_value(hex[1]);
+    if( 0 > (h | l) || (i + 1 < len && ' ' != hex[2]) ) {
+      return -1;
+    }
+    out[i] = (h << 4) | l;
+    hex += 3;
+  }
+
+  return 0;
+}
+
+
+/* ---- parsing ---- */
+
+/**
+ * Parses an unsigned decimal number. Fails if it does not fit into a long.
+ */
+static int parse_long(const char **p, const char *end, long *value) {
+  const char *s = *p;
+  long v = 0;
+
+  if( s == end || '0' > *s || '9' < *s ) {
+    return -1;
+  }
+  while( s != end && '0' <= *s && '9' >= *s ) {
+    if( v > (LONG_MAX - 9) / 10 ) {
+      return -1;
+    }
+    v = v * 10 + (*s++ - '0');
+  }
+
+  *value = v;
+  *p = s;
+  return 0;
+}
+
+
+static int parse_int(const char **p, const char *end, int *value) {
+  long v;
+
+  if( parse_long(p, end, &v) || INT_MAX < v ) {
+    return -1;
+  }
+  *value = (int)v;
+  return 0;
+}
+
+
+static int parse_char(const char **p, const char *end, char c) {
+  if( *p == end || c != **p ) {
+    return -1;
+  }
+  (*p)++;
+  return 0;
+}
+
+
+/**
+ * Parses <sec>.<fraction>. The number of fractional digits tells the
+ * resolution: 6 for older microsecond logs, 9 for nanosecond logs.
+ *
+ * @param digits Set to the number of fractional digits, may be NULL.
+ */
+static int parse_time(const char **p, const char *end, struct timespec *t, int *digits) {
+  const char *s;
+  long sec, nsec = 0;
+  int n = 0;
+
+  if( parse_long(p, end, &sec) || parse_char(p, end, '.') ) {
+    return -1;
+  }
+
+  for( s = *p; s != end && '0' <= *s && '9' >= *s; s++, n++ ) {
+    if( 9 > n ) {
+      nsec = nsec * 10 + (*s - '0');
+    }
+  }
+  if( !n ) {
+    return -1;
+  }
+  for( ; 9 > n; n++ ) {
+    nsec *= 10;
+  }
+
+  if( NULL != digits ) {
+    *digits = s - *p;
+  }
+  *p = s;
+  t->tv_sec = sec;
+  t->tv_nsec = nsec;
+  return 0;
+}
+
+
+/**
+ * Parses a configuration line without the leading "cnf ".
+ *
+ * @param dedup Created if the line enables the deduplication. May be NULL.
+ */
+static int parse_config(const char *p, const char *end, struct mqttlog_header *h, struct dedup **dedup) {
+  if( end - p >= 6 && !memcmp(p, "time: ", 6) ) {
+    p += 6;
+    return parse_time(&p, end, &h->anchor, NULL);
+
+  } else if( end - p >= 7 && !memcmp(p, "dedup: ", 7) ) {
+    p += 7;
+    if( parse_int(&p, end, &h->dedup_window) || parse_char(&p, end, ' ') || parse_int(&p, end, &h->dedup_max_len) || !h->dedup_window ) {
+      return -1;
+    }
+    if( NULL != dedup ) {
+      if( NULL == *dedup ) {
+        *dedup = malloc(sizeof(struct dedup));
+        if( NULL == *dedup || dedup_init(*dedup, h->dedup_window, h->dedup_max_len, 0) ) {
+          free(*dedup);
+          *dedup = NULL;
+          return -1;
+        }
+      }
+      dedup_reset(*dedup);
+    }
+    return 0;
+
+  } else if( end - p >= 11 && !memcmp(p, "partition: ", 11) ) {
+    p += 11;
+    return parse_int(&p, end, &h->partition_levels);
+
+  } else if( end - p >= 5 && !memcmp(p, "crc: ", 5) ) {
+    p += 5;
+    return parse_long(&p, end, &h->crc_block);
+
+  } else if( end - p >= 9 && !memcmp(p, "stripes: ", 9) ) {
+    p += 9;
+    return parse_int(&p, end, &h->stripes);
+  }
+
+  // unknown configuration
+  return 0;
+}
+
+
+/**
+ * Parses the first line of a record (without the newline).
+ *
+ * @param topic Set to the topic in the line.
+ * @param digits Set to the number of fractional digits of the time.
+ * @return The record type, 0 for "ref" records or -1 on error.
+ */
+static int parse_record_line(const char *line, size_t n, struct mqttlog_record *rec, const char **topic, size_t *topic_len, int *digits) {
+  const char *p = line + 4;
+  const char *end = line + n;
+  int type;
+
+  if( 4 > n || ' ' != line[3] ) {
+    return -1;
+  }
+
+  if( !memcmp(line, "msg", 3) ) {
+    type = MQTTLOG_MSG;
+  } else if( !memcmp(line, "ref", 3) ) {
+    type = 0;
+  } else if( !memcmp(line, "key", 3) ) {
+    type = MQTTLOG_KEY;
+  } else if( !memcmp(line, "kfm", 3) ) {
+    type = MQTTLOG_KEYFRAME;
+  } else if( !memcmp(line, "drp", 3) ) {
+    type = MQTTLOG_DROP;
+  } else {
+    return -1;
+  }
+
+  if( parse_time(&p, end, &rec->time, digits) || parse_char(&p, end, ' ') ) {
+    return -1;
+  }
+
+  if( MQTTLOG_KEYFRAME == type ) {
+    if( parse_int(&p, end, &rec->len) ) {
+      return -1;
+    }
+    rec->qos = 0;
+    rec->retain = 0;
+    *topic = p;
+    *topic_len = 0;
+    return type;
+  }
+
+  if( MQTTLOG_DROP == type ) {
+    if( parse_int(&p, end, &rec->len) || parse_char(&p, end, ' ') ) {
+      return -1;
+    }
+    rec->qos = 0;
+    rec->retain = 0;
+    *topic = p;
+    *topic_len = end - p;
+    return type;
+  }
+
+  if( parse_int(&p, end, &rec->qos) || parse_char(&p, end, ' ')
+   || parse_int(&p, end, &rec->retain) || parse_char(&p, end, ' ')
+   || parse_int(&p, end, &rec->len) || parse_char(&p, end, ' ') ) {
+    return -1;
+  }
+
+  if( 2 < rec->qos || 1 < rec->retain ) {
+    return -1;
+  }
+
+  *topic = p;
+  *topic_len = end - p;
+
+  return type;
+}
+
+
+int mqttlog_detect(const char *path) {
+  struct mqttlog_reader r;
+  struct mqttlog_record rec;
+  const char *topic;
+  size_t topic_len;
+  int format = MQTTLOG_FORMAT_UNKNOWN;
+  int digits = 9;
+
+  if( mqttlog_reader_open(&r, path) ) {
+    return MQTTLOG_FORMAT_UNKNOWN;
+  }
+
+  if( 0 <= r.header.partition_levels ) {
+    format = MQTTLOG_FORMAT_PARTITIONED;
+  } else if( r.header.stripes ) {
+    format = MQTTLOG_FORMAT_STRIPED;
+  } else {
+    switch( mqttlog_reader_next(&r, &rec, 0) ) {
+      case MQTTLOG_RECORD:
+        parse_record_line(rec.raw, strcspn(rec.raw, "\n"), &rec, &topic, &topic_len, &digits);
+        // fall through
+      case MQTTLOG_END:
+        format = (6 >= digits)?(MQTTLOG_FORMAT_USEC):(MQTTLOG_FORMAT_NSEC);
+        break;
+    }
+  }
+
+  mqttlog_reader_close(&r);
+
+  return format;
+}
+
+
+/* ---- reader ---- */
+
+/**
+ * Reads more data into the buffer.
+ *
+ * @return The number of bytes read, 0 at the end of the data or -1 on error.
+ */
+static ssize_t reader_fill(struct mqttlog_reader *r) {
+  ssize_t n;
+  size_t want;
+  long limit;
+  char *buf;
+
+  if( r->start ) {
+    memmove(r->buf, r->buf + r->start, r->end - r->start);
+    r->base += r->start;
+    r->end -= r->start;
+    r->start = 0;
+  }
+
+  if( r->end == r->size ) {
+    buf = realloc(r->buf, 2 * r->size);
+    if( NULL == buf ) {
+      return -1;
+    }
+    r->buf = buf;
+    r->size *= 2;
+  }
+
+  want = r->size - r->end;
+
+  // do not read beyond the current chunk
+  if( r->chunks && r->chunk < r->num_chunks ) {
+    limit = r->chunks[r->chunk].offset + r->chunks[r->chunk].length;
+    if( r->base + (long)r->end >= limit ) {
+      return 0;
+    }
+    if( r->base + (long)(r->end + want) > limit ) {
+      want = limit - (r->base + r->end);
+    }
+  }
+
+  do {
+    if( r->seekable ) {
+      n = pread(r->fd, r->buf + r->end, want, r->base + r->end);
+    } else {
+      n = read(r->fd, r->buf + r->end, want);
+    }
+  } while( 0 > n && EINTR == errno );
+
+  if( 0 > n ) {
+    return -1;
+  }
+  if( !n ) {
+    r->eof = 1;
+  }
+
+  r->end += n;
+  return n;
+}
+
+
+/**
+ * Searches the end of the line starting at r->start + from. Reads more data if
+ * necessary. Offsets are relative to r->start, which may change.
+ *
+ * @return MQTTLOG_RECORD if the line is complete, otherwise MQTTLOG_END,
+ *         MQTTLOG_PARTIAL or MQTTLOG_ERROR.
+ */
+static int reader_line(struct mqttlog_reader *r, size_t from, size_t *nl) {
+  char *p;
+  size_t searched = from;
+  ssize_t n;
+
+  while(1) {
+    if( r->start + searched < r->end ) {
+      p = memchr(r->buf + r->start + searched, '\n', r->end - r->start - searched);
+      if( NULL != p ) {
+        *nl = p - r->buf - r->start;
+        return MQTTLOG_RECORD;
+      }
+      searched = r->end - r->start;
+    }
+
+    n = reader_fill(r);
+    if( 0 > n ) {
+      return MQTTLOG_ERROR;
+    }
+    if( !n ) {
+      return (r->start == r->end)?(MQTTLOG_END):(MQTTLOG_PARTIAL);
+    }
+  }
+}
+
+
+/**
+ * Marks n bytes as parsed.
+ */
+static void reader_consume(struct mqttlog_reader *r, size_t n) {
+  if( r->verify ) {
+    r->crc = mqttlog_crc32c(r->crc, r->buf + r->start, n);
+  }
+  r->start += n;
+}
+
+
+/**
+ * Checks a crc line (without the newline) against the current block.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+static int reader_check_crc(struct mqttlog_reader *r, const char *line, size_t n) {
+  const char *p = line + 4, *end = line + n;
+  uint32_t crc = 0;
+  long length;
+  int i, v;
+
+  for( i = 0; i < 8; i++, p++ ) {
+    v = (p < end)?(hex_value(*p)):(-1);
+    if( 0 > v ) {
+      return -1;
+    }
+    crc = (crc << 4) | v;
+  }
+
+  if( parse_char(&p, end, ' ') || parse_long(&p, end, &length) ) {
+    return -1;
+  }
+
+  if( !r->verify ) {
+    return 0;
+  }
+
+  return (crc != r->crc || length != mqttlog_reader_tell(r) - r->crc_start);
+}
+
+
+/**
+ * Moves to an offset without changing the current chunk.
+ */
+static int reader_goto(struct mqttlog_reader *r, long offset) {
+  if( offset >= r->base && offset <= r->base + (long)r->end ) {
+    r->start = offset - r->base;
+    return 0;
+  }
+
+  if( !r->seekable ) {
+    return -1;
+  }
+
+  r->base = offset;
+  r->start = 0;
+  r->end = 0;
+  r->eof = 0;
+  return 0;
+}
+
+
+/**
+ * Ensures that the payload buffer has room for len bytes.
+ */
+static int reader_payload_size(struct mqttlog_reader *r, size_t len) {
+  uint8_t *p;
+
+  if( r->payload_size < len ) {
+    p = realloc(r->payload, len);
+    if( NULL == p ) {
+      return -1;
+    }
+    r->payload = p;
+    r->payload_size = len;
+  }
+  return 0;
+}
+
+
+/**
+ * Loads the payload of a reference from the earlier msg record at offset.
+ * It is taken from the window of recent payloads or read again.
+ */
+static int reader_resolve(struct mqttlog_reader *r, long offset, int len) {
+  const struct dedup_slot *slot;
+  struct mqttlog_record rec;
+  const char *topic, *nl;
+  size_t topic_len, size;
+  char *buf;
+  ssize_t n;
+  int ret = -1;
+
+  if( NULL != r->dedup ) {
+    slot = dedup_get(r->dedup, offset);
+    if( NULL != slot ) {
+      if( slot->len != len ) {
+        return -1;
+      }
+      memcpy(r->payload, slot->payload, len);
+      return 0;
+    }
+  }
+
+  if( !r->seekable ) {
+    return -1;
+  }
+
+  size = 4096 + 3 * (size_t)len;
+  while(1) {
+    buf = malloc(size);
+    if( NULL == buf ) {
+      return -1;
+    }
+
+    n = pread(r->fd, buf, size, offset);
+    if( 0 >= n ) {
+      break;
+    }
+
+    nl = memchr(buf, '\n', n);
+    if( NULL == nl ) {
+      if( n < size ) {
+        break;
+      }
+      // very long topic
+      free(buf);
+      size *= 2;
+      continue;
+    }
+
+    if( MQTTLOG_MSG == parse_record_line(buf, nl - buf, &rec, &topic, &topic_len, NULL) && rec.len == len
+     && nl + 1 + ((len)?(3 * len - 1):(0)) <= buf + n ) {
+      ret = mqttlog_hex_decode(nl + 1, (len)?(3 * len - 1):(0), r->payload, len);
+    }
+    break;
+  }
+
+  free(buf);
+  return ret;
+}
+
+
+/**
+ * Reads the configuration lines at the current position.
+ */
+static int reader_config(struct mqttlog_reader *r) {
+  size_t nl;
+  int ret;
+
+  while( MQTTLOG_RECORD == (ret = reader_line(r, 0, &nl)) ) {
+    if( 4 > nl || memcmp(r->buf + r->start, "cnf ", 4) ) {
+      break;
+    }
+    if( parse_config(r->buf + r->start + 4, r->buf + r->start + nl, &r->header, &r->dedup) ) {
+      return -1;
+    }
+    reader_consume(r, nl + 1);
+  }
+
+  return (MQTTLOG_ERROR == ret)?(-1):(0);
+}
+
+
+int mqttlog_reader_fdopen(struct mqttlog_reader *r, int fd) {
+  memset(r, 0, sizeof(struct mqttlog_reader));
+
+  r->fd = fd;
+  r->seekable = (0 <= lseek(fd, 0, SEEK_CUR));
+  r->header.partition_levels = -1;
+
+  r->size = MQTTLOG_READ_BUFFER;
+  r->buf = malloc(r->size);
+  if( NULL == r->buf ) {
+    return -1;
+  }
+
+  if( r->seekable ) {
+    r->base = lseek(fd, 0, SEEK_CUR);
+  }
+
+  if( reader_config(r) ) {
+    free(r->buf);
+    r->buf = NULL;
+    return -1;
+  }
+  r->data_start = mqttlog_reader_tell(r);
+  r->anchor = r->header.anchor;
+
+  return 0;
+}
+
+
+int mqttlog_reader_open(struct mqttlog_reader *r, const char *path) {
+  int fd;
+
+  if( !strcmp(path, "-") ) {
+    fd = STDIN_FILENO;
+  } else {
+    fd = open(path, O_RDONLY);
+    if( 0 > fd ) {
+      return -1;
+    }
+  }
+
+  if( mqttlog_reader_fdopen(r, fd) ) {
+    if( STDIN_FILENO != fd ) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int mqttlog_reader_open_chunk(struct mqttlog_reader *r, const struct mqttlog_reader *file, const struct mqttlog_chunk *chunk) {
+  memset(r, 0, sizeof(struct mqttlog_reader));
+
+  r->fd = file->fd;
+  r->shared = 1;
+  r->seekable = 1;
+  r->header = file->header;
+  r->anchor = file->anchor;
+
+  // the whole chunk is read at once
+  r->size = (0 < chunk->length)?(chunk->length):(1);
+  r->buf = malloc(r->size);
+  if( NULL == r->buf ) {
+    return -1;
+  }
+
+  r->chunks = chunk;
+  r->num_chunks = 1;
+  r->base = chunk->offset;
+  r->data_start = chunk->offset;
+
+  return 0;
+}
+
+
+void mqttlog_reader_close(struct mqttlog_reader *r) {
+  if( 0 <= r->fd && STDIN_FILENO != r->fd && !r->shared ) {
+    close(r->fd);
+  }
+  r->fd = -1;
+
+  free(r->buf);
+  free(r->payload);
+  if( NULL != r->dedup ) {
+    dedup_free(r->dedup);
+    free(r->dedup);
+  }
+  r->buf = NULL;
+  r->payload = NULL;
+  r->dedup = NULL;
+}
+
+
+int mqttlog_reader_next(struct mqttlog_reader *r, struct mqttlog_record *rec, int decode) {
+  static char empty[] = "";
+  const char *line, *topic, *p;
+  size_t nl, nl2, topic_len;
+  long distance;
+  int type, ret;
+
+  r->eof = 0;
+
+  while(1) {
+    // continue with the next chunk of a partition
+    while( r->chunks && (r->chunk >= r->num_chunks || mqttlog_reader_tell(r) >= r->chunks[r->chunk].offset + r->chunks[r->chunk].length) ) {
+      if( r->chunk + 1 >= r->num_chunks ) {
+        r->chunk = r->num_chunks;
+        return MQTTLOG_END;
+      }
+      r->chunk++;
+      if( reader_goto(r, r->chunks[r->chunk].offset) ) {
+        return MQTTLOG_ERROR;
+      }
+    }
+
+    ret = reader_line(r, 0, &nl);
+    if( MQTTLOG_RECORD != ret ) {
+      return ret;
+    }
+
+    line = r->buf + r->start;
+    if( 4 <= nl && !memcmp(line, "cnf ", 4) ) {
+      // configuration within the log, e.g. of a concatenated log
+      if( parse_config(line + 4, line + nl, &r->header, &r->dedup) ) {
+        return MQTTLOG_ERROR;
+      }
+      reader_consume(r, nl + 1);
+      continue;
+    }
+    if( 4 <= nl && !memcmp(line, "crc ", 4) ) {
+      if( reader_check_crc(r, line, nl) ) {
+        return (r->verify)?(MQTTLOG_CORRUPT):(MQTTLOG_ERROR);
+      }
+      r->start += nl + 1;
+      r->crc = 0;
+      r->crc_start = mqttlog_reader_tell(r);
+      continue;
+    }
+    break;
+  }
+
+  type = parse_record_line(line, nl, rec, &topic, &topic_len, NULL);
+  if( 0 > type ) {
+    return MQTTLOG_ERROR;
+  }
+
+  rec->offset = mqttlog_reader_tell(r);
+  rec->abs = timespec_to_ns(&r->header.anchor) + timespec_to_ns(&rec->time);
+  rec->payload = NULL;
+  rec->topic = empty;
+
+  if( MQTTLOG_KEYFRAME == type ) {
+    rec->type = type;
+    rec->raw = line;
+    rec->raw_len = nl + 1;
+    reader_consume(r, nl + 1);
+    return MQTTLOG_RECORD;
+  }
+
+  if( MQTTLOG_DROP == type ) {
+    if( reader_payload_size(r, topic_len + 1) ) {
+      return MQTTLOG_ERROR;
+    }
+    line = r->buf + r->start;
+    memcpy(r->payload, line + nl - topic_len, topic_len);
+    r->payload[topic_len] = '\0';
+    rec->topic = (const char *)r->payload;
+    rec->type = type;
+    rec->raw = line;
+    rec->raw_len = nl + 1;
+    reader_consume(r, nl + 1);
+    return MQTTLOG_RECORD;
+  }
+
+  // the payload line, this may move the buffer
+  ret = reader_line(r, nl + 1, &nl2);
+  if( MQTTLOG_RECORD != ret ) {
+    return (MQTTLOG_END == ret)?(MQTTLOG_PARTIAL):(ret);
+  }
+  line = r->buf + r->start;
+  topic = line + nl - topic_len;
+
+  rec->type = (type)?(type):(MQTTLOG_MSG);
+  rec->raw = line;
+  rec->raw_len = nl2 + 1;
+
+  // the length has to match the hex bytes before it is used for the buffer
+  if( type && ((rec->len)?(3 * (long)rec->len - 1):(0)) != (long)(nl2 - nl - 1) ) {
+    return MQTTLOG_ERROR;
+  }
+
+  if( reader_payload_size(r, rec->len + topic_len + 1) ) {
+    return MQTTLOG_ERROR;
+  }
+
+  p = line + nl + 1;
+  if( !type ) {
+    // reference
+    if( parse_char(&p, line + nl2, '@') || parse_long(&p, line + nl2, &distance) ) {
+      return MQTTLOG_ERROR;
+    }
+    if( rec->type & decode ) {
+      if( reader_resolve(r, rec->offset - distance, rec->len) ) {
+        return MQTTLOG_ERROR;
+      }
+      rec->payload = r->payload;
+    }
+  } else if( rec->type & decode ) {
+    if( mqttlog_hex_decode(p, nl2 - nl - 1, r->payload, rec->len) ) {
+      return MQTTLOG_ERROR;
+    }
+    rec->payload = r->payload;
+
+    // the same payloads as in the window of the writer
+    if( MQTTLOG_MSG == type && NULL != r->dedup && DEDUP_MIN_LEN <= rec->len ) {
+      dedup_add(r->dedup, rec->offset, 0, rec->payload, rec->len);
+    }
+  }
+
+  // The topic is copied behind the payload to terminate it.
+  memcpy(r->payload + rec->len, topic, topic_len);
+  r->payload[rec->len + topic_len] = '\0';
+  rec->topic = (const char *)r->payload + rec->len;
+
+  reader_consume(r, nl2 + 1);
+  return MQTTLOG_RECORD;
+}
+
+
+int mqttlog_reader_seek(struct mqttlog_reader *r, long offset) {
+  return mqttlog_reader_seek_anchor(r, offset, 0);
+}
+
+
+int mqttlog_reader_seek_anchor(struct mqttlog_reader *r, long offset, int64_t anchor) {
+  int c;
+
+  r->verify = 0;
+
+  // the window of recent payloads has to be sorted by offset
+  if( NULL != r->dedup && offset < mqttlog_reader_tell(r) ) {
+    dedup_reset(r->dedup);
+  }
+
+  if( r->chunks ) {
+    for( c = 0; c < r->num_chunks - 1; c++ ) {
+      if( offset < r->chunks[c].offset + r->chunks[c].length ) {
+        break;
+      }
+    }
+    r->chunk = c;
+  }
+
+  if( anchor ) {
+    timespec_from_ns(anchor, &r->header.anchor);
+  } else {
+    r->header.anchor = r->anchor;
+  }
+
+  return reader_goto(r, offset);
+}
+
+
+void mqttlog_reader_verify(struct mqttlog_reader *r) {
+  // the configuration lines are still in the buffer
+  r->verify = 1;
+  r->crc_start = r->base;
+  r->crc = mqttlog_crc32c(0, r->buf, r->start);
+}
+
+
+long mqttlog_reader_tell(struct mqttlog_reader *r) {
+  return r->base + r->start;
+}
+
+
+int mqttlog_reader_set_chunks(struct mqttlog_reader *r, const struct mqttlog_chunk *chunks, int num_chunks) {
+  r->chunks = chunks;
+  r->num_chunks = num_chunks;
+  r->chunk = 0;
+
+  if( !num_chunks ) {
+    return 0;
+  }
+
+  r->data_start = chunks[0].offset;
+  return mqttlog_reader_seek(r, chunks[0].offset);
+}
+
+
+/* ---- writer ---- */
+
+/**
+ * Ensures that n bytes fit into the buffer.
+ */
+static int writer_reserve(struct mqttlog_writer *w, size_t n) {
+  char *buf;
+  size_t size;
+
+  if( w->len + n <= w->size ) {
+    return 0;
+  }
+
+  if( 0 <= w->fd && mqttlog_writer_flush(w) ) {
+    return -1;
+  }
+
+  if( w->len + n > w->size ) {
+    size = w->size;
+    while( w->len + n > size ) {
+      size *= 2;
+    }
+    buf = realloc(w->buf, size);
+    if( NULL == buf ) {
+      w->error = ENOMEM;
+      return -1;
+    }
+    w->buf = buf;
+    w->size = size;
+  }
+
+  return 0;
+}
+
+
+/**
+ * Ends the current block with a crc line.
+ */
+static int writer_seal(struct mqttlog_writer *w) {
+  char line[64];
+  int n;
+
+  if( !w->crc_block || w->offset == w->crc_start ) {
+    return 0;
+  }
+
+  n = snprintf(line, sizeof(line), "crc %08x %ld\n", w->crc, w->offset - w->crc_start);
+  if( writer_reserve(w, n) ) {
+    return -1;
+  }
+  memcpy(w->buf + w->len, line, n);
+  w->len += n;
+  w->offset += n;
+
+  w->crc = 0;
+  w->crc_start = w->offset;
+  return 0;
+}
+
+
+/**
+ * Adds bytes just written to the checksum of the current block. Ends the
+ * block if it is full.
+ */
+static int writer_crc(struct mqttlog_writer *w, const void *buf, size_t len) {
+  if( !w->crc_block ) {
+    return 0;
+  }
+
+  w->crc = mqttlog_crc32c(w->crc, buf, len);
+
+  if( w->offset - w->crc_start >= w->crc_block ) {
+    return writer_seal(w);
+  }
+  return 0;
+}
+
+
+static int writer_init(struct mqttlog_writer *w, int fd) {
+  memset(w, 0, sizeof(struct mqttlog_writer));
+
+  w->fd = fd;
+  w->size = MQTTLOG_WRITE_BUFFER;
+  w->buf = malloc(w->size);
+  if( NULL == w->buf ) {
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int mqttlog_writer_fdopen(struct mqttlog_writer *w, int fd) {
+  off_t offset;
+
+  if( writer_init(w, fd) ) {
+    return -1;
+  }
+
+  offset = lseek(fd, 0, SEEK_CUR);
+  w->offset = (0 < offset)?(offset):(0);
+
+  return 0;
+}
+
+
+int mqttlog_writer_open(struct mqttlog_writer *w, const char *path, int append) {
+  int fd;
+
+  if( !strcmp(path, "-") ) {
+    return mqttlog_writer_fdopen(w, STDOUT_FILENO);
+  }
+
+  fd = open(path, O_WRONLY | O_CREAT | ((append)?(O_APPEND):(O_TRUNC)), 0644);
+  if( 0 > fd ) {
+    return -1;
+  }
+
+  if( mqttlog_writer_fdopen(w, fd) ) {
+    close(fd);
+    return -1;
+  }
+
+  if( append ) {
+    w->offset = lseek(fd, 0, SEEK_END);
+    w->append = 1;
+  }
+
+  return 0;
+}
+
+
+int mqttlog_writer_mem(struct mqttlog_writer *w) {
+  return writer_init(w, -1);
+}
+
+
+void mqttlog_writer_reset(struct mqttlog_writer *w) {
+  w->len = 0;
+  w->offset = 0;
+}
+
+
+int mqttlog_writer_header(struct mqttlog_writer *w, const struct mqttlog_header *header) {
+  char line[128];
+  int n;
+
+  // the first block starts with the header
+  w->crc_block = header->crc_block;
+  w->crc_start = w->offset;
+  w->crc = 0;
+
+  n = snprintf(line, sizeof(line), "cnf time: %ld.%09ld\n", (long)header->anchor.tv_sec, header->anchor.tv_nsec);
+  if( 0 > mqttlog_writer_raw(w, line, n) ) {
+    return -1;
+  }
+
+  if( header->dedup_window ) {
+    if( NULL == w->dedup ) {
+      w->dedup = malloc(sizeof(struct dedup));
+      if( NULL == w->dedup || dedup_init(w->dedup, header->dedup_window, header->dedup_max_len, 1) ) {
+        free(w->dedup);
+        w->dedup = NULL;
+        return -1;
+      }
+    }
+
+    n = snprintf(line, sizeof(line), "cnf dedup: %d %d\n", header->dedup_window, header->dedup_max_len);
+    if( 0 > mqttlog_writer_raw(w, line, n) ) {
+      return -1;
+    }
+  }
+
+  if( 0 <= header->partition_levels ) {
+    n = snprintf(line, sizeof(line), "cnf partition: %d\n", header->partition_levels);
+    if( 0 > mqttlog_writer_raw(w, line, n) ) {
+      return -1;
+    }
+  }
+
+  if( header->crc_block ) {
+    n = snprintf(line, sizeof(line), "cnf crc: %ld\n", header->crc_block);
+    if( 0 > mqttlog_writer_raw(w, line, n) ) {
+      return -1;
+    }
+  }
+
+  if( header->stripes ) {
+    n = snprintf(line, sizeof(line), "cnf stripes: %d\n", header->stripes);
+    if( 0 > mqttlog_writer_raw(w, line, n) ) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+int mqttlog_writer_continue(struct mqttlog_writer *w, const struct mqttlog_header *header) {
+  w->crc_block = header->crc_block;
+  w->crc_start = w->offset;
+  w->crc = 0;
+
+  if( header->dedup_window && NULL == w->dedup ) {
+    w->dedup = malloc(sizeof(struct dedup));
+    if( NULL == w->dedup || dedup_init(w->dedup, header->dedup_window, header->dedup_max_len, 1) ) {
+      free(w->dedup);
+      w->dedup = NULL;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+int mqttlog_writer_index(struct mqttlog_writer *w, const char *path, long interval) {
+  char index_file[PATH_SIZE];
+
+  snprintf(index_file, sizeof(index_file), "%s.idx", path);
+  w->index_fd = fopen(index_file, (w->append)?("a"):("w"));
+  if( NULL == w->index_fd ) {
+    return -1;
+  }
+  w->index_interval = interval;
+  w->index_last = -interval;
+
+  return 0;
+}
+
+
+/**
+ * Writes the first line of a record into the buffer.
+ */
+static void writer_record_line(struct mqttlog_writer *w, const char *type, const struct timespec *time, int qos, int retain, int len, const char *topic, size_t topic_len) {
+  int n;
+
+  n = snprintf(w->buf + w->len, MAX_HEADER_LEN, "%s %ld.%09ld %d %d %d ", type, (long)time->tv_sec, time->tv_nsec, qos, retain, len);
+  w->len += n;
+  memcpy(w->buf + w->len, topic, topic_len);
+  w->len += topic_len;
+  w->buf[w->len++] = '\n';
+}
+
+
+long mqttlog_writer_record(struct mqttlog_writer *w, int type, const struct timespec *time, int qos, int retain, int len, const char *topic, const void *payload) {
+  size_t topic_len = strlen(topic);
+  size_t before;
+  long offset = w->offset;
+  long target = -1;
+  uint64_t hash = 0;
+  long written;
+
+  if( NULL != w->index_fd && MQTTLOG_MSG == type && w->offset - w->index_last >= w->index_interval ) {
+    fprintf(w->index_fd, "ent %ld.%09ld %ld\n", (long)time->tv_sec, time->tv_nsec, w->offset);
+    w->index_last = w->offset;
+  }
+
+  if( NULL != w->dedup && MQTTLOG_MSG == type && DEDUP_MIN_LEN <= len ) {
+    hash = dedup_hash(payload, len);
+    target = dedup_find(w->dedup, hash, payload, len);
+  }
+
+  if( 0 <= target ) {
+    if( writer_reserve(w, MAX_HEADER_LEN + topic_len + 32) ) {
+      return -1;
+    }
+    before = w->len;
+    writer_record_line(w, "ref", time, qos, retain, len, topic, topic_len);
+    w->len += snprintf(w->buf + w->len, 32, "@%ld\n", offset - target);
+  } else {
+    if( writer_reserve(w, MAX_HEADER_LEN + topic_len + 3 * (size_t)len + 1) ) {
+      return -1;
+    }
+    before = w->len;
+    writer_record_line(w, (MQTTLOG_KEY == type)?("key"):("msg"), time, qos, retain, len, topic, topic_len);
+    w->len += mqttlog_hex_encode(payload, len, w->buf + w->len);
+    w->buf[w->len++] = '\n';
+
+    if( NULL != w->dedup && MQTTLOG_MSG == type && DEDUP_MIN_LEN <= len ) {
+      dedup_add(w->dedup, offset, hash, payload, len);
+    }
+  }
+
+  written = w->len - before;
+  w->offset += written;
+
+  if( writer_crc(w, w->buf + before, written) ) {
+    return -1;
+  }
+
+  return written;
+}
+
+
+long mqttlog_writer_keyframe(struct mqttlog_writer *w, const struct timespec *time, size_t keys) {
+  char line[128];
+  int n;
+
+  if( NULL != w->index_fd ) {
+    fprintf(w->index_fd, "kfm %ld.%09ld %ld\n", (long)time->tv_sec, time->tv_nsec, w->offset);
+  }
+
+  n = snprintf(line, sizeof(line), "kfm %ld.%09ld %zu\n", (long)time->tv_sec, time->tv_nsec, keys);
+  return mqttlog_writer_raw(w, line, n);
+}
+
+
+long mqttlog_writer_drop(struct mqttlog_writer *w, const struct timespec *time, int count, const char *policy) {
+  size_t policy_len = strlen(policy);
+  size_t before;
+  long written;
+
+  if( writer_reserve(w, MAX_HEADER_LEN + policy_len + 1) ) {
+    return -1;
+  }
+  before = w->len;
+
+  w->len += snprintf(w->buf + w->len, MAX_HEADER_LEN, "drp %ld.%09ld %d ", (long)time->tv_sec, time->tv_nsec, count);
+  memcpy(w->buf + w->len, policy, policy_len);
+  w->len += policy_len;
+  w->buf[w->len++] = '\n';
+
+  written = w->len - before;
+  w->offset += written;
+
+  if( writer_crc(w, w->buf + before, written) ) {
+    return -1;
+  }
+
+  return written;
+}
+
+
+long mqttlog_writer_raw(struct mqttlog_writer *w, const void *buf, size_t len) {
+  const char *p = buf;
+  size_t todo = len;
+  ssize_t n;
+
+  if( 0 <= w->fd && len >= w->size ) {
+    // large blocks are written directly
+    if( mqttlog_writer_flush(w) ) {
+      return -1;
+    }
+    while( todo ) {
+      n = write(w->fd, p, todo);
+      if( 0 > n ) {
+        if( EINTR == errno ) {
+          continue;
+        }
+        w->error = errno;
+        return -1;
+      }
+      p += n;
+      todo -= n;
+      w->offset += n;
+    }
+  } else {
+    if( writer_reserve(w, len) ) {
+      return -1;
+    }
+    memcpy(w->buf + w->len, buf, len);
+    w->len += len;
+    w->offset += len;
+  }
+
+  if( writer_crc(w, buf, len) ) {
+    return -1;
+  }
+
+  return len;
+}
+
+
+long mqttlog_writer_copy(struct mqttlog_writer *w, int fd, long offset, long len) {
+  off_t pos = offset;
+  long todo = len;
+  ssize_t n;
+
+  if( writer_seal(w) || mqttlog_writer_flush(w) ) {
+    return -1;
+  }
+
+#ifdef HAVE_COPY_FILE_RANGE
+  // within the kernel, some file systems only share the extents
+  while( 0 <= w->fd && todo ) {
+    n = copy_file_range(fd, &pos, w->fd, NULL, todo, 0);
+    if( 0 > n && EINTR == errno ) {
+      continue;
+    }
+    if( 0 >= n ) {
+      // e.g. another file system on older kernels, sendfile() still works
+      break;
+    }
+    todo -= n;
+  }
+#endif
+
+  while( 0 <= w->fd && todo ) {
+    n = sendfile(w->fd, fd, &pos, todo);
+    if( 0 > n && EINTR == errno ) {
+      continue;
+    }
+    if( 0 >= n ) {
+      break;
+    }
+    todo -= n;
+  }
+
+  // memory writers and whatever the kernel did not copy
+  while( todo ) {
+    n = (todo < (long)w->size)?(todo):((long)w->size);
+    if( writer_reserve(w, n) ) {
+      return -1;
+    }
+    n = pread(fd, w->buf + w->len, n, pos);
+    if( 0 > n && EINTR == errno ) {
+      continue;
+    }
+    if( 0 >= n ) {
+      w->error = (n)?(errno):(EIO);
+      return -1;
+    }
+    w->len += n;
+    pos += n;
+    todo -= n;
+  }
+
+  // the copied blocks end with their own crc line
+  w->offset += len;
+  w->crc = 0;
+  w->crc_start = w->offset;
+
+  return len;
+}
+
+
+int mqttlog_writer_flush(struct mqttlog_writer *w) {
+  size_t done = 0;
+  ssize_t n;
+
+  if( 0 > w->fd ) {
+    return 0;
+  }
+
+  while( done < w->len ) {
+    n = write(w->fd, w->buf + done, w->len - done);
+    if( 0 > n ) {
+      if( EINTR == errno ) {
+        continue;
+      }
+      w->error = errno;
+      // keep what was not written
+      memmove(w->buf, w->buf + done, w->len - done);
+      w->len -= done;
+      return -1;
+    }
+    done += n;
+  }
+  w->len = 0;
+
+  if( NULL != w->index_fd ) {
+    fflush(w->index_fd);
+  }
+
+  return 0;
+}
+
+
+int mqttlog_writer_close(struct mqttlog_writer *w) {
+  int ret = 0;
+
+  if( writer_seal(w) || mqttlog_writer_flush(w) ) {
+    ret = -1;
+  }
+
+  if( 0 <= w->fd && STDOUT_FILENO != w->fd && close(w->fd) ) {
+    ret = -1;
+  }
+  w->fd = -1;
+
+  if( NULL != w->index_fd ) {
+    fclose(w->index_fd);
+    w->index_fd = NULL;
+  }
+
+  if( NULL != w->dedup ) {
+    dedup_free(w->dedup);
+    free(w->dedup);
+    w->dedup = NULL;
+  }
+
+  free(w->buf);
+  w->buf = NULL;
+
+  return ret;
+}
+
+
+/* ---- recovery ---- */
+
+long mqttlog_recover(const char *path) {
+  struct mqttlog_reader r;
+  struct mqttlog_record rec;
+  struct mqttlog_index idx;
+  char line[64];
+  long end, crc_start;
+  uint32_t crc;
+  size_t i, j;
+  int ret, fd, n;
+
+  if( mqttlog_reader_open(&r, path) ) {
+    return -1;
+  }
+  mqttlog_reader_verify(&r);
+
+  end = mqttlog_reader_tell(&r);
+  crc = r.crc;
+  crc_start = r.crc_start;
+
+  while( MQTTLOG_RECORD == (ret = mqttlog_reader_next(&r, &rec, MQTTLOG_MSG | MQTTLOG_KEY)) ) {
+    end = mqttlog_reader_tell(&r);
+    crc = r.crc;
+    crc_start = r.crc_start;
+  }
+
+  if( MQTTLOG_END == ret ) {
+    end = mqttlog_reader_tell(&r);
+    crc = r.crc;
+    crc_start = r.crc_start;
+  } else if( MQTTLOG_CORRUPT == ret ) {
+    // the whole block is dropped
+    end = r.crc_start;
+    crc = 0;
+    crc_start = end;
+  }
+  mqttlog_reader_close(&r);
+
+  if( truncate(path, end) ) {
+    return -1;
+  }
+
+  // protect the records after the last crc line
+  if( r.header.crc_block && crc_start < end ) {
+    n = snprintf(line, sizeof(line), "crc %08x %ld\n", crc, end - crc_start);
+    fd = open(path, O_WRONLY | O_APPEND);
+    if( 0 > fd ) {
+      return -1;
+    }
+    if( n != write(fd, line, n) ) {
+      close(fd);
+      return -1;
+    }
+    close(fd);
+    end += n;
+  }
+
+  if( !mqttlog_index_load(&idx, path) ) {
+    for( i = 0, j = 0; i < idx.count; i++ ) {
+      if( idx.entries[i].offset < end ) {
+        idx.entries[j++] = idx.entries[i];
+      }
+    }
+    ret = 0;
+    if( j != idx.count ) {
+      idx.count = j;
+      ret = mqttlog_index_save(&idx, path);
+    }
+    mqttlog_index_free(&idx);
+    if( ret ) {
+      return -1;
+    }
+  }
+
+  return end;
+}
+
+
+/* ---- index ---- */
+
+int mqttlog_index_add(struct mqttlog_index *idx, int64_t time, long offset, int keyframe, int64_t anchor) {
+  struct mqttlog_index_entry *entries;
+
+  if( idx->count == idx->size ) {
+    entries = realloc(idx->entries, ((idx->size)?(2 * idx->size):(64)) * sizeof(struct mqttlog_index_entry));
+    if( NULL == entries ) {
+      return -1;
+    }
+    idx->entries = entries;
+    idx->size = (idx->size)?(2 * idx->size):(64);
+  }
+
+  idx->entries[idx->count].time = time;
+  idx->entries[idx->count].offset = offset;
+  idx->entries[idx->count].keyframe = keyframe;
+  idx->entries[idx->count].anchor = anchor;
+  idx->count++;
+
+  return 0;
+}
+
+
+int mqttlog_index_load(struct mqttlog_index *idx, const char *path) {
+  char index_file[PATH_SIZE];
+  char line[128];
+  char type[4];
+  char frac[16], anchor_frac[16];
+  struct timespec t, anchor;
+  long offset;
+  FILE *fd;
+  int n;
+
+  memset(idx, 0, sizeof(struct mqttlog_index));
+
+  snprintf(index_file, sizeof(index_file), "%s.idx", path);
+  fd = fopen(index_file, "r");
+  if( NULL == fd ) {
+    return -1;
+  }
+
+  // entries behind a cnf time line between the records have its anchor
+  while( NULL != fgets(line, sizeof(line), fd) ) {
+    n = sscanf(line, "%3s %ld.%15[0-9] %ld %ld.%15[0-9]", type, &t.tv_sec, frac, &offset, &anchor.tv_sec, anchor_frac);
+    if( 4 > n ) {
+      break;
+    }
+    t.tv_nsec = timespec_nsec_from_digits(frac);
+    anchor.tv_nsec = (6 == n)?(timespec_nsec_from_digits(anchor_frac)):(0);
+    if( mqttlog_index_add(idx, timespec_to_ns(&t), offset, !strcmp(type, "kfm"), (6 == n)?(timespec_to_ns(&anchor)):(0)) ) {
+      fclose(fd);
+      mqttlog_index_free(idx);
+      return -1;
+    }
+  }
+
+  fclose(fd);
+  return 0;
+}
+
+
+int mqttlog_index_build(struct mqttlog_index *idx, struct mqttlog_reader *r, long interval) {
+  struct mqttlog_record rec;
+  int64_t start = timespec_to_ns(&r->anchor);
+  int64_t anchor;
+  long last = -interval;
+  int ret;
+
+  memset(idx, 0, sizeof(struct mqttlog_index));
+
+  if( mqttlog_reader_seek(r, r->data_start) ) {
+    return -1;
+  }
+
+  while( MQTTLOG_RECORD == (ret = mqttlog_reader_next(r, &rec, 0)) ) {
+    anchor = timespec_to_ns(&r->header.anchor);
+    anchor = (anchor != start)?(anchor):(0);
+    if( MQTTLOG_KEYFRAME == rec.type ) {
+      if( mqttlog_index_add(idx, rec.abs - start, rec.offset, 1, anchor) ) {
+        return -1;
+      }
+    } else if( MQTTLOG_MSG == rec.type && rec.offset - last >= interval ) {
+      if( mqttlog_index_add(idx, rec.abs - start, rec.offset, 0, anchor) ) {
+        return -1;
+      }
+      last = rec.offset;
+    }
+  }
+
+  return (MQTTLOG_END == ret)?(0):(-1);
+}
+
+
+int mqttlog_index_save(const struct mqttlog_index *idx, const char *path) {
+  char index_file[PATH_SIZE];
+  struct timespec t;
+  size_t i;
+  FILE *fd;
+
+  snprintf(index_file, sizeof(index_file), "%s.idx", path);
+  fd = fopen(index_file, "w");
+  if( NULL == fd ) {
+    return -1;
+  }
+
+  for( i = 0; i < idx->count; i++ ) {
+    timespec_from_ns(idx->entries[i].time, &t);
+    fprintf(fd, "%s %ld.%09ld %ld", (idx->entries[i].keyframe)?("kfm"):("ent"), (long)t.tv_sec, t.tv_nsec, idx->entries[i].offset);
+    if( idx->entries[i].anchor ) {
+      timespec_from_ns(idx->entries[i].anchor, &t);
+      fprintf(fd, " %ld.%09ld", (long)t.tv_sec, t.tv_nsec);
+    }
+    fputc('\n', fd);
+  }
+
+  return fclose(fd);
+}
+
+
+const struct mqttlog_index_entry *mqttlog_index_lookup(const struct mqttlog_index *idx, int64_t time, int keyframe) {
+  size_t lo = 0, hi = idx->count, mid;
+
+  // first entry after time
+  while( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if( idx->entries[mid].time <= time ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  while( lo-- ) {
+    if( !keyframe || idx->entries[lo].keyframe ) {
+      return idx->entries + lo;
+    }
+  }
+
+  return NULL;
+}
+
+
+long mqttlog_index_find(const struct mqttlog_index *idx, int64_t time, int keyframe) {
+  const struct mqttlog_index_entry *entry = mqttlog_index_lookup(idx, time, keyframe);
+
+  return (NULL != entry)?(entry->offset):(-1);
+}
+
+
+void mqttlog_index_free(struct mqttlog_index *idx) {
+  free(idx->entries);
+  memset(idx, 0, sizeof(struct mqttlog_index));
+}
+
+
+/* ---- partitions ---- */
+
+int mqttlog_parts_load(const char *path, struct mqttlog_partition **parts, int *num_parts) {
+  char parts_file[PATH_SIZE];
+  char type[4];
+  char *key = NULL;
+  struct mqttlog_partition *p;
+  struct mqttlog_chunk chunk, *chunks;
+  long first_sec, first_nsec, last_sec, last_nsec;
+  size_t key_size = 0;
+  ssize_t n;
+  int id;
+  FILE *fd;
+
+  *parts = NULL;
+  *num_parts = 0;
+
+  snprintf(parts_file, sizeof(parts_file), "%s.parts", path);
+  fd = fopen(parts_file, "r");
+  if( NULL == fd ) {
+    return -1;
+  }
+
+  while( 2 == fscanf(fd, "%3s %d", type, &id) ) {
+
+    if( !strcmp(type, "prt") ) {
+      // the key is the rest of the line
+      if( ' ' != fgetc(fd) || 0 >= (n = getline(&key, &key_size, fd)) || id != *num_parts ) {
+        goto error;
+      }
+      if( '\n' == key[n - 1] ) {
+        key[n - 1] = '\0';
+      }
+
+      p = realloc(*parts, (*num_parts + 1) * sizeof(struct mqttlog_partition));
+      if( NULL == p ) {
+        goto error;
+      }
+      *parts = p;
+      p = &(*parts)[(*num_parts)++];
+      memset(p, 0, sizeof(struct mqttlog_partition));
+      p->key = strdup(key);
+      if( NULL == p->key ) {
+        goto error;
+      }
+
+    } else if( !strcmp(type, "chk") ) {
+      if( 7 != fscanf(fd, " %ld %ld %ld.%ld %ld.%ld %ld\n", &chunk.offset, &chunk.length, &first_sec, &first_nsec, &last_sec, &last_nsec, &chunk.records)
+          || 0 > id || id >= *num_parts ) {
+        goto error;
+      }
+      chunk.first = first_sec * NSEC_PER_SEC + first_nsec;
+      chunk.last = last_sec * NSEC_PER_SEC + last_nsec;
+      p = &(*parts)[id];
+      chunks = realloc(p->chunks, (p->num_chunks + 1) * sizeof(struct mqttlog_chunk));
+      if( NULL == chunks ) {
+        goto error;
+      }
+      p->chunks = chunks;
+      p->chunks[p->num_chunks++] = chunk;
+
+    } else {
+      goto error;
+    }
+  }
+
+  free(key);
+  fclose(fd);
+  return 0;
+
+error:
+  free(key);
+  fclose(fd);
+  mqttlog_parts_free(*parts, *num_parts);
+  *parts = NULL;
+  *num_parts = 0;
+  return -1;
+}
+
+
+void mqttlog_parts_free(struct mqttlog_partition *parts, int num_parts) {
+  int i;
+
+  for( i = 0; i < num_parts; i++ ) {
+    free(parts[i].key);
+    free(parts[i].chunks);
+  }
+  free(parts);
+}
+
+
+int mqttlog_stripes_load(const char *path, char ***files, int *num_files) {
+  char stripes_file[PATH_SIZE];
+  char *line = NULL, **f;
+  size_t line_size = 0;
+  ssize_t n;
+  int id, pos = 0;
+  FILE *fd;
+
+  *files = NULL;
+  *num_files = 0;
+
+  snprintf(stripes_file, sizeof(stripes_file), "%s.stripes", path);
+  fd = fopen(stripes_file, "r");
+  if( NULL == fd ) {
+    return -1;
+  }
+
+  while( 0 < (n = getline(&line, &line_size, fd)) ) {
+    if( '\n' == line[n - 1] ) {
+      line[n - 1] = '\0';
+    }
+
+    // the layout is only informational
+    if( !strncmp(line, "lay ", 4) ) {
+      continue;
+    }
+
+    // the path is the rest of the line
+    if( 1 != sscanf(line, "stp %d %n", &id, &pos) || id != *num_files || !line[pos] ) {
+      goto error;
+    }
+
+    f = realloc(*files, (*num_files + 1) * sizeof(char *));
+    if( NULL == f ) {
+      goto error;
+    }
+    *files = f;
+    (*files)[*num_files] = strdup(line + pos);
+    if( NULL == (*files)[*num_files] ) {
+      goto error;
+    }
+    (*num_files)++;
+  }
+
+  free(line);
+  fclose(fd);
+  return 0;
+
+error:
+  free(line);
+  fclose(fd);
+  mqttlog_stripes_free(*files, *num_files);
+  *files = NULL;
+  *num_files = 0;
+  return -1;
+}
+
+
+void mqttlog_stripes_free(char **files, int num_files) {
+  int i;
+
+  for( i = 0; i < num_files; i++ ) {
+    free(files[i]);
+  }
+  free(files);
+}
@@ -0,0 +1,207 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "record-ring.h"
+#include "mqttlog.h"
+#include "timespec.h"
+
+#define RING_ALIGN  8
+
+
+int ring_init(struct record_ring *r, size_t size) {
+  memset(r, 0, sizeof(struct record_ring));
+
+  r->size = size & ~(size_t)(RING_ALIGN - 1);
+  r->buf = malloc(r->size);
+  if( NULL == r->buf ) {
+    return -1;
+  }
+  memset(r->buf, 0, r->size);
+
+  return 0;
+}
+
+
+void ring_free(struct record_ring *r) {
+  free(r->buf);
+  memset(r, 0, sizeof(struct record_ring));
+}
+
+
+void ring_clear(struct record_ring *r) {
+  r->head = 0;
+  r->tail = 0;
+  r->end = 0;
+  r->wrapped = 0;
+  r->count = 0;
+  r->used = 0;
+}
+
+
+/**
+ * Removes the oldest record.
+ */
+static void ring_drop(struct record_ring *r) {
+  const struct ring_record *rec = (const struct ring_record *)(r->buf + r->tail);
+
+  r->tail += rec->size;
+  r->used -= rec->size;
+  r->count--;
+
+  if( r->wrapped && r->tail == r->end ) {
+    r->tail = 0;
+    r->wrapped = 0;
+  }
+}
+
+
+int ring_push(struct record_ring *r, int type, int64_t time, int qos, int retain, int len, const char *topic, const void *payload) {
+  size_t topic_len = strlen(topic);
+  size_t size = (sizeof(struct ring_record) + topic_len + 1 + len + RING_ALIGN - 1) & ~(size_t)(RING_ALIGN - 1);
+  struct ring_record *rec;
+
+  if( size > r->size ) {
+    return -1;
+  }
+
+  while(1) {
+    if( !r->count ) {
+      ring_clear(r);
+    }
+
+    if( !r->wrapped ) {
+      if( r->head + size <= r->size ) {
+        break;
+      }
+      // continue at the start of the buffer
+      r->end = r->head;
+      r->head = 0;
+      r->wrapped = 1;
+    }
+
+    if( r->head + size <= r->tail ) {
+      break;
+    }
+    ring_drop(r);
+  }
+
+  rec = (struct ring_record *)(r->buf + r->head);
+  rec->time = time;
+  rec->size = size;
+  rec->topic_len = topic_len;
+  rec->len = len;
+  rec->type = type;
+  rec->qos = qos;
+  rec->retain = retain;
+  memcpy(rec + 1, topic, topic_len + 1);
+  if( NULL != payload && 0 < len ) {
+    memcpy((uint8_t *)(rec + 1) + topic_len + 1, payload, len);
+  }
+
+  r->head += size;
+  r->used += size;
+  r->count++;
+
+  return 0;
+}
+
+
+void ring_expire(struct record_ring *r, int64_t time) {
+  while( r->count && ((const struct ring_record *)(r->buf + r->tail))->time < time ) {
+    ring_drop(r);
+  }
+}
+
+
+void ring_copy(struct record_ring *dst, const struct record_ring *src) {
+  size_t n = 0;
+
+  if( src->count ) {
+    if( src->wrapped ) {
+      memcpy(dst->buf, src->buf + src->tail, src->end - src->tail);
+      n = src->end - src->tail;
+      memcpy(dst->buf + n, src->buf, src->head);
+      n += src->head;
+    } else {
+      memcpy(dst->buf, src->buf + src->tail, src->head - src->tail);
+      n = src->head - src->tail;
+    }
+  }
+
+  dst->head = n;
+  dst->tail = 0;
+  dst->end = 0;
+  dst->wrapped = 0;
+  dst->count = src->count;
+  dst->used = n;
+}
+
+
+const struct ring_record *ring_first(const struct record_ring *r) {
+  if( !r->count ) {
+    return NULL;
+  }
+  return (const struct ring_record *)(r->buf + r->tail);
+}
+
+
+const struct ring_record *ring_next(const struct record_ring *r, const struct ring_record *rec) {
+  size_t pos = (const uint8_t *)rec - r->buf + rec->size;
+
+  if( r->wrapped && pos == r->end ) {
+    pos = 0;
+  }
+  if( pos == r->head ) {
+    return NULL;
+  }
+  return (const struct ring_record *)(r->buf + pos);
+}
+
+
+int ring_write(const struct record_ring *r, struct mqttlog_writer *w) {
+  const struct ring_record *rec;
+  struct timespec time;
+  int keyframe = 0;
+  long ret = 0;
+
+  for( rec = ring_first(r); NULL != rec && 0 <= ret; rec = ring_next(r, rec) ) {
+    timespec_from_ns(rec->time, &time);
+
+    switch( rec->type ) {
+      case MQTTLOG_KEYFRAME:
+        keyframe = 1;
+        ret = mqttlog_writer_keyframe(w, &time, rec->len);
+        break;
+
+      case MQTTLOG_KEY:
+        // the start of the oldest keyframe may have been overwritten
+        if( keyframe ) {
+          ret = mqttlog_writer_record(w, MQTTLOG_KEY, &time, rec->qos, rec->retain, rec->len, RING_RECORD_TOPIC(rec), RING_RECORD_PAYLOAD(rec));
+        }
+        break;
+
+      case MQTTLOG_DROP:
+        ret = mqttlog_writer_drop(w, &time, rec->len, RING_RECORD_TOPIC(rec));
+        break;
+
+      default:
+        keyframe = 1;
+        ret = mqttlog_writer_record(w, MQTTLOG_MSG, &time, rec->qos, rec->retain, rec->len, RING_RECORD_TOPIC(rec), RING_RECORD_PAYLOAD(rec));
+    }
+  }
+
+  return (0 > ret)?(-1):(0);
+}
@@ -0,0 +1,352 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "rewrite.h"
+
+#if defined(__SSE2__)
+  #define REWRITE_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+#define REWRITE_MAX_DIGITS  18  // longer numbers would overflow int64_t
+
+static const int64_t rewrite_pow10[] = { 1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL, 1000000000LL };
+
+
+/**
+ * @return The ns per unit or 0 if the unit is unknown.
+ */
+static int64_t rewrite_unit(const char *unit) {
+  if( !strcmp(unit, "s") ) {
+    return 1000000000LL;
+  } else if( !strcmp(unit, "ms") ) {
+    return 1000000LL;
+  } else if( !strcmp(unit, "us") ) {
+    return 1000LL;
+  } else if( !strcmp(unit, "ns") ) {
+    return 1LL;
+  }
+  return 0;
+}
+
+
+int rewrite_parse(struct rewrite *r, char *spec) {
+  char *sep = strrchr(spec, ':');
+  char *arg, *comma, *end;
+  size_t len;
+
+  memset(r, 0, sizeof(struct rewrite));
+  r->unit = 1000000LL;
+
+  if( NULL == sep || sep == spec ) {
+    return -1;
+  }
+
+  if( !strncmp(sep + 1, "json=", 5) ) {
+    r->type = REWRITE_JSON;
+    arg = sep + 6;
+    comma = strchr(arg, ',');
+    len = (NULL == comma)?(strlen(arg)):((size_t)(comma - arg));
+    if( !len ) {
+      return -1;
+    }
+    r->key = malloc(len + 3);
+    if( NULL == r->key ) {
+      return -1;
+    }
+    r->key[0] = '"';
+    memcpy(r->key + 1, arg, len);
+    r->key[len + 1] = '"';
+    r->key[len + 2] = 0;
+    r->key_len = len + 2;
+
+  } else if( !strncmp(sep + 1, "bin=", 4) ) {
+    r->type = REWRITE_BIN;
+    r->offset = strtol(sep + 5, &end, 10);
+    if( end == sep + 5 || ',' != *end || 0 > r->offset ) {
+      return -1;
+    }
+    arg = end + 1;
+    comma = strchr(arg, ',');
+    len = (NULL == comma)?(strlen(arg)):((size_t)(comma - arg));
+    if( 5 != len || 'u' != arg[0] ) {
+      return -1;
+    }
+    if( !strncmp(arg + 1, "32", 2) ) {
+      r->width = 4;
+    } else if( !strncmp(arg + 1, "64", 2) ) {
+      r->width = 8;
+    } else {
+      return -1;
+    }
+    if( !strncmp(arg + 3, "be", 2) ) {
+      r->big_endian = 1;
+    } else if( strncmp(arg + 3, "le", 2) ) {
+      return -1;
+    }
+
+  } else {
+    return -1;
+  }
+
+  if( NULL != comma ) {
+    r->unit = rewrite_unit(comma + 1);
+    if( !r->unit ) {
+      return -1;
+    }
+  }
+
+  r->spec = spec;
+  r->filter = strndup(spec, sep - spec);
+  if( NULL == r->filter ) {
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void rewrite_free(struct rewrite *r) {
+  free(r->filter);
+  free(r->key);
+  r->filter = NULL;
+  r->key = NULL;
+}
+
+
+const char *rewrite_find(const char *buf, size_t len, const char *needle, size_t needle_len) {
+  size_t i = 0, probe;
+#ifdef REWRITE_SSE2
+  __m128i first, last, a, b;
+  unsigned mask;
+  int bit;
+#endif
+
+  if( !needle_len ) {
+    return buf;
+  }
+  if( needle_len > len ) {
+    return NULL;
+  }
+
+  // a quoted key starts and ends with the same byte, so probe the second one
+  probe = (2 < needle_len && needle[0] == needle[needle_len - 1])?(1):(0);
+
+#ifdef REWRITE_SSE2
+  first = _mm_set1_epi8(needle[probe]);
+  last = _mm_set1_epi8(needle[needle_len - 1]);
+
+  for( ; i + needle_len - 1 + 16 <= len; i += 16 ) {
+    a = _mm_loadu_si128((const __m128i *)(buf + i + probe));
+    b = _mm_loadu_si128((const __m128i *)(buf + i + needle_len - 1));
+    mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while( mask ) {
+      bit = __builtin_ctz(mask);
+      if( !memcmp(buf + i + bit, needle, needle_len) ) {
+        return buf + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for( ; i + needle_len <= len; i++ ) {
+    if( buf[i + probe] == needle[probe] && !memcmp(buf + i, needle, needle_len) ) {
+      return buf + i;
+    }
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Makes room for n bytes in the buffer.
+ *
+ * @return 0 on success, otherwise something else.
+ */
+static int rewrite_reserve(uint8_t **buf, size_t *size, size_t n) {
+  uint8_t *p;
+
+  if( n <= *size ) {
+    return 0;
+  }
+  p = realloc(*buf, 2 * n);
+  if( NULL == p ) {
+    return -1;
+  }
+  *buf = p;
+  *size = 2 * n;
+
+  return 0;
+}
+
+
+/**
+ * Shifts a JSON number, which starts at s, and formats it into out.
+ *
+ * @param end Set to the first byte after the number.
+ * @return The length of the new number or 0 if it is not a plain number.
+ */
+static size_t rewrite_number(const char *s, const char *limit, int64_t shift, int64_t unit, char *out, const char **end) {
+  const char *p = s, *q;
+  int64_t value = 0, scale;
+  char digits[24];
+  int neg = 0, n = 0, frac = 0, i, len = 0;
+
+  if( p < limit && '-' == *p ) {
+    neg = 1;
+    p++;
+  }
+  q = p;
+  while( p < limit && '0' <= *p && '9' >= *p ) {
+    p++;
+    n++;
+  }
+  if( !n ) {
+    return 0;
+  }
+  if( p < limit && '.' == *p ) {
+    p++;
+    while( p < limit && '0' <= *p && '9' >= *p ) {
+      p++;
+      frac++;
+    }
+    if( !frac ) {
+      return 0;
+    }
+  }
+  // exponents, overflows and fractions below 1 ns are left unchanged
+  if( (p < limit && ('e' == *p || 'E' == *p)) || REWRITE_MAX_DIGITS < n + frac || 9 < frac || rewrite_pow10[frac] > unit ) {
+    return 0;
+  }
+  *end = p;
+
+  // at most REWRITE_MAX_DIGITS digits, so the value fits
+  for( ; q < p; q++ ) {
+    if( '.' != *q ) {
+      value = value * 10 + (*q - '0');
+    }
+  }
+
+  // the shift in units of the last digit
+  scale = unit / rewrite_pow10[frac];
+  value = ((neg)?(-value):(value)) + shift / scale;
+
+  if( 0 > value ) {
+    out[len++] = '-';
+    value = -value;
+  }
+  n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while( value || n <= frac );
+  for( i = n - 1; 0 <= i; i-- ) {
+    out[len++] = digits[i];
+    if( i == frac && frac ) {
+      out[len++] = '.';
+    }
+  }
+
+  return len;
+}
+
+
+static long rewrite_json(const struct rewrite *r, const char *payload, size_t len, int64_t shift, uint8_t **buf, size_t *size) {
+  const char *p = payload, *limit = payload + len, *key, *q, *end;
+  char number[32];
+  size_t out = 0, n;
+  int found = 0;
+
+  while( NULL != (key = rewrite_find(p, limit - p, r->key, r->key_len)) ) {
+    q = key + r->key_len;
+    while( q < limit && (' ' == *q || '\t' == *q || '\r' == *q || '\n' == *q) ) {
+      q++;
+    }
+    // a string value equal to the key
+    if( q == limit || ':' != *q ) {
+      if( rewrite_reserve(buf, size, out + (q - p)) ) {
+        return -1;
+      }
+      memcpy(*buf + out, p, q - p);
+      out += q - p;
+      p = q;
+      continue;
+    }
+    q++;
+    while( q < limit && (' ' == *q || '\t' == *q || '\r' == *q || '\n' == *q) ) {
+      q++;
+    }
+
+    n = rewrite_number(q, limit, shift, r->unit, number, &end);
+    if( !n ) {
+      end = q;
+    }
+    if( rewrite_reserve(buf, size, out + (q - p) + n) ) {
+      return -1;
+    }
+    memcpy(*buf + out, p, q - p);
+    out += q - p;
+    memcpy(*buf + out, number, n);
+    out += n;
+    found |= (0 < n);
+    p = end;
+  }
+
+  if( !found ) {
+    return -1;
+  }
+
+  if( rewrite_reserve(buf, size, out + (limit - p)) ) {
+    return -1;
+  }
+  memcpy(*buf + out, p, limit - p);
+
+  return out + (limit - p);
+}
+
+
+static long rewrite_bin(const struct rewrite *r, const uint8_t *payload, size_t len, int64_t shift, uint8_t **buf, size_t *size) {
+  uint8_t *b;
+  uint64_t value = 0;
+  int i;
+
+  if( (size_t)r->offset + r->width > len || rewrite_reserve(buf, size, len) ) {
+    return -1;
+  }
+  memcpy(*buf, payload, len);
+  b = *buf + r->offset;
+
+  for( i = 0; i < r->width; i++ ) {
+    value = (value << 8) | b[(r->big_endian)?(i):(r->width - 1 - i)];
+  }
+  value += (uint64_t)(shift / r->unit);
+  for( i = r->width - 1; 0 <= i; i-- ) {
+    b[(r->big_endian)?(i):(r->width - 1 - i)] = value & 0xff;
+    value >>= 8;
+  }
+
+  return len;
+}
+
+
+long rewrite_apply(const struct rewrite *r, const uint8_t *payload, size_t len, int64_t shift, uint8_t **buf, size_t *size) {
+  if( REWRITE_JSON == r->type ) {
+    return rewrite_json(r, (const char *)payload, len, shift, buf, size);
+  }
+  return rewrite_bin(r, payload, len, shift, buf, size);
+}
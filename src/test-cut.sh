@@ -0,0 +1,62 @@
+#!/bin/sh
+# Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# Cuts a window out of log files with and without checksums, splits a log
+# into pieces and concatenates them again with mqttlog-cut. The window has to
+# hold the records from its start up to its end and start with a keyframe of
+# the last values before it, the concatenated pieces all messages.
+
+set -e
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# the records of a dump between two times relative to the recording start
+window() {
+  awk -v start=$((1400000000 + $1)).$2 -v end=$((1400000000 + $3)).$4 \
+    '$2 >= start && $2 < end' "$tmp/all.txt"
+}
+
+for options in "-c 8192 -k 500 -i 16384" "-k 500"; do
+  ./mqttlog-testlog $options -n 6000 write "$tmp/all.log"
+  ./mqttlog-testlog dump "$tmp/all.log" > "$tmp/all.txt"
+  grep '^msg' "$tmp/all.txt" > "$tmp/msg.txt"
+  # a missing index is built first
+  rm -f "$tmp/all.log.idx"
+
+  ./mqttlog-cut -s 12.5 -e 31 -o "$tmp/cut.log" "$tmp/all.log"
+  ./mqttlog-check "$tmp/cut.log"
+  ./mqttlog-testlog dump "$tmp/cut.log" > "$tmp/cut.txt"
+  window 12 500000000 31 000000000 > "$tmp/window.txt"
+  tail -n +22 "$tmp/cut.txt" | cmp - "$tmp/window.txt"
+
+  # the keyframe at the start holds the last value of every topic
+  head -n 1 "$tmp/cut.txt" | grep -q '^kfm 1400000012.500000000 '
+  window 0 0 12 500000000 | awk '$1 == "msg" { last[$5] = $0 } END { for( t in last ) print last[t] }' \
+    | cut -d ' ' -f 3- | sort > "$tmp/last.txt"
+  sed -n 2,21p "$tmp/cut.txt" | cut -d ' ' -f 3- | sort | cmp - "$tmp/last.txt"
+
+  rm -f "$tmp"/piece-*
+  ./mqttlog-cut -S 20 -o "$tmp/piece-{n}.log" "$tmp/all.log"
+  for piece in 0 1 2; do
+    ./mqttlog-check "$tmp/piece-$piece.log" >&2
+    ./mqttlog-testlog dump "$tmp/piece-$piece.log" | grep '^msg'
+  done | cmp - "$tmp/msg.txt"
+  test ! -e "$tmp/piece-3.log"
+
+  ./mqttlog-cut -o "$tmp/whole.log" "$tmp/piece-0.log" "$tmp/piece-1.log" "$tmp/piece-2.log"
+  ./mqttlog-check "$tmp/whole.log"
+  ./mqttlog-testlog dump "$tmp/whole.log" | grep '^msg' | cmp - "$tmp/msg.txt"
+done
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# Exports logs with mqttlog-export and reads the Arrow files back with
+# mqttlog-testlog, which checks the magic, the footer and the blocks. The rows
+# have to be the messages of the log.
+
+set -e
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+messages=3000
+./mqttlog-testlog -c 4096 -k 100 -n $messages write "$tmp/all.log"
+./mqttlog-testlog dump "$tmp/all.log" | grep '^msg' > "$tmp/all.txt"
+
+# one and several row groups, decoded by one and several threads
+for options in "" "-r 1000 -j 1" "-r 7 -j 4"; do
+  ./mqttlog-export $options -o "$tmp/all.arrow" "$tmp/all.log"
+  ./mqttlog-testlog arrow "$tmp/all.arrow" | cmp - "$tmp/all.txt"
+done
+
+# an incomplete log is exported up to its last valid record
+size=$(wc -c < "$tmp/all.log")
+head -c $((size / 2)) "$tmp/all.log" > "$tmp/half.log"
+if ./mqttlog-export -r 100 -o "$tmp/half.arrow" "$tmp/half.log"; then
+  echo "The export of an incomplete log passed."
+  exit 1
+fi
+./mqttlog-testlog arrow "$tmp/half.arrow" > "$tmp/half.txt"
+n=$(wc -l < "$tmp/half.txt")
+test $n -gt 0 -a $n -lt $messages
+head -n $n "$tmp/all.txt" | cmp - "$tmp/half.txt"
+
+# a length which does not match the payload
+printf 'cnf time: 1400000000.000000000\nmsg 0.000000000 1 0 3 dev/0/v\n41 42\n' > "$tmp/length.log"
+status=0
+./mqttlog-export -o "$tmp/length.arrow" "$tmp/length.log" || status=$?
+test $status -eq 1
+test -z "$(./mqttlog-testlog arrow "$tmp/length.arrow")"
+
+# the reader notices a damaged Arrow file
+size=$(wc -c < "$tmp/all.arrow")
+head -c $((size - 1)) "$tmp/all.arrow" > "$tmp/cut.arrow"
+if ./mqttlog-testlog arrow "$tmp/cut.arrow" > /dev/null; then
+  echo "The check of a cut off Arrow file passed."
+  exit 1
+fi
+cp "$tmp/all.arrow" "$tmp/footer.arrow"
+printf '\377\377\377\177' | dd of="$tmp/footer.arrow" bs=1 seek=$((size - 10)) conv=notrunc 2> /dev/null
+if ./mqttlog-testlog arrow "$tmp/footer.arrow" > /dev/null; then
+  echo "The check of an Arrow file with an invalid footer length passed."
+  exit 1
+fi
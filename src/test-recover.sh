@@ -0,0 +1,82 @@
+#!/bin/sh
+# Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Writes a log file with checksums, damages it like a crash of the recorder
+# and a broken disk, recovers it with mqttlog-check --recover and continues it
+# like mqttrecorder --append. The recovered records have to be a prefix of the
+# written ones, the continued log file has to contain all of them.
+
+set -e
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+messages=2000
+./mqttlog-testlog -c 4096 -k 100 -n $messages write "$tmp/all.log"
+./mqttlog-testlog dump "$tmp/all.log" | grep '^msg' > "$tmp/all.txt"
+./mqttlog-check "$tmp/all.log"
+
+# check that the messages of a log file are a prefix of all messages
+prefix() {
+  ./mqttlog-testlog dump "$1" | grep '^msg' > "$tmp/got.txt"
+  n=$(wc -l < "$tmp/got.txt")
+  head -n $n "$tmp/all.txt" | cmp - "$tmp/got.txt"
+}
+
+# the recorder crashed in the middle of a record
+size=$(wc -c < "$tmp/all.log")
+head -c $((size - 1000)) "$tmp/all.log" > "$tmp/crash.log"
+if ./mqttlog-check --recover "$tmp/crash.log"; then
+  echo "The check of a cut off log file passed."
+  exit 1
+fi
+./mqttlog-check "$tmp/crash.log"
+prefix "$tmp/crash.log"
+test $n -gt 0 -a $n -lt $messages
+
+# continue it like mqttrecorder --append
+./mqttlog-testlog -c 4096 -k 100 -f $n -n $((messages - n)) append "$tmp/crash.log"
+./mqttlog-check "$tmp/crash.log"
+prefix "$tmp/crash.log"
+test $n -eq $messages
+
+# a damaged block in the middle
+cp "$tmp/all.log" "$tmp/damaged.log"
+printf 'X' | dd of="$tmp/damaged.log" bs=1 seek=$((size / 2)) conv=notrunc 2> /dev/null
+if ./mqttlog-check --recover "$tmp/damaged.log"; then
+  echo "The check of a damaged log file passed."
+  exit 1
+fi
+./mqttlog-check "$tmp/damaged.log"
+prefix "$tmp/damaged.log"
+test $n -gt 0 -a $n -le $((messages / 2))
+
+# a length which does not fit into an int or does not match the payload
+for len in 4294967295 99999999999999999999 3; do
+  printf 'cnf time: 1400000000.000000000\nmsg 0.000000000 1 0 %s dev/0/v\n41 42\n' $len > "$tmp/length.log"
+  if ./mqttlog-testlog dump "$tmp/length.log"; then
+    echo "The dump of a record of length $len passed."
+    exit 1
+  fi
+  # the tools which do not decode the payloads have to fail, not crash
+  status=0
+  ./mqttlog-cut -o "$tmp/cut.log" "$tmp/length.log" || status=$?
+  test $status -gt 0 -a $status -lt 128
+  if ./mqttlog-check --recover "$tmp/length.log"; then
+    echo "The check of a record of length $len passed."
+    exit 1
+  fi
+  ./mqttlog-check "$tmp/length.log"
+  test $(wc -l < "$tmp/length.log") -eq 1
+done
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# Pushes messages and keyframes into rings of several sizes like
+# mqttrecorder --ring and dumps them. A dump has to hold the newest messages
+# without a gap and must not start with the rest of an overwritten keyframe.
+
+set -e
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+messages=5000
+./mqttlog-testlog -k 100 -n $messages write "$tmp/all.log"
+./mqttlog-testlog dump "$tmp/all.log" | grep '^msg' > "$tmp/all.txt"
+
+# 20393 and 27356 bytes overwrite the start of the oldest keyframe
+for ring in 16384 20393 27356 40000 65536; do
+  ./mqttlog-testlog -c 4096 -k 100 -n $messages -r $ring ring "$tmp/ring.log"
+  ./mqttlog-check "$tmp/ring.log"
+  ./mqttlog-testlog dump "$tmp/ring.log" > "$tmp/dump.txt"
+  if head -n 1 "$tmp/dump.txt" | grep -q '^key'; then
+    echo "The dump of a ring of $ring bytes starts with a key."
+    exit 1
+  fi
+  grep '^msg' "$tmp/dump.txt" > "$tmp/got.txt"
+  n=$(wc -l < "$tmp/got.txt")
+  test $n -gt 0 -a $n -lt $messages
+  tail -n $n "$tmp/all.txt" | cmp - "$tmp/got.txt"
+done
+
+# a window of 2 s holds the message at its start and all after it
+./mqttlog-testlog -n $messages -r 10000000 -w 2000 ring "$tmp/window.log"
+./mqttlog-check "$tmp/window.log"
+./mqttlog-testlog dump "$tmp/window.log" | grep '^msg' > "$tmp/got.txt"
+tail -n 201 "$tmp/all.txt" | cmp - "$tmp/got.txt"
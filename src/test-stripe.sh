@@ -0,0 +1,79 @@
+#!/bin/sh
+# Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# Records messages played by mqttplayer with mqttrecorder --stripe over three
+# stripes. The stripes merged by time have to hold the played messages in
+# their order, and so has a plain recording of a replay of the striped log.
+# Needs a broker: MQTTLOG_TEST_BROKER=<host>[:<port>] or mosquitto in the PATH.
+
+set -e
+tmp=$(mktemp -d)
+broker_pid=
+cleanup() {
+  test -z "$broker_pid" || kill $broker_pid
+  rm -rf "$tmp"
+}
+trap cleanup EXIT
+
+if test -n "$MQTTLOG_TEST_BROKER"; then
+  host=${MQTTLOG_TEST_BROKER%%:*}
+  port=1883
+  test "$host" = "$MQTTLOG_TEST_BROKER" || port=${MQTTLOG_TEST_BROKER#*:}
+elif command -v mosquitto > /dev/null; then
+  host=localhost
+  port=$((20000 + $$ % 10000))
+  mosquitto -p $port > "$tmp/mosquitto.txt" 2>&1 &
+  broker_pid=$!
+  sleep 1
+else
+  echo "No broker: set MQTTLOG_TEST_BROKER or install mosquitto."
+  exit 77
+fi
+
+./mqttlog-testlog -k 200 -n 2000 write "$tmp/all.log"
+./mqttlog-testlog dump "$tmp/all.log" | awk '$1 == "msg" { print $5, $6 }' > "$tmp/all.txt"
+
+# records a replay of the log file $1 into the log file $2 with the options
+# after them
+record() {
+  play=$1
+  out=$2
+  shift 2
+  ./mqttrecorder -b $host -p $port -t 'dev/#' "$@" "$out" &
+  recorder=$!
+  sleep 1
+  ./mqttplayer -b $host -p $port -i "$play"
+  sleep 2
+  kill -INT $recorder
+  wait $recorder
+}
+
+# the topics and payloads of the messages of log files merged by time
+messages() {
+  for log in "$@"; do
+    ./mqttlog-testlog dump "$log"
+  done | awk '$1 == "msg"' | sort -s -k 2,2 | awk '{ print $5, $6 }'
+}
+
+record "$tmp/all.log" "$tmp/striped.log" -K 1 --crc 4096 -S "$tmp/stripe-0.log" -S "$tmp/stripe-1.log" -S "$tmp/stripe-2.log"
+for stripe in 0 1 2; do
+  ./mqttlog-check "$tmp/stripe-$stripe.log"
+  ./mqttlog-testlog dump "$tmp/stripe-$stripe.log" | grep -q '^msg'
+done
+messages "$tmp"/stripe-*.log | cmp - "$tmp/all.txt"
+
+record "$tmp/striped.log" "$tmp/replay.log"
+messages "$tmp/replay.log" | cmp - "$tmp/all.txt"
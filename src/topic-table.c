@@ -0,0 +1,170 @@
+/* Copyright 2014 Bernd Lehmann (der-b@der-b.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "topic-table.h"
+
+uint64_t fnv1a(const void *buf, size_t length) {
+  const uint8_t *p = (const uint8_t *)buf;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for( i = 0; i < length; i++ ) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+
+int topic_table_init(struct topic_table *table, size_t num_buckets) {
+  table->buckets = calloc(num_buckets, sizeof(struct topic_entry *));
+  if( NULL == table->buckets ) {
+    return -1;
+  }
+  table->num_buckets = num_buckets;
+  table->count = 0;
+
+  return 0;
+}
+
+
+/**
+ * Doubles the number of buckets. On allocation failure the table stays as it
+ * is, it only gets slower.
+ */
+static void topic_table_grow(struct topic_table *table) {
+  struct topic_entry **buckets, *entry, *next;
+  size_t num_buckets, i, b;
+
+  num_buckets = table->num_buckets * 2;
+  buckets = calloc(num_buckets, sizeof(struct topic_entry *));
+  if( NULL == buckets ) {
+    return;
+  }
+
+  for( i = 0; i < table->num_buckets; i++ ) {
+    for( entry = table->buckets[i]; entry; entry = next ) {
+      next = entry->next;
+      b = fnv1a(entry->topic, strlen(entry->topic)) % num_buckets;
+      entry->next = buckets[b];
+      buckets[b] = entry;
+    }
+  }
+
+  free(table->buckets);
+  table->buckets = buckets;
+  table->num_buckets = num_buckets;
+}
+
+
+struct topic_entry *topic_table_get(struct topic_table *table, const char *topic, int create) {
+  struct topic_entry *entry;
+  size_t b;
+
+  b = fnv1a(topic, strlen(topic)) % table->num_buckets;
+  for( entry = table->buckets[b]; entry; entry = entry->next ) {
+    if( !strcmp(entry->topic, topic) ) {
+      return entry;
+    }
+  }
+
+  if( !create ) {
+    return NULL;
+  }
+
+  entry = calloc(1, sizeof(struct topic_entry));
+  if( NULL == entry ) {
+    return NULL;
+  }
+  entry->topic = strdup(topic);
+  if( NULL == entry->topic ) {
+    free(entry);
+    return NULL;
+  }
+
+  if( table->count >= 2 * table->num_buckets ) {
+    topic_table_grow(table);
+    b = fnv1a(topic, strlen(topic)) % table->num_buckets;
+  }
+
+  entry->next = table->buckets[b];
+  table->buckets[b] = entry;
+  table->count++;
+
+  return entry;
+}
+
+
+int topic_entry_set(struct topic_entry *entry, int64_t time, int qos, int retain, int len, const void *payload) {
+  uint8_t *p;
+
+  if( entry->size < len ) {
+    p = realloc(entry->payload, len);
+    if( NULL == p ) {
+      return -1;
+    }
+    entry->payload = p;
+    entry->size = len;
+  }
+
+  if( len ) {
+    memcpy(entry->payload, payload, len);
+  }
+  entry->time   = time;
+  entry->qos    = qos;
+  entry->retain = retain;
+  entry->len    = len;
+
+  return 0;
+}
+
+
+void topic_table_foreach(struct topic_table *table, void (*fn)(struct topic_entry *entry, void *userdata), void *userdata) {
+  struct topic_entry *entry;
+  size_t i;
+
+  for( i = 0; i < table->num_buckets; i++ ) {
+    for( entry = table->buckets[i]; entry; entry = entry->next ) {
+      fn(entry, userdata);
+    }
+  }
+}
+
+
+void topic_table_clear(struct topic_table *table) {
+  struct topic_entry *entry, *next;
+  size_t i;
+
+  for( i = 0; i < table->num_buckets; i++ ) {
+    for( entry = table->buckets[i]; entry; entry = next ) {
+      next = entry->next;
+      free(entry->topic);
+      free(entry->payload);
+      free(entry);
+    }
+    table->buckets[i] = NULL;
+  }
+  table->count = 0;
+}
+
+
+void topic_table_free(struct topic_table *table) {
+  topic_table_clear(table);
+  free(table->buckets);
+  table->buckets = NULL;
+  table->num_buckets = 0;
+}